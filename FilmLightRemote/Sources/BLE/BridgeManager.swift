@@ -16,6 +16,34 @@ class BridgeManager: ObservableObject {
     @Published var maxLights: Int = 9
     @Published var lightStatuses: [UInt16: Bool] = [:]  // unicast → connected
     @Published var lastError: String?
+    @Published var bridgeBootId: String?
+    @Published var provisioningStates: [String: String] = [:]  // device UUID → state
+    @Published var configStates: [UInt16: String] = [:]  // unicast → config state
+    @Published var monitoredOutputs: [UInt16: MonitoredOutput] = [:]  // unicast → what the bridge last sent
+    @Published var topology: [UInt16: TopologyNode] = [:]  // unicast → where it sits in the mesh
+    @Published var showPlaying = false  // A stored show is running on the bridge
+    var bridgeCuesDigest: String?  // CRC of the bridge's loaded cue list, from ready
+    var bridgeShowDigests: [String: String] = [:]  // asset → CRC stored on the bridge
+
+    /// A light's output as rendered by the bridge (from the monitor stream).
+    struct MonitoredOutput {
+        var intensity: Double = 0   // percent
+        var cctKelvin: Int = 0
+        var hue: Int = 0
+        var saturation: Int = 0
+        var sleepMode: Int = 0
+        var effect: Int = 0
+        var mode: Int = 0           // 1 CCT, 2 HSI, 3 sleep, 4 fixture effect
+    }
+
+    /// Where a light sits in the mesh, from its heartbeats (see topology.h).
+    struct TopologyNode {
+        var hops: Int               // Fewest relay hops to any proxy, 0 = not measured
+        var ttl: Int                // TTL the bridge uses for it
+        var features: Int           // Relay/proxy/friend/LPN bits from the heartbeat
+        var ageSeconds: Int
+        var linkHops: [Int]         // Per proxy slot: hops, 0 = unmeasured, -1 = not heard
+    }
 
     struct BridgeInfo: Identifiable {
         let id = UUID()
@@ -30,6 +58,13 @@ class BridgeManager: ObservableObject {
     private var browser: NWBrowser?
     private var reconnectWork: DispatchWorkItem?
     private var pingTimer: Timer?
+    private var bridgePort: UInt16 = 8765
+
+    // UDP side channel for absolute state commands (see udp_control.h)
+    private var udpConnection: NWConnection?
+    private var udpSession: UInt32 = 0
+    private var udpToken: [UInt8] = []
+    private var udpSeq: UInt32 = 0
 
     private static let lastBridgeHostKey = "lastBridgeHost"
 
@@ -108,6 +143,7 @@ class BridgeManager: ObservableObject {
         webSocket?.resume()
 
         connectedBridgeAddress = host
+        bridgePort = port
         startReceiving()
         startPingTimer()
     }
@@ -117,6 +153,7 @@ class BridgeManager: ObservableObject {
         pingTimer = nil
         reconnectWork?.cancel()
         reconnectWork = nil
+        closeUDPChannel()
 
         webSocket?.cancel(with: .normalClosure, reason: nil)
         webSocket = nil
@@ -141,7 +178,9 @@ class BridgeManager: ObservableObject {
                 case .string(let text):
                     self?.handleMessage(text)
                 case .data(let data):
-                    if let text = String(data: data, encoding: .utf8) {
+                    if data.first == 0x4D {
+                        DispatchQueue.main.async { self?.handleMonitorFrame(data) }
+                    } else if let text = String(data: data, encoding: .utf8) {
                         self?.handleMessage(text)
                     }
                 @unknown default:
@@ -177,7 +216,18 @@ class BridgeManager: ObservableObject {
                     self?.lastBridgeHost = host
                 }
                 print("BridgeManager: bridge ready v\(self?.bridgeVersion ?? "?")")
-                self?.sendKeysAndLights()
+                self?.bridgeBootId = json["boot_id"] as? String
+                self?.openUDPChannel(json["udp"] as? [String: Any])
+                let cues = json["cues"] as? String ?? ""
+                self?.bridgeCuesDigest = cues.isEmpty ? nil : cues
+                self?.bridgeShowDigests = (json["show"] as? [String: String] ?? [:]).filter { !$0.value.isEmpty }
+                if let keysDigest = json["keys"] as? String,
+                   let lights = json["lights"] as? [[String: Any]] {
+                    self?.syncWithBridge(keysDigest: keysDigest, remoteLights: lights)
+                } else {
+                    // Older bridge firmware without digests
+                    self?.sendKeysAndLights()
+                }
 
             case "light_status":
                 if let unicast = json["unicast"] as? Int,
@@ -185,6 +235,50 @@ class BridgeManager: ObservableObject {
                     self?.lightStatuses[UInt16(unicast)] = connected
                 }
 
+            case "provision_progress":
+                if let uuid = json["uuid"] as? String, let state = json["state"] as? String {
+                    self?.provisioningStates[uuid] = state
+                }
+
+            case "provisioned":
+                self?.handleProvisioned(json)
+
+            case "provision_stopped":
+                if let next = json["next_unicast"] as? Int {
+                    self?.advanceNextUnicast(to: UInt16(next))
+                }
+
+            case "config_progress":
+                if let unicast = json["unicast"] as? Int, let state = json["state"] as? String {
+                    if state == "running", let step = json["step"] as? Int, let steps = json["steps"] as? Int {
+                        self?.configStates[UInt16(unicast)] = "\(step)/\(steps)"
+                    } else {
+                        self?.configStates[UInt16(unicast)] = state
+                    }
+                }
+
+            case "config_done":
+                print("BridgeManager: config done — \(json["done"] as? Int ?? 0) ok, \(json["failed"] as? Int ?? 0) failed in \(json["ms"] as? Int ?? 0) ms")
+
+            case "topology":
+                var nodes: [UInt16: TopologyNode] = [:]
+                for light in json["lights"] as? [[String: Any]] ?? [] {
+                    guard let unicast = light["unicast"] as? Int else { continue }
+                    nodes[UInt16(unicast)] = TopologyNode(
+                        hops: light["hops"] as? Int ?? 0,
+                        ttl: light["ttl"] as? Int ?? 7,
+                        features: light["features"] as? Int ?? 0,
+                        ageSeconds: light["age_s"] as? Int ?? 0,
+                        linkHops: light["links"] as? [Int] ?? [])
+                }
+                self?.topology = nodes
+
+            case "show":
+                self?.showPlaying = json["playing"] as? Bool ?? false
+
+            case "cue", "cue_done", "cues":
+                break
+
             case "error":
                 let msg = json["message"] as? String ?? "Unknown bridge error"
                 self?.lastError = msg
@@ -196,6 +290,33 @@ class BridgeManager: ObservableObject {
         }
     }
 
+    /// Decode a binary monitor frame: 'M', flags, seq, count, then per light
+    /// unicast (LE16), field mask and the masked fields (see monitor.h).
+    /// Runs on the main queue; deltas apply to the published outputs.
+    private func handleMonitorFrame(_ data: Data) {
+        let bytes = [UInt8](data)
+        guard bytes.count >= 4 else { return }
+        let keyframe = bytes[1] & 0x01 != 0
+        var outputs = keyframe ? [:] : monitoredOutputs
+        var pos = 4
+        func u8() -> Int? { guard pos < bytes.count else { return nil }; pos += 1; return Int(bytes[pos - 1]) }
+        func u16() -> Int? { guard let lo = u8(), let hi = u8() else { return nil }; return lo | (hi << 8) }
+
+        for _ in 0..<Int(bytes[3]) {
+            guard let unicast = u16(), let mask = u8() else { return }
+            var out = outputs[UInt16(unicast)] ?? MonitoredOutput()
+            if mask & 0x01 != 0 { guard let v = u16() else { return }; out.intensity = Double(v) / 10 }
+            if mask & 0x02 != 0 { guard let v = u16() else { return }; out.cctKelvin = v }
+            if mask & 0x04 != 0 { guard let v = u16() else { return }; out.hue = v }
+            if mask & 0x08 != 0 { guard let v = u8() else { return }; out.saturation = v }
+            if mask & 0x10 != 0 { guard let v = u8() else { return }; out.sleepMode = v }
+            if mask & 0x20 != 0 { guard let v = u8() else { return }; out.effect = v }
+            if mask & 0x40 != 0 { guard let v = u8() else { return }; out.mode = v }
+            outputs[UInt16(unicast)] = out
+        }
+        monitoredOutputs = outputs
+    }
+
     // MARK: - Send Helpers
 
     private func send(_ dict: [String: Any]) {
@@ -209,6 +330,58 @@ class BridgeManager: ObservableObject {
         }
     }
 
+    /// Send an idempotent state command over UDP when the channel is up,
+    /// else over the WebSocket. A lost datagram is superseded by the next.
+    /// Datagram: 'U', version, session (LE32), seq (LE32), JSON, then the
+    /// first 8 bytes of AES-CMAC(token) over everything before it. The
+    /// WebSocket fallback carries the seq too, so a datagram still in
+    /// flight can't undo it.
+    private func sendState(_ dict: [String: Any]) {
+        guard let conn = udpConnection, conn.state == .ready,
+              let json = try? JSONSerialization.data(withJSONObject: dict) else {
+            var dict = dict
+            if udpConnection != nil {
+                udpSeq &+= 1
+                dict["seq"] = udpSeq
+            }
+            send(dict)
+            return
+        }
+        udpSeq &+= 1
+        var packet: [UInt8] = [0x55, 1]
+        withUnsafeBytes(of: udpSession.littleEndian) { packet += $0 }
+        withUnsafeBytes(of: udpSeq.littleEndian) { packet += $0 }
+        packet += [UInt8](json)
+        packet += MeshCrypto.aes_cmac(key: udpToken, message: packet).prefix(8)
+        conn.send(content: Data(packet), completion: .idempotent)
+    }
+
+    private func openUDPChannel(_ info: [String: Any]?) {
+        closeUDPChannel()
+        guard let info = info, let host = connectedBridgeAddress,
+              let port = info["port"] as? Int, let nwPort = NWEndpoint.Port(rawValue: UInt16(port)),
+              let session = info["session"] as? Int,
+              let tokenHex = info["token"] as? String, tokenHex.count == 32 else { return }
+
+        udpToken = stride(from: 0, to: 32, by: 2).compactMap { i in
+            let start = tokenHex.index(tokenHex.startIndex, offsetBy: i)
+            return UInt8(tokenHex[start..<tokenHex.index(start, offsetBy: 2)], radix: 16)
+        }
+        guard udpToken.count == 16 else { return }
+        udpSession = UInt32(truncatingIfNeeded: session)
+        udpSeq = 0
+
+        let conn = NWConnection(host: NWEndpoint.Host(host), port: nwPort, using: .udp)
+        conn.start(queue: .global(qos: .userInitiated))
+        udpConnection = conn
+        print("BridgeManager: UDP channel on port \(port)")
+    }
+
+    private func closeUDPChannel() {
+        udpConnection?.cancel()
+        udpConnection = nil
+    }
+
     // MARK: - Initial Setup
 
     /// Send mesh keys and all saved lights to the bridge after connection.
@@ -223,7 +396,8 @@ class BridgeManager: ObservableObject {
             "network_key": networkKey.map { String(format: "%02X", $0) }.joined(),
             "app_key": appKey.map { String(format: "%02X", $0) }.joined(),
             "iv_index": ivIndex,
-            "src_address": 1
+            "src_address": 1,
+            "cluster_base": ks.clusterBaseAddress
         ])
 
         // Register all saved lights
@@ -232,15 +406,104 @@ class BridgeManager: ObservableObject {
         }
     }
 
+    /// Resume a session by sending only what differs from the bridge's state.
+    /// The bridge's ready event carries a digest of its loaded keys and a hash
+    /// per registered light; anything matching is skipped entirely.
+    private func syncWithBridge(keysDigest: String, remoteLights: [[String: Any]]) {
+        let ks = KeyStorage.shared
+        let networkKey = ks.getNetworkKeyOrDefault()
+        let appKey = ks.getAppKeyOrDefault()
+        let ivIndex = ks.ivIndex
+        let srcAddress: UInt16 = 1
+
+        var keysSent = false
+        if keysDigest != Self.keysDigest(networkKey: networkKey, appKey: appKey,
+                                         ivIndex: ivIndex, srcAddress: srcAddress) {
+            send([
+                "cmd": "set_keys",
+                "network_key": networkKey.map { String(format: "%02X", $0) }.joined(),
+                "app_key": appKey.map { String(format: "%02X", $0) }.joined(),
+                "iv_index": ivIndex,
+                "src_address": srcAddress,
+                "cluster_base": ks.clusterBaseAddress
+            ])
+            keysSent = true
+        }
+
+        var remote: [UInt16: String] = [:]
+        for entry in remoteLights {
+            if let unicast = entry["unicast"] as? Int, let hash = entry["hash"] as? String {
+                remote[UInt16(unicast)] = hash
+            }
+        }
+
+        // Add or update lights the bridge is missing or has stale
+        let saved = ks.savedLights
+        var added = 0
+        for light in saved {
+            let hash = Self.registryHash(id: light.id.uuidString, unicast: light.unicastAddress,
+                                         name: light.name)
+            if remote[light.unicastAddress] != hash {
+                addLight(light)
+                added += 1
+            }
+        }
+
+        // Remove lights the phone no longer knows about
+        let savedAddresses = Set(saved.map { $0.unicastAddress })
+        var removed = 0
+        for unicast in remote.keys where !savedAddresses.contains(unicast) {
+            removeLight(unicast: unicast)
+            removed += 1
+        }
+
+        print("BridgeManager: resumed session (keys \(keysSent ? "sent" : "unchanged"), " +
+              "\(added) lights added, \(removed) removed)")
+    }
+
+    /// Must match mesh_crypto_keys_digest(): s1(NetKey || AppKey || IV || SRC)[0..7] as hex.
+    static func keysDigest(networkKey: [UInt8], appKey: [UInt8], ivIndex: UInt32,
+                           srcAddress: UInt16) -> String {
+        var m = networkKey + appKey
+        m += [UInt8(ivIndex >> 24 & 0xFF), UInt8(ivIndex >> 16 & 0xFF),
+              UInt8(ivIndex >> 8 & 0xFF), UInt8(ivIndex & 0xFF)]
+        m += [UInt8(srcAddress >> 8), UInt8(srcAddress & 0xFF)]
+        return MeshCrypto.s1(m).prefix(8).map { String(format: "%02X", $0) }.joined()
+    }
+
+    /// Must match light_registry_entry_digest(): FNV-1a 32 over id || 0x00 || unicast (BE) || name.
+    /// The bridge stores at most 63 bytes of id and name, so longer values just re-send.
+    static func registryHash(id: String, unicast: UInt16, name: String) -> String {
+        var bytes = Array(id.utf8)
+        bytes.append(0)
+        bytes += [UInt8(unicast >> 8), UInt8(unicast & 0xFF)]
+        bytes += Array(name.utf8)
+        var h: UInt32 = 0x811C9DC5
+        for b in bytes {
+            h ^= UInt32(b)
+            h = h &* 0x01000193
+        }
+        return String(format: "%08X", h)
+    }
+
     // MARK: - Light Management
 
     func addLight(_ light: SavedLight) {
-        send([
+        var cmd: [String: Any] = [
             "cmd": "add_light",
             "id": light.id.uuidString,
             "unicast": light.unicastAddress,
             "name": light.name
-        ])
+        ]
+        // Lets the bridge send config messages to this light
+        if let key = KeyStorage.shared.getDeviceKey(forAddress: light.unicastAddress) {
+            cmd["device_key"] = key.map { String(format: "%02X", $0) }.joined()
+        }
+        send(cmd)
+    }
+
+    func removeLight(unicast: UInt16) {
+        send(["cmd": "remove_light", "unicast": unicast])
     }
 
     func connectLight(unicast: UInt16) {
@@ -251,10 +514,335 @@ class BridgeManager: ObservableObject {
         send(["cmd": "disconnect", "unicast": unicast])
     }
 
+    // MARK: - Provisioning
+
+    /// Let the bridge provision unprovisioned fixtures in parallel. Addresses
+    /// continue from the phone's next unicast address.
+    func startProvisioning(maxDevices: Int = 0) {
+        provisioningStates.removeAll()
+        send([
+            "cmd": "provision_start",
+            "first_unicast": KeyStorage.shared.nextUnicastAddress,
+            "max": maxDevices
+        ])
+    }
+
+    func stopProvisioning() {
+        send(["cmd": "provision_stop"])
+    }
+
+    /// The bridge already registered the light; save it and its device key
+    /// so the phone can configure and control it like one it provisioned.
+    private func handleProvisioned(_ json: [String: Any]) {
+        guard let uuidString = json["uuid"] as? String,
+              let uuid = UUID(uuidString: uuidString),
+              let unicast = json["unicast"] as? Int,
+              let keyHex = json["device_key"] as? String else { return }
+
+        var deviceKey: [UInt8] = []
+        var index = keyHex.startIndex
+        while index < keyHex.endIndex, let next = keyHex.index(index, offsetBy: 2, limitedBy: keyHex.endIndex) {
+            if let byte = UInt8(keyHex[index..<next], radix: 16) { deviceKey.append(byte) }
+            index = next
+        }
+
+        let ks = KeyStorage.shared
+        ks.storeDeviceKey(deviceKey, forAddress: UInt16(unicast))
+        // The bridge holds the BLE link, so the device UUID stands in for the peripheral
+        ks.addSavedLight(SavedLight(id: uuid,
+                                    name: json["name"] as? String ?? "Fixture",
+                                    unicastAddress: UInt16(unicast),
+                                    peripheralIdentifier: uuid))
+        if let next = json["next_unicast"] as? Int {
+            advanceNextUnicast(to: UInt16(next))
+        }
+        provisioningStates[uuidString] = "complete"
+        print("BridgeManager: bridge provisioned \(uuidString) as 0x\(String(format: "%04X", unicast))")
+    }
+
+    // MARK: - Configuration
+
+    /// Configure lights through the bridge, many at once. `full` runs the whole
+    /// post-provisioning sequence (AppKey, binds, publication, relay, groups);
+    /// otherwise only relay and group subscriptions are sent, for re-grouping.
+    func configureLights(_ unicasts: [UInt16], groups: [UInt16], full: Bool = false) {
+        let ks = KeyStorage.shared
+        var lights: [[String: Any]] = []
+        for unicast in unicasts {
+            guard let key = ks.getDeviceKey(forAddress: unicast) else { continue }
+            lights.append([
+                "unicast": unicast,
+                "device_key": key.map { String(format: "%02X", $0) }.joined()
+            ])
+        }
+        configStates.removeAll()
+        send(["cmd": "configure", "lights": lights, "groups": groups, "full": full])
+    }
+
+    func stopConfiguring() {
+        send(["cmd": "configure_stop"])
+    }
+
+    // MARK: - Output Monitor
+
+    /// Stream what the bridge renders for each light, `rateHz` times a second (1-20).
+    func startMonitor(rateHz: Int = 10) {
+        send(["cmd": "monitor", "rate": rateHz])
+    }
+
+    func stopMonitor() {
+        send(["cmd": "monitor", "rate": 0])
+        monitoredOutputs.removeAll()
+    }
+
+    // MARK: - Rules
+
+    /// Install the bridge's rule table (see rules.h on the bridge); it is
+    /// saved there and keeps reacting while the phone is away.
+    func setRules(_ rules: [[String: Any]]) {
+        send(["cmd": "rules", "rules": rules])
+    }
+
+    /// Feed a named external value (button, OSC, DMX) to the bridge's rules.
+    func sendInput(name: String, value: Double = 1) {
+        send(["cmd": "input", "name": name, "value": value])
+    }
+
+    // MARK: - Cues
+
+    /// Load a cue list into the bridge's player (see cue_player.h on the
+    /// bridge). Each cue holds only what it changes.
+    func loadCues(_ cues: [[String: Any]]) {
+        send(["cmd": "cues", "cues": cues])
+    }
+
+    /// Run the next cue, or jump to `index` with the state tracked up to it.
+    func goCue(_ index: Int? = nil) {
+        var cmd: [String: Any] = ["cmd": "cue_go"]
+        if let index = index {
+            cmd["cue"] = index
+        }
+        send(cmd)
+    }
+
+    /// Hold a running cue fade where it is.
+    func stopCue() {
+        send(["cmd": "cue_stop"])
+    }
+
+    /// A move list as the bridge's player runs it: the cue list, the cue
+    /// each move GOes, and for a move with lightsOffAfter the cue that
+    /// turns its lights off once its fade is done.
+    struct CuePlan {
+        var cues: [[String: Any]] = []
+        var moveCue: [Int] = []
+        var offCue: [Int?] = []
+    }
+
+    /// Tracking cues for the bridge's player, one per move plus one after
+    /// each move that turns its lights off: each carries only the
+    /// attributes that differ from what earlier cues left the light at, so
+    /// a move that touches one light sends one light. A move's "from" state
+    /// is ignored (a tracking cue fades from wherever the light is, which
+    /// is the previous move's "to" unless edited).
+    static func cuePlan(from moves: [Move]) -> CuePlan {
+        var tracked: [UInt16: [String: Double]] = [:]
+        var plan = CuePlan()
+
+        func change(_ unicast: UInt16, to look: [String: Double]) -> [String: Any]? {
+            let previous = tracked[unicast] ?? [:]
+            tracked[unicast] = previous.merging(look) { $1 }
+
+            var delta: [String: Any] = [:]
+            for (key, value) in look where previous[key] != value {
+                switch key {
+                case "on": delta[key] = value != 0
+                case "mode": delta[key] = value != 0 ? "hsi" : "cct"
+                default: delta[key] = value
+                }
+            }
+            guard !delta.isEmpty else { return nil }
+            delta["unicast"] = Int(unicast)
+            return delta
+        }
+
+        for move in moves {
+            let lights = move.lightEntries.compactMap { entry in
+                cueLook(entry.toState).flatMap { change(entry.unicastAddress, to: $0) }
+            }
+            plan.moveCue.append(plan.cues.count)
+            plan.cues.append(["fade_ms": Int(move.fadeTime * 1000), "lights": lights])
+
+            guard move.lightsOffAfter else {
+                plan.offCue.append(nil)
+                continue
+            }
+            let off = move.lightEntries.compactMap { change($0.unicastAddress, to: ["on": 0]) }
+            plan.offCue.append(plan.cues.count)
+            plan.cues.append(["fade_ms": 0, "lights": off])
+        }
+        return plan
+    }
+
+    static func trackingCues(from moves: [Move]) -> [[String: Any]] {
+        cuePlan(from: moves).cues
+    }
+
+    /// Whether the bridge's player can run these moves; lights in effect
+    /// mode stay with the phone.
+    static func canPlayCues(_ moves: [Move]) -> Bool {
+        moves.allSatisfy { move in move.lightEntries.allSatisfy { cueLook($0.toState) != nil } }
+    }
+
+    /// The attributes of a static look, as the bridge's player names them.
+    private static func cueLook(_ state: CueState) -> [String: Double]? {
+        switch LightMode(rawValue: state.mode) ?? .cct {
+        case .cct:
+            return ["on": state.isOn ? 1 : 0, "mode": 0, "intensity": state.intensity,
+                    "cct_kelvin": state.cctKelvin.rounded()]
+        case .hsi:
+            return ["on": state.isOn ? 1 : 0, "mode": 1, "intensity": state.intensity,
+                    "hue": state.hue.rounded(), "saturation": state.saturation.rounded(),
+                    "cct_kelvin": state.hsiCCT.rounded()]
+        case .effects:
+            return nil
+        }
+    }
+
+    // MARK: - Stored Shows
+
+    enum ShowAsset: String {
+        case timeline, scenes
+    }
+
+    /// Bytes per PUT; the bridge streams each one to flash as it arrives.
+    private static let storeChunk = 8192
+
+    /// Put a move list on the bridge as a stored show (show_player.h on the
+    /// bridge): the tracking cues become its scenes and each move's start
+    /// (and lights-off) its timeline, so the bridge runs it with no phone
+    /// in the loop.
+    /// Starts it once both assets are in if `play` is set.
+    func storeShow(moves: [Move], play: Bool = false, completion: ((Bool) -> Void)? = nil) {
+        let plan = Self.cuePlan(from: moves)
+        var events: [(ms: Int, cue: Int)] = []
+        var start = 0.0
+        for (index, move) in moves.enumerated() {
+            // As MoveEngine plays it: each move after the first waits its
+            // wait time once the one before has faded
+            if index > 0 { start += moves[index - 1].fadeTime + move.waitTime }
+            events.append((ms: Int(start * 1000), cue: plan.moveCue[index]))
+            if let off = plan.offCue[index] {
+                events.append((ms: Int((start + move.fadeTime) * 1000), cue: off))
+            }
+        }
+        let scenes = ShowEncoder.cueList(plan.cues)
+        let timeline = ShowEncoder.timeline(events)
+
+        uploadShowAsset(.scenes, raw: scenes, events: plan.cues.count) { [weak self] ok in
+            guard ok, let self = self else { completion?(false); return }
+            self.uploadShowAsset(.timeline, raw: timeline, events: events.count) { ok in
+                if ok && play { self.playShow() }
+                completion?(ok)
+            }
+        }
+    }
+
+    /// Upload an asset to the bridge's store (show_store.h): compressed,
+    /// in chunks that each carry their CRC-32, resuming from wherever the
+    /// bridge says it got to after a rejected chunk. Skipped when the
+    /// bridge already holds the same bytes (its ready event's "show").
+    /// Calls back on the main queue.
+    func uploadShowAsset(_ kind: ShowAsset, raw: [UInt8], events: Int,
+                         completion: @escaping (Bool) -> Void) {
+        let finish = { (ok: Bool) in DispatchQueue.main.async { completion(ok) } }
+        guard let host = connectedBridgeAddress else {
+            finish(false)
+            return
+        }
+        let port = bridgePort
+        let encoded = ShowEncoder.lzss(raw)
+        let crc = ShowEncoder.crc32(encoded)
+        if bridgeShowDigests[kind.rawValue] == String(format: "%08X", crc) {
+            finish(true)
+            return
+        }
+        let encoding = "encoding=lzss&window=\(ShowEncoder.windowBits)&lookahead=\(ShowEncoder.lookaheadBits)"
+            + "&raw_length=\(raw.count)&raw_crc=\(ShowEncoder.crc32(raw))&events=\(events)"
+        var retries = 0
+
+        func put(from offset: Int) {
+            let end = min(offset + Self.storeChunk, encoded.count)
+            let chunk = offset <= end ? Array(encoded[offset..<end]) : []
+            var query = "offset=\(offset)&length=\(encoded.count)&crc=\(crc)&chunk_crc=\(ShowEncoder.crc32(chunk))"
+            if offset == 0 { query += "&" + encoding }
+            guard let url = URL(string: "http://\(host):\(port)/store/\(kind.rawValue)?\(query)") else {
+                finish(false)
+                return
+            }
+            var request = URLRequest(url: url)
+            request.httpMethod = "PUT"
+            request.httpBody = Data(chunk)
+
+            URLSession.shared.dataTask(with: request) { data, response, _ in
+                let status = (response as? HTTPURLResponse)?.statusCode ?? 0
+                let json = data.flatMap { try? JSONSerialization.jsonObject(with: $0) } as? [String: Any]
+                let next = json?["offset"] as? Int
+                if status == 200, let next = next {
+                    if json?["done"] as? Bool == true {
+                        DispatchQueue.main.async { self.bridgeShowDigests[kind.rawValue] = String(format: "%08X", crc) }
+                        print("BridgeManager: stored \(kind.rawValue), \(raw.count) → \(encoded.count) bytes")
+                        finish(true)
+                    } else {
+                        put(from: next)
+                    }
+                    return
+                }
+                retries += 1
+                guard retries <= 3 else {
+                    print("BridgeManager: \(kind.rawValue) upload failed (HTTP \(status))")
+                    finish(false)
+                    return
+                }
+                // Resume where the bridge is; without an answer, start over
+                put(from: next ?? 0)
+            }.resume()
+        }
+        put(from: 0)
+    }
+
+    /// Load the stored scenes into the cue player for GOs by hand.
+    func loadShow() {
+        send(["cmd": "show_load"])
+    }
+
+    /// Play the stored show from the start.
+    func playShow() {
+        send(["cmd": "show_play"])
+    }
+
+    func stopShow() {
+        send(["cmd": "show_stop"])
+    }
+
+    // MARK: - Topology
+
+    /// Ask for the hop/reachability map; the answer lands in `topology`.
+    func requestTopology() {
+        send(["cmd": "topology"])
+    }
+
+    private func advanceNextUnicast(to next: UInt16) {
+        let ks = KeyStorage.shared
+        if next > ks.nextUnicastAddress {
+            ks.nextUnicastAddress = next
+        }
+    }
+
     // MARK: - One-Shot Commands
 
     func setCCT(unicast: UInt16, intensity: Double, cctKelvin: Int, sleepMode: Int) {
-        send([
+        sendState([
             "cmd": "set_cct",
             "unicast": unicast,
             "intensity": intensity,
@@ -264,7 +852,7 @@ class BridgeManager: ObservableObject {
     }
 
     func setHSI(unicast: UInt16, intensity: Double, hue: Int, saturation: Int, cctKelvin: Int, sleepMode: Int) {
-        send([
+        sendState([
             "cmd": "set_hsi",
             "unicast": unicast,
             "intensity": intensity,
@@ -276,7 +864,7 @@ class BridgeManager: ObservableObject {
     }
 
     func sendSleep(unicast: UInt16, on: Bool) {
-        send(["cmd": "sleep", "unicast": unicast, "on": on])
+        sendState(["cmd": "sleep", "unicast": unicast, "on": on])
     }
 
     func setEffect(unicast: UInt16, effectType: Int, intensity: Double, frq: Int,
@@ -309,7 +897,7 @@ class BridgeManager: ObservableObject {
     }
 
     func updateEffect(unicast: UInt16, params: [String: Any]) {
-        send([
+        sendState([
             "cmd": "update_effect",
             "unicast": unicast,
             "params": params
@@ -15,6 +15,7 @@ class KeyStorage {
     private let ivIndexKey = "mesh.ivIndex"
     private let deviceKeysKey = "mesh.deviceKeys"
     private let nextUnicastAddressKey = "mesh.nextUnicastAddress"
+    private let clusterBaseAddressKey = "mesh.clusterBaseAddress"
     private let savedLightsKey = "mesh.savedLights"
     private let cueListsKey = "cues.cueLists"
     private let timelinesKey = "cues.timelines"
@@ -136,6 +137,21 @@ class KeyStorage {
         return address
     }
 
+    /// Addresses bridges 1-15 of a cluster send from (cluster_base on the
+    /// bridge). Reserved once, where allocation had got to, so no fixture
+    /// is ever given one.
+    static let clusterAddressCount: UInt16 = 15
+
+    var clusterBaseAddress: UInt16 {
+        let stored = defaults.integer(forKey: clusterBaseAddressKey)
+        if stored != 0 { return UInt16(stored) }
+        let base = nextUnicastAddress
+        nextUnicastAddress = base + Self.clusterAddressCount
+        defaults.set(Int(base), forKey: clusterBaseAddressKey)
+        print("KeyStorage: Reserved cluster addresses 0x\(String(format: "%04X", base))+")
+        return base
+    }
+
     // MARK: - Device Keys
 
     /// Stored device keys indexed by unicast address (hex string)
@@ -392,6 +408,7 @@ class KeyStorage {
         defaults.removeObject(forKey: ivIndexKey)
         defaults.removeObject(forKey: deviceKeysKey)
         defaults.removeObject(forKey: nextUnicastAddressKey)
+        defaults.removeObject(forKey: clusterBaseAddressKey)
         defaults.removeObject(forKey: savedLightsKey)
         defaults.removeObject(forKey: cueListsKey)
         defaults.removeObject(forKey: timelinesKey)
@@ -37,10 +37,9 @@ class MeshConfigManager: ObservableObject {
     // Config Relay Set: opcode 0x8023
     private static let opcodeRelaySet: [UInt8] = [0x80, 0x23]
 
-    // Config Model Subscription Add: opcode 0x801B (for SIG models, 2-byte model ID)
-    private static let opcodeModelSubAddSIG: [UInt8] = [0x80, 0x1B]
-    // Config Vendor Model Subscription Add: opcode 0x801C (for vendor models, 4-byte model ID)
-    private static let opcodeModelSubAddVendor: [UInt8] = [0x80, 0x1C]
+    // Config Model Subscription Add: opcode 0x801B, with a 2-byte SIG or
+    // 4-byte vendor model ID (0x801C is Subscription Delete)
+    private static let opcodeModelSubAdd: [UInt8] = [0x80, 0x1B]
 
     // Standard SIG model IDs for Aputure lights
     private static let lightModels: [(id: UInt16, name: String)] = [
@@ -391,8 +390,8 @@ class MeshConfigManager: ObservableObject {
         var payload: [UInt8]
 
         if model.isSIG {
-            // SIG model: opcode 0x801B, 2-byte model ID
-            payload = Self.opcodeModelSubAddSIG
+            // SIG model: 2-byte model ID
+            payload = Self.opcodeModelSubAdd
             payload.append(UInt8(unicastAddress & 0xFF))
             payload.append(UInt8((unicastAddress >> 8) & 0xFF))
             payload.append(UInt8(groupAddr & 0xFF))
@@ -400,8 +399,8 @@ class MeshConfigManager: ObservableObject {
             payload.append(UInt8(model.id & 0xFF))
             payload.append(UInt8((model.id >> 8) & 0xFF))
         } else {
-            // Vendor model: opcode 0x801C, 4-byte model ID (company + model)
-            payload = Self.opcodeModelSubAddVendor
+            // Vendor model: 4-byte model ID (company + model)
+            payload = Self.opcodeModelSubAdd
             payload.append(UInt8(unicastAddress & 0xFF))
             payload.append(UInt8((unicastAddress >> 8) & 0xFF))
             payload.append(UInt8(groupAddr & 0xFF))
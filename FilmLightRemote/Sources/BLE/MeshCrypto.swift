@@ -724,7 +724,7 @@ class MeshCrypto {
     // MARK: - Crypto Primitives
 
     /// AES-CMAC using CryptoSwift
-    private static func aes_cmac(key: [UInt8], message: [UInt8]) -> [UInt8] {
+    static func aes_cmac(key: [UInt8], message: [UInt8]) -> [UInt8] {
         do {
             let cmac = try CMAC(key: key).authenticate(message)
             return cmac
@@ -0,0 +1,175 @@
+import Foundation
+
+/// Encodes shows for the bridge's store (show_store.h, show_player.h on the
+/// bridge): cue lists and timelines as zigzag varint records, compressed
+/// the way heatshrink does it so the bridge can decode them as it plays.
+enum ShowEncoder {
+    /// Window and lookahead bits the bridge decodes with (show_codec.h).
+    static let windowBits = 10
+    static let lookaheadBits = 4
+
+    // MARK: - Varints
+
+    /// 0, -1, 1, -2, 2 ... → 0, 1, 2, 3, 4 ...
+    static func zigzag(_ v: Int32) -> UInt32 {
+        (UInt32(bitPattern: v) << 1) ^ UInt32(bitPattern: v >> 31)
+    }
+
+    static func appendVarint(_ value: UInt32, to out: inout [UInt8]) {
+        var v = value
+        while v >= 0x80 {
+            out.append(UInt8(truncatingIfNeeded: v) | 0x80)
+            v >>= 7
+        }
+        out.append(UInt8(v))
+    }
+
+    // MARK: - Records
+
+    /// A tracking cue list (BridgeManager.trackingCues) in the player's
+    /// binary form: cue count, change count, then per cue fade_ms, change
+    /// count and its changes (unicast delta, attribute flags, values).
+    static func cueList(_ cues: [[String: Any]]) -> [UInt8] {
+        let lists = cues.map { $0["lights"] as? [[String: Any]] ?? [] }
+        var out: [UInt8] = []
+        appendVarint(UInt32(cues.count), to: &out)
+        appendVarint(UInt32(lists.reduce(0) { $0 + $1.count }), to: &out)
+
+        var unicast: Int32 = 0
+        for (cue, lights) in zip(cues, lists) {
+            appendVarint(UInt32(max(cue["fade_ms"] as? Int ?? 0, 0)), to: &out)
+            appendVarint(UInt32(lights.count), to: &out)
+            for light in lights {
+                let address = Int32(light["unicast"] as? Int ?? 0)
+                appendVarint(zigzag(address &- unicast), to: &out)
+                unicast = address
+
+                var flags: UInt32 = 0
+                var values: [UInt32] = []
+                if let on = light["on"] as? Bool {
+                    flags |= 0x01 | (on ? 0x40 : 0)
+                }
+                if let mode = light["mode"] as? String {
+                    flags |= 0x02 | (mode == "hsi" ? 0x80 : 0)
+                }
+                if let intensity = number(light["intensity"]) {
+                    flags |= 0x04
+                    values.append(UInt32(min(max(intensity, 0), 100) * 10 + 0.5))
+                }
+                if let cct = number(light["cct_kelvin"]) {
+                    flags |= 0x08
+                    values.append(UInt32(min(max(cct.rounded(), 1000), 20000)))
+                }
+                if let hue = number(light["hue"]) {
+                    flags |= 0x10
+                    let h = Int(hue.rounded()) % 360
+                    values.append(UInt32(h < 0 ? h + 360 : h))
+                }
+                if let saturation = number(light["saturation"]) {
+                    flags |= 0x20
+                    values.append(UInt32(min(max(saturation.rounded(), 0), 100)))
+                }
+                appendVarint(flags, to: &out)
+                values.forEach { appendVarint($0, to: &out) }
+            }
+        }
+        return out
+    }
+
+    /// Timeline records: each cue's start as a zigzag delta in ms from the
+    /// previous record, then the cue index.
+    static func timeline(_ events: [(ms: Int, cue: Int)]) -> [UInt8] {
+        var out: [UInt8] = []
+        var last = 0
+        for event in events {
+            appendVarint(zigzag(Int32(clamping: event.ms - last)), to: &out)
+            appendVarint(UInt32(event.cue), to: &out)
+            last = event.ms
+        }
+        return out
+    }
+
+    private static func number(_ value: Any?) -> Double? {
+        if let d = value as? Double { return d }
+        if let i = value as? Int { return Double(i) }
+        return nil
+    }
+
+    // MARK: - Compression
+
+    /// heatshrink's LZSS: 1 + literal byte, or 0 + (offset - 1) in
+    /// `windowBits` + (count - 1) in `lookaheadBits`, MSB first, with the
+    /// last byte zero-padded. Longest match in the window, nearest on a tie.
+    static func lzss(_ input: [UInt8], windowBits: Int = ShowEncoder.windowBits,
+                     lookaheadBits: Int = ShowEncoder.lookaheadBits) -> [UInt8] {
+        let window = 1 << windowBits
+        let lookahead = 1 << lookaheadBits
+        let breakEven = (1 + windowBits + lookaheadBits) / 8
+
+        var out: [UInt8] = []
+        out.reserveCapacity(input.count / 2)
+        var bits: UInt32 = 0
+        var used = 0
+        func put(_ value: Int, _ count: Int) {
+            for i in stride(from: count - 1, through: 0, by: -1) {
+                bits = (bits << 1) | UInt32((value >> i) & 1)
+                used += 1
+                if used == 8 {
+                    out.append(UInt8(truncatingIfNeeded: bits))
+                    bits = 0
+                    used = 0
+                }
+            }
+        }
+
+        var pos = 0
+        while pos < input.count {
+            let maxLen = min(input.count - pos, lookahead)
+            var bestLen = 0
+            var bestPos = 0
+            var p = pos - 1
+            while p >= max(pos - window, 0) {
+                var n = 0
+                while n < maxLen && input[p + n] == input[pos + n] { n += 1 }
+                if n > bestLen {
+                    bestLen = n
+                    bestPos = p
+                    if n == maxLen { break }
+                }
+                p -= 1
+            }
+
+            if bestLen > breakEven {
+                put(0, 1)
+                put(pos - bestPos - 1, windowBits)
+                put(bestLen - 1, lookaheadBits)
+                pos += bestLen
+            } else {
+                put(1, 1)
+                put(Int(input[pos]), 8)
+                pos += 1
+            }
+        }
+        if used > 0 { put(0, 8 - used) }
+        return out
+    }
+
+    // MARK: - CRC-32
+
+    private static let crcTable: [UInt32] = (0..<256).map { i -> UInt32 in
+        var c = UInt32(i)
+        for _ in 0..<8 {
+            c = c & 1 != 0 ? 0xEDB88320 ^ (c >> 1) : c >> 1
+        }
+        return c
+    }
+
+    /// CRC-32 as the bridge's esp_crc32_le(0, ...) computes it.
+    static func crc32<S: Sequence>(_ bytes: S) -> UInt32 where S.Element == UInt8 {
+        var crc: UInt32 = 0xFFFFFFFF
+        for b in bytes {
+            crc = crcTable[Int((crc ^ UInt32(b)) & 0xFF)] ^ (crc >> 8)
+        }
+        return crc ^ 0xFFFFFFFF
+    }
+}
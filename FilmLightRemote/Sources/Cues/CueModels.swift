@@ -148,7 +148,7 @@ struct MoveLightEntry: Identifiable, Codable {
 
 // MARK: - Cue State (snapshot of a light's look)
 
-struct CueState: Codable {
+struct CueState: Codable, Equatable {
     var isOn: Bool = true
     var mode: String = "CCT"           // LightMode.rawValue
     var intensity: Double = 50.0
@@ -275,22 +275,47 @@ struct CueState: Codable {
 
     // MARK: - Interpolation
 
-    /// Linearly interpolate between two CueStates. t=0 returns `from`, t=1 returns `to`.
+    /// Interpolate between two CueStates. t=0 returns `from`, t=1 returns `to`.
+    /// CCT moves evenly in mireds and hue the short way round in perceptual
+    /// hue, so equal steps look equal (see `PerceptualHue`).
     static func interpolate(from a: CueState, to b: CueState, t: Double) -> CueState {
         let t = min(max(t, 0), 1)
         func lerp(_ start: Double, _ end: Double) -> Double {
             start + (end - start) * t
         }
+        func mireds(_ start: Double, _ end: Double) -> Double {
+            guard start > 0, end > 0 else { return lerp(start, end) }
+            return 1e6 / lerp(1e6 / start, 1e6 / end)
+        }
         var result = b
         result.intensity = lerp(a.intensity, b.intensity)
-        result.cctKelvin = lerp(a.cctKelvin, b.cctKelvin)
-        result.hue = lerp(a.hue, b.hue)
+        result.cctKelvin = mireds(a.cctKelvin, b.cctKelvin)
+        result.hue = PerceptualHue.lerp(a.hue, b.hue, t: t)
         result.saturation = lerp(a.saturation, b.saturation)
         result.hsiIntensity = lerp(a.hsiIntensity, b.hsiIntensity)
-        result.hsiCCT = lerp(a.hsiCCT, b.hsiCCT)
+        result.hsiCCT = mireds(a.hsiCCT, b.hsiCCT)
         return result
     }
 
+    // MARK: - Output
+
+    /// True if both states put the same command on the air: only the
+    /// attributes the mode sends count, at the resolution they're sent at.
+    func sameOutput(as other: CueState) -> Bool {
+        if !isOn || !other.isOn { return isOn == other.isOn }
+        guard mode == other.mode else { return false }
+        let sameIntensity = (intensity * 10).rounded() == (other.intensity * 10).rounded()
+        switch LightMode(rawValue: mode) ?? .cct {
+        case .cct:
+            return sameIntensity && Int(cctKelvin) == Int(other.cctKelvin)
+        case .hsi:
+            return sameIntensity && Int(hue) == Int(other.hue) &&
+                Int(saturation) == Int(other.saturation) && Int(hsiCCT) == Int(other.hsiCCT)
+        case .effects:
+            return self == other
+        }
+    }
+
     // MARK: - Summary
 
     var modeSummary: String {
@@ -319,6 +344,100 @@ struct CueState: Codable {
     }
 }
 
+// MARK: - Perceptual Hue
+
+/// Fixture hue re-spaced so equal steps look equal: distance in OKLab along
+/// the fully saturated hue circle, scaled to 0-360. The same tables as the
+/// bridge's color_space.c, built once on first use; a conversion is a
+/// table lookup and a lerp.
+enum PerceptualHue {
+    private static let hueSteps = 360
+    private static let inverseSteps = 720
+
+    private static let forwardTable: [Double] = {
+        func oklab(_ h: Double) -> (Double, Double, Double) {
+            let x = h.truncatingRemainder(dividingBy: 360) / 60
+            let f = x - x.rounded(.down)
+            let rgb: (Double, Double, Double)
+            switch Int(x) {
+            case 0: rgb = (1, f, 0)
+            case 1: rgb = (1 - f, 1, 0)
+            case 2: rgb = (0, 1, f)
+            case 3: rgb = (0, 1 - f, 1)
+            case 4: rgb = (f, 0, 1)
+            default: rgb = (1, 0, 1 - f)
+            }
+            let (r, g, b) = rgb
+            let l = cbrt(0.4122214708 * r + 0.5363325363 * g + 0.0514459929 * b)
+            let m = cbrt(0.2119034982 * r + 0.6806995451 * g + 0.1073969566 * b)
+            let s = cbrt(0.0883024619 * r + 0.2817188376 * g + 0.6299787005 * b)
+            return (0.2104542553 * l + 0.7936177850 * m - 0.0040720468 * s,
+                    1.9779984951 * l - 2.4285922050 * m + 0.4505937099 * s,
+                    0.0259040371 * l + 0.7827717662 * m - 0.8086757660 * s)
+        }
+
+        let sub = 8
+        var table = [Double](repeating: 0, count: hueSteps + 1)
+        var prev = oklab(0)
+        var arc = 0.0
+        for i in 1...(hueSteps * sub) {
+            let lab = oklab(Double(i) / Double(sub))
+            let dl = lab.0 - prev.0, da = lab.1 - prev.1, db = lab.2 - prev.2
+            arc += (dl * dl + da * da + db * db).squareRoot()
+            prev = lab
+            if i % sub == 0 { table[i / sub] = arc }
+        }
+        return table.map { $0 * 360 / arc }
+    }()
+
+    private static let inverseTable: [Double] = {
+        let forward = forwardTable
+        var table = [Double](repeating: 0, count: inverseSteps + 1)
+        var h = 0
+        for i in 0...inverseSteps {
+            let p = Double(i) * 360 / Double(inverseSteps)
+            while h < hueSteps - 1 && forward[h + 1] < p { h += 1 }
+            let span = forward[h + 1] - forward[h]
+            let frac = span > 0 ? (p - forward[h]) / span : 0
+            table[i] = min(Double(h) + frac, 360)
+        }
+        return table
+    }()
+
+    private static func wrap(_ h: Double) -> Double {
+        let r = h.truncatingRemainder(dividingBy: 360)
+        return r < 0 ? r + 360 : r
+    }
+
+    private static func lookup(_ table: [Double], _ steps: Int, _ x: Double) -> Double {
+        let pos = x * Double(steps) / 360
+        let i = Int(pos)
+        if i >= steps { return table[steps] }
+        return table[i] + (table[i + 1] - table[i]) * (pos - Double(i))
+    }
+
+    static func toPerceptual(_ hue: Double) -> Double {
+        lookup(forwardTable, hueSteps, wrap(hue))
+    }
+
+    static func fromPerceptual(_ p: Double) -> Double {
+        let h = lookup(inverseTable, inverseSteps, wrap(p))
+        return h >= 360 ? 0 : h
+    }
+
+    /// Fixture hue a fraction t of the way from a to b, the short way round.
+    static func lerp(_ a: Double, _ b: Double, t: Double) -> Double {
+        // Exact at the ends; the round trip is only good to a tenth of a degree
+        if a == b || t <= 0 { return a }
+        if t >= 1 { return b }
+        let pa = toPerceptual(a)
+        var d = toPerceptual(b) - pa
+        if d > 180 { d -= 360 }
+        if d < -180 { d += 360 }
+        return fromPerceptual(pa + d * t)
+    }
+}
+
 // MARK: - Beat Mode Types
 
 enum TimelineMode: String, Codable {
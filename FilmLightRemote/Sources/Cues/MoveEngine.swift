@@ -8,6 +8,16 @@ import Combine
 ///   - next: fires the current move only, advances index, stops
 ///
 /// Lights always hold at their final position — no dimming on end.
+///
+/// Output is tracked per light: a light is only sent a state that differs
+/// from what it was last sent, and a fade only steps the lights whose
+/// from and to states differ, so a move that changes one light costs one
+/// light's traffic.
+///
+/// Through a bridge, moves with no effects run on the bridge's cue player
+/// instead: the list goes over once as tracking cues and each move is a
+/// GO, so the fade steps never cross the network. `runStoredShow` goes
+/// further and hands the bridge the whole timeline.
 class MoveEngine: ObservableObject {
     @Published var currentMoveIndex: Int = 0
     @Published var isRunning: Bool = false
@@ -17,11 +27,20 @@ class MoveEngine: ObservableObject {
     private var fadeTimer: Timer?
     private var allMoves: [Move] = []
     private var playingAll: Bool = false
+    private var lastSent: [UInt16: CueState] = [:]
+
+    // The cue list on the bridge, and the moves it was built from
+    private var cuePlan: BridgeManager.CuePlan?
+    private var cueMoves: Data?
+    private var usingCues = false
+    private var showWatch: AnyCancellable?
 
     // MARK: - Public API
 
     /// Run all moves from currentMoveIndex to the end.
     func playAll(moves: [Move]) {
+        // A fresh run: lights may have been changed by hand since
+        lastSent.removeAll()
         allMoves = moves
         playingAll = true
         fireCurrentMove()
@@ -36,11 +55,43 @@ class MoveEngine: ObservableObject {
 
     func stop() {
         cancelPending()
+        if showWatch != nil, let bm = bleManager {
+            bm.bridgeManager.stopShow()
+        }
+        showWatch = nil
         isRunning = false
     }
 
-    func reset() {
+    /// Store the moves on the bridge as a show and play it there from the
+    /// top; runs until the bridge reports the show over or stop().
+    func runStoredShow(moves: [Move]) {
+        guard let bm = bleManager, bm.useBridge, MoveEngine.canRunOnBridge(moves) else { return }
         cancelPending()
+        lastSent.removeAll()
+        // The show loads its own list over the player's
+        cuePlan = nil
+        cueMoves = nil
+        isRunning = true
+        bm.bridgeManager.storeShow(moves: moves, play: true) { [weak self] ok in
+            guard let self = self else { return }
+            guard ok else {
+                self.isRunning = false
+                return
+            }
+            self.showWatch = bm.bridgeManager.$showPlaying.dropFirst().filter { !$0 }.sink { [weak self] _ in
+                self?.showWatch = nil
+                self?.isRunning = false
+            }
+        }
+    }
+
+    static func canRunOnBridge(_ moves: [Move]) -> Bool {
+        BridgeManager.canPlayCues(moves)
+    }
+
+    func reset() {
+        stop()
+        lastSent.removeAll()
         currentMoveIndex = 0
         isRunning = false
     }
@@ -58,9 +109,38 @@ class MoveEngine: ObservableObject {
         isRunning = true
 
         let move = allMoves[currentMoveIndex]
+        if let plan = bridgeCues(bleManager: bm) {
+            usingCues = true
+            bm.bridgeManager.goCue(plan.moveCue[currentMoveIndex])
+            // The bridge fades; we only keep time for the chain
+            let work = DispatchWorkItem { [weak self] in self?.moveDidComplete() }
+            waitWork = work
+            DispatchQueue.main.asyncAfter(deadline: .now() + move.fadeTime, execute: work)
+            return
+        }
+        usingCues = false
         executeMove(move, bleManager: bm)
     }
 
+    /// The bridge's cue list for allMoves, loaded if it isn't already; nil
+    /// when the moves have to be played from here.
+    private func bridgeCues(bleManager: BLEManager) -> BridgeManager.CuePlan? {
+        guard bleManager.useBridge, MoveEngine.canRunOnBridge(allMoves) else {
+            cuePlan = nil
+            return nil
+        }
+        let encoded = try? JSONEncoder().encode(allMoves)
+        if cuePlan == nil || encoded == nil || encoded != cueMoves {
+            let plan = BridgeManager.cuePlan(from: allMoves)
+            bleManager.bridgeManager.loadCues(plan.cues)
+            cuePlan = plan
+            cueMoves = encoded
+        }
+        // The bridge drives the lights now; what we sent may be stale
+        lastSent.removeAll()
+        return cuePlan
+    }
+
     private func executeMove(_ move: Move, bleManager: BLEManager) {
         if move.fadeTime > 0 && !move.lightEntries.isEmpty {
             startFade(move, bleManager: bleManager)
@@ -81,6 +161,9 @@ class MoveEngine: ObservableObject {
             sendState(entry.fromState, to: entry.unicastAddress, bleManager: bleManager)
         }
 
+        // Lights whose from and to match hold after the first send
+        let moving = move.lightEntries.filter { !$0.fromState.sameOutput(as: $0.toState) }
+
         let fadeTime = move.fadeTime
         let startTime = Date()
         let tickInterval: TimeInterval = 0.05
@@ -92,7 +175,7 @@ class MoveEngine: ObservableObject {
             let elapsed = Date().timeIntervalSince(startTime)
             let t = min(elapsed / fadeTime, 1.0)
 
-            for entry in move.lightEntries {
+            for entry in moving {
                 let interpolated = CueState.interpolate(from: entry.fromState, to: entry.toState, t: t)
                 self.sendState(interpolated, to: entry.unicastAddress, bleManager: bleManager)
             }
@@ -109,9 +192,13 @@ class MoveEngine: ObservableObject {
 
     private func moveDidComplete() {
         let completedMove = allMoves[currentMoveIndex]
-        if completedMove.lightsOffAfter, let bm = bleManager {
+        if usingCues, let off = cuePlan?.offCue[currentMoveIndex], let bm = bleManager {
+            bm.bridgeManager.goCue(off)
+        } else if !usingCues, completedMove.lightsOffAfter, let bm = bleManager {
             for entry in completedMove.lightEntries {
-                bm.sendSleep(false, targetAddress: entry.unicastAddress)
+                var off = entry.toState
+                off.isOn = false
+                sendState(off, to: entry.unicastAddress, bleManager: bm)
             }
         }
 
@@ -141,6 +228,9 @@ class MoveEngine: ObservableObject {
     // MARK: - Send State
 
     private func sendState(_ state: CueState, to address: UInt16, bleManager: BLEManager) {
+        if let last = lastSent[address], last.sameOutput(as: state) { return }
+        lastSent[address] = state
+
         let mode = LightMode(rawValue: state.mode) ?? .cct
 
         if !state.isOn {
@@ -285,6 +375,8 @@ class MoveEngine: ObservableObject {
         waitWork = nil
         fadeTimer?.invalidate()
         fadeTimer = nil
+        // Stopping effects changes what those lights show
+        lastSent = lastSent.filter { $0.value.mode != LightMode.effects.rawValue }
         if let bm = bleManager {
             if bm.useBridge {
                 bm.bridgeManager.stopAll()
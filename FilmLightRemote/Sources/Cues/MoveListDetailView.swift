@@ -47,6 +47,13 @@ struct MoveListDetailView: View {
                     } label: {
                         Label("Reset to Top", systemImage: "arrow.counterclockwise")
                     }
+                    if bleManager.useBridge && MoveEngine.canRunOnBridge(moveList.moves) {
+                        Button {
+                            engine.runStoredShow(moves: moveList.moves)
+                        } label: {
+                            Label("Run on Bridge", systemImage: "externaldrive.badge.play")
+                        }
+                    }
                 } label: {
                     Image(systemName: "ellipsis.circle")
                 }
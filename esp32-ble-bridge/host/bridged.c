@@ -0,0 +1,761 @@
+/*
+ * bridged.c
+ *
+ * Host bridge daemon: a cluster node (cluster_proto.h) that drives the
+ * fixtures it owns through the shared core from main/ (command handlers,
+ * registry, effect engine, rules, cue player) over host transports
+ * (mesh_host.c). The cluster side mirrors cluster.c on the epoll loop.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "cJSON.h"
+
+#include "cluster_proto.h"
+#include "cluster.h"
+#include "command.h"
+#include "mesh_crypto.h"
+#include "ble_mesh.h"
+#include "light_registry.h"
+#include "effect_engine.h"
+#include "heap_health.h"
+#include "rules.h"
+#include "cue_player.h"
+#include "checkpoint.h"
+#include "ws_server.h"
+#include "event_loop.h"
+#include "transport.h"
+#include "mesh_host.h"
+#include "ws_host.h"
+#include "platform.h"
+
+static const char *TAG = "bridged";
+
+#define TO_ALL          0xFF
+#define ASSIGN_EVERY    5
+#define KICK_MS         100
+
+typedef struct {
+    int node;
+    int cluster_port;
+    const char *peers;
+    const char *secret;
+    const char *sim;        // host:port of the fixture simulator
+    const char *proxies[MESH_HOST_TRANSPORTS];  // BlueZ proxy addresses
+    int proxy_count;
+    const char *state;      // Directory for the NVS files (checkpoint, SEQ, rules)
+    int control_port;       // Local JSON commands, 0 = off
+    int ws_port;            // The phone's WebSocket, 0 = off
+    int capacity;
+} options_t;
+
+static options_t s_opt = {
+    .cluster_port = 8767,
+    .peers = "",
+    .secret = "",
+    .sim = NULL,
+    .state = NULL,
+    .ws_port = 8765,
+    .capacity = MAX_LIGHTS,
+};
+
+// The loop thread runs the cluster, but cluster_route and
+// cluster_relay_event are also called from the effect timers, the cue
+// player and the rules task. Same two locks as cluster.c.
+static cluster_state_t s_st;
+static SemaphoreHandle_t s_lock = NULL;     // s_st, s_addrs, s_leader
+static SemaphoreHandle_t s_tx_lock = NULL;  // s_tx and s_counter
+static bool s_running = false;
+static volatile bool s_kick = false;        // Reassign now instead of at the next HELLO
+static int s_sock = -1;
+static uint8_t s_key[16];
+static uint32_t s_counter = 0;
+static uint8_t s_tx[CLUSTER_MAX_DATAGRAM];
+static uint8_t s_assign[2 + CLUSTER_MAX_FIXTURES * 3];
+static struct sockaddr_in s_addrs[CLUSTER_MAX_NODES];
+static struct sockaddr_in s_peers[CLUSTER_MAX_NODES];
+static int s_peer_count = 0;
+static uint8_t s_leader = CLUSTER_NO_OWNER;
+static int s_hellos = 0;
+
+// MARK: - Cluster transport
+
+static void send_to(const struct sockaddr_in *addrs, int count, cluster_msg_t type, int dst,
+                    const void *body, size_t len)
+{
+    size_t total = CLUSTER_HEADER_LEN + (dst >= 0 ? 1 : 0) + len + CLUSTER_TAG_LEN;
+    if (total > sizeof(s_tx)) {
+        ESP_LOGW(TAG, "Dropped %zu-byte message", total);
+        return;
+    }
+
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    size_t n = cluster_proto_header(&s_st, s_tx, type, ++s_counter);
+    if (dst >= 0) s_tx[n++] = (uint8_t)dst;
+    memcpy(s_tx + n, body, len);
+    n += len;
+
+    uint8_t mac[16];
+    mesh_crypto_aes_cmac(s_key, s_tx, n, mac);
+    memcpy(s_tx + n, mac, CLUSTER_TAG_LEN);
+    n += CLUSTER_TAG_LEN;
+
+    for (int i = 0; i < count; i++) {
+        sendto(s_sock, s_tx, n, 0, (const struct sockaddr *)&addrs[i], sizeof(addrs[i]));
+    }
+    xSemaphoreGive(s_tx_lock);
+}
+
+static void send_all(cluster_msg_t type, int dst, const void *body, size_t len)
+{
+    send_to(s_peers, s_peer_count, type, dst, body, len);
+}
+
+static void send_node(uint8_t node, cluster_msg_t type, int dst, const void *body, size_t len)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    struct sockaddr_in addr = s_addrs[node];
+    xSemaphoreGive(s_lock);
+
+    if (addr.sin_port) {
+        send_to(&addr, 1, type, dst, body, len);
+    } else {
+        send_all(type, dst, body, len);
+    }
+}
+
+static void send_json(uint8_t dst, cluster_msg_t type, const cJSON *root)
+{
+    char *text = cJSON_PrintUnformatted(root);
+    if (!text) return;
+    if (dst == TO_ALL) {
+        send_all(type, dst, text, strlen(text));
+    } else {
+        send_node(dst, type, dst, text, strlen(text));
+    }
+    cJSON_free(text);
+}
+
+static bool authentic(const uint8_t *buf, int len)
+{
+    if (len < CLUSTER_HEADER_LEN + CLUSTER_TAG_LEN) return false;
+
+    uint8_t mac[16];
+    int body = len - CLUSTER_TAG_LEN;
+    mesh_crypto_aes_cmac(s_key, buf, body, mac);
+    uint8_t diff = 0;
+    for (int i = 0; i < CLUSTER_TAG_LEN; i++) diff |= mac[i] ^ buf[body + i];
+    return diff == 0;
+}
+
+// MARK: - Fixtures
+
+// Node 0 keeps the phone's src_address, node k sends from cluster_base +
+// k - 1 (cluster.c)
+static void adjust_src(cJSON *root)
+{
+    if (s_st.self == 0) return;
+
+    cJSON *src = cJSON_GetObjectItem(root, "src_address");
+    cJSON *base = cJSON_GetObjectItem(root, "cluster_base");
+    int addr;
+    if (cJSON_IsNumber(base) && base->valueint > 0 &&
+        base->valueint + CLUSTER_MAX_NODES - 2 <= 0x7FFF) {
+        addr = base->valueint + s_st.self - 1;
+    } else {
+        addr = (cJSON_IsNumber(src) ? src->valueint : 0x0001) + s_st.self;
+        ESP_LOGW(TAG, "set_keys without cluster_base, sending from 0x%04X", addr);
+    }
+    if (src) {
+        cJSON_SetNumberValue(src, addr);
+    } else {
+        cJSON_AddNumberToObject(root, "src_address", addr);
+    }
+}
+
+static void drop_local(uint16_t unicast)
+{
+    light_entry_t e;
+    if (!light_registry_lookup(unicast, &e)) return;
+    ESP_LOGI(TAG, "0x%04X moved off this bridge", unicast);
+    effect_engine_stop(unicast);
+    light_registry_remove(unicast);
+}
+
+// Make the registry match what the leader assigned here, as cluster.c does
+static void reconcile(void)
+{
+    static cluster_fixture_t adds[MAX_LIGHTS];
+    static light_entry_t e;
+    int n_add = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES && n_add < MAX_LIGHTS; i++) {
+        const cluster_fixture_t *f = &s_st.fixtures[i];
+        if (f->unicast && f->owner == s_st.self && !light_registry_lookup(f->unicast, &e)) {
+            adds[n_add++] = *f;
+        }
+    }
+    xSemaphoreGive(s_lock);
+
+    for (int slot = 0; slot < MAX_LIGHTS; slot++) {
+        if (!light_registry_read_slot(slot, &e)) continue;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        const cluster_fixture_t *f = cluster_proto_find(&s_st, e.unicast);
+        uint8_t owner = f ? f->owner : CLUSTER_NO_OWNER;
+        xSemaphoreGive(s_lock);
+        if (owner != CLUSTER_NO_OWNER && owner != s_st.self) drop_local(e.unicast);
+    }
+
+    bool up = ble_mesh_is_proxy_connected();
+    for (int i = 0; i < n_add; i++) {
+        const cluster_fixture_t *f = &adds[i];
+        if (!light_registry_add(f->id, f->unicast, f->name)) {
+            ESP_LOGW(TAG, "Registry full, can't take 0x%04X", f->unicast);
+            break;
+        }
+        if (f->has_key) light_registry_set_device_key(f->unicast, f->device_key);
+        ESP_LOGI(TAG, "0x%04X assigned to this bridge", f->unicast);
+        ws_server_notify_light_status(f->unicast, up);
+    }
+}
+
+// A new leader starts from its own registry for anything it hasn't heard of
+static void import_registry(void)
+{
+    static light_entry_t e;
+    for (int slot = 0; slot < MAX_LIGHTS; slot++) {
+        if (!light_registry_read_slot(slot, &e)) continue;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (!cluster_proto_find(&s_st, e.unicast)) {
+            cluster_fixture_t *f = cluster_proto_add(&s_st, e.id, e.unicast, e.name,
+                                                     e.has_device_key ? e.device_key : NULL);
+            if (f) f->owner = s_st.self;
+        }
+        xSemaphoreGive(s_lock);
+    }
+}
+
+static void sync_fixtures(uint8_t node)
+{
+    uint8_t body[64 + sizeof(((cluster_fixture_t *)0)->id) + sizeof(((cluster_fixture_t *)0)->name)];
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES; i++) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        size_t len = s_st.fixtures[i].unicast
+            ? cluster_proto_write_fixture(&s_st.fixtures[i], true, body, sizeof(body)) : 0;
+        xSemaphoreGive(s_lock);
+        if (len) send_node(node, CLUSTER_MSG_FIXTURE, -1, body, len);
+    }
+    s_kick = true;
+}
+
+// MARK: - Periodic
+
+// No topology map on the host: a fixture is reachable whenever a
+// transport is up
+static void send_hello(void)
+{
+    static light_entry_t e;
+    uint16_t unicasts[MAX_LIGHTS];
+    uint8_t hops[MAX_LIGHTS];
+    int n = 0;
+
+    bool up = ble_mesh_is_proxy_connected();
+    for (int slot = 0; slot < MAX_LIGHTS; slot++) {
+        if (!light_registry_read_slot(slot, &e)) continue;
+        unicasts[n] = e.unicast;
+        hops[n] = up ? CLUSTER_HOPS_UNKNOWN : CLUSTER_UNREACHABLE;
+        n++;
+    }
+
+    uint8_t flags = (up ? CLUSTER_FLAG_PROXY_UP : 0) |
+                    (ws_server_has_client() ? CLUSTER_FLAG_CLIENT : 0);
+    uint8_t body[3 + MAX_LIGHTS * 3];
+    size_t len = cluster_proto_write_hello(body, sizeof(body), flags, (uint8_t)n, unicasts, hops, n);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    cluster_proto_read_hello(&s_st, s_st.self, body, len, loop_now_ms());
+    xSemaphoreGive(s_lock);
+
+    send_all(CLUSTER_MSG_HELLO, -1, body, len);
+}
+
+static void lead(bool force)
+{
+    uint32_t now = loop_now_ms();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint8_t leader = cluster_proto_leader(&s_st, now);
+    bool became = leader == s_st.self && s_leader != s_st.self;
+    if (leader != s_leader) {
+        ESP_LOGI(TAG, "Leader is node %d", leader);
+        s_leader = leader;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (leader != s_st.self) return;
+    if (became) import_registry();
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool changed = cluster_proto_assign(&s_st, now);
+    size_t len = cluster_proto_write_assign(&s_st, s_assign, sizeof(s_assign));
+    xSemaphoreGive(s_lock);
+
+    if (changed || force || became) send_all(CLUSTER_MSG_ASSIGN, -1, s_assign, len);
+    if (changed || became) reconcile();
+}
+
+static void hello_tick(int fd, void *ctx)
+{
+    s_kick = false;
+    send_hello();
+    lead(++s_hellos % ASSIGN_EVERY == 0);
+}
+
+static void kick_tick(int fd, void *ctx)
+{
+    if (s_kick) {
+        s_kick = false;
+        lead(true);
+    }
+}
+
+// MARK: - Receive
+
+static void cluster_readable(int fd, void *ctx)
+{
+    static uint8_t buf[CLUSTER_MAX_DATAGRAM + 1];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int len = recvfrom(fd, buf, CLUSTER_MAX_DATAGRAM, 0, (struct sockaddr *)&from, &from_len);
+    if (len <= 0 || !authentic(buf, len)) return;
+    len -= CLUSTER_TAG_LEN;
+    buf[len] = '\0';
+
+    uint32_t now = loop_now_ms();
+    cluster_msg_t type;
+    uint8_t node;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool was_alive = buf[3] < CLUSTER_MAX_NODES && cluster_proto_alive(&s_st, buf[3], now);
+    if (!cluster_proto_accept(&s_st, buf, len, now, &type, &node)) {
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    s_addrs[node] = from;
+    uint8_t leader = cluster_proto_leader(&s_st, now);
+
+    const uint8_t *body = buf + CLUSTER_HEADER_LEN;
+    size_t body_len = len - CLUSTER_HEADER_LEN;
+    bool changed = false;
+    bool removed = false;
+    uint16_t unicast = 0;
+    switch (type) {
+    case CLUSTER_MSG_HELLO:
+        cluster_proto_read_hello(&s_st, node, body, body_len, now);
+        break;
+    case CLUSTER_MSG_ASSIGN:
+        if (node == leader) changed = cluster_proto_read_assign(&s_st, body, body_len);
+        break;
+    case CLUSTER_MSG_FIXTURE:
+        if (node == leader) {
+            bool added;
+            removed = cluster_proto_read_fixture(&s_st, body, body_len, &unicast, &added) && !added;
+        }
+        break;
+    default:
+        break;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (type == CLUSTER_MSG_HELLO && !was_alive) {
+        ESP_LOGI(TAG, "Node %d joined", node);
+        if (leader == s_st.self) sync_fixtures(node);
+    }
+    if (changed) reconcile();
+    if (removed) drop_local(unicast);
+
+    if ((type == CLUSTER_MSG_COMMAND || type == CLUSTER_MSG_EVENT) && body_len > 1 &&
+        (body[0] == s_st.self || body[0] == TO_ALL)) {
+        const char *json = (const char *)body + 1;
+        if (type == CLUSTER_MSG_EVENT) {
+            if (ws_server_has_client()) ws_server_send(json);
+            return;
+        }
+
+        cJSON *root = cJSON_Parse(json);
+        if (!root) return;
+        if (leader == s_st.self) {
+            if (!cluster_route(root)) ws_server_dispatch(root);
+        } else {
+            cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
+            if (cJSON_IsString(cmd) && strcmp(cmd->valuestring, "set_keys") == 0) adjust_src(root);
+            ws_server_dispatch(root);
+        }
+        cJSON_Delete(root);
+    }
+}
+
+// MARK: - cluster.h
+
+static bool is_fixture_cmd(const char *cmd)
+{
+    static const char *cmds[] = {
+        "set_cct", "set_hsi", "sleep", "set_effect", "start_effect", "update_effect", "stop_effect",
+    };
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        if (strcmp(cmd, cmds[i]) == 0) return true;
+    }
+    return false;
+}
+
+// Same routing as cluster.c
+bool cluster_route(cJSON *root)
+{
+    if (!s_running) return false;
+    cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
+    if (!cmd || !cJSON_IsString(cmd) || strcmp(cmd->valuestring, "cluster") == 0) return false;
+    const char *c = cmd->valuestring;
+
+    uint32_t now = loop_now_ms();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint8_t leader = cluster_proto_leader(&s_st, now);
+    xSemaphoreGive(s_lock);
+
+    if (leader != s_st.self) {
+        send_json(leader, CLUSTER_MSG_COMMAND, root);
+        return true;
+    }
+
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    uint16_t unicast = cJSON_IsNumber(uni) ? (uint16_t)uni->valueint : 0;
+
+    if (strcmp(c, "add_light") == 0 && unicast) {
+        cJSON *id = cJSON_GetObjectItem(root, "id");
+        cJSON *name = cJSON_GetObjectItem(root, "name");
+        cJSON *dk = cJSON_GetObjectItem(root, "device_key");
+        uint8_t key[16];
+        bool has_key = cJSON_IsString(dk) && command_parse_hex(dk->valuestring, key, 16) == 16;
+
+        uint8_t body[64 + sizeof(((cluster_fixture_t *)0)->id) + sizeof(((cluster_fixture_t *)0)->name)];
+        size_t len = 0;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        cluster_fixture_t *f = cluster_proto_add(&s_st, cJSON_IsString(id) ? id->valuestring : "",
+                                                 unicast, cJSON_IsString(name) ? name->valuestring : "",
+                                                 has_key ? key : NULL);
+        if (f) len = cluster_proto_write_fixture(f, true, body, sizeof(body));
+        xSemaphoreGive(s_lock);
+
+        if (!f) return false;
+        if (len) send_all(CLUSTER_MSG_FIXTURE, -1, body, len);
+        s_kick = true;
+        return true;
+    }
+
+    if (strcmp(c, "remove_light") == 0 && unicast) {
+        cluster_fixture_t gone = { .unicast = unicast };
+        uint8_t body[8];
+        size_t len = cluster_proto_write_fixture(&gone, false, body, sizeof(body));
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        cluster_proto_remove(&s_st, unicast);
+        xSemaphoreGive(s_lock);
+        send_all(CLUSTER_MSG_FIXTURE, -1, body, len);
+        return false;
+    }
+
+    if (strcmp(c, "set_keys") == 0 || strcmp(c, "stop_all") == 0) {
+        send_json(TO_ALL, CLUSTER_MSG_COMMAND, root);
+        if (strcmp(c, "set_keys") == 0) adjust_src(root);
+        return false;
+    }
+
+    if (unicast && is_fixture_cmd(c)) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        const cluster_fixture_t *f = cluster_proto_find(&s_st, unicast);
+        uint8_t owner = f ? f->owner : CLUSTER_NO_OWNER;
+        bool live = cluster_proto_alive(&s_st, owner, now);
+        xSemaphoreGive(s_lock);
+
+        if (owner != CLUSTER_NO_OWNER && owner != s_st.self && live) {
+            send_json(owner, CLUSTER_MSG_COMMAND, root);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cluster_relay_event(const char *json)
+{
+    if (!s_running) return false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint8_t target = cluster_proto_client_node(&s_st, loop_now_ms());
+    xSemaphoreGive(s_lock);
+
+    if (target == CLUSTER_NO_OWNER || target == s_st.self) return false;
+    send_node(target, CLUSTER_MSG_EVENT, target, json, strlen(json));
+    return true;
+}
+
+void cluster_report(void)
+{
+    size_t max = 96 + CLUSTER_MAX_NODES * 64 + CLUSTER_MAX_FIXTURES * 48;
+    char *msg = malloc(max);
+    if (!msg) return;
+
+    uint32_t now = loop_now_ms();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int pos = snprintf(msg, max, "{\"event\":\"cluster\",\"node\":%d,\"leader\":%d,\"nodes\":[",
+                       s_st.self, cluster_proto_leader(&s_st, now));
+    bool first = true;
+    for (int i = 0; i < CLUSTER_MAX_NODES; i++) {
+        if (!cluster_proto_alive(&s_st, i, now)) continue;
+        const cluster_node_t *n = &s_st.nodes[i];
+        pos += snprintf(msg + pos, max - pos,
+                        "%s{\"node\":%d,\"proxy\":%s,\"load\":%d,\"client\":%s}",
+                        first ? "" : ",", i,
+                        (n->flags & CLUSTER_FLAG_PROXY_UP) ? "true" : "false", n->load,
+                        (n->flags & CLUSTER_FLAG_CLIENT) ? "true" : "false");
+        first = false;
+    }
+    pos += snprintf(msg + pos, max - pos, "],\"fixtures\":[");
+    first = true;
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES; i++) {
+        const cluster_fixture_t *f = &s_st.fixtures[i];
+        if (!f->unicast) continue;
+        pos += snprintf(msg + pos, max - pos, "%s{\"unicast\":%u,\"owner\":%d,\"hops\":%d}",
+                        first ? "" : ",", f->unicast,
+                        f->owner == CLUSTER_NO_OWNER ? -1 : f->owner,
+                        f->hops >= CLUSTER_HOPS_UNKNOWN ? (f->hops == CLUSTER_UNREACHABLE ? -1 : 0)
+                                                         : f->hops);
+        first = false;
+    }
+    xSemaphoreGive(s_lock);
+    snprintf(msg + pos, max - pos, "]}");
+    ws_server_send(msg);
+    free(msg);
+}
+
+// MARK: - Local control
+
+// One JSON command per datagram, from this machine only
+static void control_readable(int fd, void *ctx)
+{
+    char buf[CLUSTER_MAX_DATAGRAM + 1];
+    int len = recv(fd, buf, CLUSTER_MAX_DATAGRAM, 0);
+    if (len <= 0) return;
+    buf[len] = '\0';
+
+    cJSON *root = cJSON_Parse(buf);
+    if (!root) {
+        ESP_LOGW(TAG, "Control: not JSON");
+        return;
+    }
+    if (!cluster_route(root)) ws_server_dispatch(root);
+    cJSON_Delete(root);
+}
+
+// MARK: - Setup
+
+static int open_udp(uint32_t addr, int port, bool broadcast)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (broadcast) setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+
+    struct sockaddr_in a = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(addr),
+    };
+    if (bind(sock, (struct sockaddr *)&a, sizeof(a)) < 0) {
+        ESP_LOGE(TAG, "bind to port %d failed: %s", port, strerror(errno));
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void parse_peers(const char *peers)
+{
+    char *list = strdup(peers);
+    char *save = NULL;
+    for (char *tok = strtok_r(list, ", ", &save); tok && s_peer_count < CLUSTER_MAX_NODES;
+         tok = strtok_r(NULL, ", ", &save)) {
+        char *colon = strchr(tok, ':');
+        int port = s_opt.cluster_port;
+        if (colon) {
+            *colon = '\0';
+            port = atoi(colon + 1);
+        }
+        struct sockaddr_in *a = &s_peers[s_peer_count];
+        *a = (struct sockaddr_in) { .sin_family = AF_INET, .sin_port = htons(port) };
+        if (inet_aton(tok, &a->sin_addr)) {
+            s_peer_count++;
+        } else {
+            ESP_LOGW(TAG, "Bad peer \"%s\"", tok);
+        }
+    }
+    free(list);
+
+    if (s_peer_count == 0) {
+        s_peers[0] = (struct sockaddr_in) {
+            .sin_family = AF_INET,
+            .sin_port = htons(s_opt.cluster_port),
+            .sin_addr.s_addr = htonl(INADDR_BROADCAST),
+        };
+        s_peer_count = 1;
+    }
+}
+
+static void on_signal(int sig)
+{
+    loop_stop();
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s --node N --secret S [options]\n"
+            "  --port P        cluster UDP port (8767)\n"
+            "  --peers LIST    ip[:port],... to send to instead of broadcast\n"
+            "  --sim HOST:PORT fixture simulator for the loopback transport\n"
+            "  --bluez ADDR    mesh proxy over BlueZ, repeatable; ADDR[/random][@ADAPTER]\n"
+            "  --ws P          the phone's WebSocket on port P (8765), 0 = off\n"
+            "  --control P     JSON commands on 127.0.0.1:P\n"
+            "  --state DIR     keep the checkpoint, SEQ ceiling and rules in DIR\n"
+            "                  ($STATE_DIRECTORY, else ./bridged-node<N>)\n"
+            "  --capacity N    fixtures this bridge can own (%d)\n"
+            "  -v              more logging, repeatable\n", prog, MAX_LIGHTS);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option longopts[] = {
+        { "node", required_argument, NULL, 'n' },
+        { "port", required_argument, NULL, 'p' },
+        { "peers", required_argument, NULL, 'P' },
+        { "secret", required_argument, NULL, 's' },
+        { "sim", required_argument, NULL, 'S' },
+        { "bluez", required_argument, NULL, 'b' },
+        { "control", required_argument, NULL, 'c' },
+        { "capacity", required_argument, NULL, 'C' },
+        { "state", required_argument, NULL, 'd' },
+        { "ws", required_argument, NULL, 'w' },
+        { NULL, 0, NULL, 0 },
+    };
+    s_opt.node = -1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "v", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'n': s_opt.node = atoi(optarg); break;
+        case 'p': s_opt.cluster_port = atoi(optarg); break;
+        case 'P': s_opt.peers = optarg; break;
+        case 's': s_opt.secret = optarg; break;
+        case 'S': s_opt.sim = optarg; break;
+        case 'b':
+            if (s_opt.proxy_count == MESH_HOST_TRANSPORTS) {
+                usage(argv[0]);
+                return 2;
+            }
+            s_opt.proxies[s_opt.proxy_count++] = optarg;
+            break;
+        case 'c': s_opt.control_port = atoi(optarg); break;
+        case 'C': s_opt.capacity = atoi(optarg); break;
+        case 'd': s_opt.state = optarg; break;
+        case 'w': s_opt.ws_port = atoi(optarg); break;
+        case 'v': host_log_level++; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (s_opt.node < 0 || s_opt.node >= CLUSTER_MAX_NODES || !s_opt.secret[0] ||
+        s_opt.capacity < 1 || s_opt.capacity > MAX_LIGHTS) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // The SEQ ceiling lives here: without it a restart would send SEQs the
+    // fixtures have already seen, and they would ignore the bridge
+    char state_dir[256];
+    if (!s_opt.state) s_opt.state = getenv("STATE_DIRECTORY");
+    if (!s_opt.state) {
+        snprintf(state_dir, sizeof(state_dir), "bridged-node%d", s_opt.node);
+        s_opt.state = state_dir;
+    }
+    if (platform_nvs_init(s_opt.state) != ESP_OK) return 1;
+    if (loop_init() < 0) return 1;
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    if (s_opt.sim) {
+        char host[64];
+        const char *colon = strrchr(s_opt.sim, ':');
+        if (!colon || (size_t)(colon - s_opt.sim) >= sizeof(host)) {
+            usage(argv[0]);
+            return 2;
+        }
+        memcpy(host, s_opt.sim, colon - s_opt.sim);
+        host[colon - s_opt.sim] = '\0';
+        transport_t *t = transport_loopback_open(host, atoi(colon + 1));
+        if (!t) return 1;
+        mesh_host_add_transport(t);
+    }
+    for (int i = 0; i < s_opt.proxy_count; i++) {
+        transport_t *t = transport_bluez_open(s_opt.proxies[i]);
+        if (!t || !mesh_host_add_transport(t)) return 1;
+    }
+
+    // The firmware's start order (main.c)
+    heap_health_init();
+    light_registry_init();
+    effect_engine_init();
+    if (ble_mesh_init() != ESP_OK) return 1;
+    rules_init();
+    cue_player_init();
+
+    // Keys, registry and the SEQ ceiling from the last run; SEQ starts
+    // above anything sent before
+    checkpoint_restore();
+    checkpoint_start();
+
+    s_lock = xSemaphoreCreateMutex();
+    s_tx_lock = xSemaphoreCreateMutex();
+    if (!s_lock || !s_tx_lock) return 1;
+
+    uint32_t boot;
+    if (getrandom(&boot, sizeof(boot), 0) != sizeof(boot)) boot = (uint32_t)getpid();
+    cluster_proto_init(&s_st, (uint8_t)s_opt.node, boot, (uint8_t)s_opt.capacity);
+    mesh_crypto_s1((const uint8_t *)s_opt.secret, strlen(s_opt.secret), s_key);
+    parse_peers(s_opt.peers);
+
+    s_sock = open_udp(INADDR_ANY, s_opt.cluster_port, true);
+    if (s_sock < 0 || loop_add_fd(s_sock, cluster_readable, NULL) < 0) return 1;
+    if (loop_add_timer(CLUSTER_HELLO_MS, hello_tick, NULL) < 0) return 1;
+    if (loop_add_timer(KICK_MS, kick_tick, NULL) < 0) return 1;
+    s_running = true;
+
+    if (s_opt.ws_port && ws_host_start(s_opt.ws_port) != ESP_OK) return 1;
+
+    if (s_opt.control_port) {
+        int ctl = open_udp(INADDR_LOOPBACK, s_opt.control_port, false);
+        if (ctl < 0 || loop_add_fd(ctl, control_readable, NULL) < 0) return 1;
+    }
+
+    ESP_LOGI(TAG, "Node %d on UDP port %d, %d peer address(es)", s_opt.node,
+             s_opt.cluster_port, s_peer_count);
+    loop_run();
+    ESP_LOGI(TAG, "Stopped");
+    return 0;
+}
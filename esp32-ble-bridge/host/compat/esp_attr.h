@@ -0,0 +1,8 @@
+#pragma once
+
+// Host stand-in for the section attributes. Nothing survives a restart of
+// the process, so RTC_NOINIT data is ordinary zeroed memory and a restore
+// always falls back to NVS.
+
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the ROM CRC: CRC-32 (IEEE, reflected), chainable the
+// same way esp_crc32_le is
+
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the GATT types ble_mesh.h mentions
+
+typedef uint8_t esp_gatt_if_t;
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdio.h>
+#include "esp_err.h"
+
+// Host stand-in for ESP_LOGx: one line per message on stderr, filtered by
+// host_log_level (1 = errors .. 5 = verbose)
+
+extern int host_log_level;
+
+#define HOST_LOG(level, letter, tag, fmt, ...) do {                         \
+        if ((level) <= host_log_level) {                                    \
+            fprintf(stderr, letter " (%s) " fmt "\n", tag, ##__VA_ARGS__);  \
+        }                                                                   \
+    } while (0)
+
+#define ESP_LOGE(tag, fmt, ...) HOST_LOG(1, "E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) HOST_LOG(2, "W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) HOST_LOG(3, "I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) HOST_LOG(4, "D", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) HOST_LOG(5, "V", tag, fmt, ##__VA_ARGS__)
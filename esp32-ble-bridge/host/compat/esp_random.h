@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Host stand-in for the hardware RNG: getrandom(), or a seeded PRNG when
+// platform_random_seed (platform.h) asks for repeatable runs
+
+uint32_t esp_random(void);
+void esp_fill_random(void *buf, size_t len);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "esp_err.h"
+
+// Host stand-in for the reset reason. A process start is always a power-on
+// as far as the checkpoint is concerned.
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_BROWNOUT,
+} esp_reset_reason_t;
+
+esp_reset_reason_t esp_reset_reason(void);
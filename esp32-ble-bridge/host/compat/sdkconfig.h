@@ -0,0 +1,7 @@
+#pragma once
+
+// Host build configuration. Numeric options left out here take the
+// Kconfig defaults the modules fall back to; bools set in Kconfig by
+// default have to be spelled out.
+
+#define CONFIG_BRIDGE_STEP_FILTER 1
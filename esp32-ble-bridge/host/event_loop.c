@@ -0,0 +1,186 @@
+/*
+ * event_loop.c
+ *
+ * epoll dispatch and timerfd timers for the host daemon.
+ */
+
+#include "event_loop.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "esp_log.h"
+
+static const char *TAG = "loop";
+
+#define LOOP_MAX_WATCHES 32
+#define LOOP_MAX_POSTS   32
+
+typedef struct {
+    int fd;                 // -1 = free
+    bool timer;
+    loop_cb_t cb;
+    void *ctx;
+} watch_t;
+
+typedef struct {
+    void (*fn)(void *arg);
+    void *arg;
+} post_t;
+
+static int s_epoll = -1;
+static watch_t s_watches[LOOP_MAX_WATCHES];
+static volatile sig_atomic_t s_stop = 0;
+
+// Calls posted from other threads, woken through an eventfd
+static int s_post_fd = -1;
+static pthread_mutex_t s_post_lock = PTHREAD_MUTEX_INITIALIZER;
+static post_t s_posts[LOOP_MAX_POSTS];
+static int s_post_head = 0;
+static int s_post_count = 0;
+
+static int add_watch(int fd, bool timer, loop_cb_t cb, void *ctx)
+{
+    watch_t *w = NULL;
+    for (int i = 0; i < LOOP_MAX_WATCHES && !w; i++) {
+        if (s_watches[i].fd < 0) w = &s_watches[i];
+    }
+    if (!w) return -1;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = w };
+    if (epoll_ctl(s_epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ESP_LOGE(TAG, "epoll_ctl(%d) failed: %d", fd, errno);
+        return -1;
+    }
+    *w = (watch_t) { .fd = fd, .timer = timer, .cb = cb, .ctx = ctx };
+    return 0;
+}
+
+static void run_posts(int fd, void *ctx)
+{
+    uint64_t n;
+    if (read(fd, &n, sizeof(n)) != sizeof(n)) return;
+    while (1) {
+        pthread_mutex_lock(&s_post_lock);
+        if (!s_post_count) {
+            pthread_mutex_unlock(&s_post_lock);
+            return;
+        }
+        post_t p = s_posts[s_post_head];
+        s_post_head = (s_post_head + 1) % LOOP_MAX_POSTS;
+        s_post_count--;
+        pthread_mutex_unlock(&s_post_lock);
+        p.fn(p.arg);
+    }
+}
+
+int loop_init(void)
+{
+    s_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (s_epoll < 0) {
+        ESP_LOGE(TAG, "epoll_create1 failed: %d", errno);
+        return -1;
+    }
+    for (int i = 0; i < LOOP_MAX_WATCHES; i++) s_watches[i].fd = -1;
+
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0 || add_watch(fd, false, run_posts, NULL) < 0) {
+        ESP_LOGE(TAG, "eventfd failed: %d", errno);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    s_post_fd = fd;
+    return 0;
+}
+
+int loop_add_fd(int fd, loop_cb_t cb, void *ctx)
+{
+    return add_watch(fd, false, cb, ctx);
+}
+
+void loop_remove_fd(int fd)
+{
+    for (int i = 0; i < LOOP_MAX_WATCHES; i++) {
+        if (s_watches[i].fd == fd) {
+            epoll_ctl(s_epoll, EPOLL_CTL_DEL, fd, NULL);
+            s_watches[i].fd = -1;
+        }
+    }
+}
+
+int loop_add_timer(uint32_t period_ms, loop_cb_t cb, void *ctx)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct timespec period = {
+        .tv_sec = period_ms / 1000,
+        .tv_nsec = (long)(period_ms % 1000) * 1000000L,
+    };
+    struct itimerspec spec = { .it_interval = period, .it_value = period };
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0 || add_watch(fd, true, cb, ctx) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int loop_post(void (*fn)(void *arg), void *arg)
+{
+    if (s_post_fd < 0) return -1;
+    pthread_mutex_lock(&s_post_lock);
+    bool full = s_post_count == LOOP_MAX_POSTS;
+    if (!full) {
+        s_posts[(s_post_head + s_post_count) % LOOP_MAX_POSTS] = (post_t) { fn, arg };
+        s_post_count++;
+    }
+    pthread_mutex_unlock(&s_post_lock);
+    if (full) return -1;
+
+    uint64_t one = 1;
+    if (write(s_post_fd, &one, sizeof(one)) != sizeof(one)) {
+        ESP_LOGW(TAG, "eventfd write failed: %d", errno);
+    }
+    return 0;
+}
+
+void loop_run(void)
+{
+    struct epoll_event events[16];
+    while (!s_stop) {
+        int n = epoll_wait(s_epoll, events, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ESP_LOGE(TAG, "epoll_wait failed: %d", errno);
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            watch_t *w = events[i].data.ptr;
+            if (w->fd < 0) continue;    // Removed by an earlier callback
+            if (w->timer) {
+                // Missed expirations collapse into one call, like a late tick
+                uint64_t expirations;
+                if (read(w->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+            }
+            w->cb(w->fd, w->ctx);
+        }
+    }
+}
+
+void loop_stop(void)
+{
+    s_stop = 1;
+}
+
+uint32_t loop_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
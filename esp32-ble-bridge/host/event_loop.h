@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Single-threaded epoll loop for the host daemon. Sockets and timerfd
+// timers call back on the loop thread, like a bridge task on the ESP32.
+// The shared modules from main/ run their own tasks and esp_timer
+// callbacks beside it (platform_sys.c, platform_timer.c), so state they
+// reach needs the same locks it has on the ESP32.
+
+typedef void (*loop_cb_t)(int fd, void *ctx);
+
+int loop_init(void);
+
+// Call cb whenever fd is readable
+int loop_add_fd(int fd, loop_cb_t cb, void *ctx);
+void loop_remove_fd(int fd);
+
+// Call cb every period_ms, the first time period_ms from now. Returns the
+// timer's fd, or -1.
+int loop_add_timer(uint32_t period_ms, loop_cb_t cb, void *ctx);
+
+// Run fn(arg) on the loop thread, from any thread, in the order posted.
+// Returns -1 before loop_init or when LOOP_MAX_POSTS calls are waiting.
+int loop_post(void (*fn)(void *arg), void *arg);
+
+// Dispatch until loop_stop is called (also from a signal handler)
+void loop_run(void);
+void loop_stop(void);
+
+// CLOCK_MONOTONIC in ms
+uint32_t loop_now_ms(void);
@@ -0,0 +1,531 @@
+/*
+ * mesh_host.c
+ *
+ * ble_mesh.h on the host daemon: mesh PDUs over transport_t links. Link
+ * bookkeeping follows ble_mesh.c, minus everything the radio needs (scan,
+ * hot links, connection parameters, coexistence). Commands are encrypted
+ * on a pool of worker threads instead of the caller's.
+ */
+
+#include "mesh_host.h"
+#include "ble_mesh.h"
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "mesh_crypto.h"
+#include "sidus_protocol.h"
+#include "light_registry.h"
+#include "ws_server.h"
+#include "monitor.h"
+#include "checkpoint.h"
+#include "rules.h"
+
+static const char *TAG = "mesh_host";
+
+#define HOST_TTL            7       // No topology map on the host yet
+#define LINK_POLL_MS        1000
+#define RESYNC_INTERVAL_MS  60
+#define BURST_GAP_US        2000
+#define CRYPTO_WORKERS_MAX  8
+#define CRYPTO_QUEUE_LEN    64      // Jobs per worker
+#define CRYPTO_WAIT_MS      20      // Block a sender this long on a full queue
+#define ACCESS_MAX          11      // Sidus access messages
+
+typedef struct {
+    transport_t *t;
+    bool up;
+    uint32_t filter_gen;            // Key generation the proxy filter went out for, 0 = none
+    uint8_t rx_buf[MESH_PDU_MAX];   // Proxy SAR reassembly
+    int rx_len;
+} link_t;
+
+static link_t s_links[MESH_HOST_TRANSPORTS];
+static int s_link_count = 0;
+static bool s_any_up = false;
+static bool s_resync_all_on_ready = false;
+static mesh_bearer_mode_t s_bearer = MESH_BEARER_GATT;
+
+// Sends come from the loop thread, the effect timers, the cue player and
+// the rules task; the lock covers the links and the counters, and keeps each
+// SEQ claim in order with its send.
+static portMUX_TYPE s_tx_lock = portMUX_INITIALIZER_UNLOCKED;
+static ble_tx_stats_t s_tx;
+static int64_t s_last_write_us = 0;
+
+// One queue per worker. A light always goes to the same worker, so its
+// PDUs leave in SEQ order while different lights encrypt in parallel.
+typedef struct {
+    uint16_t unicast;
+    uint8_t len;
+    uint8_t access[ACCESS_MAX];
+} crypto_job_t;
+
+static QueueHandle_t s_workers[CRYPTO_WORKERS_MAX];
+static int s_worker_count = 0;
+
+static esp_timer_handle_t s_link_timer = NULL;
+static esp_timer_handle_t s_resync_timer = NULL;
+static bool s_resync_running = false;
+
+static void resync_start(void);
+static bool start_workers(void);
+
+bool mesh_host_add_transport(transport_t *t)
+{
+    if (s_link_count >= MESH_HOST_TRANSPORTS) return false;
+    s_links[s_link_count++] = (link_t) { .t = t };
+    return true;
+}
+
+// MARK: - Receive
+
+// Reassemble proxy PDUs the way ble_mesh.c proxy_rx does
+static void link_rx(transport_t *t, const uint8_t *data, int len, void *ctx)
+{
+    link_t *l = ctx;
+    if (len < 1 || (data[0] & 0x3F) != 0x00) return;       // Network PDUs only
+
+    uint8_t sar = data[0] & 0xC0;
+    if (sar == 0x00 || sar == 0x40) {
+        l->rx_len = 0;
+    } else if (l->rx_len == 0) {
+        return;
+    }
+    if (l->rx_len + len - 1 > (int)sizeof(l->rx_buf)) {
+        l->rx_len = 0;
+        return;
+    }
+    memcpy(l->rx_buf + l->rx_len, data + 1, len - 1);
+    l->rx_len += len - 1;
+    if (sar != 0x00 && sar != 0xC0) return;
+
+    int n = l->rx_len;
+    l->rx_len = 0;
+    mesh_rx_pdu_t rx;
+    if (mesh_crypto_decode_network(l->rx_buf, n, &rx)) {
+        ESP_LOGD(TAG, "PDU from 0x%04X via %s, TTL %d", rx.src, t->name, rx.ttl);
+    }
+}
+
+// MARK: - Links
+
+static void notify_all_registered_lights(bool connected)
+{
+    light_entry_t light;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (light_registry_read_slot(i, &light)) {
+            light_registry_set_connected(light.unicast, connected);
+            ws_server_notify_light_status(light.unicast, connected);
+            rules_post_light(light.unicast, connected);
+        }
+    }
+}
+
+static void send_filter_setup(link_t *l)
+{
+    uint8_t pdu[64];
+    int len = mesh_crypto_create_proxy_filter_setup(pdu, sizeof(pdu));
+    if (len > 0 && l->t->send(l->t, pdu, len)) {
+        l->filter_gen = mesh_crypto_key_generation();
+        ESP_LOGI(TAG, "Sent proxy filter setup on %s", l->t->name);
+    }
+}
+
+// Transports don't report link changes, so they are polled here. A link
+// coming up is handled like a proxy finishing service discovery.
+static void link_tick(void *arg)
+{
+    bool was_up = s_any_up;
+    bool any = false, came_up = false;
+
+    portENTER_CRITICAL(&s_tx_lock);
+    for (int i = 0; i < s_link_count; i++) {
+        link_t *l = &s_links[i];
+        bool up = l->t->is_up(l->t);
+        if (l->up && !up) {
+            ESP_LOGW(TAG, "%s went down", l->t->name);
+            l->filter_gen = 0;
+            l->rx_len = 0;
+            s_resync_all_on_ready = true;
+        }
+        if (up && !l->up) {
+            ESP_LOGI(TAG, "%s ready", l->t->name);
+            came_up = true;
+        }
+        l->up = up;
+        if (up && mesh_crypto_is_initialized() &&
+            l->filter_gen != mesh_crypto_key_generation()) {
+            send_filter_setup(l);
+        }
+        any |= up;
+    }
+    s_any_up = any;
+    portEXIT_CRITICAL(&s_tx_lock);
+
+    if (was_up && !any) {
+        notify_all_registered_lights(false);
+        rules_post_proxy(false);
+    }
+    if (came_up) {
+        if (!was_up) rules_post_proxy(true);
+        notify_all_registered_lights(true);
+        if (s_resync_all_on_ready) {
+            s_resync_all_on_ready = false;
+            int n = light_registry_mark_all_dirty();
+            ESP_LOGI(TAG, "Link recovered, %d lights queued for resync", n);
+        }
+        resync_start();
+        checkpoint_mesh_ready();
+    }
+}
+
+// MARK: - Shadow resync
+
+static esp_err_t replay_shadow(const light_entry_t *light)
+{
+    const light_shadow_t *s = &light->shadow;
+    switch (s->kind) {
+    case SHADOW_CCT:
+        return ble_mesh_send_cct(light->unicast, s->intensity, s->cct_kelvin, s->sleep_mode);
+    case SHADOW_HSI:
+        return ble_mesh_send_hsi(light->unicast, s->intensity, s->hue, s->saturation,
+                                 s->cct_kelvin, s->sleep_mode);
+    case SHADOW_SLEEP:
+        return ble_mesh_send_sleep(light->unicast, s->sleep_mode != 0);
+    case SHADOW_HW_EFFECT:
+        return ble_mesh_send_effect(light->unicast, s->effect_type, s->intensity, s->frq,
+                                    s->cct_kelvin, s->cop_car_color, s->effect_mode,
+                                    s->hue, s->saturation);
+    default:
+        return ESP_OK;
+    }
+}
+
+static void resync_stop(void)
+{
+    if (s_resync_running) {
+        esp_timer_stop(s_resync_timer);
+        s_resync_running = false;
+    }
+}
+
+static void resync_tick(void *arg)
+{
+    if (!ble_mesh_is_proxy_connected()) {
+        resync_stop();
+        return;
+    }
+
+    light_entry_t light;
+    if (!light_registry_take_dirty(&light)) {
+        ESP_LOGI(TAG, "Resync complete");
+        resync_stop();
+        return;
+    }
+    if (replay_shadow(&light) != ESP_OK) {
+        resync_stop();
+        return;
+    }
+    ESP_LOGI(TAG, "Resynced light 0x%04X (shadow kind %d)", light.unicast, light.shadow.kind);
+}
+
+static void resync_start(void)
+{
+    if (!s_resync_timer || s_resync_running) return;
+    if (!light_registry_has_dirty()) return;
+
+    if (esp_timer_start_periodic(s_resync_timer, RESYNC_INTERVAL_MS * 1000) == ESP_OK) {
+        s_resync_running = true;
+    }
+}
+
+void ble_mesh_request_resync(uint16_t unicast)
+{
+    light_registry_mark_dirty(unicast);
+    if (ble_mesh_is_proxy_connected()) {
+        resync_start();
+    }
+}
+
+// MARK: - Public API
+
+esp_err_t ble_mesh_init(void)
+{
+    esp_timer_create_args_t resync_args = {
+        .callback = resync_tick,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "resync",
+    };
+    esp_err_t ret = esp_timer_create(&resync_args, &s_resync_timer);
+    if (ret) return ret;
+
+    esp_timer_create_args_t link_args = {
+        .callback = link_tick,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "link_poll",
+    };
+    ret = esp_timer_create(&link_args, &s_link_timer);
+    if (ret) return ret;
+    if (!start_workers()) return ESP_ERR_NO_MEM;
+
+    for (int i = 0; i < s_link_count; i++) {
+        s_links[i].t->on_rx = link_rx;
+        s_links[i].t->rx_ctx = &s_links[i];
+    }
+    esp_timer_start_periodic(s_link_timer, LINK_POLL_MS * 1000);
+    ESP_LOGI(TAG, "Mesh over %d transport(s), %d crypto worker(s)", s_link_count,
+             s_worker_count);
+    return ESP_OK;
+}
+
+void ble_mesh_set_bearer(mesh_bearer_mode_t mode)
+{
+    // Transports are the only bearer here
+    s_bearer = mode;
+}
+
+mesh_bearer_mode_t ble_mesh_get_bearer(void)
+{
+    return s_bearer;
+}
+
+esp_err_t ble_mesh_connect_proxy(void)
+{
+    // Transports connect on their own; just pick up any link already up
+    link_tick(NULL);
+    return s_link_count ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+bool ble_mesh_is_proxy_connected(void)
+{
+    portENTER_CRITICAL(&s_tx_lock);
+    bool up = s_any_up;
+    portEXIT_CRITICAL(&s_tx_lock);
+    return up;
+}
+
+int ble_mesh_proxy_link_count(void)
+{
+    int n = 0;
+    portENTER_CRITICAL(&s_tx_lock);
+    for (int i = 0; i < s_link_count; i++) n += s_links[i].up;
+    portEXIT_CRITICAL(&s_tx_lock);
+    return n;
+}
+
+esp_err_t ble_mesh_disconnect_proxy(void)
+{
+    return ESP_OK;
+}
+
+void ble_mesh_set_link_params(const ble_link_params_t *params)
+{
+}
+
+void ble_mesh_get_tx_stats(ble_tx_stats_t *out)
+{
+    portENTER_CRITICAL(&s_tx_lock);
+    *out = s_tx;
+    portEXIT_CRITICAL(&s_tx_lock);
+}
+
+int64_t ble_mesh_tx_idle_us(void)
+{
+    portENTER_CRITICAL(&s_tx_lock);
+    int64_t last = s_last_write_us;
+    portEXIT_CRITICAL(&s_tx_lock);
+    return esp_timer_get_time() - last;
+}
+
+uint32_t ble_mesh_conn_interval_us(void)
+{
+    return 0;
+}
+
+esp_err_t ble_mesh_write(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                         const uint8_t *data, int len)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+// MARK: - Send
+
+// Call with s_tx_lock held
+static bool fanout_locked(const uint8_t *pdu, int len)
+{
+    bool sent = false;
+    for (int i = 0; i < s_link_count; i++) {
+        link_t *l = &s_links[i];
+        if (!l->up) continue;
+        if (l->t->send(l->t, pdu, len)) {
+            sent = true;
+            s_tx.writes++;
+        } else {
+            s_tx.write_errors++;
+        }
+    }
+    if (sent) {
+        int64_t now = esp_timer_get_time();
+        if (now - s_last_write_us > BURST_GAP_US) s_tx.bursts++;
+        s_last_write_us = now;
+    }
+    return sent;
+}
+
+esp_err_t ble_mesh_send_pdus(uint8_t pdus[][MESH_PDU_MAX], const int *lens, int count)
+{
+    bool sent = true;
+    portENTER_CRITICAL(&s_tx_lock);
+    for (int i = 0; i < count; i++) {
+        sent = fanout_locked(pdus[i], lens[i]) && sent;
+    }
+    portEXIT_CRITICAL(&s_tx_lock);
+    return sent ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+// Runs on a crypto worker. Only the fan-out holds the lock; the AES work
+// for different lights overlaps.
+static void encrypt_and_send(const crypto_job_t *job)
+{
+    uint8_t pdu[64];
+    uint32_t seq;
+    int pdu_len = mesh_crypto_create_standard_pdu_ttl(job->access, job->len, job->unicast,
+                                                      HOST_TTL, pdu, sizeof(pdu), &seq);
+    if (pdu_len <= 0) {
+        ESP_LOGE(TAG, "Failed to create mesh PDU for 0x%04X", job->unicast);
+        return;
+    }
+
+    portENTER_CRITICAL(&s_tx_lock);
+    light_registry_claim_seq(job->unicast, seq);
+    bool sent = fanout_locked(pdu, pdu_len);
+    portEXIT_CRITICAL(&s_tx_lock);
+
+    if (!sent) {
+        ESP_LOGW(TAG, "No transport up for 0x%04X", job->unicast);
+        light_registry_mark_dirty(job->unicast);
+    }
+}
+
+static void crypto_worker(void *arg)
+{
+    QueueHandle_t q = arg;
+    crypto_job_t job;
+    for (;;) {
+        if (xQueueReceive(q, &job, portMAX_DELAY) == pdPASS) {
+            encrypt_and_send(&job);
+        }
+    }
+}
+
+static bool start_workers(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = cpus < 1 ? 1 : cpus > CRYPTO_WORKERS_MAX ? CRYPTO_WORKERS_MAX : (int)cpus;
+    for (int i = 0; i < n; i++) {
+        QueueHandle_t q = xQueueCreate(CRYPTO_QUEUE_LEN, sizeof(crypto_job_t));
+        if (!q) break;
+        if (xTaskCreate(crypto_worker, "mesh_crypto", 4096, q, 5, NULL) != pdPASS) {
+            vQueueDelete(q);
+            break;
+        }
+        s_workers[s_worker_count++] = q;
+    }
+    return s_worker_count > 0;
+}
+
+// Returns once the job is queued. A link that is down is reported here;
+// one that drops before the worker gets to the job marks the light dirty.
+static esp_err_t send_mesh_pdu(uint16_t unicast, const uint8_t *access_msg, int access_len)
+{
+    if (access_len <= 0 || access_len > ACCESS_MAX || !s_worker_count) return ESP_FAIL;
+    if (!ble_mesh_is_proxy_connected()) {
+        ESP_LOGW(TAG, "No transport up for 0x%04X", unicast);
+        light_registry_mark_dirty(unicast);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    crypto_job_t job = { .unicast = unicast, .len = (uint8_t)access_len };
+    memcpy(job.access, access_msg, access_len);
+    if (xQueueSend(s_workers[unicast % s_worker_count], &job,
+                   pdMS_TO_TICKS(CRYPTO_WAIT_MS)) != pdPASS) {
+        ESP_LOGW(TAG, "Crypto queue full, dropped a command for 0x%04X", unicast);
+        light_registry_mark_dirty(unicast);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_mesh_prerender(uint16_t unicast, const uint8_t *access_msg, int access_len,
+                             mesh_frame_t *out)
+{
+    out->unicast = unicast;
+    out->direct = false;
+    out->key_gen = mesh_crypto_key_generation();
+    out->len = mesh_crypto_create_standard_pdu_ttl(access_msg, access_len, unicast, HOST_TTL,
+                                                   out->pdu, sizeof(out->pdu), &out->seq);
+    return out->len > 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t ble_mesh_send_frame(const mesh_frame_t *frame)
+{
+    if (frame->len <= 0 || frame->key_gen != mesh_crypto_key_generation()) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    portENTER_CRITICAL(&s_tx_lock);
+    if (!light_registry_claim_seq(frame->unicast, frame->seq)) {
+        portEXIT_CRITICAL(&s_tx_lock);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    bool sent = fanout_locked(frame->pdu, frame->len);
+    portEXIT_CRITICAL(&s_tx_lock);
+
+    if (!sent) {
+        light_registry_mark_dirty(frame->unicast);
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_mesh_send_cct(uint16_t unicast, double intensity, int cct_kelvin, int sleep_mode)
+{
+    uint8_t access_msg[11];
+    sidus_build_access_cct(intensity, cct_kelvin, sleep_mode, access_msg);
+    monitor_record(unicast, MONITOR_MODE_CCT, intensity, cct_kelvin, 0, 0, sleep_mode, 0);
+    return send_mesh_pdu(unicast, access_msg, 11);
+}
+
+esp_err_t ble_mesh_send_hsi(uint16_t unicast, double intensity, int hue, int saturation,
+                            int cct_kelvin, int sleep_mode)
+{
+    uint8_t access_msg[11];
+    sidus_build_access_hsi(intensity, hue, saturation, cct_kelvin, sleep_mode, access_msg);
+    monitor_record(unicast, MONITOR_MODE_HSI, intensity, cct_kelvin, hue, saturation, sleep_mode, 0);
+    return send_mesh_pdu(unicast, access_msg, 11);
+}
+
+esp_err_t ble_mesh_send_sleep(uint16_t unicast, bool on)
+{
+    uint8_t access_msg[11];
+    sidus_build_access_sleep(on, access_msg);
+    monitor_record(unicast, MONITOR_MODE_SLEEP, 0, 0, 0, 0, on ? 1 : 0, 0);
+    return send_mesh_pdu(unicast, access_msg, 11);
+}
+
+esp_err_t ble_mesh_send_effect(uint16_t unicast, int effect_type, double intensity, int frq,
+                               int cct_kelvin, int cop_car_color, int effect_mode,
+                               int hue, int saturation)
+{
+    uint8_t access_msg[11];
+    sidus_build_access_effect(effect_type, intensity, frq, cct_kelvin,
+                              cop_car_color, effect_mode, hue, saturation, access_msg);
+    monitor_record(unicast, MONITOR_MODE_HW_EFFECT, intensity, cct_kelvin, hue, saturation, 1,
+                   effect_type);
+    return send_mesh_pdu(unicast, access_msg, 11);
+}
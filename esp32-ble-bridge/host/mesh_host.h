@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include "transport.h"
+
+// ble_mesh.h for the host daemon: the same send, prerender and resync API
+// over transports instead of GATT proxy links. Every transport that is up
+// carries every PDU, as every ready proxy link does on the ESP32.
+
+#define MESH_HOST_TRANSPORTS 4
+
+// Carry mesh traffic over t from now on. Takes over t's on_rx. Call
+// before ble_mesh_init.
+bool mesh_host_add_transport(transport_t *t);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Host side of the ESP-IDF stand-ins in compat/: what the daemon and the
+// tests set before the shared modules from main/ start.
+
+// Directory holding the NVS files, created if missing
+esp_err_t platform_nvs_init(const char *dir);
+
+// Repeatable esp_random/esp_fill_random from a seed; 0 returns to
+// getrandom()
+void platform_random_seed(uint64_t seed);
+
+// MARK: - Virtual clock
+
+// Run esp_timer on a virtual clock starting at 0. Call before the first
+// esp_timer_create. Time then only moves in platform_timer_advance.
+void platform_clock_virtual(void);
+
+// How late a timer fires, in us, asked once per expiry under the virtual
+// clock. Injected lateness moves the clock, as a late wakeup would.
+typedef int64_t (*platform_lateness_t)(const char *timer_name, int64_t deadline_us, void *ctx);
+void platform_timer_set_lateness(platform_lateness_t fn, void *ctx);
+
+// Move the virtual clock by us, running every callback that falls due in
+// deadline order on the calling thread
+void platform_timer_advance(int64_t us);
+
+// MARK: - Heap
+
+// Statistics of the bridge heap (platform_heap.c)
+typedef struct {
+    size_t size;                // Arena bytes in use by the heap so far
+    size_t free;
+    size_t largest;
+    size_t min_free;
+    size_t blocks;              // Allocated blocks
+} platform_heap_stats_t;
+
+void platform_heap_stats(platform_heap_stats_t *out);
+
+// Allocations per call site: the return address of the malloc, calloc,
+// realloc or memalign call. Sites past the table's size share one entry
+// with pc NULL.
+typedef struct {
+    void *pc;
+    uint64_t allocs;            // Since start
+    uint64_t live;              // Not yet freed
+} platform_heap_site_t;
+
+// Fill out[] with up to max sites that have allocated; returns how many
+int platform_heap_sites(platform_heap_site_t *out, int max);
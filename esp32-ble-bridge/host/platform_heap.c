@@ -0,0 +1,402 @@
+/*
+ * platform_heap.c
+ *
+ * The bridge heap on the host: malloc and friends replaced by a first-fit
+ * allocator over one fixed arena, so heap_caps can report free space, the
+ * largest free block and the low-water mark the way the ESP32 heap does.
+ * Each block also remembers which call site allocated it, so a soak run
+ * can tell which code is holding on to memory.
+ */
+
+#include "platform.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "esp_heap_caps.h"
+
+#ifndef HOST_HEAP_SIZE
+#define HOST_HEAP_SIZE      (64u << 20)
+#endif
+
+#define ALIGN               16
+#define HDR                 sizeof(block_t)
+#define MIN_BLOCK           (HDR + 2 * sizeof(void *))
+#define INUSE               1u
+#define PREV_INUSE          2u
+#define FLAGS               (INUSE | PREV_INUSE)
+
+#define SITE_SLOTS          512
+
+// Allocations made from one return address
+typedef struct {
+    void *pc;
+    uint64_t allocs;
+    uint64_t live;
+} site_t;
+
+// Boundary-tagged block. prev_size is only valid while the previous block
+// is free. A free block keeps its list links in the header; a block in
+// use keeps its call site there instead.
+typedef struct block {
+    size_t prev_size;
+    size_t head;                    // Size including this header, | flags
+    union {
+        struct {
+            struct block *next_free;
+            struct block *prev_free;
+        };
+        site_t *site;
+    };
+} block_t;
+
+_Static_assert(sizeof(size_t) * 2 == ALIGN, "header must keep payloads aligned");
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *s_arena = NULL;
+static uint8_t *s_end = NULL;       // Sentinel header lives here
+static block_t *s_free = NULL;      // Address order
+static size_t s_free_bytes = 0;
+static size_t s_min_free = 0;
+static size_t s_blocks = 0;
+static site_t s_sites[SITE_SLOTS];  // Open addressing on pc; the last slot takes overflow
+
+static size_t bsize(const block_t *b) { return b->head & ~(size_t)FLAGS; }
+static block_t *next_block(block_t *b) { return (block_t *)((uint8_t *)b + bsize(b)); }
+static void *payload(block_t *b) { return (uint8_t *)b + HDR; }
+static block_t *block_of(void *p) { return (block_t *)((uint8_t *)p - HDR); }
+
+static bool heap_init(void)
+{
+    if (s_arena) return true;
+    void *p = mmap(NULL, HOST_HEAP_SIZE + HDR, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) return false;
+
+    s_arena = p;
+    s_end = s_arena + HOST_HEAP_SIZE;
+    block_t *b = (block_t *)s_arena;
+    b->head = HOST_HEAP_SIZE | PREV_INUSE;
+    b->next_free = b->prev_free = NULL;
+    s_free = b;
+
+    // Sentinel: an in-use block of size 0 stops coalescing at the end
+    block_t *end = (block_t *)s_end;
+    end->prev_size = HOST_HEAP_SIZE;
+    end->head = INUSE;
+
+    s_free_bytes = s_min_free = HOST_HEAP_SIZE;
+    return true;
+}
+
+static bool owned(void *p)
+{
+    return s_arena && (uint8_t *)p >= s_arena + HDR && (uint8_t *)p < s_end;
+}
+
+static void list_remove(block_t *b)
+{
+    if (b->prev_free) b->prev_free->next_free = b->next_free;
+    else s_free = b->next_free;
+    if (b->next_free) b->next_free->prev_free = b->prev_free;
+}
+
+static void list_insert(block_t *b)
+{
+    block_t *prev = NULL, *at = s_free;
+    while (at && at < b) {
+        prev = at;
+        at = at->next_free;
+    }
+    b->prev_free = prev;
+    b->next_free = at;
+    if (prev) prev->next_free = b;
+    else s_free = b;
+    if (at) at->prev_free = b;
+}
+
+// Mark b free (not yet listed) and tell the block after it
+static void set_free(block_t *b, size_t size, size_t prev_flag)
+{
+    b->head = size | prev_flag;
+    block_t *n = next_block(b);
+    n->prev_size = size;
+    n->head &= ~(size_t)PREV_INUSE;
+}
+
+// Take need bytes from the front of free block b, which is in the list
+static void *carve(block_t *b, size_t need)
+{
+    size_t size = bsize(b);
+    size_t prev_flag = b->head & PREV_INUSE;
+    if (size - need >= MIN_BLOCK) {
+        block_t *rest = (block_t *)((uint8_t *)b + need);
+        rest->next_free = b->next_free;
+        rest->prev_free = b->prev_free;
+        if (rest->prev_free) rest->prev_free->next_free = rest;
+        else s_free = rest;
+        if (rest->next_free) rest->next_free->prev_free = rest;
+        set_free(rest, size - need, PREV_INUSE);
+        size = need;
+    } else {
+        list_remove(b);
+        next_block(b)->head |= PREV_INUSE;
+    }
+    b->head = size | INUSE | prev_flag;
+
+    s_free_bytes -= size;
+    if (s_free_bytes < s_min_free) s_min_free = s_free_bytes;
+    s_blocks++;
+    return payload(b);
+}
+
+static site_t *site_for(void *pc)
+{
+    size_t at = ((uintptr_t)pc >> 2) % (SITE_SLOTS - 1);
+    for (size_t i = 0; i < SITE_SLOTS - 1; i++) {
+        site_t *e = &s_sites[(at + i) % (SITE_SLOTS - 1)];
+        if (e->pc == pc) return e;
+        if (!e->pc) {
+            e->pc = pc;
+            return e;
+        }
+    }
+    return &s_sites[SITE_SLOTS - 1];
+}
+
+static size_t request_size(size_t n)
+{
+    if (n > HOST_HEAP_SIZE) return 0;
+    size_t need = (n + HDR + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    return need < MIN_BLOCK ? MIN_BLOCK : need;
+}
+
+static void *alloc_locked(size_t n, void *pc)
+{
+    size_t need = request_size(n);
+    if (!need || !heap_init()) return NULL;
+    for (block_t *b = s_free; b; b = b->next_free) {
+        if (bsize(b) < need) continue;
+        void *p = carve(b, need);
+        b->site = site_for(pc);
+        b->site->allocs++;
+        b->site->live++;
+        return p;
+    }
+    return NULL;
+}
+
+static void free_locked(void *p)
+{
+    block_t *b = block_of(p);
+    size_t size = bsize(b);
+    s_free_bytes += size;
+    s_blocks--;
+    if (b->site) b->site->live--;
+
+    size_t prev_flag = b->head & PREV_INUSE;
+    block_t *n = next_block(b);
+    if (!(n->head & INUSE)) {
+        list_remove(n);
+        size += bsize(n);
+    }
+    if (!prev_flag) {
+        // The previous block is free and already listed: grow it
+        block_t *prev = (block_t *)((uint8_t *)b - b->prev_size);
+        set_free(prev, bsize(prev) + size, prev->head & PREV_INUSE);
+        return;
+    }
+    set_free(b, size, PREV_INUSE);
+    list_insert(b);
+}
+
+static void *alloc_at(size_t n, void *pc)
+{
+    pthread_mutex_lock(&s_lock);
+    void *p = alloc_locked(n, pc);
+    pthread_mutex_unlock(&s_lock);
+    if (!p) errno = ENOMEM;
+    return p;
+}
+
+void *malloc(size_t n)
+{
+    return alloc_at(n, __builtin_return_address(0));
+}
+
+void free(void *p)
+{
+    // Anything from before the arena (the loader's own allocations) is
+    // not ours to take back
+    if (!p || !owned(p)) return;
+    pthread_mutex_lock(&s_lock);
+    free_locked(p);
+    pthread_mutex_unlock(&s_lock);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    if (size && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *p = alloc_at(count * size, __builtin_return_address(0));
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+static void *realloc_at(void *p, size_t n, void *pc)
+{
+    if (!p) return alloc_at(n, pc);
+    if (!n) {
+        free(p);
+        return NULL;
+    }
+    size_t have = bsize(block_of(p)) - HDR;
+    if (n <= have) return p;
+
+    void *q = alloc_at(n, pc);
+    if (!q) return NULL;
+    memcpy(q, p, have);
+    free(p);
+    return q;
+}
+
+void *realloc(void *p, size_t n)
+{
+    return realloc_at(p, n, __builtin_return_address(0));
+}
+
+void *reallocarray(void *p, size_t count, size_t size)
+{
+    if (size && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc_at(p, count * size, __builtin_return_address(0));
+}
+
+// Over-allocate, then give the slack in front of the aligned address back
+static void *memalign_at(size_t align, size_t n, void *pc)
+{
+    if (align <= ALIGN) return alloc_at(n, pc);
+    if (align & (align - 1)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&s_lock);
+    uint8_t *raw = alloc_locked(n + align + MIN_BLOCK, pc);
+    if (!raw) {
+        pthread_mutex_unlock(&s_lock);
+        errno = ENOMEM;
+        return NULL;
+    }
+    uintptr_t at = ((uintptr_t)raw + MIN_BLOCK + align - 1) & ~(uintptr_t)(align - 1);
+    block_t *b = block_of(raw);
+    block_t *a = block_of((void *)at);
+    size_t lead = (uint8_t *)a - (uint8_t *)b;
+    size_t total = bsize(b);
+
+    a->head = (total - lead) | INUSE | PREV_INUSE;
+    a->site = b->site;
+    a->site->live++;
+    b->head = lead | INUSE | (b->head & PREV_INUSE);
+    s_blocks++;
+    free_locked(payload(b));
+    pthread_mutex_unlock(&s_lock);
+    return (void *)at;
+}
+
+void *memalign(size_t align, size_t n)
+{
+    return memalign_at(align, n, __builtin_return_address(0));
+}
+
+int posix_memalign(void **out, size_t align, size_t n)
+{
+    if (align % sizeof(void *)) return EINVAL;
+    void *p = memalign_at(align, n, __builtin_return_address(0));
+    if (!p) return ENOMEM;
+    *out = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t align, size_t n)
+{
+    return memalign_at(align, n, __builtin_return_address(0));
+}
+
+void *valloc(size_t n)
+{
+    return memalign_at(4096, n, __builtin_return_address(0));
+}
+
+void *pvalloc(size_t n)
+{
+    return memalign_at(4096, (n + 4095) & ~(size_t)4095, __builtin_return_address(0));
+}
+
+size_t malloc_usable_size(void *p)
+{
+    return p && owned(p) ? bsize(block_of(p)) - HDR : 0;
+}
+
+// MARK: - Queries
+
+void platform_heap_stats(platform_heap_stats_t *out)
+{
+    pthread_mutex_lock(&s_lock);
+    heap_init();
+    size_t largest = 0;
+    for (block_t *b = s_free; b; b = b->next_free) {
+        if (bsize(b) > largest) largest = bsize(b);
+    }
+    *out = (platform_heap_stats_t) {
+        .size = HOST_HEAP_SIZE,
+        .free = s_free_bytes,
+        .largest = largest > HDR ? largest - HDR : 0,
+        .min_free = s_min_free,
+        .blocks = s_blocks,
+    };
+    pthread_mutex_unlock(&s_lock);
+}
+
+int platform_heap_sites(platform_heap_site_t *out, int max)
+{
+    int n = 0;
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < SITE_SLOTS && n < max; i++) {
+        if (!s_sites[i].allocs) continue;
+        out[n++] = (platform_heap_site_t) {
+            .pc = s_sites[i].pc,
+            .allocs = s_sites[i].allocs,
+            .live = s_sites[i].live,
+        };
+    }
+    pthread_mutex_unlock(&s_lock);
+    return n;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    platform_heap_stats_t s;
+    platform_heap_stats(&s);
+    return s.free;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    platform_heap_stats_t s;
+    platform_heap_stats(&s);
+    return s.largest;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    platform_heap_stats_t s;
+    platform_heap_stats(&s);
+    return s.min_free;
+}
@@ -0,0 +1,245 @@
+/*
+ * platform_nvs.c
+ *
+ * NVS key/value storage over files in a state directory.
+ */
+
+#include "platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "nvs.h"
+#include "esp_log.h"
+
+static const char *TAG = "nvs";
+
+#define NVS_MAX_HANDLES     16
+#define NVS_NAME_MAX        15      // Namespace and key length limit, as on the ESP32
+#define NVS_VALUE_MAX       (508 * 1024)
+
+typedef enum {
+    TYPE_U8 = 0x01,
+    TYPE_U32 = 0x04,
+    TYPE_STR = 0x21,
+    TYPE_BLOB = 0x42,
+} nvs_type_t;
+
+typedef struct {
+    bool used;
+    bool writable;
+    char ns[NVS_NAME_MAX + 1];
+} handle_t;
+
+static char s_dir[PATH_MAX] = "";
+static handle_t s_handles[NVS_MAX_HANDLES];
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+
+esp_err_t platform_nvs_init(const char *dir)
+{
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "Can't create %s: %s", dir, strerror(errno));
+        return ESP_FAIL;
+    }
+    if (strlen(dir) >= sizeof(s_dir) - 2 * (NVS_NAME_MAX + 8)) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&s_lock);
+    strcpy(s_dir, dir);
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+static bool valid_name(const char *name)
+{
+    size_t len = name ? strlen(name) : 0;
+    if (len == 0 || len > NVS_NAME_MAX) return false;
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '/' || name[i] == '.') return false;
+    }
+    return true;
+}
+
+static handle_t *lookup(nvs_handle_t h)
+{
+    if (h == 0 || h > NVS_MAX_HANDLES || !s_handles[h - 1].used) return NULL;
+    return &s_handles[h - 1];
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *out)
+{
+    if (!valid_name(name) || !out) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&s_lock);
+    if (!s_dir[0]) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (int i = 0; i < NVS_MAX_HANDLES; i++) {
+        if (s_handles[i].used) continue;
+        s_handles[i].used = true;
+        s_handles[i].writable = mode == NVS_READWRITE;
+        strcpy(s_handles[i].ns, name);
+        *out = (nvs_handle_t)(i + 1);
+        pthread_mutex_unlock(&s_lock);
+        return ESP_OK;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t h)
+{
+    pthread_mutex_lock(&s_lock);
+    handle_t *hd = lookup(h);
+    if (hd) hd->used = false;
+    pthread_mutex_unlock(&s_lock);
+}
+
+// Every set is already on disk
+esp_err_t nvs_commit(nvs_handle_t h)
+{
+    pthread_mutex_lock(&s_lock);
+    bool ok = lookup(h) != NULL;
+    pthread_mutex_unlock(&s_lock);
+    return ok ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+// <dir>/<namespace>.<key>, under s_lock
+static esp_err_t path_of(nvs_handle_t h, const char *key, bool write, char *path, size_t size)
+{
+    handle_t *hd = lookup(h);
+    if (!hd || !valid_name(key)) return ESP_ERR_INVALID_ARG;
+    if (write && !hd->writable) return ESP_ERR_INVALID_STATE;
+    int n = snprintf(path, size, "%s/%s.%s", s_dir, hd->ns, key);
+    return n >= 0 && (size_t)n < size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static esp_err_t write_value(nvs_handle_t h, const char *key, nvs_type_t type,
+                             const void *value, size_t len)
+{
+    if (len > NVS_VALUE_MAX) return ESP_ERR_INVALID_SIZE;
+
+    char path[PATH_MAX], tmp[PATH_MAX + 4];
+    pthread_mutex_lock(&s_lock);
+    esp_err_t err = path_of(h, key, true, path, sizeof(path));
+    if (err != ESP_OK) {
+        pthread_mutex_unlock(&s_lock);
+        return err;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.new", path);
+
+    // Written aside and renamed over the old value, so a crash mid-write
+    // leaves one or the other
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    uint8_t t = (uint8_t)type;
+    bool ok = fd >= 0 && write(fd, &t, 1) == 1 && write(fd, value, len) == (ssize_t)len &&
+              fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) {
+        ESP_LOGE(TAG, "Write %s failed: %s", path, strerror(errno));
+        unlink(tmp);
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+// Read into out (up to *len bytes); *len becomes the stored length
+static esp_err_t read_value(nvs_handle_t h, const char *key, nvs_type_t type, void *out, size_t *len)
+{
+    char path[PATH_MAX];
+    pthread_mutex_lock(&s_lock);
+    esp_err_t err = path_of(h, key, false, path, sizeof(path));
+    if (err != ESP_OK) {
+        pthread_mutex_unlock(&s_lock);
+        return err;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f) - 1;
+    fseek(f, 0, SEEK_SET);
+    int t = fgetc(f);
+    if (t != (int)type || size < 0) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out && (size_t)size > *len) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else if (out && fread(out, 1, (size_t)size, f) != (size_t)size) {
+        err = ESP_FAIL;
+    } else {
+        *len = (size_t)size;
+    }
+    fclose(f);
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t h, const char *key, const void *value, size_t length)
+{
+    return write_value(h, key, TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t h, const char *key, void *out, size_t *length)
+{
+    if (!length) return ESP_ERR_INVALID_ARG;
+    return read_value(h, key, TYPE_BLOB, out, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t h, const char *key, const char *value)
+{
+    return write_value(h, key, TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t h, const char *key, char *out, size_t *length)
+{
+    if (!length) return ESP_ERR_INVALID_ARG;
+    return read_value(h, key, TYPE_STR, out, length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t h, const char *key, uint32_t value)
+{
+    return write_value(h, key, TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t h, const char *key, uint32_t *out)
+{
+    size_t len = sizeof(*out);
+    uint32_t v;
+    esp_err_t err = read_value(h, key, TYPE_U32, &v, &len);
+    if (err == ESP_OK && len != sizeof(v)) err = ESP_ERR_NVS_INVALID_LENGTH;
+    if (err == ESP_OK) *out = v;
+    return err;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t h, const char *key, uint8_t value)
+{
+    return write_value(h, key, TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t h, const char *key, uint8_t *out)
+{
+    size_t len = sizeof(*out);
+    uint8_t v;
+    esp_err_t err = read_value(h, key, TYPE_U8, &v, &len);
+    if (err == ESP_OK && len != sizeof(v)) err = ESP_ERR_NVS_INVALID_LENGTH;
+    if (err == ESP_OK) *out = v;
+    return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t h, const char *key)
+{
+    char path[PATH_MAX];
+    pthread_mutex_lock(&s_lock);
+    esp_err_t err = path_of(h, key, true, path, sizeof(path));
+    if (err == ESP_OK && unlink(path) < 0) err = ESP_ERR_NVS_NOT_FOUND;
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
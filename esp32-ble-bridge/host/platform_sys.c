@@ -0,0 +1,386 @@
+/*
+ * platform_sys.c
+ *
+ * FreeRTOS tasks, semaphores and queues over pthreads, plus the small
+ * ESP-IDF system calls the shared modules make.
+ */
+
+#include "platform.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_crc.h"
+#include "esp_system.h"
+
+static const char *TAG = "platform";
+
+int host_log_level = 3;
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:                return "ESP_OK";
+    case ESP_FAIL:              return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC:   return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    default:                    return "ESP_ERR";
+    }
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return ESP_RST_POWERON;
+}
+
+// MARK: - Time
+
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ticks / 1000;
+    ts.tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Wait on cond until pred holds or ticks pass; false on timeout
+#define WAIT_UNTIL(cond, mutex, ticks, pred) ({                             \
+        bool ok_ = true;                                                    \
+        struct timespec until_ = deadline_after(ticks);                     \
+        while (!(pred) && ok_) {                                            \
+            if ((ticks) == 0) ok_ = false;                                  \
+            else if ((ticks) == portMAX_DELAY) pthread_cond_wait(cond, mutex); \
+            else ok_ = pthread_cond_timedwait(cond, mutex, &until_) != ETIMEDOUT; \
+        }                                                                   \
+        ok_ || (pred);                                                      \
+    })
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+// MARK: - Tasks
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notified;
+};
+
+static __thread struct host_task *s_self = NULL;
+
+static struct host_task *task_new(void)
+{
+    struct host_task *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    pthread_mutex_init(&t->lock, NULL);
+    cond_init(&t->cond);
+    return t;
+}
+
+static void *task_main(void *arg)
+{
+    struct host_task *t = arg;
+    s_self = t;
+    t->fn(t->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *out)
+{
+    struct host_task *t = task_new();
+    if (!t) return pdFAIL;
+    t->fn = fn;
+    t->arg = arg;
+    if (out) *out = t;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&t->thread, &attr, task_main, t);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        ESP_LOGE(TAG, "Task %s: pthread_create failed: %d", name, err);
+        if (out) *out = NULL;
+        free(t);
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *out, BaseType_t core)
+{
+    return xTaskCreate(fn, name, stack_depth, arg, priority, out);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Only self-deletion is used; the handle stays valid for late notifies
+    if (!task || task == s_self) pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = { .tv_sec = ticks / 1000, .tv_nsec = (long)(ticks % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    // Threads not started by xTaskCreate (main, timers) get a handle too
+    if (!s_self) s_self = task_new();
+    return s_self;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct host_task *t = xTaskGetCurrentTaskHandle();
+    pthread_mutex_lock(&t->lock);
+    WAIT_UNTIL(&t->cond, &t->lock, ticks, t->notified > 0);
+    uint32_t value = t->notified;
+    if (value) t->notified = clear_on_exit ? 0 : value - 1;
+    pthread_mutex_unlock(&t->lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notified++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+// MARK: - Semaphores
+
+struct host_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UBaseType_t count;
+    UBaseType_t max;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    struct host_sem *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    pthread_mutex_init(&s->lock, NULL);
+    cond_init(&s->cond);
+    s->count = initial;
+    s->max = max;
+    return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool ok = WAIT_UNTIL(&sem->cond, &sem->lock, ticks, sem->count > 0);
+    if (ok) sem->count--;
+    pthread_mutex_unlock(&sem->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool ok = sem->count < sem->max;
+    if (ok) {
+        sem->count++;
+        pthread_cond_signal(&sem->cond);
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    if (!sem) return;
+    pthread_mutex_destroy(&sem->lock);
+    pthread_cond_destroy(&sem->cond);
+    free(sem);
+}
+
+// MARK: - Queues
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t readable;
+    pthread_cond_t writable;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t items[];
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue *q = calloc(1, sizeof(*q) + (size_t)length * item_size);
+    if (!q) return NULL;
+    pthread_mutex_init(&q->lock, NULL);
+    cond_init(&q->readable);
+    cond_init(&q->writable);
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->lock);
+    bool ok = WAIT_UNTIL(&q->writable, &q->lock, ticks, q->count < q->length);
+    if (ok) {
+        UBaseType_t tail = (q->head + q->count) % q->length;
+        memcpy(q->items + (size_t)tail * q->item_size, item, q->item_size);
+        q->count++;
+        pthread_cond_signal(&q->readable);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok ? pdPASS : pdFAIL;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    return xQueueSend(q, item, ticks);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->lock);
+    bool ok = WAIT_UNTIL(&q->readable, &q->lock, ticks, q->count > 0);
+    if (ok) {
+        memcpy(item, q->items + (size_t)q->head * q->item_size, q->item_size);
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        pthread_cond_signal(&q->writable);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok ? pdPASS : pdFAIL;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t n = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    if (!q) return;
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->readable);
+    pthread_cond_destroy(&q->writable);
+    free(q);
+}
+
+// MARK: - Random
+
+// xorshift64*, only when a test asked for a repeatable sequence
+static uint64_t s_seed = 0;
+static pthread_mutex_t s_rand_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void platform_random_seed(uint64_t seed)
+{
+    pthread_mutex_lock(&s_rand_lock);
+    s_seed = seed;
+    pthread_mutex_unlock(&s_rand_lock);
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    pthread_mutex_lock(&s_rand_lock);
+    if (s_seed) {
+        for (size_t i = 0; i < len; i++) {
+            s_seed ^= s_seed >> 12;
+            s_seed ^= s_seed << 25;
+            s_seed ^= s_seed >> 27;
+            p[i] = (uint8_t)((s_seed * 0x2545F4914F6CDD1DULL) >> 56);
+        }
+        pthread_mutex_unlock(&s_rand_lock);
+        return;
+    }
+    pthread_mutex_unlock(&s_rand_lock);
+
+    while (len) {
+        ssize_t n = getrandom(p, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ESP_LOGE(TAG, "getrandom failed: %d", errno);
+            abort();
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+}
+
+uint32_t esp_random(void)
+{
+    uint32_t v;
+    esp_fill_random(&v, sizeof(v));
+    return v;
+}
+
+// MARK: - CRC
+
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
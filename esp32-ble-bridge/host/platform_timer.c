@@ -0,0 +1,274 @@
+/*
+ * platform_timer.c
+ *
+ * esp_timer for the host: a timer thread on CLOCK_MONOTONIC, or a virtual
+ * clock that only moves when a test advances it.
+ */
+
+#include "platform.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "timer";
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+    int64_t deadline;           // -1 = not armed
+    int64_t period;             // 0 = one-shot
+    bool deleted;               // Freed once its running callback returns
+    struct esp_timer *next;
+};
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond;
+static pthread_cond_t s_idle = PTHREAD_COND_INITIALIZER;   // s_running changed
+static struct esp_timer *s_timers = NULL;
+static struct esp_timer *s_running = NULL;
+static pthread_t s_thread;
+static bool s_started = false;
+
+static bool s_virtual = false;
+static int64_t s_virtual_now = 0;
+static platform_lateness_t s_lateness = NULL;
+static void *s_lateness_ctx = NULL;
+
+static int64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Process start, so times read like uptime on the ESP32
+static int64_t s_epoch = -1;
+
+int64_t esp_timer_get_time(void)
+{
+    if (s_virtual) return __atomic_load_n(&s_virtual_now, __ATOMIC_ACQUIRE);
+    int64_t now = monotonic_us();
+    int64_t epoch = __atomic_load_n(&s_epoch, __ATOMIC_ACQUIRE);
+    if (epoch < 0) {
+        int64_t expected = -1;
+        __atomic_compare_exchange_n(&s_epoch, &expected, now, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        epoch = __atomic_load_n(&s_epoch, __ATOMIC_ACQUIRE);
+    }
+    return now - epoch;
+}
+
+// Earliest armed timer due by limit, under s_lock
+static struct esp_timer *earliest(int64_t limit)
+{
+    struct esp_timer *best = NULL;
+    for (struct esp_timer *t = s_timers; t; t = t->next) {
+        if (t->deadline < 0 || t->deadline > limit) continue;
+        if (!best || t->deadline < best->deadline) best = t;
+    }
+    return best;
+}
+
+static void unlink_timer(struct esp_timer *timer)
+{
+    for (struct esp_timer **p = &s_timers; *p; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            return;
+        }
+    }
+}
+
+// Run one expired timer with s_lock held; the lock is dropped around the
+// callback. A periodic timer is re-armed from its deadline, so a late tick
+// doesn't shift the ones after it.
+static void fire(struct esp_timer *t)
+{
+    if (t->period) {
+        t->deadline += t->period;
+    } else {
+        t->deadline = -1;
+    }
+    s_running = t;
+    pthread_mutex_unlock(&s_lock);
+
+    t->callback(t->arg);
+
+    pthread_mutex_lock(&s_lock);
+    s_running = NULL;
+    if (t->deleted) free(t);
+    pthread_cond_broadcast(&s_idle);
+}
+
+static void *timer_thread(void *arg)
+{
+    pthread_mutex_lock(&s_lock);
+    while (1) {
+        int64_t now = esp_timer_get_time();
+        struct esp_timer *t = earliest(INT64_MAX);
+        if (!t) {
+            pthread_cond_wait(&s_cond, &s_lock);
+            continue;
+        }
+        if (t->deadline > now) {
+            int64_t at = monotonic_us() + (t->deadline - now);
+            struct timespec ts = { .tv_sec = at / 1000000, .tv_nsec = (at % 1000000) * 1000 };
+            pthread_cond_timedwait(&s_cond, &s_lock, &ts);
+            continue;
+        }
+        fire(t);
+    }
+    return NULL;
+}
+
+static void start_thread(void)
+{
+    if (s_started || s_virtual) return;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&s_thread, NULL, timer_thread, NULL) != 0) {
+        ESP_LOGE(TAG, "Timer thread failed to start");
+        abort();
+    }
+    pthread_detach(s_thread);
+    s_started = true;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out)
+{
+    if (!args || !args->callback || !out) return ESP_ERR_INVALID_ARG;
+    struct esp_timer *t = calloc(1, sizeof(*t));
+    if (!t) return ESP_ERR_NO_MEM;
+    t->callback = args->callback;
+    t->arg = args->arg;
+    t->name = args->name ? args->name : "";
+    t->deadline = -1;
+
+    pthread_mutex_lock(&s_lock);
+    start_thread();
+    t->next = s_timers;
+    s_timers = t;
+    pthread_mutex_unlock(&s_lock);
+    *out = t;
+    return ESP_OK;
+}
+
+static esp_err_t arm(esp_timer_handle_t t, uint64_t us, int64_t period)
+{
+    if (!t) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&s_lock);
+    if (t->deadline >= 0) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    t->deadline = esp_timer_get_time() + (int64_t)us;
+    t->period = period;
+    if (s_started) pthread_cond_signal(&s_cond);
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t t, uint64_t timeout_us)
+{
+    return arm(t, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t t, uint64_t period_us)
+{
+    if (period_us == 0) return ESP_ERR_INVALID_ARG;
+    return arm(t, period_us, (int64_t)period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t t)
+{
+    if (!t) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&s_lock);
+    bool armed = t->deadline >= 0;
+    t->deadline = -1;
+    pthread_mutex_unlock(&s_lock);
+    return armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t t)
+{
+    pthread_mutex_lock(&s_lock);
+    bool armed = t && t->deadline >= 0;
+    pthread_mutex_unlock(&s_lock);
+    return armed;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t t)
+{
+    if (!t) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&s_lock);
+    if (t->deadline >= 0) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    unlink_timer(t);
+    if (t == s_running) {
+        // From its own callback: freed when that returns. From another
+        // thread: wait for the callback, as the ESP32 dispatch would.
+        if (s_virtual || pthread_equal(pthread_self(), s_thread)) {
+            t->deleted = true;
+            pthread_mutex_unlock(&s_lock);
+            return ESP_OK;
+        }
+        while (s_running == t) pthread_cond_wait(&s_idle, &s_lock);
+    }
+    free(t);
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+// MARK: - Virtual clock
+
+void platform_clock_virtual(void)
+{
+    pthread_mutex_lock(&s_lock);
+    if (s_started) {
+        ESP_LOGE(TAG, "Virtual clock requested after the timer thread started");
+        abort();
+    }
+    s_virtual = true;
+    s_virtual_now = 0;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void platform_timer_set_lateness(platform_lateness_t fn, void *ctx)
+{
+    pthread_mutex_lock(&s_lock);
+    s_lateness = fn;
+    s_lateness_ctx = ctx;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void platform_timer_advance(int64_t us)
+{
+    pthread_mutex_lock(&s_lock);
+    int64_t until = s_virtual_now + us;
+    struct esp_timer *t;
+    while ((t = earliest(until)) != NULL) {
+        int64_t at = t->deadline;
+        if (s_lateness) {
+            int64_t late = s_lateness(t->name, at, s_lateness_ctx);
+            if (late > 0) at += late;
+        }
+        if (at > s_virtual_now) __atomic_store_n(&s_virtual_now, at, __ATOMIC_RELEASE);
+        if (s_virtual_now > until) until = s_virtual_now;
+        fire(t);
+    }
+    __atomic_store_n(&s_virtual_now, until, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&s_lock);
+}
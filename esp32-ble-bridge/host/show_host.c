@@ -0,0 +1,20 @@
+/*
+ * show_host.c
+ *
+ * show_player.h on the host daemon, as far as the checkpoint needs it.
+ * There is no show store on the host, so no show is ever playing.
+ */
+
+#include "show_player.h"
+#include <string.h>
+
+void show_player_snapshot(show_snapshot_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->last_cue = -1;
+}
+
+esp_err_t show_player_resume(const show_snapshot_t *snap)
+{
+    return snap->playing ? ESP_ERR_NOT_FOUND : ESP_OK;
+}
@@ -0,0 +1,315 @@
+/*
+ * cluster.c
+ *
+ * Cluster protocol tests: several nodes running cluster_proto over an
+ * in-memory bus on a simulated clock, the way cluster.c drives it (HELLO
+ * every second, the leader assigning and sending ASSIGN). Checks leader
+ * election and takeover, owners picked by who can reach a fixture,
+ * failover when the owner dies, a rebooted node getting the fixture list
+ * back, and a fixture left with nobody to own it.
+ *
+ * Built with the undefined behaviour sanitizer, so a shift by
+ * CLUSTER_NO_OWNER fails the run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cluster_proto.h"
+
+#define NODES       4
+#define FIXTURES    6
+#define TICK_MS     100
+#define FIRST       0x0010
+
+static int s_failures = 0;
+
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            s_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+typedef struct {
+    bool up;
+    bool proxy;
+    bool reach[FIXTURES];   // Over its proxy link
+    uint32_t counter;
+    uint32_t last_hello;
+    cluster_state_t st;
+} node_t;
+
+static node_t s_nodes[NODES];
+static uint32_t s_now = 0;
+static uint32_t s_boots = 0;
+
+// MARK: - Bus
+
+#define TO_ALL      (-1)
+
+static void deliver(int from, int to, const uint8_t *buf, size_t len);
+static void hello(int i);
+
+static void send_msg(int from, int to, cluster_msg_t type, const uint8_t *body, size_t len)
+{
+    uint8_t buf[CLUSTER_MAX_DATAGRAM];
+    node_t *n = &s_nodes[from];
+    size_t pos = cluster_proto_header(&n->st, buf, type, ++n->counter);
+    memcpy(buf + pos, body, len);
+    deliver(from, to, buf, pos + len);
+}
+
+// As cluster.c's leader does for a node that (re)appears: its HELLO
+// first, or the node drops the rest
+static void sync_fixtures(int from, int to)
+{
+    uint8_t body[256];
+    hello(from);
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES; i++) {
+        const cluster_fixture_t *f = &s_nodes[from].st.fixtures[i];
+        if (!f->unicast) continue;
+        size_t len = cluster_proto_write_fixture(f, true, body, sizeof(body));
+        send_msg(from, to, CLUSTER_MSG_FIXTURE, body, len);
+    }
+}
+
+// What cluster.c's handle_datagram does with the protocol's part of it
+static void deliver(int from, int to, const uint8_t *buf, size_t len)
+{
+    for (int i = 0; i < NODES; i++) {
+        node_t *n = &s_nodes[i];
+        if (i == from || !n->up || (to != TO_ALL && i != to)) continue;
+
+        cluster_msg_t type;
+        uint8_t node;
+        bool was_alive = cluster_proto_alive(&n->st, (uint8_t)from, s_now);
+        if (!cluster_proto_accept(&n->st, buf, len, s_now, &type, &node)) continue;
+        uint8_t leader = cluster_proto_leader(&n->st, s_now);
+        const uint8_t *body = buf + CLUSTER_HEADER_LEN;
+        size_t body_len = len - CLUSTER_HEADER_LEN;
+        uint16_t unicast;
+        bool added;
+        switch (type) {
+        case CLUSTER_MSG_HELLO:
+            cluster_proto_read_hello(&n->st, node, body, body_len, s_now);
+            if (!was_alive && leader == i) sync_fixtures(i, node);
+            break;
+        case CLUSTER_MSG_ASSIGN:
+            if (node == leader) cluster_proto_read_assign(&n->st, body, body_len);
+            break;
+        case CLUSTER_MSG_FIXTURE:
+            if (node == leader) cluster_proto_read_fixture(&n->st, body, body_len, &unicast, &added);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// MARK: - Nodes
+
+static void boot(int i)
+{
+    node_t *n = &s_nodes[i];
+    n->up = true;
+    n->counter = 0;
+    n->last_hello = s_now - CLUSTER_HELLO_MS;
+    cluster_proto_init(&n->st, (uint8_t)i, ++s_boots, 4);
+}
+
+// What cluster.c's send_hello reports: the fixtures it owns, with hops
+static void hello(int i)
+{
+    node_t *n = &s_nodes[i];
+    uint16_t unicasts[FIXTURES];
+    uint8_t hops[FIXTURES];
+    int count = 0;
+    for (int k = 0; k < FIXTURES; k++) {
+        const cluster_fixture_t *f = cluster_proto_find(&n->st, FIRST + k);
+        if (!f || f->owner != i) continue;
+        unicasts[count] = FIRST + k;
+        hops[count] = n->proxy && n->reach[k] ? 1 : CLUSTER_UNREACHABLE;
+        count++;
+    }
+    uint8_t flags = n->proxy ? CLUSTER_FLAG_PROXY_UP : 0;
+    uint8_t body[3 + FIXTURES * 3];
+    size_t len = cluster_proto_write_hello(body, sizeof(body), flags, (uint8_t)count,
+                                           unicasts, hops, count);
+    cluster_proto_read_hello(&n->st, (uint8_t)i, body, len, s_now);
+    send_msg(i, TO_ALL, CLUSTER_MSG_HELLO, body, len);
+}
+
+static void lead(int i)
+{
+    static uint8_t body[CLUSTER_MAX_DATAGRAM];
+    node_t *n = &s_nodes[i];
+    if (cluster_proto_leader(&n->st, s_now) != i) return;
+    cluster_proto_assign(&n->st, s_now);
+    size_t len = cluster_proto_write_assign(&n->st, body, sizeof(body));
+    send_msg(i, TO_ALL, CLUSTER_MSG_ASSIGN, body, len);
+}
+
+static void run(uint32_t ms)
+{
+    for (uint32_t end = s_now + ms; s_now < end;) {
+        s_now += TICK_MS;
+        for (int i = 0; i < NODES; i++) {
+            node_t *n = &s_nodes[i];
+            if (!n->up || s_now - n->last_hello < CLUSTER_HELLO_MS) continue;
+            n->last_hello = s_now;
+            hello(i);
+            lead(i);
+        }
+    }
+}
+
+// The phone adds fixtures through the leader, which passes them on
+static void add_fixtures(int leader)
+{
+    static uint8_t body[256];
+    for (int k = 0; k < FIXTURES; k++) {
+        char id[16];
+        snprintf(id, sizeof(id), "light-%d", k);
+        cluster_fixture_t *f = cluster_proto_add(&s_nodes[leader].st, id, FIRST + k, id, NULL);
+        size_t len = cluster_proto_write_fixture(f, true, body, sizeof(body));
+        send_msg(leader, TO_ALL, CLUSTER_MSG_FIXTURE, body, len);
+    }
+}
+
+static uint8_t owner(int viewer, int k)
+{
+    const cluster_fixture_t *f = cluster_proto_find(&s_nodes[viewer].st, FIRST + k);
+    return f ? f->owner : CLUSTER_NO_OWNER;
+}
+
+// Every live node names the same leader and the same owners
+static bool agreed(uint8_t leader)
+{
+    for (int i = 0; i < NODES; i++) {
+        if (!s_nodes[i].up) continue;
+        if (cluster_proto_leader(&s_nodes[i].st, s_now) != leader) return false;
+        for (int k = 0; k < FIXTURES; k++) {
+            if (owner(i, k) != owner(leader, k)) return false;
+        }
+    }
+    return true;
+}
+
+// MARK: - Tests
+
+static void test_election(void)
+{
+    for (int i = 0; i < NODES; i++) boot(i);
+    run(3 * CLUSTER_HELLO_MS);
+    CHECK(agreed(0), "no agreement on node 0 leading");
+
+    s_nodes[0].up = false;
+    run(CLUSTER_DEAD_MS + 2 * CLUSTER_HELLO_MS);
+    CHECK(agreed(1), "node 1 didn't take over");
+
+    // Back with a new boot: its HELLO is accepted once it was silent
+    boot(0);
+    run(3 * CLUSTER_HELLO_MS);
+    CHECK(agreed(0), "rebooted node 0 didn't lead again");
+}
+
+static void test_reachability(void)
+{
+    // Nodes 1 and 3 have proxies; only node 3 reaches fixtures 4 and 5
+    for (int i = 0; i < NODES; i++) {
+        s_nodes[i].proxy = i == 1 || i == 3;
+        for (int k = 0; k < FIXTURES; k++) s_nodes[i].reach[k] = i == 3 || k < 4;
+    }
+    run(2 * CLUSTER_HELLO_MS);
+    add_fixtures(0);
+    run(3 * CLUSTER_HELLO_MS);
+    CHECK(agreed(0), "owners disagree after adding");
+    for (int k = 0; k < FIXTURES; k++) {
+        uint8_t o = owner(0, k);
+        CHECK(o == 1 || o == 3, "fixture %d went to node %d, which has no proxy", k, o);
+    }
+
+    // An owner that can't reach its fixture loses it after the rehome time
+    run(CLUSTER_REHOME_MS + 3 * CLUSTER_HELLO_MS);
+    CHECK(agreed(0), "owners disagree after rehoming");
+    CHECK(owner(0, 4) == 3 && owner(0, 5) == 3, "fixtures 4/5 owned by %d/%d, not the node reaching them",
+          owner(0, 4), owner(0, 5));
+    for (int k = 0; k < FIXTURES; k++) {
+        const cluster_fixture_t *f = cluster_proto_find(&s_nodes[0].st, FIRST + k);
+        CHECK(f->hops == 1, "fixture %d still unreachable from node %d", k, f->owner);
+    }
+}
+
+static void test_failover(void)
+{
+    int victim = owner(0, 0);
+    s_nodes[victim].up = false;
+    run(CLUSTER_DEAD_MS + 3 * CLUSTER_HELLO_MS);
+    CHECK(agreed(0), "owners disagree after node %d died", victim);
+    for (int k = 0; k < FIXTURES; k++) {
+        uint8_t o = owner(0, k);
+        CHECK(o != victim && o < NODES && s_nodes[o].up, "fixture %d left with node %d", k, o);
+    }
+
+    boot(victim);
+    s_nodes[victim].proxy = true;
+}
+
+// One fixture each, the owner of one losing its link and then dying with
+// the rest: the leader is full, so that fixture has nobody to own it. It
+// starts over, without its rehome state, once there is room again.
+static void test_no_owner(void)
+{
+    for (int i = 0; i < NODES; i++) {
+        boot(i);
+        s_nodes[i].st.capacity = 1;
+        s_nodes[i].proxy = true;
+        for (int k = 0; k < FIXTURES; k++) s_nodes[i].reach[k] = true;
+    }
+    run(2 * CLUSTER_HELLO_MS);
+    add_fixtures(0);
+    run(2 * CLUSTER_HELLO_MS);
+
+    int k0 = -1;
+    for (int k = 0; k < FIXTURES && k0 < 0; k++) {
+        uint8_t o = owner(0, k);
+        if (o != 0 && o != CLUSTER_NO_OWNER) k0 = k;
+    }
+    CHECK(k0 >= 0, "no fixture owned by another node");
+    if (k0 < 0) return;
+    s_nodes[owner(0, k0)].reach[k0] = false;
+    run(2 * CLUSTER_HELLO_MS);
+    const cluster_fixture_t *f = cluster_proto_find(&s_nodes[0].st, FIRST + k0);
+    CHECK(f->unreachable_ms != 0, "fixture %d not marked unreachable", k0);
+
+    for (int i = 1; i < NODES; i++) s_nodes[i].up = false;
+    run(CLUSTER_DEAD_MS + 2 * CLUSTER_HELLO_MS);
+    CHECK(f->owner == CLUSTER_NO_OWNER, "fixture %d owned by %d with node 0 full", k0, f->owner);
+    CHECK(f->unreachable_ms == 0 && f->tried == 0, "dropped fixture kept its rehome state");
+
+    // Past the rehome time with no owner: nothing to mark as tried
+    run(CLUSTER_REHOME_MS + 2 * CLUSTER_HELLO_MS);
+
+    for (int i = 0; i < NODES; i++) s_nodes[i].st.capacity = 2;
+    for (int i = 1; i < NODES; i++) boot(i);
+    run(3 * CLUSTER_HELLO_MS);
+    CHECK(agreed(0), "owners disagree after the nodes came back");
+    for (int k = 0; k < FIXTURES; k++) {
+        CHECK(owner(0, k) < NODES, "fixture %d has no owner with room on every node", k);
+    }
+}
+
+int main(void)
+{
+    test_election();
+    test_reachability();
+    test_failover();
+    test_no_owner();
+
+    printf("%s: %d failure(s)\n", s_failures ? "FAIL" : "PASS", s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,497 @@
+/*
+ * codec.c
+ *
+ * Show asset encoding tests: the LZSS decoder against heatshrink output
+ * for the window and lookahead bits the phone uploads with, the zigzag
+ * varint tables the event records are made of, binary cue lists through
+ * the cue player's loader, and the player picking up from a warm-restart
+ * snapshot.
+ *
+ * The encoder here makes heatshrink's choices (longest match in the
+ * window, nearest on a tie, literals below the break-even length), so its
+ * output is byte for byte what `heatshrink -e -w W -l L` writes; the
+ * hand-checked vector pins that down.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_crc.h"
+
+#include "platform.h"
+#include "show_codec.h"
+#include "cue_player.h"
+
+#define MAX_RAW     (48u << 10)
+#define MAX_ENC     (MAX_RAW + MAX_RAW / 8 + 16)
+
+static int s_failures = 0;
+
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            s_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+static uint8_t s_raw[MAX_RAW];
+static uint8_t s_enc[MAX_ENC];
+static uint8_t s_out[MAX_RAW];
+static show_decoder_t s_dec;
+
+// MARK: - Encoder
+
+typedef struct {
+    uint8_t *out;
+    size_t len;
+    uint8_t bits;
+    int used;
+} bit_writer_t;
+
+static void put_bits(bit_writer_t *w, uint32_t v, int count)
+{
+    for (int i = count - 1; i >= 0; i--) {
+        w->bits = (uint8_t)((w->bits << 1) | ((v >> i) & 1));
+        if (++w->used == 8) {
+            w->out[w->len++] = w->bits;
+            w->used = 0;
+            w->bits = 0;
+        }
+    }
+}
+
+// heatshrink's encoding of in; returns the length. *max_offset is the
+// longest distance a backreference used.
+static size_t hs_encode(const uint8_t *in, size_t len, int window_sz2, int lookahead_sz2,
+                        uint8_t *out, size_t *max_offset)
+{
+    const size_t window = (size_t)1 << window_sz2;
+    const size_t lookahead = (size_t)1 << lookahead_sz2;
+    const size_t break_even = (1 + window_sz2 + lookahead_sz2) / 8;
+    bit_writer_t w = { .out = out };
+    *max_offset = 0;
+
+    size_t pos = 0;
+    while (pos < len) {
+        size_t max_len = len - pos < lookahead ? len - pos : lookahead;
+        size_t start = pos > window ? pos - window : 0;
+        size_t best_len = 0, best_pos = 0;
+        for (size_t p = pos; p-- > start;) {
+            size_t n = 0;
+            while (n < max_len && in[p + n] == in[pos + n]) n++;
+            if (n > best_len) {
+                best_len = n;
+                best_pos = p;
+                if (n == max_len) break;
+            }
+        }
+
+        if (best_len > break_even) {
+            size_t offset = pos - best_pos;
+            put_bits(&w, 0, 1);
+            put_bits(&w, (uint32_t)(offset - 1), window_sz2);
+            put_bits(&w, (uint32_t)(best_len - 1), lookahead_sz2);
+            if (offset > *max_offset) *max_offset = offset;
+            pos += best_len;
+        } else {
+            put_bits(&w, 1, 1);
+            put_bits(&w, in[pos], 8);
+            pos++;
+        }
+    }
+    if (w.used) put_bits(&w, 0, 8 - w.used);
+    return w.len;
+}
+
+// MARK: - Decoding
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    int chunk;              // Largest pull, to land bit fields across chunks
+    bool fail;              // Report a read error at the end instead of EOF
+} source_t;
+
+static int pull(void *ctx, uint8_t *buf, int max)
+{
+    source_t *s = ctx;
+    if (s->pos == s->len) return s->fail ? -1 : 0;
+    size_t n = s->len - s->pos;
+    if (n > (size_t)max) n = max;
+    if (n > (size_t)s->chunk) n = s->chunk;
+    memcpy(buf, s->data + s->pos, n);
+    s->pos += n;
+    return (int)n;
+}
+
+// Decode everything, read_len bytes at a time; returns the count or -1
+static int decode_all(source_t *src, int window_sz2, int lookahead_sz2, int read_len)
+{
+    if (show_decoder_init(&s_dec, SHOW_CODEC_LZSS, window_sz2, lookahead_sz2, pull, src) != ESP_OK) {
+        return -1;
+    }
+    int total = 0;
+    while (1) {
+        int want = read_len;
+        if (total + want > (int)sizeof(s_out)) want = (int)sizeof(s_out) - total;
+        if (want == 0) break;
+        int n = show_decoder_read(&s_dec, s_out + total, want);
+        if (n < 0) return -1;
+        total += n;
+        if (n < want) break;
+    }
+    return total;
+}
+
+static int read_decoded(void *ctx, uint8_t *b)
+{
+    return show_decoder_read(ctx, b, 1);
+}
+
+// MARK: - Heatshrink output
+
+static void test_vector(void)
+{
+    // heatshrink -e -w 8 -l 3 of "abcdeabcde": five literals, then
+    // offset 5 count 5 as index 4, count 4
+    static const uint8_t expected[] = { 0xb0, 0xd8, 0xac, 0x76, 0x4b, 0x28, 0x12, 0x00 };
+    const char *text = "abcdeabcde";
+    size_t max_offset;
+
+    size_t n = hs_encode((const uint8_t *)text, 10, 8, 3, s_enc, &max_offset);
+    CHECK(n == sizeof(expected) && memcmp(s_enc, expected, n) == 0,
+          "encoder disagrees with the heatshrink vector");
+
+    source_t src = { .data = expected, .len = sizeof(expected), .chunk = 64 };
+    int got = decode_all(&src, 8, 3, 64);
+    CHECK(got == 10 && memcmp(s_out, text, 10) == 0, "heatshrink vector decodes to %d byte(s)", got);
+
+    // The same stream read as -l 4 is a different stream
+    src.pos = 0;
+    got = decode_all(&src, 8, 4, 64);
+    CHECK(got != 10 || memcmp(s_out, text, 10) != 0, "lookahead bits ignored");
+}
+
+static uint32_t s_rand = 1;
+
+static uint32_t next_rand(void)
+{
+    s_rand = s_rand * 1103515245u + 12345u;
+    return s_rand >> 16;
+}
+
+typedef enum { INPUT_TEXT, INPUT_NOISE, INPUT_RUN, INPUT_PERIOD } input_t;
+
+static size_t make_input(input_t kind, int window_sz2, uint8_t *buf, size_t len)
+{
+    static const char *words[] = { "cue ", "fade ", "intensity ", "5600 ", "hsi ", "\n" };
+    size_t period = (size_t)1 << window_sz2;
+    size_t n = 0;
+    switch (kind) {
+    case INPUT_TEXT:
+        while (n < len) {
+            const char *w = words[next_rand() % 6];
+            size_t wl = strlen(w);
+            if (n + wl > len) wl = len - n;
+            memcpy(buf + n, w, wl);
+            n += wl;
+        }
+        break;
+    case INPUT_NOISE:
+        for (; n < len; n++) buf[n] = (uint8_t)next_rand();
+        break;
+    case INPUT_RUN:
+        // Copies that overlap their own output
+        memset(buf, 0x55, len);
+        n = len;
+        break;
+    case INPUT_PERIOD:
+        // Noise repeating at exactly the window: only the longest
+        // offset matches
+        for (; n < len; n++) buf[n] = n < period ? (uint8_t)next_rand() : buf[n - period];
+        break;
+    }
+    return n;
+}
+
+static void test_round_trips(void)
+{
+    static const int params[][2] = { { 4, 3 }, { 8, 3 }, { 8, 4 }, { 10, 4 }, { 10, 9 } };
+    static const int chunks[] = { 1, 7, SHOW_CODEC_IN_CHUNK };
+    static const int reads[] = { 1, 3, 1000 };
+
+    for (size_t p = 0; p < sizeof(params) / sizeof(params[0]); p++) {
+        int w = params[p][0], l = params[p][1];
+        for (input_t kind = INPUT_TEXT; kind <= INPUT_PERIOD; kind++) {
+            size_t len = make_input(kind, w, s_raw, 20000);
+            size_t max_offset;
+            size_t enc_len = hs_encode(s_raw, len, w, l, s_enc, &max_offset);
+            if (kind == INPUT_PERIOD) {
+                CHECK(max_offset == ((size_t)1 << w), "-w %d: longest offset %zu unused", w, max_offset);
+            }
+            for (int c = 0; c < 3; c++) {
+                source_t src = { .data = s_enc, .len = enc_len, .chunk = chunks[c] };
+                int got = decode_all(&src, w, l, reads[c]);
+                CHECK(got == (int)len && memcmp(s_out, s_raw, len) == 0,
+                      "-w %d -l %d input %d chunk %d: %d of %zu byte(s)", w, l, kind, chunks[c], got, len);
+            }
+        }
+    }
+
+    // A stream cut short ends early; a failed read is an error
+    size_t max_offset;
+    size_t len = make_input(INPUT_TEXT, 10, s_raw, 4000);
+    size_t enc_len = hs_encode(s_raw, len, 10, 4, s_enc, &max_offset);
+    source_t src = { .data = s_enc, .len = enc_len / 2, .chunk = 64 };
+    int got = decode_all(&src, 10, 4, 256);
+    CHECK(got > 0 && got < (int)len && memcmp(s_out, s_raw, got) == 0, "truncated stream: %d byte(s)", got);
+    src = (source_t){ .data = s_enc, .len = enc_len / 2, .chunk = 64, .fail = true };
+    CHECK(decode_all(&src, 10, 4, 256) < 0, "read error not reported");
+
+    CHECK(!show_codec_params_valid(SHOW_CODEC_LZSS, 11, 4), "window above the decoder's accepted");
+    CHECK(!show_codec_params_valid(SHOW_CODEC_LZSS, 8, 8), "lookahead as large as the window accepted");
+}
+
+// MARK: - Varints
+
+typedef struct {
+    int32_t value;
+    uint32_t zigzag;
+    uint8_t bytes[5];
+    int len;
+} varint_case_t;
+
+static const varint_case_t k_varints[] = {
+    { 0, 0, { 0x00 }, 1 },
+    { -1, 1, { 0x01 }, 1 },
+    { 1, 2, { 0x02 }, 1 },
+    { -2, 3, { 0x03 }, 1 },
+    { 63, 126, { 0x7e }, 1 },
+    { -64, 127, { 0x7f }, 1 },
+    { 64, 128, { 0x80, 0x01 }, 2 },
+    { -65, 129, { 0x81, 0x01 }, 2 },
+    { 8191, 16382, { 0xfe, 0x7f }, 2 },
+    { -8193, 16385, { 0x81, 0x80, 0x01 }, 3 },
+    { 40000, 80000, { 0x80, 0xf1, 0x04 }, 3 },
+    { INT32_MAX, 0xfffffffeu, { 0xfe, 0xff, 0xff, 0xff, 0x0f }, 5 },
+    { INT32_MIN, 0xffffffffu, { 0xff, 0xff, 0xff, 0xff, 0x0f }, 5 },
+};
+
+typedef struct {
+    const uint8_t *data;
+    int len;
+    int pos;
+} bytes_t;
+
+static int read_bytes(void *ctx, uint8_t *b)
+{
+    bytes_t *s = ctx;
+    if (s->pos == s->len) return 0;
+    *b = s->data[s->pos++];
+    return 1;
+}
+
+static void test_varints(void)
+{
+    for (size_t i = 0; i < sizeof(k_varints) / sizeof(k_varints[0]); i++) {
+        const varint_case_t *c = &k_varints[i];
+        CHECK(show_zigzag_encode(c->value) == c->zigzag, "zigzag(%ld)", (long)c->value);
+        CHECK(show_zigzag_decode(c->zigzag) == c->value, "unzigzag(%lu)", (unsigned long)c->zigzag);
+
+        bytes_t src = { c->bytes, c->len, 0 };
+        uint32_t v = 0;
+        CHECK(show_varint_read(read_bytes, &src, &v) == ESP_OK && v == c->zigzag && src.pos == c->len,
+              "varint %lu", (unsigned long)c->zigzag);
+        CHECK(show_varint_read(read_bytes, &src, &v) == ESP_ERR_NOT_FOUND, "varint %lu: no end",
+              (unsigned long)c->zigzag);
+    }
+
+    static const struct {
+        uint8_t bytes[6];
+        int len;
+    } bad[] = {
+        { { 0x80 }, 1 },                                // Truncated
+        { { 0xff, 0xff, 0xff, 0xff, 0x1f }, 5 },        // 33 bits
+        { { 0x80, 0x80, 0x80, 0x80, 0x80, 0x00 }, 6 },  // Six bytes
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        bytes_t src = { bad[i].bytes, bad[i].len, 0 };
+        uint32_t v;
+        CHECK(show_varint_read(read_bytes, &src, &v) == ESP_ERR_INVALID_SIZE, "bad varint %zu accepted", i);
+    }
+}
+
+static size_t put_varint(uint8_t *out, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+// An event table the way the phone writes it: times as zigzag deltas,
+// compressed, then read back record by record
+static void test_event_table(void)
+{
+    static int32_t times[2000];
+    int32_t t = 0;
+    size_t len = 0;
+    for (int i = 0; i < 2000; i++) {
+        // Mostly a steady beat, with jumps back (loops) and far ahead
+        t += i % 97 == 0 ? -30000 : i % 211 == 0 ? 600000 : 500 + (int32_t)(next_rand() % 3) * 250;
+        times[i] = t;
+        len += put_varint(s_raw + len, show_zigzag_encode(t - (i ? times[i - 1] : 0)));
+        len += put_varint(s_raw + len, (uint32_t)(i % 40));
+    }
+
+    size_t max_offset;
+    size_t enc_len = hs_encode(s_raw, len, 10, 4, s_enc, &max_offset);
+    CHECK(enc_len < len, "event table compressed to %zu of %zu byte(s)", enc_len, len);
+
+    source_t src = { .data = s_enc, .len = enc_len, .chunk = 64 };
+    show_decoder_init(&s_dec, SHOW_CODEC_LZSS, 10, 4, pull, &src);
+    int32_t acc = 0;
+    int i = 0;
+    uint32_t zz, cue;
+    esp_err_t err;
+    while ((err = show_varint_read(read_decoded, &s_dec, &zz)) == ESP_OK) {
+        acc = (int32_t)((uint32_t)acc + (uint32_t)show_zigzag_decode(zz));
+        CHECK(show_varint_read(read_decoded, &s_dec, &cue) == ESP_OK, "record %d: no cue", i);
+        if (i < 2000) {
+            CHECK(acc == times[i] && cue == (uint32_t)(i % 40), "record %d: %ld ms cue %lu", i,
+                  (long)acc, (unsigned long)cue);
+        }
+        i++;
+    }
+    CHECK(err == ESP_ERR_NOT_FOUND && i == 2000, "%d record(s), ended with %s", i, esp_err_to_name(err));
+}
+
+// MARK: - Binary cue lists
+
+static esp_err_t next_cue_varint(void *ctx, uint32_t *value)
+{
+    return show_varint_read(read_bytes, ctx, value);
+}
+
+static esp_err_t load(const uint8_t *data, int len)
+{
+    bytes_t src = { data, len, 0 };
+    return cue_player_load_binary(next_cue_varint, &src);
+}
+
+static void test_cue_lists(void)
+{
+    // Two cues: 0x0010 on in CCT at 75.5% 3200 K over 2 s, then at once
+    // 0x0012 to HSI hue 240 saturation 100 (flags 0xb2 take two bytes),
+    // and 0x0010 off
+    static const uint8_t list[] = {
+        2, 3,
+        0xd0, 0x0f, 1,  0x20, 0x4f, 0xf3, 0x05, 0x80, 0x19,
+        0, 2,  0x04, 0xb2, 0x01, 0xf0, 0x01, 0x64,  0x03, 0x01,
+    };
+    CHECK(load(list, sizeof(list)) == ESP_OK, "binary list rejected");
+    // The ready event's digest is the CRC of what the phone encoded
+    uint32_t crc = 0;
+    CHECK(cue_player_digest(&crc) && crc == esp_crc32_le(0, list, sizeof(list)),
+          "list digest %08lX", (unsigned long)crc);
+    CHECK(cue_player_go(1) == ESP_OK, "cue 1 missing");
+    CHECK(cue_player_go(2) == ESP_ERR_NOT_FOUND, "cue 2 exists");
+
+    CHECK(load(list, sizeof(list) - 1) == ESP_ERR_INVALID_SIZE, "truncated list accepted");
+
+    static uint8_t extra[sizeof(list) + 1];
+    memcpy(extra, list, sizeof(list));
+    CHECK(load(extra, sizeof(extra)) == ESP_ERR_INVALID_SIZE, "trailing bytes accepted");
+
+    static uint8_t bad[sizeof(list)];
+    memcpy(bad, list, sizeof(list));
+    bad[9] = 0x7f;      // CCT 127 K
+    CHECK(load(bad, sizeof(bad)) != ESP_OK, "out-of-range CCT accepted");
+
+    memcpy(bad, list, sizeof(list));
+    bad[1] = 4;         // More changes announced than follow
+    CHECK(load(bad, sizeof(bad)) == ESP_ERR_INVALID_SIZE, "short change count accepted");
+
+    // One change each for more lights than a list can drive
+    static uint8_t wide[8 + (CUE_LIGHTS_MAX + 1) * 3];
+    int n = 0;
+    wide[n++] = 1;
+    n += (int)put_varint(wide + n, CUE_LIGHTS_MAX + 1);
+    wide[n++] = 0;
+    n += (int)put_varint(wide + n, CUE_LIGHTS_MAX + 1);
+    for (int i = 0; i <= CUE_LIGHTS_MAX; i++) {
+        wide[n++] = i ? 2 : 2 * 0x20;   // 0x0020, then +1 each
+        wide[n++] = 0x01;
+    }
+    CHECK(load(wide, n) == ESP_ERR_INVALID_SIZE, "list over %d lights accepted", CUE_LIGHTS_MAX);
+
+    // The failed loads left the first list in place
+    CHECK(cue_player_go(1) == ESP_OK, "failed load replaced the list");
+}
+
+// A warm restart mid-fade: the player comes back at its cue, showing what
+// it was, and the list the phone sends again keeps that position once
+static void test_cue_resume(void)
+{
+    static cue_snapshot_t snap, now;
+    memset(&snap, 0, sizeof(snap));
+    snap.cue = 0;
+    snap.fade_ms = 2000;
+    snap.fade_elapsed_ms = 1500;
+    snap.track_count = 1;
+    cue_track_snapshot_t *t = &snap.tracks[0];
+    t->unicast = 0x0010;
+    t->fading = 0x04;
+    t->out = (cue_look_snapshot_t) { .mask = 0x3f, .flags = 0x01, .intensity = 600, .cct_kelvin = 3200 };
+    t->end = t->out;
+    t->end.intensity = 755;
+    t->to = t->end;
+
+    static const uint8_t list[] = {
+        2, 3,
+        0xd0, 0x0f, 1,  0x20, 0x4f, 0xf3, 0x05, 0x80, 0x19,
+        0, 2,  0x04, 0xb2, 0x01, 0xf0, 0x01, 0x64,  0x03, 0x01,
+    };
+    static const uint8_t empty[] = { 0, 0 };
+    CHECK(load(empty, sizeof(empty)) == ESP_OK, "empty list rejected");
+
+    cue_player_resume(&snap);
+    cue_player_snapshot(&now);
+    CHECK(now.cue == 0 && now.track_count == 1, "resumed at cue %d with %d light(s)", now.cue,
+          now.track_count);
+    CHECK(now.tracks[0].unicast == 0x0010 && now.tracks[0].to.intensity == 755,
+          "resumed light lost its target");
+
+    CHECK(load(list, sizeof(list)) == ESP_OK, "list rejected after resume");
+    cue_player_snapshot(&now);
+    CHECK(now.cue == 0, "reloaded list lost the position (cue %d)", now.cue);
+    CHECK(now.track_count == 1, "reloaded list dropped the resumed light");
+
+    CHECK(load(list, sizeof(list)) == ESP_OK, "list rejected");
+    cue_player_snapshot(&now);
+    CHECK(now.cue == -1, "second load kept the position");
+}
+
+int main(int argc, char **argv)
+{
+    host_log_level = argc > 1 && strcmp(argv[1], "-v") == 0 ? 3 : 1;
+
+    test_vector();
+    test_round_trips();
+    test_varints();
+    test_event_table();
+
+    if (cue_player_init() != ESP_OK) return 1;
+    test_cue_lists();
+    test_cue_resume();
+
+    printf("%s: %d failure(s)\n", s_failures ? "FAIL" : "PASS", s_failures);
+    return s_failures ? 1 : 0;
+}
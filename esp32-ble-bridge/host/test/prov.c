@@ -0,0 +1,461 @@
+/*
+ * prov.c
+ *
+ * Provisioning tests. prov_crypto against the Mesh Profile 8.7 sample
+ * data (ConfirmationKey, both confirmations, SessionKey, SessionNonce,
+ * DeviceKey and the encrypted provisioning data), then the provisioner's
+ * state machine over a bearer that simulates unprovisioned devices:
+ * parallel links with different element counts, a device whose
+ * confirmation doesn't check out, one that never answers, and the device
+ * limit.
+ *
+ * The bearer queues everything the provisioner sends; the main thread
+ * plays the devices' side from that queue, the way the BTC task would
+ * deliver their notifications.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "platform.h"
+#include "prov_crypto.h"
+#include "prov_bearer.h"
+#include "provisioner.h"
+#include "mesh_crypto.h"
+#include "light_registry.h"
+
+#define MAX_DEVICES     8
+#define QUEUE_LEN       64
+#define QUIET_MS        300     // No traffic this long: the links are idle
+
+static const uint8_t NET_KEY[16] = {
+    0x7d, 0xd7, 0x36, 0x4c, 0xd8, 0x42, 0xad, 0x18, 0xc1, 0x7c, 0x2b, 0x82, 0x0c, 0x84, 0xc3, 0xd6,
+};
+static const uint8_t APP_KEY[16] = {
+    0x63, 0x96, 0x47, 0x71, 0x73, 0x4f, 0xbd, 0x76, 0xe3, 0xb4, 0x05, 0x19, 0xd1, 0xd9, 0x4a, 0x48,
+};
+#define IV_INDEX        0x12345678
+
+static int s_failures = 0;
+
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            s_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+// MARK: - Helpers
+
+static void from_hex(const char *hex, uint8_t *out, int len)
+{
+    for (int i = 0; i < len; i++) {
+        unsigned v;
+        sscanf(hex + i * 2, "%2x", &v);
+        out[i] = (uint8_t)v;
+    }
+}
+
+static bool equal_hex(const uint8_t *data, const char *hex, int len)
+{
+    uint8_t want[64];
+    from_hex(hex, want, len);
+    return memcmp(data, want, len) == 0;
+}
+
+static uint64_t s_rng = 1;
+
+static int test_rng(void *ctx, unsigned char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        s_rng ^= s_rng >> 12;
+        s_rng ^= s_rng << 25;
+        s_rng ^= s_rng >> 27;
+        buf[i] = (uint8_t)((s_rng * 0x2545F4914F6CDD1DULL) >> 56);
+    }
+    return 0;
+}
+
+// MARK: - Spec sample data
+
+// Mesh Profile 8.7.1-8.7.16: PB-ADV provisioning, no OOB
+static void test_sample_data(void)
+{
+    prov_session_t s;
+    uint8_t priv[32], dev_pub[64], invite[1], caps[11], start[5], net_key[16];
+    prov_crypto_init(&s, test_rng, NULL);
+
+    from_hex("06a516693c9aa31a6084545d0c5db641b48572b97203ddffb7ac73f7d0457663", priv, 32);
+    CHECK(prov_crypto_set_private_key(&s, priv) == ESP_OK, "private key rejected");
+    CHECK(equal_hex(s.pub, "2c31a47b5779809ef44cb5eaaf5c3e43d5f8faad4a8794cb987e9b03745c78dd"
+                           "919512183898dfbecd52e2408e43871fd021109117bd3ed4eaf8437743715d4f", 64),
+          "provisioner public key");
+
+    from_hex("f465e43ff23d3f1b9dc7dfc04da8758184dbc966204796eccf0d6cf5e16500cc"
+             "0201d048bcbbd899eeefc424164e33c201c2b010ca6b4d43a8a155cad8ecb279", dev_pub, 64);
+    CHECK(prov_crypto_ecdh(&s, dev_pub) == ESP_OK, "device public key rejected");
+    CHECK(equal_hex(s.secret, "ab85843a2f6d883f62e5684b38e307335fe6e1945ecd19604105c6f23221eb69",
+                    32), "ECDHSecret");
+
+    from_hex("00", invite, 1);
+    from_hex("0100010000000000000000", caps, 11);
+    from_hex("0000000000", start, 5);
+    prov_crypto_derive_confirmation_key(&s, invite, caps, start);
+    CHECK(equal_hex(s.conf_salt, "5faabe187337c71cc6c973369dcaa79a", 16), "ConfirmationSalt");
+    CHECK(equal_hex(s.conf_key, "e31fe046c68ec339c425fc6629f0336f", 16), "ConfirmationKey");
+
+    static const uint8_t auth_zero[16] = { 0 };
+    uint8_t conf[16];
+    from_hex("8b19ac31d58b124c946209b5db1021b9", s.prov_random, 16);
+    from_hex("55a2a2bca04cd32ff6f346bd0a0c1a3a", s.dev_random, 16);
+    prov_crypto_confirmation(&s, s.prov_random, auth_zero, conf);
+    CHECK(equal_hex(conf, "b38a114dfdca1fe153bd2c1e0dc46ac2", 16), "Provisioner confirmation");
+    prov_crypto_confirmation(&s, s.dev_random, auth_zero, conf);
+    CHECK(equal_hex(conf, "eeba521c196b52cc2e37aa40329f554e", 16), "Device confirmation");
+
+    prov_crypto_derive_session_keys(&s);
+    CHECK(equal_hex(s.session_key, "c80253af86b33dfa450bbdb2a191fea3", 16), "SessionKey");
+    CHECK(equal_hex(s.session_nonce, "da7ddbe78b5f62b81d6847487e", 13), "SessionNonce");
+    CHECK(equal_hex(s.device_key, "0520adad5e0142aa3e325087b4ec16d8", 16), "DeviceKey");
+
+    uint8_t enc[PROV_DATA_ENC_LEN];
+    from_hex("efb2255e6422d330088e09bb015ed707", net_key, 16);
+    prov_crypto_encrypt_data(&s, net_key, 0x0567, 0x00, 0x01020304, 0x0b0c, enc);
+    CHECK(equal_hex(enc, "d0bd7f4a89a2ff6222af59a90a60ad58acfe3123356f5cec29", PROV_DATA_LEN),
+          "Encrypted provisioning data");
+    CHECK(equal_hex(enc + PROV_DATA_LEN, "73e0ec50783b10c7", 8), "Provisioning data MIC");
+
+    // A point off the curve must not yield a secret
+    dev_pub[63] ^= 0x01;
+    CHECK(prov_crypto_ecdh(&s, dev_pub) != ESP_OK, "off-curve public key accepted");
+}
+
+// MARK: - Simulated devices
+
+typedef enum { DEV_OK, DEV_BAD_CONFIRM, DEV_SILENT } dev_kind_t;
+
+typedef struct {
+    dev_kind_t kind;
+    uint8_t uuid[16];
+    uint8_t elements;
+    int link;                   // -1 when not on a link
+    uint8_t invite[1];
+    uint8_t caps[11];
+    uint8_t start[5];
+    uint8_t own_pub[64];
+    uint8_t prov_conf[16];
+    prov_session_t s;           // Device side: pub = provisioner's, dev_pub = ours
+    bool completed;
+    uint16_t unicast;
+} device_t;
+
+static device_t s_devs[MAX_DEVICES];
+static int s_dev_count = 0;
+static int s_link_dev[PROVISIONER_MAX_LINKS];
+
+typedef struct {
+    int link;
+    bool closed;
+    uint8_t pdu[66];
+    int len;
+} bearer_ev_t;
+
+static pthread_mutex_t s_q_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_q_cond = PTHREAD_COND_INITIALIZER;
+static bearer_ev_t s_q[QUEUE_LEN];
+static int s_q_head = 0, s_q_count = 0;
+
+static void enqueue(const bearer_ev_t *ev)
+{
+    pthread_mutex_lock(&s_q_lock);
+    if (s_q_count == QUEUE_LEN) {
+        fprintf(stderr, "prov: bearer queue overflow\n");
+        exit(2);
+    }
+    s_q[(s_q_head + s_q_count++) % QUEUE_LEN] = *ev;
+    pthread_cond_signal(&s_q_cond);
+    pthread_mutex_unlock(&s_q_lock);
+}
+
+static bool dequeue(bearer_ev_t *ev, int wait_ms)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += (long)wait_ms * 1000000;
+    until.tv_sec += until.tv_nsec / 1000000000;
+    until.tv_nsec %= 1000000000;
+
+    pthread_mutex_lock(&s_q_lock);
+    while (!s_q_count) {
+        if (pthread_cond_timedwait(&s_q_cond, &s_q_lock, &until) == ETIMEDOUT) break;
+    }
+    bool got = s_q_count > 0;
+    if (got) {
+        *ev = s_q[s_q_head];
+        s_q_head = (s_q_head + 1) % QUEUE_LEN;
+        s_q_count--;
+    }
+    pthread_mutex_unlock(&s_q_lock);
+    return got;
+}
+
+esp_err_t prov_bearer_init(void)
+{
+    for (int i = 0; i < PROVISIONER_MAX_LINKS; i++) s_link_dev[i] = -1;
+    return ESP_OK;
+}
+
+esp_err_t prov_bearer_scan(bool on)
+{
+    return ESP_OK;
+}
+
+void prov_bearer_send(int link, const uint8_t *pdu, int len)
+{
+    bearer_ev_t ev = { .link = link, .len = len };
+    memcpy(ev.pdu, pdu, len);
+    enqueue(&ev);
+}
+
+void prov_bearer_close(int link)
+{
+    bearer_ev_t ev = { .link = link, .closed = true };
+    enqueue(&ev);
+}
+
+static device_t *add_device(dev_kind_t kind, uint8_t elements)
+{
+    device_t *d = &s_devs[s_dev_count];
+    memset(d, 0, sizeof(*d));
+    d->kind = kind;
+    d->elements = elements;
+    d->link = -1;
+    d->uuid[0] = 0xD0;
+    d->uuid[15] = (uint8_t)s_dev_count;
+    s_dev_count++;
+    return d;
+}
+
+// The bearer found the device's beacon, connected and enabled
+// notifications. Returns the link or -1 if the provisioner ignored it.
+static int discover(device_t *d)
+{
+    int link = provisioner_link_found(d->uuid, NULL);
+    if (link < 0) return -1;
+    d->link = link;
+    s_link_dev[link] = (int)(d - s_devs);
+    provisioner_link_connected(link);
+    provisioner_link_ready(link);
+    return link;
+}
+
+static void reply(device_t *d, uint8_t type, const uint8_t *payload, int len)
+{
+    uint8_t pdu[66];
+    pdu[0] = type;
+    memcpy(pdu + 1, payload, len);
+    provisioner_link_pdu(d->link, pdu, len + 1);
+}
+
+static void device_rx(device_t *d, const uint8_t *pdu, int len)
+{
+    static const uint8_t auth_zero[16] = { 0 };
+    const uint8_t *p = pdu + 1;
+
+    switch (pdu[0]) {
+    case 0x00:                  // Invite
+        if (d->kind == DEV_SILENT) return;
+        memcpy(d->invite, p, 1);
+        memset(d->caps, 0, sizeof(d->caps));
+        d->caps[0] = d->elements;
+        d->caps[2] = 0x01;      // FIPS P-256
+        reply(d, 0x01, d->caps, sizeof(d->caps));
+        break;
+
+    case 0x02:                  // Start
+        memcpy(d->start, p, 5);
+        break;
+
+    case 0x03: {                // Public key
+        prov_crypto_init(&d->s, test_rng, NULL);
+        CHECK(prov_crypto_keygen(&d->s) == ESP_OK, "device keygen");
+        memcpy(d->own_pub, d->s.pub, 64);
+        CHECK(prov_crypto_ecdh(&d->s, p) == ESP_OK, "provisioner public key rejected");
+        memcpy(d->s.pub, p, 64);
+        memcpy(d->s.dev_pub, d->own_pub, 64);
+        prov_crypto_derive_confirmation_key(&d->s, d->invite, d->caps, d->start);
+        reply(d, 0x03, d->own_pub, 64);
+        break;
+    }
+
+    case 0x05: {                // Confirmation
+        uint8_t conf[16];
+        memcpy(d->prov_conf, p, 16);
+        test_rng(NULL, d->s.dev_random, 16);
+        prov_crypto_confirmation(&d->s, d->s.dev_random, auth_zero, conf);
+        if (d->kind == DEV_BAD_CONFIRM) conf[0] ^= 0x80;
+        reply(d, 0x05, conf, 16);
+        break;
+    }
+
+    case 0x06: {                // Random
+        uint8_t expected[16];
+        memcpy(d->s.prov_random, p, 16);
+        prov_crypto_confirmation(&d->s, d->s.prov_random, auth_zero, expected);
+        CHECK(memcmp(expected, d->prov_conf, 16) == 0, "provisioner confirmation mismatch");
+        reply(d, 0x06, d->s.dev_random, 16);
+        break;
+    }
+
+    case 0x07: {                // Data
+        uint8_t data[PROV_DATA_LEN];
+        prov_crypto_derive_session_keys(&d->s);
+        int n = mesh_crypto_ccm_decrypt(d->s.session_key, d->s.session_nonce, p,
+                                        PROV_DATA_ENC_LEN, 8, data);
+        CHECK(n == PROV_DATA_LEN, "provisioning data MIC");
+        if (n != PROV_DATA_LEN) return;
+
+        CHECK(memcmp(data, NET_KEY, 16) == 0, "NetKey");
+        CHECK(data[16] == 0 && data[17] == 0 && data[18] == 0, "key index and flags");
+        uint32_t iv = (uint32_t)data[19] << 24 | data[20] << 16 | data[21] << 8 | data[22];
+        CHECK(iv == IV_INDEX, "IV index %08X", (unsigned)iv);
+        d->unicast = (uint16_t)(data[23] << 8 | data[24]);
+        d->completed = true;
+        reply(d, 0x08, NULL, 0);
+        break;
+    }
+
+    default:
+        CHECK(false, "unexpected PDU 0x%02X to device", pdu[0]);
+        break;
+    }
+}
+
+// Deliver queued traffic until the links go quiet.
+static void pump(void)
+{
+    bearer_ev_t ev;
+    while (dequeue(&ev, QUIET_MS)) {
+        int at = s_link_dev[ev.link];
+        if (at < 0) continue;
+        device_t *d = &s_devs[at];
+        if (ev.closed) {
+            s_link_dev[ev.link] = -1;
+            d->link = -1;
+            provisioner_link_closed(ev.link);
+        } else {
+            device_rx(d, ev.pdu, ev.len);
+        }
+    }
+}
+
+// MARK: - State machine
+
+static void test_parallel(void)
+{
+    device_t *a = add_device(DEV_OK, 1);
+    device_t *b = add_device(DEV_OK, 2);
+    device_t *c = add_device(DEV_OK, 1);
+
+    CHECK(provisioner_start(0x0010, 0) == ESP_OK, "start");
+    CHECK(discover(a) >= 0 && discover(b) >= 0 && discover(c) >= 0, "links refused");
+    CHECK(provisioner_link_count() == 3, "%d links open", provisioner_link_count());
+    pump();
+
+    uint32_t used = 0;
+    device_t *devs[] = { a, b, c };
+    for (int i = 0; i < 3; i++) {
+        device_t *d = devs[i];
+        CHECK(d->completed, "device %d not provisioned", i);
+        CHECK(d->unicast >= 0x0010 && d->unicast + d->elements <= 0x0014,
+              "device %d at 0x%04X", i, d->unicast);
+        for (int e = 0; e < d->elements; e++) {
+            uint32_t bit = 1u << ((d->unicast + e - 0x0010) & 31);
+            CHECK(!(used & bit), "address 0x%04X given twice", d->unicast + e);
+            used |= bit;
+        }
+
+        light_entry_t light;
+        CHECK(light_registry_lookup(d->unicast, &light) && light.has_device_key &&
+              memcmp(light.device_key, d->s.device_key, 16) == 0,
+              "device %d not registered with its device key", i);
+    }
+    CHECK(provisioner_link_count() == 0, "%d links left open", provisioner_link_count());
+    provisioner_stop();
+}
+
+static void test_bad_confirmation(void)
+{
+    device_t *d = add_device(DEV_BAD_CONFIRM, 1);
+    CHECK(provisioner_start(0x0040, 0) == ESP_OK, "start");
+
+    // Retried until the provisioner gives up on the device
+    int attempts = 0;
+    while (attempts < 10 && discover(d) >= 0) {
+        attempts++;
+        pump();
+        CHECK(!d->completed, "provisioned despite a bad confirmation");
+    }
+    CHECK(attempts == 3, "%d attempts", attempts);
+    CHECK(!light_registry_lookup(0x0040, &(light_entry_t){0}), "registered after failing");
+    CHECK(provisioner_link_count() == 0, "%d links left open", provisioner_link_count());
+    provisioner_stop();
+}
+
+static void test_timeout(void)
+{
+    device_t *d = add_device(DEV_SILENT, 1);
+    CHECK(provisioner_start(0x0050, 0) == ESP_OK, "start");
+    CHECK(discover(d) >= 0, "link refused");
+    pump();
+    CHECK(provisioner_link_count() == 1, "silent link closed early");
+
+    platform_timer_advance(31 * 1000000);
+    pump();
+    CHECK(provisioner_link_count() == 0, "silent link not timed out");
+    provisioner_stop();
+}
+
+static void test_limit(void)
+{
+    device_t *a = add_device(DEV_OK, 1);
+    device_t *b = add_device(DEV_OK, 1);
+    CHECK(provisioner_start(0x0060, 1) == ESP_OK, "start");
+    CHECK(discover(a) >= 0, "first link refused");
+    CHECK(discover(b) < 0, "second link opened past the limit");
+    pump();
+    CHECK(a->completed, "first device not provisioned");
+    CHECK(!provisioner_is_active(), "still active after the limit");
+    CHECK(discover(b) < 0, "link opened after stopping");
+}
+
+// MARK: - Main
+
+int main(int argc, char **argv)
+{
+    host_log_level = argc > 1 && strcmp(argv[1], "-v") == 0 ? 3 : 1;
+    platform_clock_virtual();
+    platform_random_seed(1);
+
+    test_sample_data();
+
+    light_registry_init();
+    mesh_crypto_init(NET_KEY, APP_KEY, IV_INDEX, 0x0001);
+    if (provisioner_init() != ESP_OK) return 1;
+
+    test_parallel();
+    test_bad_confirmation();
+    test_timeout();
+    test_limit();
+
+    printf("%s: %d failure(s)\n", s_failures ? "FAIL" : "PASS", s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,397 @@
+/*
+ * soak.c
+ *
+ * Long-run soak of the shared core: a mixed command workload (state
+ * changes, software effects, registry churn, reports) on the virtual
+ * clock for simulated days, with jittered timer wakeups. Every simulated
+ * hour it samples the largest free block, the allocations still live at
+ * each call site and the effect step lateness. At the end it fits a trend
+ * to each series and fails if the largest block keeps shrinking or
+ * anything else keeps growing.
+ *
+ * The heap is ESP32-sized (HOST_HEAP_SIZE in CMakeLists.txt), so
+ * fragmentation shows up in the largest block as it would on the device.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <dlfcn.h>
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "platform.h"
+#include "transport.h"
+#include "mesh_host.h"
+#include "command.h"
+#include "ble_mesh.h"
+#include "light_registry.h"
+#include "effect_engine.h"
+#include "heap_health.h"
+#include "cue_player.h"
+
+#define HOUR_US             (3600LL * 1000000)
+#define MINUTE_US           (60LL * 1000000)
+#define WARMUP_HOURS        2
+#define ACTIONS_PER_MIN     6
+#define MAX_SITES           256
+#define MAX_HOURS           (24 * 30)
+#define FIRST_UNICAST       0x0002
+
+// How far a series may move over the run, past warm-up, before it counts
+// as a trend (half of it in each half of the run): the larger of an
+// absolute floor and a share of its mean
+typedef struct {
+    const char *name;
+    double floor;
+    double share;
+    int sign;                   // +1 = growing is bad, -1 = shrinking is bad
+} limit_t;
+
+static const limit_t LARGEST = { "largest free block", 2048, 0.02, -1 };
+static const limit_t BLOCKS = { "allocated blocks", 16, 0.10, +1 };
+static const limit_t LATENESS = { "step lateness", 100, 0.25, +1 };
+static const limit_t SITE = { "live allocations", 8, 0.10, +1 };
+
+static struct {
+    double days;
+    int lights;
+    uint64_t seed;
+    bool verbose;
+} s_opt = { .days = 3, .lights = 16, .seed = 1 };
+
+static uint64_t s_rng;
+static uint64_t s_commands = 0;
+static atomic_uint_fast64_t s_pdus;
+
+// Per-hour series
+static double s_largest[MAX_HOURS];
+static double s_blocks[MAX_HOURS];
+static double s_late[MAX_HOURS];
+static void *s_site_pc[MAX_SITES];
+static double s_site_live[MAX_SITES][MAX_HOURS];
+static int s_site_count = 0;
+static int s_hours = 0;
+
+// MARK: - Workload
+
+static uint64_t rnd(void)
+{
+    // xorshift64*, so runs repeat for a seed on any libc
+    s_rng ^= s_rng >> 12;
+    s_rng ^= s_rng << 25;
+    s_rng ^= s_rng >> 27;
+    return s_rng * 0x2545F4914F6CDD1DULL;
+}
+
+static int rnd_int(int lo, int hi)
+{
+    return lo + (int)(rnd() % (uint64_t)(hi - lo + 1));
+}
+
+// The way the WebSocket delivers a command: parse, dispatch, free
+static void command(const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    cJSON *root = cJSON_Parse(buf);
+    if (!root) {
+        fprintf(stderr, "soak: bad command %s\n", buf);
+        exit(2);
+    }
+    if (!command_dispatch(root)) {
+        fprintf(stderr, "soak: not dispatched: %s\n", buf);
+        exit(2);
+    }
+    cJSON_Delete(root);
+    s_commands++;
+}
+
+static const char *const ENGINES[] = {
+    "pulsing", "strobe", "fire", "candle", "party", "faulty_bulb",
+    "tv", "lightning", "paparazzi", "welding", "explosion",
+};
+
+static void start_effect(int unicast)
+{
+    const char *engine = ENGINES[rnd() % (sizeof(ENGINES) / sizeof(ENGINES[0]))];
+    if (rnd() % 2) {
+        command("{\"cmd\":\"start_effect\",\"unicast\":%d,\"engine\":\"%s\",\"params\":"
+                "{\"colorMode\":\"cct\",\"intensity\":%d,\"cctKelvin\":%d,\"frequency\":%d,"
+                "\"strobeHz\":%d,\"pulsingMin\":10,\"pulsingMax\":90,\"pulsingShape\":50}}",
+                unicast, engine, rnd_int(20, 100), rnd_int(2700, 6500), rnd_int(1, 10),
+                rnd_int(1, 12));
+    } else {
+        command("{\"cmd\":\"start_effect\",\"unicast\":%d,\"engine\":\"%s\",\"params\":"
+                "{\"colorMode\":\"hsi\",\"intensity\":%d,\"hue\":%d,\"saturation\":%d,"
+                "\"frequency\":%d,\"partyColors\":[0,120,240],\"partyTransition\":%d}}",
+                unicast, engine, rnd_int(20, 100), rnd_int(0, 359), rnd_int(0, 100),
+                rnd_int(1, 10), rnd_int(0, 100));
+    }
+}
+
+static void one_action(void)
+{
+    int unicast = FIRST_UNICAST + rnd_int(0, s_opt.lights - 1);
+    int pick = rnd_int(0, 99);
+
+    if (pick < 25) {
+        command("{\"cmd\":\"set_cct\",\"unicast\":%d,\"intensity\":%d,\"cct_kelvin\":%d}",
+                unicast, rnd_int(0, 100), rnd_int(2700, 6500));
+    } else if (pick < 40) {
+        command("{\"cmd\":\"set_hsi\",\"unicast\":%d,\"intensity\":%d,\"hue\":%d,"
+                "\"saturation\":%d}", unicast, rnd_int(0, 100), rnd_int(0, 359), rnd_int(0, 100));
+    } else if (pick < 45) {
+        command("{\"cmd\":\"sleep\",\"unicast\":%d,\"on\":%s}", unicast,
+                rnd() % 2 ? "true" : "false");
+    } else if (pick < 62) {
+        start_effect(unicast);
+    } else if (pick < 70) {
+        command("{\"cmd\":\"update_effect\",\"unicast\":%d,\"params\":{\"intensity\":%d}}",
+                unicast, rnd_int(10, 100));
+    } else if (pick < 80) {
+        command("{\"cmd\":\"stop_effect\",\"unicast\":%d}", unicast);
+    } else if (pick < 85) {
+        command("{\"cmd\":\"set_effect\",\"unicast\":%d,\"effect_type\":%d,\"intensity\":%d,"
+                "\"frequency\":%d}", unicast, rnd_int(1, 10), rnd_int(10, 100), rnd_int(1, 10));
+    } else if (pick < 90) {
+        // Registry churn: the fixture is removed and provisioned again
+        command("{\"cmd\":\"remove_light\",\"unicast\":%d}", unicast);
+        command("{\"cmd\":\"add_light\",\"id\":\"fx-%04x\",\"unicast\":%d,\"name\":\"Light %d\"}",
+                unicast, unicast, unicast);
+    } else if (pick < 95) {
+        command("{\"cmd\":\"health\"}");
+        command("{\"cmd\":\"effect_stats\"}");
+    } else if (pick < 98) {
+        command("{\"cmd\":\"monitor\",\"rate\":%d}", rnd() % 2 ? rnd_int(1, 20) : 0);
+    } else {
+        command("{\"cmd\":\"stop_all\"}");
+    }
+}
+
+// Timer wakeups are late by up to 1.5 ms, now and then by 15-40 ms, as a
+// busy bridge's would be
+static int64_t lateness(const char *name, int64_t deadline_us, void *ctx)
+{
+    uint64_t r = rnd();
+    if (r % 500 == 0) return 15000 + (int64_t)(r >> 32) % 25000;
+    return (int64_t)((r >> 16) % 1500);
+}
+
+// MARK: - Transport
+
+// Always up; PDUs are only counted
+static bool null_send(transport_t *t, const uint8_t *pdu, int len)
+{
+    atomic_fetch_add(&s_pdus, 1);
+    return true;
+}
+
+static bool null_is_up(transport_t *t)
+{
+    return true;
+}
+
+static transport_t s_null = { .name = "null", .send = null_send, .is_up = null_is_up };
+
+// MARK: - Sampling
+
+static int site_index(void *pc)
+{
+    for (int i = 0; i < s_site_count; i++) {
+        if (s_site_pc[i] == pc) return i;
+    }
+    if (s_site_count == MAX_SITES) return -1;
+    s_site_pc[s_site_count] = pc;
+    return s_site_count++;
+}
+
+static void sample_hour(int64_t late_sum, int late_n)
+{
+    platform_heap_stats_t hs;
+    platform_heap_stats(&hs);
+    s_largest[s_hours] = (double)hs.largest;
+    s_blocks[s_hours] = (double)hs.blocks;
+    s_late[s_hours] = late_n ? (double)late_sum / late_n : 0;
+
+    static platform_heap_site_t sites[MAX_SITES];
+    int n = platform_heap_sites(sites, MAX_SITES);
+    for (int i = 0; i < n; i++) {
+        int at = site_index(sites[i].pc);
+        if (at >= 0) s_site_live[at][s_hours] = (double)sites[i].live;
+    }
+    s_hours++;
+}
+
+// Least-squares change across y[first..last)
+static double trend(const double *y, int first, int last)
+{
+    int m = last - first;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = first; i < last; i++) {
+        double x = i - first;
+        sx += x;
+        sy += y[i];
+        sxx += x * x;
+        sxy += x * y[i];
+    }
+    double den = m * sxx - sx * sx;
+    if (m < 2 || den == 0) return 0;
+    return (m * sxy - sx * sy) / den * (m - 1);
+}
+
+// A trend has to show in both halves of the run after warm-up. A leak
+// does; the allocator settling into a new layout once is a step in one
+// half only.
+static bool check(const limit_t *lim, const char *label, const double *y, int n)
+{
+    int first = n > WARMUP_HOURS + 4 ? WARMUP_HOURS : 0;
+    int mid = first + (n - first) / 2;
+    double mean = 0;
+    for (int i = first; i < n; i++) mean += y[i] / (n - first);
+
+    double early = trend(y, first, mid + 1) * lim->sign;
+    double late = trend(y, mid, n) * lim->sign;
+    double change = trend(y, first, n);
+    double allowed = lim->floor > lim->share * mean ? lim->floor : lim->share * mean;
+    bool bad = early > allowed / 2 && late > allowed / 2;
+    if (bad || s_opt.verbose) {
+        printf("%s %-28s mean %12.1f  change %+10.1f  (limit %.1f per half)\n",
+               bad ? "FAIL" : "  ok", label, mean, change, allowed / 2);
+    }
+    return !bad;
+}
+
+static const char *site_name(void *pc, char *buf, size_t len)
+{
+    Dl_info info;
+    if (pc && dladdr(pc, &info) && info.dli_fname) {
+        if (info.dli_sname) {
+            snprintf(buf, len, "%s+0x%lx", info.dli_sname,
+                     (unsigned long)((char *)pc - (char *)info.dli_saddr));
+        } else {
+            // For addr2line -e <file>
+            snprintf(buf, len, "%s@0x%lx", strrchr(info.dli_fname, '/') ?
+                     strrchr(info.dli_fname, '/') + 1 : info.dli_fname,
+                     (unsigned long)((char *)pc - (char *)info.dli_fbase));
+        }
+    } else {
+        snprintf(buf, len, "%p", pc);
+    }
+    return buf;
+}
+
+// MARK: - Main
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --days D      simulated days to run (3)\n"
+            "  --lights N    fixtures in the workload (16)\n"
+            "  --seed S      workload and esp_random seed (1)\n"
+            "  -v            log the core's output and every series\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option longopts[] = {
+        { "days", required_argument, NULL, 'd' },
+        { "lights", required_argument, NULL, 'l' },
+        { "seed", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 },
+    };
+    host_log_level = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "v", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'd': s_opt.days = atof(optarg); break;
+        case 'l': s_opt.lights = atoi(optarg); break;
+        case 's': s_opt.seed = strtoull(optarg, NULL, 0); break;
+        case 'v':
+            s_opt.verbose = true;
+            host_log_level = 3;
+            break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    int hours = (int)(s_opt.days * 24);
+    if (hours < 1 || hours > MAX_HOURS || s_opt.lights < 1 || s_opt.lights > MAX_LIGHTS ||
+        !s_opt.seed) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    s_rng = s_opt.seed;
+    platform_clock_virtual();
+    platform_random_seed(s_opt.seed);
+    platform_timer_set_lateness(lateness, NULL);
+    mesh_host_add_transport(&s_null);
+
+    heap_health_init();
+    light_registry_init();
+    effect_engine_init();
+    if (ble_mesh_init() != ESP_OK) return 1;
+    cue_player_init();
+
+    command("{\"cmd\":\"set_keys\",\"network_key\":\"7dd7364cd842ad18c17c2b820c84c3d6\","
+            "\"app_key\":\"63964771734fbd76e3b40519d1d94a48\",\"iv_index\":305419896,"
+            "\"src_address\":1}");
+    for (int i = 0; i < s_opt.lights; i++) {
+        int unicast = FIRST_UNICAST + i;
+        command("{\"cmd\":\"add_light\",\"id\":\"fx-%04x\",\"unicast\":%d,\"name\":\"Light %d\"}",
+                unicast, unicast, unicast);
+    }
+    platform_timer_advance(2 * 1000000);    // Link poll brings the transport up
+
+    int64_t now = esp_timer_get_time();
+    for (int h = 0; h < hours; h++) {
+        int64_t late_sum = 0;
+        int late_n = 0;
+        for (int m = 0; m < 60; m++) {
+            int64_t minute_end = now + MINUTE_US;
+            for (int a = 0; a < ACTIONS_PER_MIN; a++) {
+                int64_t at = now + (int64_t)(rnd() % (uint64_t)(minute_end - now));
+                platform_timer_advance(at - now);
+                now = esp_timer_get_time();
+                one_action();
+                if (now >= minute_end) break;
+            }
+            if (now < minute_end) platform_timer_advance(minute_end - now);
+            now = esp_timer_get_time();
+
+            // The health timer has closed another interval
+            heap_health_stats_t st;
+            heap_health_get_stats(&st);
+            late_sum += st.late_avg_us;
+            late_n++;
+        }
+        sample_hour(late_sum, late_n);
+        if ((h + 1) % 24 == 0) {
+            printf("day %d: largest %.0f, %.0f blocks, lateness %.0f us, %llu commands, "
+                   "%llu PDUs\n", (h + 1) / 24, s_largest[h], s_blocks[h], s_late[h],
+                   (unsigned long long)s_commands, (unsigned long long)atomic_load(&s_pdus));
+        }
+    }
+
+    bool ok = check(&LARGEST, LARGEST.name, s_largest, s_hours);
+    ok = check(&BLOCKS, BLOCKS.name, s_blocks, s_hours) && ok;
+    ok = check(&LATENESS, LATENESS.name, s_late, s_hours) && ok;
+    for (int i = 0; i < s_site_count; i++) {
+        char name[96];
+        ok = check(&SITE, site_name(s_site_pc[i], name, sizeof(name)), s_site_live[i],
+                   s_hours) && ok;
+    }
+
+    printf("%s after %.1f simulated days, %d call sites\n", ok ? "PASS" : "FAIL", s_opt.days,
+           s_site_count);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,24 @@
+/*
+ * test_stubs.c
+ *
+ * The cluster side of bridged.c for test programs that run the shared
+ * core without a cluster: nothing is routed or relayed.
+ */
+
+#include <stdbool.h>
+#include "cJSON.h"
+#include "cluster.h"
+
+bool cluster_route(cJSON *root)
+{
+    return false;
+}
+
+bool cluster_relay_event(const char *json)
+{
+    return false;
+}
+
+void cluster_report(void)
+{
+}
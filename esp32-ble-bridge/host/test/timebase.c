@@ -0,0 +1,271 @@
+/*
+ * timebase.c
+ *
+ * Drift check of the effect grid timebase: a 4 Hz strobe and a pulse run
+ * on the virtual clock for simulated hours while every timer wakeup is
+ * late by a jittered amount, with occasional long stalls. Each send is
+ * stamped with the virtual time it left the engine (monitor_record is
+ * wrapped at link time). The strobe's flashes and the pulse's upward
+ * mid-level crossings must keep the nominal period: the fitted period
+ * stays within a few microseconds of it, and no flash or crossing sits
+ * further from its grid slot at the end of the run than lateness and
+ * frame quantisation allow at the start.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <getopt.h>
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "platform.h"
+#include "transport.h"
+#include "mesh_host.h"
+#include "command.h"
+#include "ble_mesh.h"
+#include "light_registry.h"
+#include "effect_engine.h"
+#include "heap_health.h"
+#include "monitor.h"
+
+#define HOUR_US         (3600LL * 1000000)
+#define STROBE_UNICAST  0x0002
+#define PULSE_UNICAST   0x0003
+#define STROBE_HZ       4
+#define PULSE_FREQUENCY 3
+#define PULSE_MID       50.0
+#define FRAME_US        30000           // SEG_PULSE step at frame scale 100
+#define FLASH_SLACK_US  5000            // sw_strobe skips slots later than this
+#define PERIOD_ERR_US   2.0             // Fitted period vs nominal
+#define MAX_HOURS       24
+#define MAX_EVENTS      (MAX_HOURS * 3600 * STROBE_HZ + 16)
+
+// Static: malloc is the ESP32-sized test heap
+typedef struct {
+    int64_t t[MAX_EVENTS];
+    int n;
+} series_t;
+
+static struct {
+    double hours;
+    uint64_t seed;
+    bool verbose;
+} s_opt = { .hours = 4, .seed = 1 };
+
+static uint64_t s_rng;
+static int64_t s_max_late = 0;
+static series_t s_flashes;
+static series_t s_crossings;
+static double s_pulse_prev = -1;
+
+// MARK: - Instrumentation
+
+static uint64_t rnd(void)
+{
+    // xorshift64*, so runs repeat for a seed on any libc
+    s_rng ^= s_rng >> 12;
+    s_rng ^= s_rng << 25;
+    s_rng ^= s_rng >> 27;
+    return s_rng * 0x2545F4914F6CDD1DULL;
+}
+
+static void push(series_t *s, int64_t t)
+{
+    if (s->n < MAX_EVENTS) s->t[s->n++] = t;
+}
+
+void __real_monitor_record(uint16_t unicast, monitor_mode_t mode, double intensity,
+                           int cct_kelvin, int hue, int saturation, int sleep_mode,
+                           int hw_effect);
+
+// Every effect send passes here on the timer thread, at the virtual time
+// the engine sent it
+void __wrap_monitor_record(uint16_t unicast, monitor_mode_t mode, double intensity,
+                           int cct_kelvin, int hue, int saturation, int sleep_mode,
+                           int hw_effect)
+{
+    int64_t now = esp_timer_get_time();
+    if (unicast == STROBE_UNICAST && intensity > 0 && sleep_mode == 1) {
+        push(&s_flashes, now);
+    } else if (unicast == PULSE_UNICAST && mode != MONITOR_MODE_SLEEP) {
+        if (s_pulse_prev >= 0 && s_pulse_prev < PULSE_MID && intensity >= PULSE_MID) {
+            push(&s_crossings, now);
+        }
+        s_pulse_prev = intensity;
+    }
+    __real_monitor_record(unicast, mode, intensity, cct_kelvin, hue, saturation, sleep_mode,
+                          hw_effect);
+}
+
+// Wakeups are late by up to 2 ms, one in 300 by 6-30 ms
+static int64_t lateness(const char *name, int64_t deadline_us, void *ctx)
+{
+    uint64_t r = rnd();
+    int64_t late = r % 300 == 0 ? 6000 + (int64_t)(r >> 32) % 24000
+                                : (int64_t)((r >> 16) % 2000);
+    if (late > s_max_late) s_max_late = late;
+    return late;
+}
+
+static bool null_send(transport_t *t, const uint8_t *pdu, int len)
+{
+    return true;
+}
+
+static bool null_is_up(transport_t *t)
+{
+    return true;
+}
+
+static transport_t s_null = { .name = "null", .send = null_send, .is_up = null_is_up };
+
+static void command(const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    cJSON *root = cJSON_Parse(buf);
+    if (!root || !command_dispatch(root)) {
+        fprintf(stderr, "timebase: command failed: %s\n", buf);
+        exit(2);
+    }
+    cJSON_Delete(root);
+}
+
+// MARK: - Analysis
+
+// Place events on slots t0 + k * period and fit a line through (k, t).
+// Fails if the fitted slope is off the period, an event is further from
+// its slot than `slack`, a slot holds two events or more than
+// `max_missed` of the slots are empty.
+static bool check(const char *name, const series_t *s, double period_us, double slack_us,
+                  double max_missed)
+{
+    if (s->n < 2) {
+        printf("FAIL %-7s %d events\n", name, s->n);
+        return false;
+    }
+    int64_t t0 = s->t[0];
+    int64_t last_k = -1;
+    int dup = 0;
+    double err_max = 0, err_end = 0;
+    double sk = 0, sx = 0, skk = 0, skx = 0;
+    int64_t end_from = s->t[s->n - 1] - HOUR_US;
+    for (int i = 0; i < s->n; i++) {
+        double x = (double)(s->t[i] - t0);
+        int64_t k = llround(x / period_us);
+        double err = fabs(x - k * period_us);
+        if (k == last_k) dup++;
+        last_k = k;
+        if (err > err_max) err_max = err;
+        if (s->t[i] >= end_from && err > err_end) err_end = err;
+        sk += k;
+        sx += x;
+        skk += (double)k * k;
+        skx += k * x;
+    }
+    double fitted = (s->n * skx - sk * sx) / (s->n * skk - sk * sk);
+    double missed = 1.0 - (double)s->n / (double)(last_k + 1);
+
+    bool ok = fabs(fitted - period_us) <= PERIOD_ERR_US && err_max <= slack_us && !dup &&
+              missed <= max_missed;
+    printf("%s %-7s %d events over %lld slots: period %.3f us (nominal %.3f), "
+           "phase error max %.0f us (last hour %.0f, limit %.0f), missed %.2f%%\n",
+           ok ? "  ok" : "FAIL", name, s->n, (long long)last_k + 1, fitted, period_us,
+           err_max, err_end, slack_us, missed * 100);
+    return ok;
+}
+
+// MARK: - Main
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --hours H     simulated hours to run (4, at most 24)\n"
+            "  --seed S      lateness and esp_random seed (1)\n"
+            "  -v            log the core's output\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option longopts[] = {
+        { "hours", required_argument, NULL, 'h' },
+        { "seed", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 },
+    };
+    host_log_level = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "v", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'h': s_opt.hours = atof(optarg); break;
+        case 's': s_opt.seed = strtoull(optarg, NULL, 0); break;
+        case 'v':
+            s_opt.verbose = true;
+            host_log_level = 3;
+            break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (s_opt.hours < 1 || s_opt.hours > MAX_HOURS || !s_opt.seed) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    s_rng = s_opt.seed;
+    platform_clock_virtual();
+    platform_random_seed(s_opt.seed);
+    platform_timer_set_lateness(lateness, NULL);
+    mesh_host_add_transport(&s_null);
+
+    heap_health_init();
+    light_registry_init();
+    effect_engine_init();
+    if (ble_mesh_init() != ESP_OK) return 1;
+
+    command("{\"cmd\":\"set_keys\",\"network_key\":\"7dd7364cd842ad18c17c2b820c84c3d6\","
+            "\"app_key\":\"63964771734fbd76e3b40519d1d94a48\",\"iv_index\":305419896,"
+            "\"src_address\":1}");
+    command("{\"cmd\":\"add_light\",\"id\":\"strobe\",\"unicast\":%d,\"name\":\"Strobe\"}",
+            STROBE_UNICAST);
+    command("{\"cmd\":\"add_light\",\"id\":\"pulse\",\"unicast\":%d,\"name\":\"Pulse\"}",
+            PULSE_UNICAST);
+    platform_timer_advance(2 * 1000000);
+
+    command("{\"cmd\":\"start_effect\",\"unicast\":%d,\"engine\":\"strobe\",\"params\":"
+            "{\"colorMode\":\"cct\",\"intensity\":80,\"cctKelvin\":5600,\"strobeHz\":%d}}",
+            STROBE_UNICAST, STROBE_HZ);
+    command("{\"cmd\":\"start_effect\",\"unicast\":%d,\"engine\":\"pulsing\",\"params\":"
+            "{\"colorMode\":\"cct\",\"intensity\":100,\"cctKelvin\":3200,\"frequency\":%d,"
+            "\"pulsingMin\":10,\"pulsingMax\":90,\"pulsingShape\":50}}",
+            PULSE_UNICAST, PULSE_FREQUENCY);
+
+    int64_t total = (int64_t)(s_opt.hours * HOUR_US);
+    for (int64_t run = 0; run < total; run += 1000000) {
+        platform_timer_advance(1000000);
+    }
+    command("{\"cmd\":\"stop_all\"}");
+
+    if (s_opt.verbose) {
+        printf("max injected lateness %lld us\n", (long long)s_max_late);
+    }
+
+    // A flash is never sent more than FLASH_SLACK_US after its slot. A
+    // crossing is seen on the first frame past mid-level, so it can sit
+    // up to a frame after the true crossing, plus that frame's lateness,
+    // either side of the first crossing's own offset.
+    double strobe_period = 1e6 / STROBE_HZ;
+    double pulse_period = 4.0 * pow(0.80, PULSE_FREQUENCY) * 1e6;
+    bool ok = check("strobe", &s_flashes, strobe_period, FLASH_SLACK_US + 1, 0.01);
+    ok = check("pulse", &s_crossings, pulse_period, 2.0 * (FRAME_US + s_max_late), 0) && ok;
+
+    printf("%s after %.1f simulated hours\n", ok ? "PASS" : "FAIL", s_opt.hours);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// How the host daemon reaches the mesh: anything that carries Mesh Proxy
+// PDUs both ways, the role a GATT proxy link has on the ESP32. The daemon
+// can hold one transport per radio (or simulator) and spread fixtures
+// over them.
+
+typedef struct transport transport_t;
+
+// A proxy PDU from the mesh, on the loop thread or the transport's own
+typedef void (*transport_rx_t)(transport_t *t, const uint8_t *pdu, int len, void *ctx);
+
+struct transport {
+    const char *name;
+    // Write one proxy PDU; false if it could not go out
+    bool (*send)(transport_t *t, const uint8_t *pdu, int len);
+    // Link up and able to carry traffic
+    bool (*is_up)(transport_t *t);
+    transport_rx_t on_rx;
+    void *rx_ctx;
+};
+
+// Loopback backend for the fixture simulator: each proxy PDU is one UDP
+// datagram to host:port, and each datagram back is a PDU from the mesh.
+// The link counts as up once the simulator has answered.
+transport_t *transport_loopback_open(const char *host, int port);
+
+// BlueZ backend: an LE ATT link to one Mesh Proxy node through the kernel's
+// L2CAP sockets. spec is the proxy's address, "AA:BB:CC:DD:EE:FF", with
+// "/random" for a random address and "@<adapter address>" to pick the
+// radio. The link connects in the background and reconnects when it drops.
+transport_t *transport_bluez_open(const char *spec);
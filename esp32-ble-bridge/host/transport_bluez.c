@@ -0,0 +1,436 @@
+/*
+ * transport_bluez.c
+ *
+ * Mesh Proxy links through the Linux Bluetooth stack: an LE L2CAP socket
+ * on the ATT channel to one proxy node, with just enough of a GATT client
+ * to find the Proxy service (0x1828), its Data In (0x2ADD) and Data Out
+ * (0x2ADE) characteristics and Data Out's CCCD. The kernel does the rest,
+ * so no BlueZ library is needed and bluetoothd can keep running.
+ *
+ * Each link has its own thread that connects, discovers, then blocks on
+ * notifications, reconnecting with backoff when the link drops.
+ */
+
+#include "transport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <endian.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "esp_log.h"
+
+static const char *TAG = "bluez";
+
+// From BlueZ's bluetooth.h and l2cap.h, which aren't installed everywhere
+#define BTPROTO_L2CAP       0
+#define BDADDR_LE_PUBLIC    0x01
+#define BDADDR_LE_RANDOM    0x02
+#define ATT_CID             4
+
+typedef struct {
+    uint8_t b[6];               // Little-endian, the reverse of the text form
+} __attribute__((packed)) bdaddr_t;
+
+struct sockaddr_l2 {
+    sa_family_t l2_family;
+    unsigned short l2_psm;
+    bdaddr_t l2_bdaddr;
+    unsigned short l2_cid;
+    uint8_t l2_bdaddr_type;
+};
+
+#define ATT_ERROR_RSP           0x01
+#define ATT_MTU_REQ             0x02
+#define ATT_MTU_RSP             0x03
+#define ATT_FIND_INFO_REQ       0x04
+#define ATT_FIND_INFO_RSP       0x05
+#define ATT_READ_BY_TYPE_REQ    0x08
+#define ATT_READ_BY_TYPE_RSP    0x09
+#define ATT_READ_BY_GROUP_REQ   0x10
+#define ATT_READ_BY_GROUP_RSP   0x11
+#define ATT_WRITE_REQ           0x12
+#define ATT_WRITE_RSP           0x13
+#define ATT_NOTIFY              0x1B
+#define ATT_INDICATE            0x1D
+#define ATT_CONFIRM             0x1E
+#define ATT_WRITE_CMD           0x52
+
+#define ATT_ERR_NOT_SUPPORTED   0x06
+#define ATT_ERR_NOT_FOUND       0x0A
+
+#define UUID_PRIMARY            0x2800
+#define UUID_CHARACTERISTIC     0x2803
+#define UUID_CCCD               0x2902
+#define UUID_PROXY_SERVICE      0x1828
+#define UUID_PROXY_DATA_IN      0x2ADD
+#define UUID_PROXY_DATA_OUT     0x2ADE
+
+#define LOCAL_MTU               185     // As ble_mesh.c asks for
+#define ATT_MTU_MIN             23
+#define RSP_TIMEOUT_S           5
+#define BACKOFF_MIN_MS          1000
+#define BACKOFF_MAX_MS          30000
+
+typedef struct {
+    transport_t base;
+    char name[32];
+    struct sockaddr_l2 local;
+    struct sockaddr_l2 peer;
+
+    pthread_mutex_t lock;       // fd and up, against send on the crypto workers
+    int fd;
+    atomic_bool up;
+    uint16_t mtu;
+    uint16_t data_in;           // Value handles
+    uint16_t data_out;
+} bluez_link_t;
+
+// "AA:BB:CC:DD:EE:FF" to the kernel's byte order
+static bool parse_bdaddr(const char *s, bdaddr_t *out)
+{
+    unsigned int b[6];
+    char tail;
+    if (sscanf(s, "%2x:%2x:%2x:%2x:%2x:%2x%c", &b[5], &b[4], &b[3], &b[2], &b[1], &b[0],
+               &tail) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) out->b[i] = (uint8_t)b[i];
+    return true;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+// MARK: - ATT
+
+// A request the proxy sends us. Only MTU exchange is answered; the rest
+// get "not supported", as we have no attributes of our own.
+static void answer_request(bluez_link_t *l, const uint8_t *req, int len)
+{
+    uint8_t rsp[5];
+    if (req[0] == ATT_MTU_REQ) {
+        rsp[0] = ATT_MTU_RSP;
+        put16(rsp + 1, LOCAL_MTU);
+        send(l->fd, rsp, 3, MSG_NOSIGNAL);
+        return;
+    }
+    rsp[0] = ATT_ERROR_RSP;
+    rsp[1] = req[0];
+    put16(rsp + 2, 0);
+    rsp[4] = ATT_ERR_NOT_SUPPORTED;
+    send(l->fd, rsp, 5, MSG_NOSIGNAL);
+}
+
+// Anything the proxy sends that isn't a response to us. Returns true if
+// the PDU was one of those and has been dealt with.
+static bool handle_unsolicited(bluez_link_t *l, const uint8_t *pdu, int len)
+{
+    switch (pdu[0]) {
+    case ATT_NOTIFY:
+        if (len > 3 && get16(pdu + 1) == l->data_out && l->base.on_rx) {
+            l->base.on_rx(&l->base, pdu + 3, len - 3, l->base.rx_ctx);
+        }
+        return true;
+    case ATT_INDICATE: {
+        uint8_t confirm = ATT_CONFIRM;
+        send(l->fd, &confirm, 1, MSG_NOSIGNAL);
+        return true;
+    }
+    case ATT_MTU_REQ: case ATT_FIND_INFO_REQ: case 0x06: case ATT_READ_BY_TYPE_REQ:
+    case 0x0A: case 0x0C: case 0x0E: case ATT_READ_BY_GROUP_REQ: case ATT_WRITE_REQ:
+    case 0x16: case 0x18: case 0x20:
+        answer_request(l, pdu, len);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Send a request and wait for its response. Returns the response length,
+// -code for an ATT error response, or 0 on a timeout or a dead link.
+static int att_request(bluez_link_t *l, const uint8_t *req, int req_len, uint8_t rsp_op,
+                       uint8_t *rsp, int rsp_max)
+{
+    if (send(l->fd, req, req_len, MSG_NOSIGNAL) != req_len) return 0;
+    for (;;) {
+        int len = recv(l->fd, rsp, rsp_max, 0);
+        if (len <= 0) return 0;
+        if (rsp[0] == rsp_op) return len;
+        if (rsp[0] == ATT_ERROR_RSP && len >= 5 && rsp[1] == req[0]) return -rsp[4];
+        handle_unsolicited(l, rsp, len);
+    }
+}
+
+static void exchange_mtu(bluez_link_t *l)
+{
+    uint8_t req[3] = { ATT_MTU_REQ };
+    uint8_t rsp[LOCAL_MTU];
+    put16(req + 1, LOCAL_MTU);
+    int len = att_request(l, req, sizeof(req), ATT_MTU_RSP, rsp, sizeof(rsp));
+    uint16_t server = len >= 3 ? get16(rsp + 1) : ATT_MTU_MIN;
+    l->mtu = server < ATT_MTU_MIN ? ATT_MTU_MIN : server < LOCAL_MTU ? server : LOCAL_MTU;
+}
+
+// Handle range of the Proxy service
+static bool find_service(bluez_link_t *l, uint16_t *start, uint16_t *end)
+{
+    uint8_t req[7] = { ATT_READ_BY_GROUP_REQ };
+    uint8_t rsp[LOCAL_MTU];
+    uint16_t from = 0x0001;
+    while (from) {
+        put16(req + 1, from);
+        put16(req + 3, 0xFFFF);
+        put16(req + 5, UUID_PRIMARY);
+        int len = att_request(l, req, sizeof(req), ATT_READ_BY_GROUP_RSP, rsp, sizeof(rsp));
+        if (len < 2 || rsp[1] < 4) return false;
+        int step = rsp[1];
+        uint16_t last = 0;
+        for (int at = 2; at + step <= len; at += step) {
+            last = get16(rsp + at + 2);
+            if (step == 6 && get16(rsp + at + 4) == UUID_PROXY_SERVICE) {
+                *start = get16(rsp + at);
+                *end = last;
+                return true;
+            }
+        }
+        from = last == 0xFFFF || last < from ? 0 : last + 1;
+    }
+    return false;
+}
+
+// Value handles of Data In and Data Out within the service
+static bool find_characteristics(bluez_link_t *l, uint16_t start, uint16_t end)
+{
+    uint8_t req[7] = { ATT_READ_BY_TYPE_REQ };
+    uint8_t rsp[LOCAL_MTU];
+    l->data_in = l->data_out = 0;
+    uint16_t from = start;
+    while (from && from <= end) {
+        put16(req + 1, from);
+        put16(req + 3, end);
+        put16(req + 5, UUID_CHARACTERISTIC);
+        int len = att_request(l, req, sizeof(req), ATT_READ_BY_TYPE_RSP, rsp, sizeof(rsp));
+        if (len < 2 || rsp[1] < 5) break;
+        int step = rsp[1];
+        uint16_t last = 0;
+        // Declaration handle, properties, value handle, UUID
+        for (int at = 2; at + step <= len; at += step) {
+            last = get16(rsp + at);
+            if (step != 7) continue;
+            uint16_t uuid = get16(rsp + at + 5);
+            if (uuid == UUID_PROXY_DATA_IN) l->data_in = get16(rsp + at + 3);
+            if (uuid == UUID_PROXY_DATA_OUT) l->data_out = get16(rsp + at + 3);
+        }
+        from = last == 0xFFFF || last < from ? 0 : last + 1;
+    }
+    return l->data_in && l->data_out;
+}
+
+// Data Out's CCCD: the first 0x2902 after its value, before the next
+// characteristic
+static uint16_t find_cccd(bluez_link_t *l, uint16_t end)
+{
+    uint8_t req[5] = { ATT_FIND_INFO_REQ };
+    uint8_t rsp[LOCAL_MTU];
+    uint16_t from = l->data_out + 1;
+    while (from && from <= end) {
+        put16(req + 1, from);
+        put16(req + 3, end);
+        int len = att_request(l, req, sizeof(req), ATT_FIND_INFO_RSP, rsp, sizeof(rsp));
+        if (len < 2 || rsp[1] != 0x01) return 0;      // 16-bit UUIDs only
+        uint16_t last = 0;
+        for (int at = 2; at + 4 <= len; at += 4) {
+            last = get16(rsp + at);
+            uint16_t uuid = get16(rsp + at + 2);
+            if (uuid == UUID_CCCD) return last;
+            if (uuid == UUID_CHARACTERISTIC) return 0;
+        }
+        from = last == 0xFFFF || last < from ? 0 : last + 1;
+    }
+    return 0;
+}
+
+static bool enable_notifications(bluez_link_t *l, uint16_t cccd)
+{
+    uint8_t req[5] = { ATT_WRITE_REQ };
+    uint8_t rsp[LOCAL_MTU];
+    put16(req + 1, cccd);
+    put16(req + 3, 0x0001);
+    return att_request(l, req, sizeof(req), ATT_WRITE_RSP, rsp, sizeof(rsp)) > 0;
+}
+
+// MARK: - Link thread
+
+static bool link_connect(bluez_link_t *l)
+{
+    int fd = socket(AF_BLUETOOTH, SOCK_SEQPACKET | SOCK_CLOEXEC, BTPROTO_L2CAP);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "%s: no Bluetooth socket: %d", l->name, errno);
+        return false;
+    }
+    struct timeval tv = { .tv_sec = RSP_TIMEOUT_S };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (bind(fd, (struct sockaddr *)&l->local, sizeof(l->local)) < 0 ||
+        connect(fd, (struct sockaddr *)&l->peer, sizeof(l->peer)) < 0) {
+        ESP_LOGD(TAG, "%s: connect failed: %d", l->name, errno);
+        close(fd);
+        return false;
+    }
+    l->fd = fd;
+
+    uint16_t start, end, cccd;
+    exchange_mtu(l);
+    if (!find_service(l, &start, &end)) {
+        ESP_LOGW(TAG, "%s: no Mesh Proxy service", l->name);
+    } else if (!find_characteristics(l, start, end)) {
+        ESP_LOGW(TAG, "%s: Mesh Proxy characteristics missing", l->name);
+    } else if (!(cccd = find_cccd(l, end)) || !enable_notifications(l, cccd)) {
+        ESP_LOGW(TAG, "%s: can't enable Data Out notifications", l->name);
+    } else {
+        ESP_LOGI(TAG, "%s: proxy ready, MTU %u, data in 0x%04X, out 0x%04X",
+                 l->name, l->mtu, l->data_in, l->data_out);
+        return true;
+    }
+    l->fd = -1;
+    close(fd);
+    return false;
+}
+
+static void *link_main(void *arg)
+{
+    bluez_link_t *l = arg;
+    uint32_t backoff = BACKOFF_MIN_MS;
+    uint8_t pdu[LOCAL_MTU];
+
+    for (;;) {
+        if (!link_connect(l)) {
+            usleep(backoff * 1000);
+            backoff = backoff * 2 > BACKOFF_MAX_MS ? BACKOFF_MAX_MS : backoff * 2;
+            continue;
+        }
+        backoff = BACKOFF_MIN_MS;
+        pthread_mutex_lock(&l->lock);
+        atomic_store(&l->up, true);
+        pthread_mutex_unlock(&l->lock);
+
+        // SO_RCVTIMEO still applies; a timeout is just a quiet link
+        for (;;) {
+            int len = recv(l->fd, pdu, sizeof(pdu), 0);
+            if (len > 0) {
+                handle_unsolicited(l, pdu, len);
+            } else if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+                break;
+            }
+        }
+
+        ESP_LOGW(TAG, "%s: link lost", l->name);
+        pthread_mutex_lock(&l->lock);
+        atomic_store(&l->up, false);
+        close(l->fd);
+        l->fd = -1;
+        pthread_mutex_unlock(&l->lock);
+    }
+    return NULL;
+}
+
+// MARK: - transport_t
+
+// Write Without Response to Data In, split with proxy SAR when the PDU
+// doesn't fit the MTU
+static bool bz_send(transport_t *t, const uint8_t *pdu, int len)
+{
+    bluez_link_t *l = (bluez_link_t *)t;
+    uint8_t buf[3 + LOCAL_MTU];
+    bool ok = true;
+
+    pthread_mutex_lock(&l->lock);
+    if (!atomic_load(&l->up) || len < 1) {
+        pthread_mutex_unlock(&l->lock);
+        return false;
+    }
+    int room = l->mtu - 3;
+    buf[0] = ATT_WRITE_CMD;
+    put16(buf + 1, l->data_in);
+    if (len <= room) {
+        memcpy(buf + 3, pdu, len);
+        ok = send(l->fd, buf, 3 + len, MSG_NOSIGNAL | MSG_DONTWAIT) == 3 + len;
+    } else {
+        uint8_t type = pdu[0] & 0x3F;
+        int at = 1;
+        while (ok && at < len) {
+            int chunk = len - at < room - 1 ? len - at : room - 1;
+            uint8_t sar = at == 1 ? 0x40 : at + chunk == len ? 0xC0 : 0x80;
+            buf[3] = sar | type;
+            memcpy(buf + 4, pdu + at, chunk);
+            ok = send(l->fd, buf, 4 + chunk, MSG_NOSIGNAL | MSG_DONTWAIT) == 4 + chunk;
+            at += chunk;
+        }
+    }
+    pthread_mutex_unlock(&l->lock);
+    return ok;
+}
+
+static bool bz_is_up(transport_t *t)
+{
+    return atomic_load(&((bluez_link_t *)t)->up);
+}
+
+transport_t *transport_bluez_open(const char *spec)
+{
+    // ADDR[/random][@LOCAL]
+    char peer[18] = "", local[18] = "";
+    const char *at = strchr(spec, '@');
+    const char *slash = strchr(spec, '/');
+    size_t peer_len = slash ? (size_t)(slash - spec) : at ? (size_t)(at - spec) : strlen(spec);
+    bool random_addr = slash && strncmp(slash + 1, "random", 6) == 0;
+
+    bluez_link_t *l = calloc(1, sizeof(*l));
+    if (!l) return NULL;
+    if (peer_len < sizeof(peer)) memcpy(peer, spec, peer_len);
+    if (at) snprintf(local, sizeof(local), "%s", at + 1);
+
+    l->peer.l2_family = AF_BLUETOOTH;
+    l->peer.l2_cid = htole16(ATT_CID);
+    l->peer.l2_bdaddr_type = random_addr ? BDADDR_LE_RANDOM : BDADDR_LE_PUBLIC;
+    l->local.l2_family = AF_BLUETOOTH;
+    l->local.l2_cid = htole16(ATT_CID);
+    l->local.l2_bdaddr_type = BDADDR_LE_PUBLIC;
+    if (!parse_bdaddr(peer, &l->peer.l2_bdaddr) ||
+        (local[0] && !parse_bdaddr(local, &l->local.l2_bdaddr))) {
+        ESP_LOGE(TAG, "Bad proxy address %s", spec);
+        free(l);
+        return NULL;
+    }
+
+    snprintf(l->name, sizeof(l->name), "bluez %s", peer);
+    pthread_mutex_init(&l->lock, NULL);
+    l->fd = -1;
+    l->mtu = ATT_MTU_MIN;
+    l->base.name = l->name;
+    l->base.send = bz_send;
+    l->base.is_up = bz_is_up;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, link_main, l) != 0) {
+        ESP_LOGE(TAG, "%s: no thread", l->name);
+        free(l);
+        return NULL;
+    }
+    pthread_detach(thread);
+    ESP_LOGI(TAG, "Mesh proxy %s%s", peer, random_addr ? " (random address)" : "");
+    return &l->base;
+}
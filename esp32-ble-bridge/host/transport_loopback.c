@@ -0,0 +1,81 @@
+/*
+ * transport_loopback.c
+ *
+ * Proxy PDUs over localhost UDP, for running against a fixture simulator.
+ */
+
+#include "transport.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "esp_log.h"
+#include "event_loop.h"
+
+static const char *TAG = "loopback";
+
+typedef struct {
+    transport_t base;
+    int sock;
+    struct sockaddr_in sim;
+    bool heard;             // The simulator has sent something back
+} loopback_t;
+
+static bool lb_send(transport_t *t, const uint8_t *pdu, int len)
+{
+    loopback_t *lb = (loopback_t *)t;
+    return send(lb->sock, pdu, len, 0) == len;
+}
+
+// Polled once a second. Until the simulator answers, each poll sends it an
+// empty datagram so it learns where the bridge is.
+static bool lb_is_up(transport_t *t)
+{
+    loopback_t *lb = (loopback_t *)t;
+    if (!lb->heard) send(lb->sock, "", 0, 0);
+    return lb->heard;
+}
+
+static void lb_readable(int fd, void *ctx)
+{
+    loopback_t *lb = ctx;
+    uint8_t buf[64];
+    int len = recv(fd, buf, sizeof(buf), 0);
+    if (len <= 0) return;
+
+    if (!lb->heard) ESP_LOGI(TAG, "Simulator answered");
+    lb->heard = true;
+    if (lb->base.on_rx) lb->base.on_rx(&lb->base, buf, len, lb->base.rx_ctx);
+}
+
+transport_t *transport_loopback_open(const char *host, int port)
+{
+    loopback_t *lb = calloc(1, sizeof(*lb));
+    if (!lb) return NULL;
+
+    lb->sim.sin_family = AF_INET;
+    lb->sim.sin_port = htons(port);
+    if (!inet_aton(host, &lb->sim.sin_addr)) {
+        ESP_LOGE(TAG, "Bad simulator address %s", host);
+        free(lb);
+        return NULL;
+    }
+
+    // Connected, so only the simulator's datagrams come back on it
+    lb->sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (lb->sock < 0 || connect(lb->sock, (struct sockaddr *)&lb->sim, sizeof(lb->sim)) < 0 ||
+        loop_add_fd(lb->sock, lb_readable, lb) < 0) {
+        ESP_LOGE(TAG, "Can't reach %s:%d: %d", host, port, errno);
+        if (lb->sock >= 0) close(lb->sock);
+        free(lb);
+        return NULL;
+    }
+
+    lb->base.name = "loopback";
+    lb->base.send = lb_send;
+    lb->base.is_up = lb_is_up;
+    ESP_LOGI(TAG, "Fixture simulator at %s:%d", host, port);
+    return &lb->base;
+}
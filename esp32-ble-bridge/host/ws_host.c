@@ -0,0 +1,465 @@
+/*
+ * ws_host.c
+ *
+ * ws_server.h on the host daemon: the phone's WebSocket (RFC 6455) on the
+ * epoll loop, with the ESP32 server's one-client behaviour. Events go to
+ * the phone when it is here and through the cluster otherwise.
+ */
+
+#include "ws_host.h"
+#include "ws_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+
+#include "command.h"
+#include "cluster.h"
+#include "mesh_crypto.h"
+#include "light_registry.h"
+#include "monitor.h"
+#include "cue_player.h"
+#include "event_loop.h"
+
+static const char *TAG = "ws_host";
+
+#define WS_DEFAULT_PORT     8765
+#define WS_HANDSHAKE_MAX    4096
+#define WS_MESSAGE_MAX      (64 * 1024)
+#define WS_SEND_TIMEOUT_MS  1000
+#define WS_GUID             "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+enum {
+    OP_CONT = 0x0, OP_TEXT = 0x1, OP_BINARY = 0x2,
+    OP_CLOSE = 0x8, OP_PING = 0x9, OP_PONG = 0xA,
+};
+
+static int s_listen = -1;
+static uint32_t s_boot_id = 0;
+
+// The connection is read on the loop thread; sends come from any thread
+// and hold s_lock for a whole frame, so frames never interleave.
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static int s_fd = -1;
+static bool s_upgraded = false;
+
+// Loop thread only
+static uint8_t *s_rx = NULL;        // Bytes not yet parsed
+static size_t s_rx_len = 0;
+static uint8_t *s_msg = NULL;       // Fragments of the current message
+static size_t s_msg_len = 0;
+static uint8_t s_msg_op = 0;
+
+// MARK: - Send
+
+static bool write_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static esp_err_t send_frame(uint8_t op, const uint8_t *data, size_t len)
+{
+    uint8_t hdr[10];
+    size_t h = 0;
+    hdr[h++] = 0x80 | op;
+    if (len < 126) {
+        hdr[h++] = (uint8_t)len;
+    } else if (len <= 0xFFFF) {
+        hdr[h++] = 126;
+        hdr[h++] = (uint8_t)(len >> 8);
+        hdr[h++] = (uint8_t)len;
+    } else {
+        hdr[h++] = 127;
+        for (int i = 7; i >= 0; i--) hdr[h++] = (uint8_t)((uint64_t)len >> (i * 8));
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_fd < 0 || !s_upgraded) {
+        portEXIT_CRITICAL(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    bool ok = write_all(s_fd, hdr, h) && write_all(s_fd, data, len);
+    portEXIT_CRITICAL(&s_lock);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+// MARK: - Connection
+
+static void drop_client(const char *why)
+{
+    portENTER_CRITICAL(&s_lock);
+    int fd = s_fd;
+    bool was_up = s_upgraded;
+    s_fd = -1;
+    s_upgraded = false;
+    portEXIT_CRITICAL(&s_lock);
+    if (fd < 0) return;
+
+    loop_remove_fd(fd);
+    close(fd);
+    free(s_rx);
+    free(s_msg);
+    s_rx = s_msg = NULL;
+    s_rx_len = s_msg_len = 0;
+    ESP_LOGI(TAG, "WebSocket client %s", why);
+    if (was_up) monitor_stop();
+}
+
+// The ESP32's ready event, without the UDP session (no UDP channel here)
+// or show CRCs (no show store)
+static void send_ready(void)
+{
+    char msg[896];
+    int pos = 0;
+
+    char cues_hex[9] = "";
+    uint32_t crc;
+    if (cue_player_digest(&crc)) snprintf(cues_hex, sizeof(cues_hex), "%08lX", (unsigned long)crc);
+
+    char keys_hex[17] = "";
+    uint8_t kd[8];
+    if (mesh_crypto_keys_digest(kd)) {
+        for (int i = 0; i < 8; i++) {
+            snprintf(keys_hex + i * 2, 3, "%02X", kd[i]);
+        }
+    }
+
+    pos += snprintf(msg + pos, sizeof(msg) - pos,
+                    "{\"event\":\"ready\",\"version\":\"1.0\",\"max_lights\":%d,"
+                    "\"boot_id\":\"%08lX\",\"keys\":\"%s\",\"registry\":\"%08lX\","
+                    "\"registry_version\":%lu,\"shadow\":\"%08lX\",\"cues\":\"%s\",\"lights\":[",
+                    MAX_LIGHTS, (unsigned long)s_boot_id, keys_hex,
+                    (unsigned long)light_registry_digest(),
+                    (unsigned long)light_registry_version(),
+                    (unsigned long)light_registry_shadow_digest(), cues_hex);
+
+    light_entry_t light;
+    bool first = true;
+    for (int i = 0; i < MAX_LIGHTS && pos < (int)sizeof(msg); i++) {
+        if (!light_registry_read_slot(i, &light)) continue;
+        pos += snprintf(msg + pos, sizeof(msg) - pos,
+                        "%s{\"unicast\":%d,\"hash\":\"%08lX\"}",
+                        first ? "" : ",", light.unicast,
+                        (unsigned long)light_registry_entry_digest(&light));
+        first = false;
+    }
+    if (pos < (int)sizeof(msg)) {
+        snprintf(msg + pos, sizeof(msg) - pos, "]}");
+    }
+    ws_server_send(msg);
+}
+
+// Value of an HTTP header in a NUL-terminated request, trimmed, or NULL
+static const char *header(char *req, const char *name, size_t *len)
+{
+    size_t n = strlen(name);
+    for (char *line = strstr(req, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, n) != 0 || line[n] != ':') continue;
+        char *v = line + n + 1;
+        while (*v == ' ' || *v == '\t') v++;
+        char *end = strstr(v, "\r\n");
+        if (!end) return NULL;
+        while (end > v && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        *len = end - v;
+        return v;
+    }
+    return NULL;
+}
+
+static bool handshake(int fd)
+{
+    char *req = (char *)s_rx;
+    req[s_rx_len] = '\0';
+
+    size_t key_len = 0;
+    const char *key = header(req, "Sec-WebSocket-Key", &key_len);
+    if (strncmp(req, "GET /ws ", 8) != 0 || !key || key_len == 0 || key_len > 64) {
+        static const char bad[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        write_all(fd, (const uint8_t *)bad, sizeof(bad) - 1);
+        return false;
+    }
+
+    char concat[64 + sizeof(WS_GUID)];
+    memcpy(concat, key, key_len);
+    memcpy(concat + key_len, WS_GUID, sizeof(WS_GUID) - 1);
+    uint8_t digest[20];
+    unsigned char accept[32];
+    size_t accept_len = 0;
+    mbedtls_sha1((const unsigned char *)concat, key_len + sizeof(WS_GUID) - 1, digest);
+    mbedtls_base64_encode(accept, sizeof(accept), &accept_len, digest, sizeof(digest));
+
+    char resp[192];
+    int n = snprintf(resp, sizeof(resp),
+                     "HTTP/1.1 101 Switching Protocols\r\n"
+                     "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                     "Sec-WebSocket-Accept: %.*s\r\n\r\n", (int)accept_len, accept);
+    return write_all(fd, (const uint8_t *)resp, n);
+}
+
+static void handle_command(cJSON *root)
+{
+    // Another bridge of the cluster may own this
+    if (cluster_route(root)) return;
+    ws_server_dispatch(root);
+}
+
+static void handle_message(uint8_t op, uint8_t *data, size_t len)
+{
+    if (op != OP_TEXT) return;
+    data[len] = '\0';
+    ESP_LOGD(TAG, "RX: %s", (char *)data);
+    cJSON *root = cJSON_Parse((char *)data);
+    if (root) {
+        handle_command(root);
+        cJSON_Delete(root);
+    } else {
+        ESP_LOGE(TAG, "Failed to parse JSON");
+    }
+}
+
+// Parse every complete frame in s_rx. false when the client must go.
+static bool parse_frames(void)
+{
+    size_t pos = 0;
+    while (s_rx_len - pos >= 2) {
+        const uint8_t *f = s_rx + pos;
+        bool fin = f[0] & 0x80;
+        uint8_t op = f[0] & 0x0F;
+        if (!(f[1] & 0x80)) return false;               // Clients must mask
+        uint64_t len = f[1] & 0x7F;
+        size_t h = 2;
+        if (len == 126) {
+            if (s_rx_len - pos < 4) break;
+            len = (f[2] << 8) | f[3];
+            h = 4;
+        } else if (len == 127) {
+            if (s_rx_len - pos < 10) break;
+            len = 0;
+            for (int i = 0; i < 8; i++) len = (len << 8) | f[2 + i];
+            h = 10;
+        }
+        if (len > WS_MESSAGE_MAX) return false;
+        if (s_rx_len - pos < h + 4 + len) break;
+
+        uint8_t *payload = s_rx + pos + h + 4;
+        for (size_t i = 0; i < len; i++) payload[i] ^= f[h + (i & 3)];
+        pos += h + 4 + len;
+
+        if (op == OP_CLOSE) {
+            send_frame(OP_CLOSE, payload, len >= 2 ? 2 : 0);
+            return false;
+        }
+        if (op == OP_PING) {
+            send_frame(OP_PONG, payload, len);
+            continue;
+        }
+        if (op == OP_PONG) continue;
+
+        if (op != OP_CONT) {
+            s_msg_op = op;
+            s_msg_len = 0;
+        }
+        if (s_msg_len + len > WS_MESSAGE_MAX) return false;
+        uint8_t *grown = realloc(s_msg, s_msg_len + len + 1);
+        if (!grown) return false;
+        s_msg = grown;
+        memcpy(s_msg + s_msg_len, payload, len);
+        s_msg_len += len;
+        if (fin) {
+            handle_message(s_msg_op, s_msg, s_msg_len);
+            s_msg_len = 0;
+        }
+    }
+
+    memmove(s_rx, s_rx + pos, s_rx_len - pos);
+    s_rx_len -= pos;
+    return true;
+}
+
+static void client_readable(int fd, void *ctx)
+{
+    size_t cap = s_upgraded ? WS_MESSAGE_MAX + 14 : WS_HANDSHAKE_MAX;
+    if (!s_rx) s_rx = malloc(WS_MESSAGE_MAX + 15);
+    if (!s_rx) {
+        drop_client("dropped (no memory)");
+        return;
+    }
+
+    ssize_t n = recv(fd, s_rx + s_rx_len, cap - s_rx_len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {
+        drop_client("disconnected");
+        return;
+    }
+    s_rx_len += n;
+
+    if (!s_upgraded) {
+        s_rx[s_rx_len] = '\0';
+        char *end = strstr((char *)s_rx, "\r\n\r\n");
+        if (!end) {
+            if (s_rx_len >= cap) drop_client("dropped (oversized handshake)");
+            return;
+        }
+        if (!handshake(fd)) {
+            drop_client("rejected");
+            return;
+        }
+        // Frames may follow the request in the same read
+        size_t used = (uint8_t *)end + 4 - s_rx;
+        memmove(s_rx, s_rx + used, s_rx_len - used);
+        s_rx_len -= used;
+        portENTER_CRITICAL(&s_lock);
+        s_upgraded = true;
+        portEXIT_CRITICAL(&s_lock);
+        ESP_LOGI(TAG, "WebSocket client connected (fd=%d)", fd);
+        monitor_stop();     // A new client subscribes for itself
+        send_ready();
+        if (!s_rx_len) return;
+    }
+
+    if (!parse_frames()) drop_client("disconnected");
+}
+
+// One phone at a time, as on the ESP32: a new connection replaces the old
+static void listen_readable(int fd, void *ctx)
+{
+    int c = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if (c < 0) return;
+
+    drop_client("replaced");
+    int on = 1;
+    setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct timeval tv = { .tv_sec = WS_SEND_TIMEOUT_MS / 1000,
+                          .tv_usec = (WS_SEND_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (loop_add_fd(c, client_readable, NULL) < 0) {
+        close(c);
+        return;
+    }
+    portENTER_CRITICAL(&s_lock);
+    s_fd = c;
+    s_upgraded = false;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+// MARK: - ws_server.h
+
+esp_err_t ws_host_start(int port)
+{
+    if (s_listen >= 0) return ESP_OK;
+    s_boot_id = esp_random();
+
+    int sock = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return ESP_FAIL;
+    int on = 1, off = 0;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    struct sockaddr_in6 a = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(port),
+        .sin6_addr = IN6ADDR_ANY_INIT,
+    };
+    if (bind(sock, (struct sockaddr *)&a, sizeof(a)) < 0 || listen(sock, 4) < 0 ||
+        loop_add_fd(sock, listen_readable, NULL) < 0) {
+        ESP_LOGE(TAG, "WebSocket server on port %d failed: %s", port, strerror(errno));
+        close(sock);
+        return ESP_FAIL;
+    }
+    s_listen = sock;
+    ESP_LOGI(TAG, "WebSocket server on port %d", port);
+    return ESP_OK;
+}
+
+esp_err_t ws_server_start(void)
+{
+    return ws_host_start(WS_DEFAULT_PORT);
+}
+
+esp_err_t ws_server_send(const char *json_str)
+{
+    if (!ws_server_has_client()) {
+        // The phone may be on another bridge of the cluster
+        return cluster_relay_event(json_str) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = send_frame(OP_TEXT, (const uint8_t *)json_str, strlen(json_str));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send WS frame: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+esp_err_t ws_server_send_binary(const uint8_t *data, size_t len)
+{
+    return send_frame(OP_BINARY, data, len);
+}
+
+esp_err_t ws_server_send_event(const char *event_type, const char *json_body)
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf), "{\"event\":\"%s\",%s}", event_type, json_body);
+    return ws_server_send(buf);
+}
+
+bool ws_server_has_client(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    bool up = s_fd >= 0 && s_upgraded;
+    portEXIT_CRITICAL(&s_lock);
+    return up;
+}
+
+void ws_server_notify_light_status(uint16_t unicast, bool connected)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf),
+             "{\"event\":\"light_status\",\"unicast\":%d,\"connected\":%s}",
+             unicast, connected ? "true" : "false");
+    ws_server_send(buf);
+}
+
+void ws_server_notify_error(const char *message)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"event\":\"error\",\"message\":\"%s\"}", message);
+    ws_server_send(buf);
+}
+
+esp_err_t ws_server_queue_work(void (*fn)(void *arg), void *arg)
+{
+    return loop_post(fn, arg) == 0 ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+// Only the shared commands; the radio-specific ones have no radio here
+void ws_server_dispatch(cJSON *root)
+{
+    cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
+    if (!cmd || !cJSON_IsString(cmd)) {
+        ESP_LOGE(TAG, "Missing 'cmd' field");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Command: %s", cmd->valuestring);
+    if (!command_dispatch(root)) {
+        ESP_LOGW(TAG, "%s isn't supported on the host bridge", cmd->valuestring);
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "esp_err.h"
+
+// Start the phone's WebSocket server (ws_server.h) on port, on the event
+// loop. ws_server_start uses the ESP32's port, 8765.
+esp_err_t ws_host_start(int port);
@@ -7,11 +7,26 @@
 #include "esp_gattc_api.h"
 #include "esp_gatt_defs.h"
 #include "esp_gatt_common_api.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#if CONFIG_ESP_COEX_SW_COEXIST_ENABLE
+#include "esp_coexist.h"
+#endif
 
 #include "mesh_crypto.h"
+#include "mesh_adv.h"
 #include "sidus_protocol.h"
 #include "light_registry.h"
 #include "ws_server.h"
+#include "provisioner.h"
+#include "provisioner_gatt.h"
+#include "mesh_config.h"
+#include "monitor.h"
+#include "mesh_capture.h"
+#include "topology.h"
+#include "checkpoint.h"
+#include "rules.h"
 
 static const char *TAG = "ble_mesh";
 
@@ -35,7 +50,35 @@ static esp_bt_uuid_t mesh_proxy_data_out_uuid = {
 
 #define GATTC_APP_ID 0
 #define INVALID_HANDLE 0
-#define MAX_PROXY_CONNECTIONS 4
+
+#ifndef CONFIG_BRIDGE_PROXY_CONNECTIONS
+#define CONFIG_BRIDGE_PROXY_CONNECTIONS 4
+#endif
+#ifndef CONFIG_BRIDGE_HOT_PROXY_LINKS
+#define CONFIG_BRIDGE_HOT_PROXY_LINKS 2
+#endif
+#ifndef CONFIG_BRIDGE_HOT_RATE_MIN
+#define CONFIG_BRIDGE_HOT_RATE_MIN 8
+#endif
+
+// Each proxy link is one ACL connection; the controller allows 9
+#define MAX_PROXY_CONNECTIONS CONFIG_BRIDGE_PROXY_CONNECTIONS
+#if MAX_PROXY_CONNECTIONS > 9
+#error "CONFIG_BRIDGE_PROXY_CONNECTIONS exceeds the controller's 9 connections"
+#endif
+
+// Hot fixtures: the busiest lights get a direct proxy link and TTL 0 traffic.
+// A light turns hot at HOT_RATE_MIN msg/s and cools below half of that.
+#define HOT_PROXY_LINKS     CONFIG_BRIDGE_HOT_PROXY_LINKS
+#define HOT_RATE_MIN        ((float)CONFIG_BRIDGE_HOT_RATE_MIN)
+#define RATE_SAMPLE_MS      1000
+#define RATE_ALPHA          0.5f     // EWMA weight of the newest sample
+#define HOT_SCAN_SECONDS    5
+#define HOT_SCAN_BACKOFF_MS 30000    // Scanning steals airtime from live links
+
+// Shadow replay pacing: one light per tick keeps a recovery burst well under
+// what a single proxy link can carry alongside live effect traffic.
+#define RESYNC_INTERVAL_MS 60
 
 // Per-proxy connection state
 typedef struct {
@@ -45,13 +88,63 @@ typedef struct {
     esp_gatt_if_t gattc_if;
     uint16_t data_in_handle;  // 2ADD
     bool ready;               // Service discovery complete, can send PDUs
+    uint16_t node_unicast;    // Fixture behind this link, 0 if unknown
+    bool evicting;            // Closed by us to make room for a hot fixture
+    uint8_t rx_buf[MESH_PDU_MAX];   // Proxy SAR reassembly of incoming PDUs
+    int rx_len;
 } proxy_conn_t;
 
+// Outgoing message rate for one light
+typedef struct {
+    uint16_t unicast;         // 0 = free
+    uint16_t count;           // PDUs since the last sample
+    float rate;               // Smoothed msg/s
+    bool hot;
+} rate_entry_t;
+
 static proxy_conn_t s_proxies[MAX_PROXY_CONNECTIONS];
 static int s_proxy_count = 0;
 static bool s_scanning = false;
 static esp_gatt_if_t s_gattc_if = ESP_GATT_IF_NONE;
 
+static esp_timer_handle_t s_resync_timer = NULL;
+static bool s_resync_running = false;
+static bool s_resync_all_on_ready = false;  // A link dropped or mesh went dark
+
+static mesh_bearer_mode_t s_bearer = MESH_BEARER_GATT;
+
+static ble_link_params_t s_link = {
+    .scan_interval = 0x50,
+    .scan_window = 0x30,
+};
+
+// Rates are counted on the send path (httpd and effect timer tasks) and
+// sampled on the esp_timer task; s_hot is read from the BTC task.
+static rate_entry_t s_rates[MAX_LIGHTS];
+static uint16_t s_hot[MAX_LIGHTS];          // Hot lights that should get a link
+static int s_hot_count = 0;
+static portMUX_TYPE s_rate_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_rate_timer = NULL;
+static int64_t s_last_hot_scan_us = 0;
+
+// Proxy writes and congestion, for the coexistence report. Writes less
+// than BURST_GAP_US apart count as one burst.
+#define BURST_GAP_US 2000
+static ble_tx_stats_t s_tx;
+static int64_t s_last_write_us = 0;
+static uint32_t s_window_writes = 0;        // Since the last rate tick
+static int64_t s_congested_since[MAX_PROXY_CONNECTIONS];
+static uint32_t s_conn_int_us[MAX_PROXY_CONNECTIONS];   // Per link, 0 until negotiated
+static bool s_coex_traffic = false;
+
+// Hot fixture to connect once the proxy evicted for it has closed
+static struct {
+    bool valid;
+    uint8_t bda[6];
+    esp_ble_addr_type_t addr_type;
+    uint16_t unicast;
+} s_pending_hot;
+
 // Forward declarations
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
 static void gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
@@ -59,7 +152,19 @@ static void gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_
 static proxy_conn_t *find_proxy_by_conn_id(uint16_t conn_id);
 static proxy_conn_t *find_proxy_by_addr(const uint8_t *addr);
 static proxy_conn_t *alloc_proxy_slot(void);
+static proxy_conn_t *find_proxy_by_node(uint16_t unicast);
+static void open_proxy(proxy_conn_t *slot, const uint8_t *bda,
+                       esp_ble_addr_type_t addr_type, uint16_t node);
+static bool is_hot(uint16_t unicast);
+static int hot_links_missing(void);
+static bool evict_general_proxy(void);
 static void notify_all_registered_lights(bool connected);
+static void proxy_rx(proxy_conn_t *p, const uint8_t *data, int len);
+static void resync_start(void);
+static esp_err_t start_scan(uint32_t seconds);
+static void request_conn_params(proxy_conn_t *p);
+static void coex_update(bool traffic);
+static void set_conn_interval(int slot, uint32_t us);
 
 // Check if advertisement contains mesh proxy service (0x1828)
 static bool adv_has_mesh_proxy_service(uint8_t *adv_data, uint8_t adv_len)
@@ -84,6 +189,32 @@ static bool adv_has_mesh_proxy_service(uint8_t *adv_data, uint8_t adv_len)
     return false;
 }
 
+// Node Identity advertisement: Service Data (0x16) for 0x1828 with
+// identification type 0x01, then hash(8) and random(8). Returns the
+// registered light it belongs to, or 0.
+static uint16_t adv_node_identity(const uint8_t *adv_data, int adv_len)
+{
+    int offset = 0;
+    while (offset < adv_len) {
+        uint8_t field_len = adv_data[offset];
+        if (field_len == 0 || offset + field_len >= adv_len) break;
+
+        const uint8_t *f = &adv_data[offset + 1];
+        if (field_len >= 20 && f[0] == 0x16 && f[1] == 0x28 && f[2] == 0x18 && f[3] == 0x01) {
+            uint16_t candidates[MAX_LIGHTS];
+            int n = 0;
+            light_entry_t light;
+            for (int i = 0; i < MAX_LIGHTS; i++) {
+                if (light_registry_read_slot(i, &light)) candidates[n++] = light.unicast;
+            }
+            return mesh_crypto_match_node_identity(&f[4], &f[12], candidates, n);
+        }
+
+        offset += field_len + 1;
+    }
+    return 0;
+}
+
 // Send proxy filter setup on a specific connection
 static void send_proxy_filter_setup(proxy_conn_t *proxy)
 {
@@ -104,38 +235,46 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
 {
     switch (event) {
     case ESP_GAP_BLE_SCAN_RESULT_EVT:
+        provisioner_handle_gap_event(event, param);
         if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT && s_scanning) {
-            if (!adv_has_mesh_proxy_service(param->scan_rst.ble_adv,
-                                            param->scan_rst.adv_data_len)) {
+            int adv_len = param->scan_rst.adv_data_len + param->scan_rst.scan_rsp_len;
+            if (!adv_has_mesh_proxy_service(param->scan_rst.ble_adv, adv_len)) {
+                break;
+            }
+            uint16_t node = adv_node_identity(param->scan_rst.ble_adv, adv_len);
+
+            // Already connected to this address; learn who it is if we can
+            proxy_conn_t *known = find_proxy_by_addr(param->scan_rst.bda);
+            if (known) {
+                if (node && known->node_unicast != node) {
+                    known->node_unicast = node;
+                    ESP_LOGI(TAG, "Proxy conn_id=%d is light 0x%04X", known->conn_id, node);
+                }
                 break;
             }
 
-            // Skip if already connected to this address
-            if (find_proxy_by_addr(param->scan_rst.bda)) break;
+            bool want_hot = node && is_hot(node) && !find_proxy_by_node(node);
 
-            // Skip if no slots available
             proxy_conn_t *slot = alloc_proxy_slot();
             if (!slot) {
+                if (want_hot) {
+                    // Trade a general proxy for a direct link to this fixture
+                    if (!s_pending_hot.valid && evict_general_proxy()) {
+                        s_pending_hot.valid = true;
+                        memcpy(s_pending_hot.bda, param->scan_rst.bda, 6);
+                        s_pending_hot.addr_type = param->scan_rst.ble_addr_type;
+                        s_pending_hot.unicast = node;
+                    }
+                    break;
+                }
+                if (hot_links_missing() > 0) break;  // Keep looking for hot fixtures
                 ESP_LOGW(TAG, "No proxy slots available, stopping scan");
                 s_scanning = false;
                 esp_ble_gap_stop_scanning();
                 break;
             }
 
-            ESP_LOGI(TAG, "Found mesh proxy %02X:%02X:%02X:%02X:%02X:%02X, connecting...",
-                     param->scan_rst.bda[0], param->scan_rst.bda[1],
-                     param->scan_rst.bda[2], param->scan_rst.bda[3],
-                     param->scan_rst.bda[4], param->scan_rst.bda[5]);
-
-            slot->active = true;
-            memcpy(slot->ble_addr, param->scan_rst.bda, 6);
-            slot->conn_id = 0xFFFF;
-            slot->data_in_handle = INVALID_HANDLE;
-            slot->ready = false;
-            s_proxy_count++;
-
-            esp_ble_gattc_open(s_gattc_if, param->scan_rst.bda,
-                                param->scan_rst.ble_addr_type, true);
+            open_proxy(slot, param->scan_rst.bda, param->scan_rst.ble_addr_type, node);
         } else if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_CMPL_EVT) {
             ESP_LOGI(TAG, "Scan complete, %d proxy connections active", s_proxy_count);
             s_scanning = false;
@@ -146,6 +285,22 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
         ESP_LOGD(TAG, "Scan stopped");
         break;
 
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+        ESP_LOGI(TAG, "Conn params: interval %.2f ms, latency %d, timeout %d ms (status %d)",
+                 param->update_conn_params.conn_int * 1.25, param->update_conn_params.latency,
+                 param->update_conn_params.timeout * 10, param->update_conn_params.status);
+        if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+            proxy_conn_t *p = find_proxy_by_addr(param->update_conn_params.bda);
+            if (p) set_conn_interval(p - s_proxies, param->update_conn_params.conn_int * 1250);
+        }
+        break;
+
+    case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
+    case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+    case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
+        mesh_adv_handle_gap_event(event, param);
+        break;
+
     default:
         break;
     }
@@ -155,6 +310,13 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
 static void gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
                                  esp_ble_gattc_cb_param_t *param)
 {
+    // Provisioning links live on their own GATTC app
+    if ((event == ESP_GATTC_REG_EVT && param->reg.app_id == PROVISIONER_APP_ID) ||
+        (gattc_if != ESP_GATT_IF_NONE && gattc_if == provisioner_gattc_if())) {
+        provisioner_handle_gattc_event(event, gattc_if, param);
+        return;
+    }
+
     switch (event) {
     case ESP_GATTC_REG_EVT:
         if (param->reg.status == ESP_GATT_OK) {
@@ -187,6 +349,25 @@ static void gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_
     case ESP_GATTC_CONNECT_EVT:
         break;  // handled in OPEN_EVT
 
+    case ESP_GATTC_CONGEST_EVT: {
+        // Controller buffers for the link are full: the radio isn't getting
+        // airtime for it, usually because WiFi holds the antenna
+        proxy_conn_t *p = find_proxy_by_conn_id(param->congest.conn_id);
+        if (!p) break;
+        int64_t *since = &s_congested_since[p - s_proxies];
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&s_rate_lock);
+        if (param->congest.congested && !*since) {
+            s_tx.congestions++;
+            *since = now;
+        } else if (!param->congest.congested && *since) {
+            s_tx.congested_ms += (now - *since) / 1000;
+            *since = 0;
+        }
+        portEXIT_CRITICAL(&s_rate_lock);
+        break;
+    }
+
     case ESP_GATTC_CLOSE_EVT:
     case ESP_GATTC_DISCONNECT_EVT: {
         uint16_t conn_id = param->disconnect.conn_id;
@@ -194,15 +375,32 @@ static void gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_
                  conn_id, param->disconnect.reason);
         proxy_conn_t *p = find_proxy_by_conn_id(conn_id);
         if (p) {
+            bool evicted = p->evicting;
+            topology_link_down(p - s_proxies);
+            set_conn_interval(p - s_proxies, 0);
             p->active = false;
             p->ready = false;
+            p->evicting = false;
             p->conn_id = 0xFFFF;
             p->data_in_handle = INVALID_HANDLE;
             s_proxy_count--;
+            if (evicted) {
+                // Our own swap: hand the slot to the hot fixture
+                if (s_pending_hot.valid) {
+                    s_pending_hot.valid = false;
+                    open_proxy(p, s_pending_hot.bda, s_pending_hot.addr_type,
+                               s_pending_hot.unicast);
+                }
+            } else {
+                // We didn't close it, so the proxy fixture may have rebooted.
+                // Replay every static look once the next proxy is ready.
+                s_resync_all_on_ready = true;
+            }
         }
         // If no proxies left, notify all lights as disconnected
         if (!ble_mesh_is_proxy_connected()) {
             notify_all_registered_lights(false);
+            rules_post_proxy(false);
         }
         break;
     }
@@ -261,9 +459,18 @@ static void gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_
         free(char_elems);
 
         if (p->data_in_handle != INVALID_HANDLE) {
+            if (!ble_mesh_is_proxy_connected()) rules_post_proxy(true);
             p->ready = true;
             send_proxy_filter_setup(p);
+            request_conn_params(p);
             notify_all_registered_lights(true);
+            if (s_resync_all_on_ready) {
+                s_resync_all_on_ready = false;
+                int n = light_registry_mark_all_dirty();
+                ESP_LOGI(TAG, "Proxy recovered, %d lights queued for resync", n);
+            }
+            resync_start();
+            checkpoint_mesh_ready();
             ESP_LOGI(TAG, "Proxy conn_id=%d ready — %d total connections", conn_id, s_proxy_count);
         }
         break;
@@ -290,10 +497,17 @@ static void gattc_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_
         break;
     }
 
-    case ESP_GATTC_NOTIFY_EVT:
+    case ESP_GATTC_NOTIFY_EVT: {
         ESP_LOGD(TAG, "Notify from conn=%d handle=%d len=%d",
                  param->notify.conn_id, param->notify.handle, param->notify.value_len);
+        proxy_conn_t *p = find_proxy_by_conn_id(param->notify.conn_id);
+        if (p) {
+            mesh_capture_pdu(param->notify.conn_id, MESH_CAPTURE_RX,
+                             param->notify.value, param->notify.value_len);
+            proxy_rx(p, param->notify.value, param->notify.value_len);
+        }
         break;
+    }
 
     default:
         break;
@@ -328,18 +542,289 @@ static proxy_conn_t *alloc_proxy_slot(void)
     return NULL;
 }
 
+static proxy_conn_t *find_proxy_by_node(uint16_t unicast)
+{
+    for (int i = 0; i < MAX_PROXY_CONNECTIONS; i++) {
+        if (s_proxies[i].active && s_proxies[i].node_unicast == unicast)
+            return &s_proxies[i];
+    }
+    return NULL;
+}
+
+static void open_proxy(proxy_conn_t *slot, const uint8_t *bda,
+                       esp_ble_addr_type_t addr_type, uint16_t node)
+{
+    ESP_LOGI(TAG, "Found mesh proxy %02X:%02X:%02X:%02X:%02X:%02X%s, connecting...",
+             bda[0], bda[1], bda[2], bda[3], bda[4], bda[5],
+             node ? " (identified)" : "");
+
+    slot->active = true;
+    memcpy(slot->ble_addr, bda, 6);
+    slot->conn_id = 0xFFFF;
+    slot->data_in_handle = INVALID_HANDLE;
+    slot->ready = false;
+    slot->node_unicast = node;
+    slot->evicting = false;
+    s_proxy_count++;
+
+    esp_ble_gattc_open(s_gattc_if, (uint8_t *)bda, addr_type, true);
+}
+
+// MARK: - Hot fixtures
+
+static bool is_hot(uint16_t unicast)
+{
+    bool hot = false;
+    portENTER_CRITICAL(&s_rate_lock);
+    for (int i = 0; i < s_hot_count; i++) {
+        if (s_hot[i] == unicast) { hot = true; break; }
+    }
+    portEXIT_CRITICAL(&s_rate_lock);
+    return hot;
+}
+
+// Hot lights that don't have a direct proxy link yet
+static int hot_links_missing(void)
+{
+    uint16_t hot[MAX_LIGHTS];
+    int n;
+    portENTER_CRITICAL(&s_rate_lock);
+    n = s_hot_count;
+    memcpy(hot, s_hot, sizeof(hot));
+    portEXIT_CRITICAL(&s_rate_lock);
+
+    int missing = 0;
+    for (int i = 0; i < n; i++) {
+        if (!find_proxy_by_node(hot[i])) missing++;
+    }
+    return missing;
+}
+
+// Close one proxy that isn't serving a hot fixture, preferring the one the
+// fewest fixtures depend on (see topology_link_exclusive). Never closes the
+// last ready link, so general traffic keeps flowing during the swap.
+static bool evict_general_proxy(void)
+{
+    int ready = 0;
+    int victim_exclusive = 0;
+    proxy_conn_t *victim = NULL;
+    for (int i = 0; i < MAX_PROXY_CONNECTIONS; i++) {
+        proxy_conn_t *p = &s_proxies[i];
+        if (!p->active || p->evicting) continue;
+        if (p->ready) ready++;
+        if (!p->ready || (p->node_unicast && is_hot(p->node_unicast))) continue;
+        int exclusive = topology_link_exclusive(i);
+        if (!victim || exclusive < victim_exclusive) {
+            victim = p;
+            victim_exclusive = exclusive;
+        }
+    }
+    if (!victim || ready < 2) return false;
+
+    ESP_LOGI(TAG, "Evicting proxy conn_id=%d for a hot fixture (%d fixture(s) closest through it)",
+             victim->conn_id, victim_exclusive);
+    victim->evicting = true;
+    victim->ready = false;
+    esp_ble_gattc_close(victim->gattc_if, victim->conn_id);
+    return true;
+}
+
+static void count_tx(uint16_t unicast)
+{
+    portENTER_CRITICAL(&s_rate_lock);
+    rate_entry_t *free_e = NULL;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        rate_entry_t *e = &s_rates[i];
+        if (e->unicast == unicast) {
+            if (e->count < UINT16_MAX) e->count++;
+            goto done;
+        }
+        if (!e->unicast && !free_e) free_e = e;
+    }
+    if (free_e) {
+        free_e->unicast = unicast;
+        free_e->count = 1;
+        free_e->rate = 0;
+        free_e->hot = false;
+    }
+done:
+    portEXIT_CRITICAL(&s_rate_lock);
+}
+
+// Fold the last window into each light's rate and pick the hot set: the
+// HOT_PROXY_LINKS busiest lights that are above the threshold.
+static void rate_tick(void *arg)
+{
+    float per_sec = 1000.0f / RATE_SAMPLE_MS;
+    int missing;
+
+    portENTER_CRITICAL(&s_rate_lock);
+    bool traffic = s_window_writes > 0;
+    s_window_writes = 0;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        rate_entry_t *e = &s_rates[i];
+        if (!e->unicast) continue;
+        e->rate = e->rate * (1.0f - RATE_ALPHA) + e->count * per_sec * RATE_ALPHA;
+        e->count = 0;
+        if (e->rate < 0.1f) {
+            e->unicast = 0;         // Idle, free the entry
+            continue;
+        }
+        if (!e->hot && e->rate >= HOT_RATE_MIN) e->hot = true;
+        else if (e->hot && e->rate < HOT_RATE_MIN / 2) e->hot = false;
+    }
+
+    s_hot_count = 0;
+    bool taken[MAX_LIGHTS] = { false };
+    while (s_hot_count < HOT_PROXY_LINKS) {
+        int best = -1;
+        for (int i = 0; i < MAX_LIGHTS; i++) {
+            if (!s_rates[i].unicast || !s_rates[i].hot || taken[i]) continue;
+            if (best < 0 || s_rates[i].rate > s_rates[best].rate) best = i;
+        }
+        if (best < 0) break;
+        taken[best] = true;
+        s_hot[s_hot_count++] = s_rates[best].unicast;
+    }
+    portEXIT_CRITICAL(&s_rate_lock);
+
+    coex_update(traffic);
+    if (HOT_PROXY_LINKS == 0) return;
+
+    missing = hot_links_missing();
+    if (missing == 0 || s_scanning || !ble_mesh_is_proxy_connected()) return;
+
+    // Only fixtures advertising Node Identity can be found; don't keep the
+    // radio scanning for ones that aren't.
+    int64_t now = esp_timer_get_time();
+    if (now - s_last_hot_scan_us < (int64_t)HOT_SCAN_BACKOFF_MS * 1000) return;
+    s_last_hot_scan_us = now;
+
+    ESP_LOGI(TAG, "%d hot light(s) without a direct link, scanning", missing);
+    start_scan(HOT_SCAN_SECONDS);
+}
+
+// Reassemble proxy PDUs from a link (the proxy splits them when the MTU is
+// small) and hand complete network PDUs to the topology map and, during a
+// run, the config client. A fixture the map sees come back from a reboot
+// gets its shadow replayed.
+static void proxy_rx(proxy_conn_t *p, const uint8_t *data, int len)
+{
+    if (len < 1) return;
+
+    uint8_t sar = data[0] & 0xC0;
+    if ((data[0] & 0x3F) != 0x00) return;          // Network PDUs only
+
+    if (sar == 0x00 || sar == 0x40) {
+        p->rx_len = 0;                             // Complete or first segment
+    } else if (p->rx_len == 0) {
+        return;                                    // Continuation without a start
+    }
+    if (p->rx_len + len - 1 > (int)sizeof(p->rx_buf)) {
+        p->rx_len = 0;
+        return;
+    }
+    memcpy(p->rx_buf + p->rx_len, data + 1, len - 1);
+    p->rx_len += len - 1;
+    if (sar != 0x00 && sar != 0xC0) return;
+
+    int n = p->rx_len;
+    p->rx_len = 0;
+    mesh_rx_pdu_t rx;
+    if (mesh_crypto_decode_network(p->rx_buf, n, &rx)) {
+        if (topology_note_rx(p - s_proxies, &rx)) {
+            ESP_LOGI(TAG, "Light 0x%04X rebooted, queued for resync", rx.src);
+            ble_mesh_request_resync(rx.src);
+        }
+        if (mesh_config_is_busy()) mesh_config_handle_rx(&rx);
+    }
+}
+
 static void notify_all_registered_lights(bool connected)
 {
-    int count;
-    light_entry_t *all = light_registry_get_all(&count);
-    for (int i = 0; i < count; i++) {
-        if (all[i].registered) {
-            all[i].connected = connected;
-            ws_server_notify_light_status(all[i].unicast, connected);
+    light_entry_t light;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (light_registry_read_slot(i, &light)) {
+            light_registry_set_connected(light.unicast, connected);
+            ws_server_notify_light_status(light.unicast, connected);
+            rules_post_light(light.unicast, connected);
         }
     }
 }
 
+// MARK: - Shadow resync
+
+// Re-send a light's desired state. Software effects are skipped because the
+// effect engine re-renders them on its next step anyway.
+static esp_err_t replay_shadow(const light_entry_t *light)
+{
+    const light_shadow_t *s = &light->shadow;
+    switch (s->kind) {
+    case SHADOW_CCT:
+        return ble_mesh_send_cct(light->unicast, s->intensity, s->cct_kelvin, s->sleep_mode);
+    case SHADOW_HSI:
+        return ble_mesh_send_hsi(light->unicast, s->intensity, s->hue, s->saturation,
+                                 s->cct_kelvin, s->sleep_mode);
+    case SHADOW_SLEEP:
+        return ble_mesh_send_sleep(light->unicast, s->sleep_mode != 0);
+    case SHADOW_HW_EFFECT:
+        return ble_mesh_send_effect(light->unicast, s->effect_type, s->intensity, s->frq,
+                                    s->cct_kelvin, s->cop_car_color, s->effect_mode,
+                                    s->hue, s->saturation);
+    default:
+        return ESP_OK;
+    }
+}
+
+static void resync_stop(void)
+{
+    if (s_resync_running) {
+        esp_timer_stop(s_resync_timer);
+        s_resync_running = false;
+    }
+}
+
+// One light per tick until every shadow is clean or the mesh goes dark.
+static void resync_tick(void *arg)
+{
+    if (!ble_mesh_is_proxy_connected()) {
+        resync_stop();
+        return;
+    }
+
+    light_entry_t light;
+    if (!light_registry_take_dirty(&light)) {
+        ESP_LOGI(TAG, "Resync complete");
+        resync_stop();
+        return;
+    }
+
+    if (replay_shadow(&light) != ESP_OK) {
+        // send_mesh_pdu already re-flagged it; wait for the next proxy
+        resync_stop();
+        return;
+    }
+    ESP_LOGI(TAG, "Resynced light 0x%04X (shadow kind %d)", light.unicast, light.shadow.kind);
+}
+
+static void resync_start(void)
+{
+    if (!s_resync_timer || s_resync_running) return;
+    if (!light_registry_has_dirty()) return;
+
+    if (esp_timer_start_periodic(s_resync_timer, RESYNC_INTERVAL_MS * 1000) == ESP_OK) {
+        s_resync_running = true;
+    }
+}
+
+void ble_mesh_request_resync(uint16_t unicast)
+{
+    light_registry_mark_dirty(unicast);
+    if (ble_mesh_is_proxy_connected()) {
+        resync_start();
+    }
+}
+
 // Public API
 
 esp_err_t ble_mesh_init(void)
@@ -349,6 +834,22 @@ esp_err_t ble_mesh_init(void)
 
     esp_err_t ret;
 
+    esp_timer_create_args_t resync_args = {
+        .callback = resync_tick,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "resync",
+    };
+    ret = esp_timer_create(&resync_args, &s_resync_timer);
+    if (ret) { ESP_LOGE(TAG, "Resync timer create failed: %s", esp_err_to_name(ret)); return ret; }
+
+    esp_timer_create_args_t rate_args = {
+        .callback = rate_tick,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "proxy_rate",
+    };
+    ret = esp_timer_create(&rate_args, &s_rate_timer);
+    if (ret) { ESP_LOGE(TAG, "Rate timer create failed: %s", esp_err_to_name(ret)); return ret; }
+
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -375,7 +876,22 @@ esp_err_t ble_mesh_init(void)
 
     esp_ble_gatt_set_local_mtu(185);
 
-    ESP_LOGI(TAG, "BLE initialized (max %d proxy connections)", MAX_PROXY_CONNECTIONS);
+    ret = mesh_adv_init();
+    if (ret) { ESP_LOGE(TAG, "ADV bearer init failed: %s", esp_err_to_name(ret)); return ret; }
+
+    ret = provisioner_init();
+    if (ret) { ESP_LOGE(TAG, "Provisioner init failed: %s", esp_err_to_name(ret)); return ret; }
+
+    ret = mesh_config_init();
+    if (ret) { ESP_LOGE(TAG, "Config client init failed: %s", esp_err_to_name(ret)); return ret; }
+
+#if CONFIG_ESP_COEX_SW_COEXIST_ENABLE
+    esp_coex_status_bit_set(ESP_COEX_ST_TYPE_BLE, ESP_COEX_BLE_ST_MESH_STANDBY);
+#endif
+    esp_timer_start_periodic(s_rate_timer, RATE_SAMPLE_MS * 1000);
+
+    ESP_LOGI(TAG, "BLE initialized (max %d proxy connections, %d hot links)",
+             MAX_PROXY_CONNECTIONS, HOT_PROXY_LINKS);
     return ESP_OK;
 }
 
@@ -395,21 +911,51 @@ esp_err_t ble_mesh_connect_proxy(void)
         return ESP_OK;
     }
 
-    s_scanning = true;
     ESP_LOGI(TAG, "Scanning for mesh proxy nodes (0x1828), %d/%d slots used...",
              s_proxy_count, MAX_PROXY_CONNECTIONS);
+    return start_scan(15);
+}
+
+static esp_err_t start_scan(uint32_t seconds)
+{
+    s_scanning = true;
 
     esp_ble_scan_params_t scan_params = {
         .scan_type = BLE_SCAN_TYPE_ACTIVE,
         .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
         .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
-        .scan_interval = 0x50,
-        .scan_window = 0x30,
+        .scan_interval = s_link.scan_interval,
+        .scan_window = s_link.scan_window,
         .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE,
     };
 
     esp_ble_gap_set_scan_params(&scan_params);
-    return esp_ble_gap_start_scanning(15);  // 15 second scan
+    return esp_ble_gap_start_scanning(seconds);
+}
+
+static void request_conn_params(proxy_conn_t *p)
+{
+    if (!s_link.conn_min_int) return;
+
+    esp_ble_conn_update_params_t params = {
+        .min_int = s_link.conn_min_int,
+        .max_int = s_link.conn_max_int,
+        .latency = s_link.conn_latency,
+        .timeout = s_link.conn_timeout,
+    };
+    memcpy(params.bda, p->ble_addr, sizeof(params.bda));
+    esp_err_t err = esp_ble_gap_update_conn_params(&params);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "conn_id=%d: conn param request failed: %s", p->conn_id, esp_err_to_name(err));
+    }
+}
+
+void ble_mesh_set_link_params(const ble_link_params_t *params)
+{
+    s_link = *params;
+    for (int i = 0; i < MAX_PROXY_CONNECTIONS; i++) {
+        if (s_proxies[i].active && s_proxies[i].ready) request_conn_params(&s_proxies[i]);
+    }
 }
 
 bool ble_mesh_is_proxy_connected(void)
@@ -421,6 +967,11 @@ bool ble_mesh_is_proxy_connected(void)
     return false;
 }
 
+int ble_mesh_proxy_link_count(void)
+{
+    return s_proxy_count;
+}
+
 esp_err_t ble_mesh_disconnect_proxy(void)
 {
     for (int i = 0; i < MAX_PROXY_CONNECTIONS; i++) {
@@ -428,9 +979,11 @@ esp_err_t ble_mesh_disconnect_proxy(void)
             esp_ble_gattc_close(s_proxies[i].gattc_if, s_proxies[i].conn_id);
             s_proxies[i].active = false;
             s_proxies[i].ready = false;
+            s_proxies[i].node_unicast = 0;
         }
     }
     s_proxy_count = 0;
+    s_pending_hot.valid = false;
     return ESP_OK;
 }
 
@@ -439,38 +992,223 @@ esp_err_t ble_mesh_write(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t hand
 {
     if (handle == INVALID_HANDLE) return ESP_ERR_INVALID_STATE;
 
-    return esp_ble_gattc_write_char(gattc_if, conn_id, handle,
-                                     len, (uint8_t *)data,
-                                     ESP_GATT_WRITE_TYPE_NO_RSP,
-                                     ESP_GATT_AUTH_REQ_NONE);
+    esp_err_t err = esp_ble_gattc_write_char(gattc_if, conn_id, handle,
+                                             len, (uint8_t *)data,
+                                             ESP_GATT_WRITE_TYPE_NO_RSP,
+                                             ESP_GATT_AUTH_REQ_NONE);
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_rate_lock);
+    if (err == ESP_OK) {
+        s_tx.writes++;
+        if (now - s_last_write_us > BURST_GAP_US) s_tx.bursts++;
+        s_last_write_us = now;
+        s_window_writes++;
+    } else {
+        s_tx.write_errors++;
+    }
+    portEXIT_CRITICAL(&s_rate_lock);
+
+    if (err == ESP_OK) mesh_capture_pdu(conn_id, MESH_CAPTURE_TX, data, len);
+    return err;
 }
 
-// Send mesh PDU through ALL active proxy connections.
-// Each proxy is a different light — one of them is the target,
-// the others will ignore the message (wrong unicast address).
-static esp_err_t send_mesh_pdu(uint16_t unicast, const uint8_t *access_msg, int access_len)
+// MARK: - Coexistence
+
+// Each link negotiates its own interval; 0 clears it when the link closes
+static void set_conn_interval(int slot, uint32_t us)
 {
-    bool sent = false;
+    portENTER_CRITICAL(&s_rate_lock);
+    s_conn_int_us[slot] = us;
+    portEXIT_CRITICAL(&s_rate_lock);
+}
 
+// Tell the coexistence scheduler whether mesh traffic is flowing, so it
+// favours BLE while effects run and WiFi while the mesh is quiet
+static void coex_update(bool traffic)
+{
+    if (traffic == s_coex_traffic) return;
+    s_coex_traffic = traffic;
+#if CONFIG_ESP_COEX_SW_COEXIST_ENABLE
+    esp_coex_status_bit_clear(ESP_COEX_ST_TYPE_BLE, traffic ? ESP_COEX_BLE_ST_MESH_STANDBY
+                                                            : ESP_COEX_BLE_ST_MESH_TRAFFIC);
+    esp_coex_status_bit_set(ESP_COEX_ST_TYPE_BLE, traffic ? ESP_COEX_BLE_ST_MESH_TRAFFIC
+                                                          : ESP_COEX_BLE_ST_MESH_STANDBY);
+#endif
+    ESP_LOGD(TAG, "Coex: mesh %s", traffic ? "traffic" : "standby");
+}
+
+// Shortest interval over the links that have one
+static uint32_t shortest_conn_interval_locked(void)
+{
+    uint32_t shortest = 0;
     for (int i = 0; i < MAX_PROXY_CONNECTIONS; i++) {
-        if (!s_proxies[i].active || !s_proxies[i].ready) continue;
+        if (s_conn_int_us[i] && (!shortest || s_conn_int_us[i] < shortest)) {
+            shortest = s_conn_int_us[i];
+        }
+    }
+    return shortest;
+}
 
-        uint8_t pdu[64];
-        int pdu_len = mesh_crypto_create_standard_pdu(access_msg, access_len, unicast, pdu, sizeof(pdu));
-        if (pdu_len <= 0) {
-            ESP_LOGE(TAG, "Failed to create mesh PDU for 0x%04X", unicast);
-            continue;
+void ble_mesh_get_tx_stats(ble_tx_stats_t *out)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_rate_lock);
+    *out = s_tx;
+    for (int i = 0; i < MAX_PROXY_CONNECTIONS; i++) {
+        if (s_congested_since[i]) out->congested_ms += (now - s_congested_since[i]) / 1000;
+    }
+    out->conn_int_us = shortest_conn_interval_locked();
+    portEXIT_CRITICAL(&s_rate_lock);
+}
+
+int64_t ble_mesh_tx_idle_us(void)
+{
+    portENTER_CRITICAL(&s_rate_lock);
+    int64_t last = s_last_write_us;
+    portEXIT_CRITICAL(&s_rate_lock);
+    return esp_timer_get_time() - last;
+}
+
+uint32_t ble_mesh_conn_interval_us(void)
+{
+    portENTER_CRITICAL(&s_rate_lock);
+    uint32_t us = shortest_conn_interval_locked();
+    portEXIT_CRITICAL(&s_rate_lock);
+    return us;
+}
+
+void ble_mesh_set_bearer(mesh_bearer_mode_t mode)
+{
+    s_bearer = mode;
+    ESP_LOGI(TAG, "Bearer mode = %d", mode);
+}
+
+mesh_bearer_mode_t ble_mesh_get_bearer(void)
+{
+    return s_bearer;
+}
+
+// Write one proxy PDU to ALL active proxy connections, and/or the ADV bearer
+// depending on the bearer mode. Returns true if any bearer took it.
+static bool fanout_pdu(const uint8_t *pdu, int pdu_len)
+{
+    bool sent = false;
+
+    if (s_bearer != MESH_BEARER_ADV) {
+        for (int i = 0; i < MAX_PROXY_CONNECTIONS; i++) {
+            if (!s_proxies[i].active || !s_proxies[i].ready) continue;
+
+            esp_err_t err = ble_mesh_write(s_proxies[i].gattc_if, s_proxies[i].conn_id,
+                                            s_proxies[i].data_in_handle, pdu, pdu_len);
+            if (err == ESP_OK) {
+                sent = true;
+            }
         }
+    }
 
-        esp_err_t err = ble_mesh_write(s_proxies[i].gattc_if, s_proxies[i].conn_id,
-                                        s_proxies[i].data_in_handle, pdu, pdu_len);
-        if (err == ESP_OK) {
-            sent = true;
+    bool use_adv = s_bearer == MESH_BEARER_ADV || s_bearer == MESH_BEARER_BOTH ||
+                   (s_bearer == MESH_BEARER_ADV_FALLBACK && !sent);
+    if (use_adv && mesh_adv_send(pdu, pdu_len) == ESP_OK) {
+        sent = true;
+    }
+    return sent;
+}
+
+esp_err_t ble_mesh_send_pdus(uint8_t pdus[][MESH_PDU_MAX], const int *lens, int count)
+{
+    bool sent = true;
+    for (int i = 0; i < count; i++) {
+        sent = fanout_pdu(pdus[i], lens[i]) && sent;
+    }
+    return sent ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+// Send one mesh PDU through every bearer (see fanout_pdu). The PDU is
+// encrypted once: every proxy relays the same SEQ, so the target processes
+// it once and the other lights ignore it (wrong unicast address).
+static esp_err_t send_mesh_pdu(uint16_t unicast, const uint8_t *access_msg, int access_len)
+{
+    uint8_t pdu[64];
+    int pdu_len;
+    uint32_t seq;
+
+    count_tx(unicast);
+
+    // Hot fixture with its own link: TTL 0 reaches the proxy node itself and
+    // is never relayed, so the rest of the mesh doesn't carry this stream.
+    if (s_bearer != MESH_BEARER_ADV && is_hot(unicast)) {
+        proxy_conn_t *direct = find_proxy_by_node(unicast);
+        if (direct && direct->ready) {
+            pdu_len = mesh_crypto_create_standard_pdu_ttl(access_msg, access_len, unicast, 0,
+                                                          pdu, sizeof(pdu), &seq);
+            if (pdu_len > 0) light_registry_claim_seq(unicast, seq);
+            if (pdu_len > 0 &&
+                ble_mesh_write(direct->gattc_if, direct->conn_id, direct->data_in_handle,
+                               pdu, pdu_len) == ESP_OK) {
+                return ESP_OK;
+            }
         }
     }
 
+    // TTL from the topology map, so the relays don't flood past the fixture
+    pdu_len = mesh_crypto_create_standard_pdu_ttl(access_msg, access_len, unicast,
+                                                  topology_ttl_for(unicast), pdu, sizeof(pdu),
+                                                  &seq);
+    if (pdu_len <= 0) {
+        ESP_LOGE(TAG, "Failed to create mesh PDU for 0x%04X", unicast);
+        return ESP_FAIL;
+    }
+    light_registry_claim_seq(unicast, seq);
+
+    bool sent = fanout_pdu(pdu, pdu_len);
+
     if (!sent) {
         ESP_LOGW(TAG, "No proxy connection available for 0x%04X", unicast);
+        // The light missed this update; replay its shadow once a proxy is back
+        light_registry_mark_dirty(unicast);
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_mesh_prerender(uint16_t unicast, const uint8_t *access_msg, int access_len,
+                             mesh_frame_t *out)
+{
+    proxy_conn_t *direct = NULL;
+    if (s_bearer != MESH_BEARER_ADV && is_hot(unicast)) {
+        direct = find_proxy_by_node(unicast);
+        if (direct && !direct->ready) direct = NULL;
+    }
+
+    out->unicast = unicast;
+    out->direct = direct != NULL;
+    out->key_gen = mesh_crypto_key_generation();
+    out->len = mesh_crypto_create_standard_pdu_ttl(access_msg, access_len, unicast,
+                                                   out->direct ? 0 : topology_ttl_for(unicast),
+                                                   out->pdu, sizeof(out->pdu), &out->seq);
+    return out->len > 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t ble_mesh_send_frame(const mesh_frame_t *frame)
+{
+    if (frame->len <= 0 || frame->key_gen != mesh_crypto_key_generation()) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    count_tx(frame->unicast);
+    if (!light_registry_claim_seq(frame->unicast, frame->seq)) return ESP_ERR_INVALID_VERSION;
+
+    if (frame->direct) {
+        // TTL 0 only works over the fixture's own link
+        proxy_conn_t *direct = find_proxy_by_node(frame->unicast);
+        if (!direct || !direct->ready) return ESP_ERR_INVALID_VERSION;
+        return ble_mesh_write(direct->gattc_if, direct->conn_id, direct->data_in_handle,
+                              frame->pdu, frame->len);
+    }
+
+    if (!fanout_pdu(frame->pdu, frame->len)) {
+        light_registry_mark_dirty(frame->unicast);
         return ESP_ERR_INVALID_STATE;
     }
     return ESP_OK;
@@ -480,6 +1218,7 @@ esp_err_t ble_mesh_send_cct(uint16_t unicast, double intensity, int cct_kelvin,
 {
     uint8_t access_msg[11];
     sidus_build_access_cct(intensity, cct_kelvin, sleep_mode, access_msg);
+    monitor_record(unicast, MONITOR_MODE_CCT, intensity, cct_kelvin, 0, 0, sleep_mode, 0);
     return send_mesh_pdu(unicast, access_msg, 11);
 }
 
@@ -488,6 +1227,7 @@ esp_err_t ble_mesh_send_hsi(uint16_t unicast, double intensity, int hue, int sat
 {
     uint8_t access_msg[11];
     sidus_build_access_hsi(intensity, hue, saturation, cct_kelvin, sleep_mode, access_msg);
+    monitor_record(unicast, MONITOR_MODE_HSI, intensity, cct_kelvin, hue, saturation, sleep_mode, 0);
     return send_mesh_pdu(unicast, access_msg, 11);
 }
 
@@ -495,6 +1235,7 @@ esp_err_t ble_mesh_send_sleep(uint16_t unicast, bool on)
 {
     uint8_t access_msg[11];
     sidus_build_access_sleep(on, access_msg);
+    monitor_record(unicast, MONITOR_MODE_SLEEP, 0, 0, 0, 0, on ? 1 : 0, 0);
     return send_mesh_pdu(unicast, access_msg, 11);
 }
 
@@ -505,5 +1246,7 @@ esp_err_t ble_mesh_send_effect(uint16_t unicast, int effect_type, double intensi
     uint8_t access_msg[11];
     sidus_build_access_effect(effect_type, intensity, frq, cct_kelvin,
                               cop_car_color, effect_mode, hue, saturation, access_msg);
+    monitor_record(unicast, MONITOR_MODE_HW_EFFECT, intensity, cct_kelvin, hue, saturation, 1,
+                   effect_type);
     return send_mesh_pdu(unicast, access_msg, 11);
 }
@@ -4,10 +4,23 @@
 #include <stdbool.h>
 #include "esp_err.h"
 #include "esp_gatt_defs.h"
+#include "mesh_crypto.h"
+
+// How mesh PDUs leave the bridge
+typedef enum {
+    MESH_BEARER_GATT = 0,       // GATT proxies only (default)
+    MESH_BEARER_ADV_FALLBACK,   // GATT proxies, ADV bearer when none are up
+    MESH_BEARER_BOTH,           // GATT proxies and ADV bearer in parallel
+    MESH_BEARER_ADV,            // ADV bearer only
+} mesh_bearer_mode_t;
 
 // Initialize BLE GATT client
 esp_err_t ble_mesh_init(void);
 
+// Select the bearer(s) used for outgoing mesh PDUs.
+void ble_mesh_set_bearer(mesh_bearer_mode_t mode);
+mesh_bearer_mode_t ble_mesh_get_bearer(void);
+
 // Scan for any mesh proxy node (service 0x1828) and connect.
 // Once connected, all lights are reachable via mesh addressing.
 esp_err_t ble_mesh_connect_proxy(void);
@@ -15,13 +28,81 @@ esp_err_t ble_mesh_connect_proxy(void);
 // Returns true if a mesh proxy connection is active
 bool ble_mesh_is_proxy_connected(void);
 
+// Proxy links holding an ACL connection (connecting or ready).
+int ble_mesh_proxy_link_count(void);
+
 // Disconnect the mesh proxy connection
 esp_err_t ble_mesh_disconnect_proxy(void);
 
+// Link timing, set by the performance profile. Scan interval/window are
+// in 0.625 ms units, connection intervals in 1.25 ms, supervision timeout
+// in 10 ms. conn_min_int 0 leaves connection parameters to the fixture.
+typedef struct {
+    uint16_t scan_interval;
+    uint16_t scan_window;
+    uint16_t conn_min_int;
+    uint16_t conn_max_int;
+    uint16_t conn_latency;
+    uint16_t conn_timeout;
+} ble_link_params_t;
+
+// Use these for later scans and new links, and request the connection
+// parameters on every link already up.
+void ble_mesh_set_link_params(const ble_link_params_t *params);
+
+// Proxy write counters, for judging WiFi/BLE contention
+typedef struct {
+    uint32_t writes;            // PDUs handed to the stack
+    uint32_t bursts;            // Groups of writes less than 2 ms apart
+    uint32_t write_errors;      // Writes the stack refused
+    uint32_t congestions;       // Times a link's controller buffers filled up
+    uint32_t congested_ms;      // Total time links spent congested
+    uint32_t conn_int_us;       // Shortest negotiated interval of the open links, 0 if none
+} ble_tx_stats_t;
+
+void ble_mesh_get_tx_stats(ble_tx_stats_t *out);
+
+// Microseconds since the last proxy write
+int64_t ble_mesh_tx_idle_us(void);
+
+// Shortest connection interval negotiated on an open link, 0 if none has
+// reported one
+uint32_t ble_mesh_conn_interval_us(void);
+
+// Queue a light's desired-state shadow for a paced replay.
+// Also used when a fixture reboot is detected.
+void ble_mesh_request_resync(uint16_t unicast);
+
 // Write a mesh proxy PDU to the proxy's 2ADD characteristic.
 esp_err_t ble_mesh_write(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
                           const uint8_t *data, int len);
 
+// Send pre-built proxy PDUs (e.g. transport segments) in order over the
+// current bearer(s). ESP_ERR_INVALID_STATE if any PDU found no bearer.
+esp_err_t ble_mesh_send_pdus(uint8_t pdus[][MESH_PDU_MAX], const int *lens, int count);
+
+// A mesh PDU encrypted ahead of its send time (effect lookahead). The SEQ
+// is assigned when it is rendered.
+typedef struct {
+    uint8_t pdu[MESH_PDU_MAX];
+    int len;
+    uint16_t unicast;
+    uint32_t seq;
+    uint32_t key_gen;           // mesh_crypto_key_generation() at render time
+    bool direct;                // TTL 0 on the hot fixture's own link
+} mesh_frame_t;
+
+// Encrypt an access message for unicast now, choosing the bearer path the
+// way a live send would.
+esp_err_t ble_mesh_prerender(uint16_t unicast, const uint8_t *access_msg, int access_len,
+                             mesh_frame_t *out);
+
+// Write a pre-rendered frame; only the GATT write is left at this point.
+// ESP_ERR_INVALID_VERSION if it can no longer go out as rendered (keys
+// reloaded, a newer SEQ already went to the light, direct link gone): the
+// caller should render it again. ESP_ERR_INVALID_STATE if no bearer is up.
+esp_err_t ble_mesh_send_frame(const mesh_frame_t *frame);
+
 // Send a CCT command to a light via its unicast address
 esp_err_t ble_mesh_send_cct(uint16_t unicast, double intensity, int cct_kelvin, int sleep_mode);
 
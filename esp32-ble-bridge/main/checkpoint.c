@@ -0,0 +1,536 @@
+/*
+ * checkpoint.c
+ *
+ * Periodic capture of keys, registry and running effects to RTC memory
+ * and NVS, and the warm restart from them.
+ */
+
+#include "checkpoint.h"
+#include <string.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_crc.h"
+#include "esp_system.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "mesh_crypto.h"
+#include "light_registry.h"
+#include "effect_engine.h"
+#include "cue_player.h"
+#include "show_player.h"
+#include "ble_mesh.h"
+
+static const char *TAG = "checkpoint";
+
+#ifndef CONFIG_BRIDGE_CHECKPOINT_NVS_S
+#define CONFIG_BRIDGE_CHECKPOINT_NVS_S 30
+#endif
+
+#define CKPT_MAGIC          0x54504B43      // "CKPT"
+#define CKPT_VERSION        4
+#define CKPT_INTERVAL_MS    1000
+#define RTC_SEQ_MARGIN      0x1000          // PDUs sent after the last RTC capture
+#define NVS_SEQ_RESERVE     0x20000         // SEQ reserved ahead by the NVS ceiling
+#define NVS_NAMESPACE       "ckpt"
+#define NVS_KEY             "state"
+#define NVS_KEY_SEQ         "seq"
+#define PARTY_MAX           32
+
+// effect_params_t fields kept in the checkpoint, as float / int16
+static const size_t k_real_fields[] = {
+    offsetof(effect_params_t, intensity),
+    offsetof(effect_params_t, frequency),
+    offsetof(effect_params_t, pulsing_min),
+    offsetof(effect_params_t, pulsing_max),
+    offsetof(effect_params_t, pulsing_shape),
+    offsetof(effect_params_t, strobe_hz),
+    offsetof(effect_params_t, faulty_min),
+    offsetof(effect_params_t, faulty_max),
+    offsetof(effect_params_t, faulty_bias),
+    offsetof(effect_params_t, faulty_recovery),
+    offsetof(effect_params_t, faulty_warmth),
+    offsetof(effect_params_t, faulty_transition),
+    offsetof(effect_params_t, faulty_frequency),
+    offsetof(effect_params_t, party_transition),
+    offsetof(effect_params_t, party_hue_bias),
+};
+#define NUM_REALS ((int)(sizeof(k_real_fields) / sizeof(k_real_fields[0])))
+
+static const size_t k_int_fields[] = {
+    offsetof(effect_params_t, cct_kelvin),
+    offsetof(effect_params_t, hue),
+    offsetof(effect_params_t, saturation),
+    offsetof(effect_params_t, hsi_cct),
+    offsetof(effect_params_t, faulty_warmest_cct),
+    offsetof(effect_params_t, faulty_points),
+};
+#define NUM_INTS ((int)(sizeof(k_int_fields) / sizeof(k_int_fields[0])))
+
+typedef struct {
+    uint16_t unicast;
+    uint8_t type;
+    uint8_t color_mode;
+    uint8_t party_count;
+    int16_t ints[NUM_INTS];
+    float reals[NUM_REALS];
+    uint16_t party_cdeg[PARTY_MAX];     // Hues in hundredths of a degree
+    // Runtime phase last, so the content digest can leave it out
+    float phase_time;
+    uint8_t party_index;
+} ckpt_effect_t;
+
+// A light's shadow without its software effect parameters, which come
+// back from the effect kept for the same light
+typedef struct {
+    uint8_t kind;
+    uint8_t sleep_mode;
+    uint8_t cop_car_color;
+    uint8_t effect_mode;
+    int16_t effect_type;
+    int16_t cct_kelvin;
+    int16_t hue;
+    int16_t saturation;
+    int16_t frq;
+    float intensity;
+} ckpt_shadow_t;
+
+typedef struct {
+    uint16_t unicast;
+    bool has_device_key;
+    char id[64];                        // As the registry keeps them, so the
+    char name[64];                      // registry digest survives a restore
+    ckpt_shadow_t shadow;
+    uint8_t device_key[16];
+} ckpt_light_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;
+    uint32_t generation;
+    uint32_t seq;               // SEQ at capture; the NVS ceiling is kept apart
+    uint32_t iv_index;
+    uint16_t src;
+    uint8_t has_keys;
+    uint8_t light_count;
+    uint8_t effect_count;
+    uint8_t net_key[16];
+    uint8_t app_key[16];
+    ckpt_light_t lights[MAX_LIGHTS];
+    ckpt_effect_t effects[MAX_LIGHTS];
+    cue_snapshot_t cues;        // Cue player position, output and fade
+    show_snapshot_t show;       // Stored show's playhead; resumed from RTC only
+    uint32_t crc;               // CRC-32 of everything above
+} ckpt_t;
+
+// Survives every reset except power loss; validated by magic and CRC
+static RTC_NOINIT_ATTR ckpt_t s_rtc;
+
+static ckpt_t s_work;
+static TaskHandle_t s_task = NULL;
+static uint32_t s_generation = 0;
+
+static uint32_t s_nvs_digest = 0;
+static uint32_t s_nvs_ceiling = 0;          // SEQ reserved in NVS, under its own key
+static int64_t s_nvs_last_us = 0;
+
+// Restored effects and cue player waiting for the mesh
+static effect_snapshot_t s_pending[MAX_LIGHTS];
+static int s_pending_count = 0;
+static cue_snapshot_t s_pending_cues;
+static bool s_cues_pending = false;
+static show_snapshot_t s_pending_show;
+static bool s_show_pending = false;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// MARK: - Packing
+
+static void pack_effect(const effect_snapshot_t *s, ckpt_effect_t *e)
+{
+    const uint8_t *p = (const uint8_t *)&s->params;
+    e->unicast = s->unicast;
+    e->type = (uint8_t)s->type;
+    e->color_mode = (uint8_t)s->params.color_mode;
+    for (int i = 0; i < NUM_INTS; i++) {
+        e->ints[i] = (int16_t)*(const int *)(p + k_int_fields[i]);
+    }
+    for (int i = 0; i < NUM_REALS; i++) {
+        e->reals[i] = (float)*(const double *)(p + k_real_fields[i]);
+    }
+    int n = s->params.party_color_count;
+    if (n < 0) n = 0;
+    if (n > PARTY_MAX) n = PARTY_MAX;
+    e->party_count = (uint8_t)n;
+    for (int i = 0; i < n; i++) {
+        double h = s->params.party_colors[i];
+        e->party_cdeg[i] = (uint16_t)(h < 0 ? 0 : h > 360 ? 36000 : h * 100 + 0.5);
+    }
+    e->phase_time = (float)s->phase_time;
+    e->party_index = (uint8_t)s->party_color_index;
+}
+
+static void unpack_effect(const ckpt_effect_t *e, effect_snapshot_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    uint8_t *p = (uint8_t *)&s->params;
+    s->unicast = e->unicast;
+    s->type = (effect_type_t)e->type;
+    s->params.color_mode = (color_mode_t)e->color_mode;
+    for (int i = 0; i < NUM_INTS; i++) {
+        *(int *)(p + k_int_fields[i]) = e->ints[i];
+    }
+    for (int i = 0; i < NUM_REALS; i++) {
+        *(double *)(p + k_real_fields[i]) = e->reals[i];
+    }
+    s->params.party_color_count = e->party_count <= PARTY_MAX ? e->party_count : 0;
+    for (int i = 0; i < s->params.party_color_count; i++) {
+        s->params.party_colors[i] = e->party_cdeg[i] / 100.0;
+    }
+    s->phase_time = e->phase_time;
+    s->party_color_index = e->party_index;
+}
+
+static void pack_shadow(const light_shadow_t *s, ckpt_shadow_t *c)
+{
+    c->kind = (uint8_t)s->kind;
+    c->sleep_mode = (uint8_t)s->sleep_mode;
+    c->cop_car_color = (uint8_t)s->cop_car_color;
+    c->effect_mode = (uint8_t)s->effect_mode;
+    c->effect_type = (int16_t)s->effect_type;
+    c->cct_kelvin = (int16_t)s->cct_kelvin;
+    c->hue = (int16_t)s->hue;
+    c->saturation = (int16_t)s->saturation;
+    c->frq = (int16_t)s->frq;
+    c->intensity = (float)s->intensity;
+}
+
+// A software effect's parameters are taken from its effect record; without
+// one there is nothing to show
+static void unpack_shadow(const ckpt_t *ck, const ckpt_light_t *l, light_shadow_t *s)
+{
+    static effect_snapshot_t snap;
+    const ckpt_shadow_t *c = &l->shadow;
+    memset(s, 0, sizeof(*s));
+    s->kind = (shadow_kind_t)c->kind;
+    s->sleep_mode = c->sleep_mode;
+    s->cop_car_color = c->cop_car_color;
+    s->effect_mode = c->effect_mode;
+    s->effect_type = c->effect_type;
+    s->cct_kelvin = c->cct_kelvin;
+    s->hue = c->hue;
+    s->saturation = c->saturation;
+    s->frq = c->frq;
+    s->intensity = c->intensity;
+
+    if (s->kind != SHADOW_SW_EFFECT) return;
+    s->kind = SHADOW_NONE;
+    for (int i = 0; i < ck->effect_count; i++) {
+        if (ck->effects[i].unicast != l->unicast) continue;
+        unpack_effect(&ck->effects[i], &snap);
+        s->kind = SHADOW_SW_EFFECT;
+        s->effect_params = snap.params;
+        break;
+    }
+}
+
+static uint32_t ckpt_crc(const ckpt_t *c)
+{
+    return esp_crc32_le(0, (const uint8_t *)c, offsetof(ckpt_t, crc));
+}
+
+static bool ckpt_valid(const ckpt_t *c)
+{
+    return c->magic == CKPT_MAGIC && c->version == CKPT_VERSION &&
+           c->length == sizeof(ckpt_t) && c->light_count <= MAX_LIGHTS &&
+           c->effect_count <= MAX_LIGHTS && c->cues.track_count <= CUE_LIGHTS_MAX &&
+           c->crc == ckpt_crc(c);
+}
+
+// Digest of what matters after a power cut: keys, registry, effect
+// parameters and the cue position and targets, not SEQ, effect phase or
+// how far a cue fade got
+static uint32_t content_digest(const ckpt_t *c)
+{
+    uint32_t d = esp_crc32_le(0, (const uint8_t *)&c->iv_index,
+                              offsetof(ckpt_t, effects) - offsetof(ckpt_t, iv_index));
+    for (int i = 0; i < c->effect_count; i++) {
+        d = esp_crc32_le(d, (const uint8_t *)&c->effects[i], offsetof(ckpt_effect_t, phase_time));
+    }
+    d = esp_crc32_le(d, (const uint8_t *)&c->cues.cue, sizeof(c->cues.cue));
+    for (int i = 0; i < c->cues.track_count; i++) {
+        const cue_track_snapshot_t *t = &c->cues.tracks[i];
+        d = esp_crc32_le(d, (const uint8_t *)&t->unicast, sizeof(t->unicast));
+        d = esp_crc32_le(d, (const uint8_t *)&t->to, sizeof(t->to));
+    }
+    return d;
+}
+
+// MARK: - Capture
+
+static void capture(ckpt_t *c)
+{
+    // Zeroed first so padding doesn't change the CRC
+    memset(c, 0, sizeof(*c));
+    c->magic = CKPT_MAGIC;
+    c->version = CKPT_VERSION;
+    c->length = sizeof(ckpt_t);
+    c->generation = ++s_generation;
+    c->seq = mesh_crypto_get_seq();
+
+    if (mesh_crypto_get_network(c->net_key, &c->iv_index) && mesh_crypto_get_app_key(c->app_key)) {
+        c->src = mesh_crypto_get_src();
+        c->has_keys = 1;
+    }
+
+    light_entry_t light;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (!light_registry_read_slot(i, &light)) continue;
+        ckpt_light_t *l = &c->lights[c->light_count++];
+        l->unicast = light.unicast;
+        memcpy(l->id, light.id, sizeof(l->id));
+        memcpy(l->name, light.name, sizeof(l->name));
+        pack_shadow(&light.shadow, &l->shadow);
+        l->has_device_key = light.has_device_key;
+        memcpy(l->device_key, light.device_key, 16);
+    }
+
+    // Effects still waiting for the mesh are kept as restored, so a second
+    // reset before the mesh returns doesn't lose them
+    static effect_snapshot_t snaps[MAX_LIGHTS];
+    portENTER_CRITICAL(&s_lock);
+    int n = s_pending_count;
+    memcpy(snaps, s_pending, n * sizeof(snaps[0]));
+    portEXIT_CRITICAL(&s_lock);
+    n += effect_engine_snapshot(snaps + n, MAX_LIGHTS - n);
+    for (int i = 0; i < n; i++) {
+        pack_effect(&snaps[i], &c->effects[c->effect_count++]);
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    bool cues_pending = s_cues_pending;
+    if (cues_pending) c->cues = s_pending_cues;
+    portEXIT_CRITICAL(&s_lock);
+    if (!cues_pending) cue_player_snapshot(&c->cues);
+
+    portENTER_CRITICAL(&s_lock);
+    bool show_pending = s_show_pending;
+    if (show_pending) c->show = s_pending_show;
+    portEXIT_CRITICAL(&s_lock);
+    if (!show_pending) show_player_snapshot(&c->show);
+
+    c->crc = ckpt_crc(c);
+}
+
+static void write_nvs(const ckpt_t *c, uint32_t digest)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, NVS_KEY, c, sizeof(*c));
+        if (err == ESP_OK) err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "NVS write failed: %s", esp_err_to_name(err));
+        return;
+    }
+    s_nvs_digest = digest;
+    s_nvs_last_us = esp_timer_get_time();
+    ESP_LOGD(TAG, "Saved to NVS: %d lights, %d effects", c->light_count, c->effect_count);
+}
+
+// The SEQ ceiling is a single u32 entry, so raising it costs one NVS entry
+// rather than a rewrite of the whole record. Restoring from flash starts
+// above anything sent until the next raise.
+static void write_seq_ceiling(uint32_t seq)
+{
+    uint32_t ceiling = seq + NVS_SEQ_RESERVE;
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_u32(nvs, NVS_KEY_SEQ, ceiling);
+        if (err == ESP_OK) err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "SEQ ceiling write failed: %s", esp_err_to_name(err));
+        return;
+    }
+    s_nvs_ceiling = ceiling;
+    ESP_LOGD(TAG, "SEQ ceiling 0x%06lX", (unsigned long)ceiling);
+}
+
+static void resume_pending(void)
+{
+    static effect_snapshot_t snaps[MAX_LIGHTS];
+    static cue_snapshot_t cues;
+    static show_snapshot_t show;
+    portENTER_CRITICAL(&s_lock);
+    int n = s_pending_count;
+    memcpy(snaps, s_pending, n * sizeof(snaps[0]));
+    s_pending_count = 0;
+    bool have_cues = s_cues_pending;
+    if (have_cues) cues = s_pending_cues;
+    s_cues_pending = false;
+    bool have_show = s_show_pending;
+    if (have_show) show = s_pending_show;
+    s_show_pending = false;
+    portEXIT_CRITICAL(&s_lock);
+
+    for (int i = 0; i < n; i++) {
+        effect_engine_resume(&snaps[i]);
+    }
+    if (n) ESP_LOGI(TAG, "Resumed %d effect(s)", n);
+    // The show reloads the scenes first; the cue player then keeps its
+    // position and output over them
+    if (have_show) show_player_resume(&show);
+    if (have_cues) cue_player_resume(&cues);
+}
+
+static void checkpoint_task(void *arg)
+{
+    while (1) {
+        // Woken early when the mesh comes back
+        bool woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CKPT_INTERVAL_MS)) > 0;
+        bool pending = s_pending_count || s_cues_pending || s_show_pending;
+        if (woken || (pending && ble_mesh_is_proxy_connected())) {
+            resume_pending();
+        }
+
+        capture(&s_work);
+        if (!s_work.has_keys && s_work.light_count == 0) continue;
+        s_rtc = s_work;
+
+        // Power loss must never reuse a SEQ, so the ceiling is raised
+        // whenever half the reserve is used, whatever the batching says
+        if (s_work.has_keys && s_work.seq + NVS_SEQ_RESERVE / 2 > s_nvs_ceiling) {
+            write_seq_ceiling(s_work.seq);
+        }
+
+        if (CONFIG_BRIDGE_CHECKPOINT_NVS_S <= 0) continue;
+        uint32_t digest = content_digest(&s_work);
+        int64_t since = esp_timer_get_time() - s_nvs_last_us;
+        if (digest != s_nvs_digest && since >= (int64_t)CONFIG_BRIDGE_CHECKPOINT_NVS_S * 1000000) {
+            write_nvs(&s_work, digest);
+        }
+    }
+}
+
+// MARK: - Public
+
+esp_err_t checkpoint_restore(void)
+{
+    static ckpt_t nvs_copy;
+    static light_shadow_t shadow;
+    bool have_nvs = false;
+    uint32_t ceiling = 0;
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        size_t len = sizeof(nvs_copy);
+        have_nvs = nvs_get_blob(nvs, NVS_KEY, &nvs_copy, &len) == ESP_OK &&
+                   len == sizeof(nvs_copy) && ckpt_valid(&nvs_copy);
+        if (nvs_get_u32(nvs, NVS_KEY_SEQ, &ceiling) != ESP_OK) ceiling = 0;
+        nvs_close(nvs);
+    }
+    s_nvs_ceiling = ceiling;
+
+    // Applied even without a record, so keys set later still start above
+    // every SEQ sent before the reset
+    if (ceiling) mesh_crypto_advance_seq(ceiling);
+
+    // RTC memory is garbage after power-on; the CRC catches that too
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool have_rtc = reason != ESP_RST_POWERON && ckpt_valid(&s_rtc);
+
+    const ckpt_t *c = have_rtc ? &s_rtc : have_nvs ? &nvs_copy : NULL;
+    if (!c) {
+        ESP_LOGI(TAG, "No checkpoint, cold start");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    s_generation = c->generation;
+    if (have_nvs) {
+        s_nvs_digest = content_digest(&nvs_copy);
+        s_nvs_last_us = 0;
+    }
+
+    if (c->has_keys) {
+        mesh_crypto_init(c->net_key, c->app_key, c->iv_index, c->src);
+        if (have_rtc) mesh_crypto_advance_seq(c->seq + RTC_SEQ_MARGIN);
+    }
+
+    for (int i = 0; i < c->light_count; i++) {
+        const ckpt_light_t *l = &c->lights[i];
+        char id[sizeof(l->id) + 1] = "";
+        char name[sizeof(l->name) + 1] = "";
+        memcpy(id, l->id, sizeof(l->id));
+        memcpy(name, l->name, sizeof(l->name));
+        if (!light_registry_add(id, l->unicast, name)) continue;
+        if (l->has_device_key) light_registry_set_device_key(l->unicast, l->device_key);
+        unpack_shadow(c, l, &shadow);
+        light_registry_set_shadow(l->unicast, &shadow);
+    }
+    // Replayed by the shadow resync once a proxy is ready
+    light_registry_mark_all_dirty();
+
+    portENTER_CRITICAL(&s_lock);
+    s_pending_count = 0;
+    for (int i = 0; i < c->effect_count; i++) {
+        unpack_effect(&c->effects[i], &s_pending[s_pending_count++]);
+    }
+    s_pending_cues = c->cues;
+    s_cues_pending = c->cues.cue >= 0 || c->cues.track_count > 0;
+    // How far a show got is only worth anything if the clock didn't stop
+    // for a power cut
+    s_pending_show = c->show;
+    s_show_pending = have_rtc && c->show.playing;
+    portEXIT_CRITICAL(&s_lock);
+
+    ESP_LOGI(TAG, "Warm restart from %s (reset %d): %d light(s), %d effect(s), cue %d%s, SEQ 0x%06lX",
+             have_rtc ? "RTC" : "NVS", reason, c->light_count, c->effect_count, c->cues.cue,
+             s_show_pending ? ", show playing" : "", (unsigned long)mesh_crypto_get_seq());
+
+    if (c->has_keys && c->light_count > 0) {
+        ble_mesh_connect_proxy();
+    }
+    return ESP_OK;
+}
+
+esp_err_t checkpoint_start(void)
+{
+    if (s_task) return ESP_OK;
+    if (xTaskCreate(checkpoint_task, "ckpt", 4096, NULL, 2, &s_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void checkpoint_mesh_ready(void)
+{
+    if ((s_pending_count || s_cues_pending || s_show_pending) && s_task) xTaskNotifyGive(s_task);
+}
+
+void checkpoint_drop_pending(uint16_t unicast)
+{
+    portENTER_CRITICAL(&s_lock);
+    int n = 0;
+    for (int i = 0; i < s_pending_count; i++) {
+        if (unicast && s_pending[i].unicast != unicast) s_pending[n++] = s_pending[i];
+    }
+    s_pending_count = n;
+
+    // The cue player forgets what it was showing there; its position stays
+    cue_snapshot_t *cues = &s_pending_cues;
+    n = 0;
+    for (int i = 0; i < cues->track_count; i++) {
+        if (unicast && cues->tracks[i].unicast != unicast) cues->tracks[n++] = cues->tracks[i];
+    }
+    memset(&cues->tracks[n], 0, (cues->track_count - n) * sizeof(cues->tracks[0]));
+    cues->track_count = (uint16_t)n;
+    portEXIT_CRITICAL(&s_lock);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Warm restart. Once a second the bridge captures what it is driving: mesh
+// keys and SEQ, the light registry with its shadows, every running effect
+// with its parameters and phase, the cue player's position, output and
+// fade (cue_player.h), and how far a stored show has played
+// (show_player.h). The capture goes to RTC memory, which survives
+// panics, watchdog and software resets. It also goes to NVS for power
+// loss, but only when the content changed and at most once per
+// BRIDGE_CHECKPOINT_NVS_S, so live fader moves don't wear the flash.
+//
+// SEQ goes to NVS as a ceiling under its own key, reserved ahead of use and
+// raised before it is reached, so a restored bridge never reuses a number
+// the fixtures saw and a busy mesh costs one small entry per raise instead
+// of a rewrite of the whole record.
+//
+// On boot the keys and registry are restored and the bridge reconnects on
+// its own. Static looks replay through the shadow resync. Effects, a cue
+// fade and a playing show resume as soon as the first proxy link is ready.
+// A show only resumes after a reset, not a power cut: the time it spent
+// off is unknown.
+
+// Restore the last checkpoint. Call after the registry, effect engine, cue
+// player and BLE are initialized.
+esp_err_t checkpoint_restore(void);
+
+// Start capturing
+esp_err_t checkpoint_start(void);
+
+// A proxy link became ready; resumes restored effects
+void checkpoint_mesh_ready(void);
+
+// The phone took over this light (0 = all lights); a restored effect that
+// hasn't resumed yet is dropped
+void checkpoint_drop_pending(uint16_t unicast);
@@ -0,0 +1,658 @@
+/*
+ * cluster.c
+ *
+ * UDP transport for cluster_proto, and the glue between the cluster's
+ * fixture ownership and this bridge's registry and command handlers.
+ */
+
+#include "cluster.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+
+#include "cluster_proto.h"
+#include "mesh_crypto.h"
+#include "light_registry.h"
+#include "ble_mesh.h"
+#include "topology.h"
+#include "effect_engine.h"
+#include "ws_server.h"
+
+static const char *TAG = "cluster";
+
+#ifndef CONFIG_BRIDGE_CLUSTER_PORT
+#define CONFIG_BRIDGE_CLUSTER_PORT 0
+#endif
+#ifndef CONFIG_BRIDGE_CLUSTER_NODE
+#define CONFIG_BRIDGE_CLUSTER_NODE 0
+#endif
+#ifndef CONFIG_BRIDGE_CLUSTER_PEERS
+#define CONFIG_BRIDGE_CLUSTER_PEERS ""
+#endif
+#ifndef CONFIG_BRIDGE_CLUSTER_SECRET
+#define CONFIG_BRIDGE_CLUSTER_SECRET ""
+#endif
+
+#define ASSIGN_EVERY    5       // HELLO periods between unprompted ASSIGNs
+#define TO_ALL          0xFF    // COMMAND destination: every bridge
+
+static cluster_state_t s_st;
+static SemaphoreHandle_t s_lock = NULL;     // s_st, s_addrs, s_leader
+static SemaphoreHandle_t s_tx_lock = NULL;  // s_tx and s_counter
+static bool s_running = false;
+static volatile bool s_kick = false;        // Reassign now instead of at the next HELLO
+static int s_sock = -1;
+static uint8_t s_key[16];
+static uint32_t s_counter = 0;
+static uint8_t s_tx[CLUSTER_MAX_DATAGRAM];
+static uint8_t s_assign[2 + CLUSTER_MAX_FIXTURES * 3];
+static struct sockaddr_in s_addrs[CLUSTER_MAX_NODES];  // Where each node was last heard from
+static struct sockaddr_in s_peers[CLUSTER_MAX_NODES];  // Where "everyone" is
+static int s_peer_count = 0;
+static uint8_t s_leader = CLUSTER_NO_OWNER;
+static bool s_dup_logged = false;
+
+static uint32_t s_rejected = 0;
+
+static uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+// MARK: - Transport
+
+// dst >= 0 goes in front of the body (COMMAND and EVENT)
+static void send_to(const struct sockaddr_in *addrs, int count, cluster_msg_t type, int dst,
+                    const void *body, size_t len)
+{
+    size_t total = CLUSTER_HEADER_LEN + (dst >= 0 ? 1 : 0) + len + CLUSTER_TAG_LEN;
+    if (total > sizeof(s_tx)) {
+        ESP_LOGW(TAG, "Dropped %u-byte message", (unsigned)total);
+        return;
+    }
+
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    size_t n = cluster_proto_header(&s_st, s_tx, type, ++s_counter);
+    if (dst >= 0) s_tx[n++] = (uint8_t)dst;
+    memcpy(s_tx + n, body, len);
+    n += len;
+
+    uint8_t mac[16];
+    mesh_crypto_aes_cmac(s_key, s_tx, n, mac);
+    memcpy(s_tx + n, mac, CLUSTER_TAG_LEN);
+    n += CLUSTER_TAG_LEN;
+
+    for (int i = 0; i < count; i++) {
+        sendto(s_sock, s_tx, n, 0, (const struct sockaddr *)&addrs[i], sizeof(addrs[i]));
+    }
+    xSemaphoreGive(s_tx_lock);
+}
+
+static void send_all(cluster_msg_t type, int dst, const void *body, size_t len)
+{
+    send_to(s_peers, s_peer_count, type, dst, body, len);
+}
+
+static void send_node(uint8_t node, cluster_msg_t type, int dst, const void *body, size_t len)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    struct sockaddr_in addr = s_addrs[node];
+    xSemaphoreGive(s_lock);
+
+    if (addr.sin_port) {
+        send_to(&addr, 1, type, dst, body, len);
+    } else {
+        send_all(type, dst, body, len);
+    }
+}
+
+static void send_json(uint8_t dst, cluster_msg_t type, const cJSON *root)
+{
+    char *text = cJSON_PrintUnformatted(root);
+    if (!text) return;
+    if (dst == TO_ALL) {
+        send_all(type, dst, text, strlen(text));
+    } else {
+        send_node(dst, type, dst, text, strlen(text));
+    }
+    cJSON_free(text);
+}
+
+static bool authentic(const uint8_t *buf, int len)
+{
+    if (len < CLUSTER_HEADER_LEN + CLUSTER_TAG_LEN) return false;
+
+    uint8_t mac[16];
+    int body = len - CLUSTER_TAG_LEN;
+    mesh_crypto_aes_cmac(s_key, buf, body, mac);
+    uint8_t diff = 0;
+    for (int i = 0; i < CLUSTER_TAG_LEN; i++) diff |= mac[i] ^ buf[body + i];
+    return diff == 0;
+}
+
+// MARK: - Fixtures
+
+// Each bridge sends from its own address, so SEQ never collides. Node 0
+// keeps the phone's src_address; node k sends from cluster_base + k - 1,
+// a block the phone keeps out of its unicast allocation.
+static void adjust_src(cJSON *root)
+{
+    if (s_st.self == 0) return;
+
+    cJSON *src = cJSON_GetObjectItem(root, "src_address");
+    cJSON *base = cJSON_GetObjectItem(root, "cluster_base");
+    int addr;
+    if (cJSON_IsNumber(base) && base->valueint > 0 &&
+        base->valueint + CLUSTER_MAX_NODES - 2 <= 0x7FFF) {
+        addr = base->valueint + s_st.self - 1;
+    } else {
+        // A phone that reserves nothing: the addresses after its own may
+        // belong to fixtures
+        addr = (cJSON_IsNumber(src) ? src->valueint : 0x0001) + s_st.self;
+        ESP_LOGW(TAG, "set_keys without cluster_base, sending from 0x%04X", addr);
+    }
+    if (src) {
+        cJSON_SetNumberValue(src, addr);
+    } else {
+        cJSON_AddNumberToObject(root, "src_address", addr);
+    }
+}
+
+static uint8_t fixture_hops(uint16_t unicast, bool proxy)
+{
+    if (!proxy) return CLUSTER_UNREACHABLE;
+    int best = -1;
+    for (int l = 0; l < TOPOLOGY_MAX_LINKS; l++) {
+        int h = topology_hops(unicast, l);
+        if (h > 0 && (best < 0 || h < best)) best = h;
+    }
+    return best > 0 ? (uint8_t)best : CLUSTER_HOPS_UNKNOWN;
+}
+
+static void drop_local(uint16_t unicast)
+{
+    light_entry_t e;
+    if (!light_registry_lookup(unicast, &e)) return;
+    ESP_LOGI(TAG, "0x%04X moved off this bridge", unicast);
+    effect_engine_stop(unicast);
+    light_registry_remove(unicast);
+}
+
+// Make the registry match what the leader assigned here
+static void reconcile(void)
+{
+    static cluster_fixture_t adds[MAX_LIGHTS];
+    static light_entry_t e;
+    int n_add = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES && n_add < MAX_LIGHTS; i++) {
+        const cluster_fixture_t *f = &s_st.fixtures[i];
+        if (f->unicast && f->owner == s_st.self && !light_registry_lookup(f->unicast, &e)) {
+            adds[n_add++] = *f;
+        }
+    }
+    xSemaphoreGive(s_lock);
+
+    for (int slot = 0; slot < MAX_LIGHTS; slot++) {
+        if (!light_registry_read_slot(slot, &e)) continue;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        const cluster_fixture_t *f = cluster_proto_find(&s_st, e.unicast);
+        uint8_t owner = f ? f->owner : CLUSTER_NO_OWNER;
+        xSemaphoreGive(s_lock);
+        if (owner != CLUSTER_NO_OWNER && owner != s_st.self) drop_local(e.unicast);
+    }
+
+    bool proxy = ble_mesh_is_proxy_connected();
+    for (int i = 0; i < n_add; i++) {
+        const cluster_fixture_t *f = &adds[i];
+        if (!light_registry_add(f->id, f->unicast, f->name)) {
+            ESP_LOGW(TAG, "Registry full, can't take 0x%04X", f->unicast);
+            break;
+        }
+        if (f->has_key) light_registry_set_device_key(f->unicast, f->device_key);
+        ESP_LOGI(TAG, "0x%04X assigned to this bridge", f->unicast);
+        if (proxy) ws_server_notify_light_status(f->unicast, true);
+    }
+    if (n_add && ble_mesh_proxy_link_count() == 0) ble_mesh_connect_proxy();
+}
+
+// A new leader starts from its own registry for anything it hasn't heard of
+static void import_registry(void)
+{
+    static light_entry_t e;
+    for (int slot = 0; slot < MAX_LIGHTS; slot++) {
+        if (!light_registry_read_slot(slot, &e)) continue;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (!cluster_proto_find(&s_st, e.unicast)) {
+            cluster_fixture_t *f = cluster_proto_add(&s_st, e.id, e.unicast, e.name,
+                                                     e.has_device_key ? e.device_key : NULL);
+            if (f) f->owner = s_st.self;
+        }
+        xSemaphoreGive(s_lock);
+    }
+}
+
+// MARK: - Periodic
+
+static void send_hello(void)
+{
+    static light_entry_t e;
+    uint16_t unicasts[MAX_LIGHTS];
+    uint8_t hops[MAX_LIGHTS];
+    int n = 0;
+
+    bool proxy = ble_mesh_is_proxy_connected();
+    for (int slot = 0; slot < MAX_LIGHTS; slot++) {
+        if (!light_registry_read_slot(slot, &e)) continue;
+        unicasts[n] = e.unicast;
+        hops[n] = fixture_hops(e.unicast, proxy);
+        n++;
+    }
+
+    uint8_t flags = (proxy ? CLUSTER_FLAG_PROXY_UP : 0) |
+                    (ws_server_has_client() ? CLUSTER_FLAG_CLIENT : 0);
+    uint8_t body[3 + MAX_LIGHTS * 3];
+    size_t len = cluster_proto_write_hello(body, sizeof(body), flags, (uint8_t)n, unicasts, hops, n);
+
+    // Our own view goes through the same path as everyone else's
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    cluster_proto_read_hello(&s_st, s_st.self, body, len, now_ms());
+    xSemaphoreGive(s_lock);
+
+    send_all(CLUSTER_MSG_HELLO, -1, body, len);
+}
+
+static void lead(bool force)
+{
+    uint32_t now = now_ms();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint8_t leader = cluster_proto_leader(&s_st, now);
+    bool became = leader == s_st.self && s_leader != s_st.self;
+    if (leader != s_leader) {
+        ESP_LOGI(TAG, "Leader is node %d", leader);
+        s_leader = leader;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (leader != s_st.self) return;
+    if (became) import_registry();
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool changed = cluster_proto_assign(&s_st, now);
+    size_t len = cluster_proto_write_assign(&s_st, s_assign, sizeof(s_assign));
+    xSemaphoreGive(s_lock);
+
+    if (changed || force || became) send_all(CLUSTER_MSG_ASSIGN, -1, s_assign, len);
+    if (changed || became) reconcile();
+}
+
+// Bring a node that just (re)appeared up to date with the fixture list
+static void sync_fixtures(uint8_t node)
+{
+    // It takes nothing from us before our HELLO, and may not have had it
+    send_hello();
+
+    uint8_t body[64 + sizeof(((cluster_fixture_t *)0)->id) + sizeof(((cluster_fixture_t *)0)->name)];
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES; i++) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        size_t len = s_st.fixtures[i].unicast
+            ? cluster_proto_write_fixture(&s_st.fixtures[i], true, body, sizeof(body)) : 0;
+        xSemaphoreGive(s_lock);
+        if (len) send_node(node, CLUSTER_MSG_FIXTURE, -1, body, len);
+    }
+    s_kick = true;
+}
+
+// MARK: - Receive
+
+static void handle_datagram(uint8_t *buf, int len, const struct sockaddr_in *from)
+{
+    if (!authentic(buf, len)) {
+        s_rejected++;
+        return;
+    }
+    len -= CLUSTER_TAG_LEN;
+    buf[len] = '\0';
+
+    uint32_t boot = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32_t)buf[7] << 24);
+    if (buf[3] == s_st.self && boot != s_st.boot && !s_dup_logged) {
+        ESP_LOGE(TAG, "Another bridge is also node %d", s_st.self);
+        s_dup_logged = true;
+    }
+
+    uint32_t now = now_ms();
+    cluster_msg_t type;
+    uint8_t node;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool was_alive = buf[3] < CLUSTER_MAX_NODES && cluster_proto_alive(&s_st, buf[3], now);
+    if (!cluster_proto_accept(&s_st, buf, len, now, &type, &node)) {
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    s_addrs[node] = *from;
+    uint8_t leader = cluster_proto_leader(&s_st, now);
+
+    const uint8_t *body = buf + CLUSTER_HEADER_LEN;
+    size_t body_len = len - CLUSTER_HEADER_LEN;
+    bool changed = false;
+    bool removed = false;
+    uint16_t unicast = 0;
+    switch (type) {
+    case CLUSTER_MSG_HELLO:
+        cluster_proto_read_hello(&s_st, node, body, body_len, now);
+        break;
+    case CLUSTER_MSG_ASSIGN:
+        if (node == leader) changed = cluster_proto_read_assign(&s_st, body, body_len);
+        break;
+    case CLUSTER_MSG_FIXTURE:
+        if (node == leader) {
+            bool added;
+            removed = cluster_proto_read_fixture(&s_st, body, body_len, &unicast, &added) && !added;
+        }
+        break;
+    default:
+        break;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (type == CLUSTER_MSG_HELLO && !was_alive) {
+        ESP_LOGI(TAG, "Node %d joined", node);
+        if (leader == s_st.self) sync_fixtures(node);
+    }
+    if (changed) reconcile();
+    if (removed) drop_local(unicast);
+
+    if ((type == CLUSTER_MSG_COMMAND || type == CLUSTER_MSG_EVENT) && body_len > 1 &&
+        (body[0] == s_st.self || body[0] == TO_ALL)) {
+        const char *json = (const char *)body + 1;
+        if (type == CLUSTER_MSG_EVENT) {
+            if (ws_server_has_client()) ws_server_send(json);
+            return;
+        }
+
+        cJSON *root = cJSON_Parse(json);
+        if (!root) return;
+        if (leader == s_st.self) {
+            // A member passing on what its phone sent
+            if (!cluster_route(root)) ws_server_dispatch(root);
+        } else {
+            cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
+            if (cJSON_IsString(cmd) && strcmp(cmd->valuestring, "set_keys") == 0) adjust_src(root);
+            ws_server_dispatch(root);
+        }
+        cJSON_Delete(root);
+    }
+}
+
+static void cluster_task(void *arg)
+{
+    static uint8_t buf[CLUSTER_MAX_DATAGRAM + 1];
+    uint32_t last_hello = 0;
+    int hellos = 0;
+
+    while (1) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(s_sock, buf, CLUSTER_MAX_DATAGRAM, 0, (struct sockaddr *)&from, &from_len);
+        if (len > 0) handle_datagram(buf, len, &from);
+
+        uint32_t now = now_ms();
+        if (now - last_hello >= CLUSTER_HELLO_MS) {
+            last_hello = now;
+            s_kick = false;
+            send_hello();
+            lead(++hellos % ASSIGN_EVERY == 0);
+        } else if (s_kick) {
+            s_kick = false;
+            lead(true);
+        }
+    }
+}
+
+// "a.b.c.d[:port],..." or nothing for broadcast on our own port
+static void parse_peers(void)
+{
+    char list[sizeof(CONFIG_BRIDGE_CLUSTER_PEERS)];
+    strncpy(list, CONFIG_BRIDGE_CLUSTER_PEERS, sizeof(list));
+
+    char *save = NULL;
+    for (char *tok = strtok_r(list, ", ", &save); tok && s_peer_count < CLUSTER_MAX_NODES;
+         tok = strtok_r(NULL, ", ", &save)) {
+        char *colon = strchr(tok, ':');
+        int port = CONFIG_BRIDGE_CLUSTER_PORT;
+        if (colon) {
+            *colon = '\0';
+            port = atoi(colon + 1);
+        }
+        struct sockaddr_in *a = &s_peers[s_peer_count];
+        memset(a, 0, sizeof(*a));
+        a->sin_family = AF_INET;
+        a->sin_port = htons(port);
+        if (inet_aton(tok, &a->sin_addr)) {
+            s_peer_count++;
+        } else {
+            ESP_LOGW(TAG, "Bad peer \"%s\"", tok);
+        }
+    }
+
+    if (s_peer_count == 0) {
+        s_peers[0] = (struct sockaddr_in) {
+            .sin_family = AF_INET,
+            .sin_port = htons(CONFIG_BRIDGE_CLUSTER_PORT),
+            .sin_addr.s_addr = htonl(INADDR_BROADCAST),
+        };
+        s_peer_count = 1;
+    }
+}
+
+// MARK: - Public API
+
+esp_err_t cluster_start(void)
+{
+    if (CONFIG_BRIDGE_CLUSTER_PORT == 0 || s_running) return ESP_OK;
+
+    const char *secret = CONFIG_BRIDGE_CLUSTER_SECRET;
+    if (!secret[0]) {
+        ESP_LOGE(TAG, "No cluster secret configured, staying standalone");
+        return ESP_ERR_INVALID_ARG;
+    }
+    mesh_crypto_s1((const uint8_t *)secret, strlen(secret), s_key);
+
+    s_lock = xSemaphoreCreateMutex();
+    s_tx_lock = xSemaphoreCreateMutex();
+    if (!s_lock || !s_tx_lock) return ESP_ERR_NO_MEM;
+
+    cluster_proto_init(&s_st, CONFIG_BRIDGE_CLUSTER_NODE, esp_random(), MAX_LIGHTS);
+    parse_peers();
+
+    s_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s_sock < 0) {
+        ESP_LOGE(TAG, "socket failed: %d", errno);
+        return ESP_FAIL;
+    }
+    int on = 1;
+    setsockopt(s_sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(s_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_BRIDGE_CLUSTER_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(s_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ESP_LOGE(TAG, "bind failed: %d", errno);
+        close(s_sock);
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(cluster_task, "cluster", 6144, NULL, 5, NULL) != pdPASS) {
+        close(s_sock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_running = true;
+    ESP_LOGI(TAG, "Node %d on UDP port %d, %d peer address(es)", s_st.self,
+             CONFIG_BRIDGE_CLUSTER_PORT, s_peer_count);
+    return ESP_OK;
+}
+
+static bool is_fixture_cmd(const char *cmd)
+{
+    static const char *cmds[] = {
+        "set_cct", "set_hsi", "sleep", "set_effect", "start_effect", "update_effect", "stop_effect",
+    };
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        if (strcmp(cmd, cmds[i]) == 0) return true;
+    }
+    return false;
+}
+
+bool cluster_route(cJSON *root)
+{
+    if (!s_running) return false;
+    cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
+    if (!cmd || !cJSON_IsString(cmd) || strcmp(cmd->valuestring, "cluster") == 0) return false;
+    const char *c = cmd->valuestring;
+
+    uint32_t now = now_ms();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint8_t leader = cluster_proto_leader(&s_st, now);
+    xSemaphoreGive(s_lock);
+
+    if (leader != s_st.self) {
+        send_json(leader, CLUSTER_MSG_COMMAND, root);
+        return true;
+    }
+
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    uint16_t unicast = cJSON_IsNumber(uni) ? (uint16_t)uni->valueint : 0;
+
+    if (strcmp(c, "add_light") == 0 && unicast) {
+        cJSON *id = cJSON_GetObjectItem(root, "id");
+        cJSON *name = cJSON_GetObjectItem(root, "name");
+        cJSON *dk = cJSON_GetObjectItem(root, "device_key");
+        uint8_t key[16];
+        bool has_key = cJSON_IsString(dk) && strlen(dk->valuestring) == 32;
+        for (int i = 0; has_key && i < 16; i++) {
+            unsigned int b;
+            has_key = sscanf(dk->valuestring + i * 2, "%2x", &b) == 1;
+            key[i] = (uint8_t)b;
+        }
+
+        uint8_t body[64 + sizeof(((cluster_fixture_t *)0)->id) + sizeof(((cluster_fixture_t *)0)->name)];
+        size_t len = 0;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        cluster_fixture_t *f = cluster_proto_add(&s_st, cJSON_IsString(id) ? id->valuestring : "",
+                                                 unicast, cJSON_IsString(name) ? name->valuestring : "",
+                                                 has_key ? key : NULL);
+        if (f) len = cluster_proto_write_fixture(f, true, body, sizeof(body));
+        xSemaphoreGive(s_lock);
+
+        // Cluster table full: keep it on this bridge
+        if (!f) return false;
+        if (len) send_all(CLUSTER_MSG_FIXTURE, -1, body, len);
+        s_kick = true;
+        return true;
+    }
+
+    if (strcmp(c, "remove_light") == 0 && unicast) {
+        cluster_fixture_t gone = { .unicast = unicast };
+        uint8_t body[8];
+        size_t len = cluster_proto_write_fixture(&gone, false, body, sizeof(body));
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        cluster_proto_remove(&s_st, unicast);
+        xSemaphoreGive(s_lock);
+        send_all(CLUSTER_MSG_FIXTURE, -1, body, len);
+        return false;
+    }
+
+    if (strcmp(c, "set_keys") == 0 || strcmp(c, "stop_all") == 0) {
+        send_json(TO_ALL, CLUSTER_MSG_COMMAND, root);
+        if (strcmp(c, "set_keys") == 0) adjust_src(root);
+        return false;
+    }
+
+    if (unicast && is_fixture_cmd(c)) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        const cluster_fixture_t *f = cluster_proto_find(&s_st, unicast);
+        uint8_t owner = f ? f->owner : CLUSTER_NO_OWNER;
+        bool live = cluster_proto_alive(&s_st, owner, now);
+        xSemaphoreGive(s_lock);
+
+        if (owner != CLUSTER_NO_OWNER && owner != s_st.self && live) {
+            send_json(owner, CLUSTER_MSG_COMMAND, root);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cluster_relay_event(const char *json)
+{
+    if (!s_running) return false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint8_t target = cluster_proto_client_node(&s_st, now_ms());
+    xSemaphoreGive(s_lock);
+
+    if (target == CLUSTER_NO_OWNER || target == s_st.self) return false;
+    send_node(target, CLUSTER_MSG_EVENT, target, json, strlen(json));
+    return true;
+}
+
+void cluster_report(void)
+{
+    if (!s_running) {
+        ws_server_send_event("cluster", "\"node\":-1");
+        return;
+    }
+
+    size_t max = 96 + CLUSTER_MAX_NODES * 64 + CLUSTER_MAX_FIXTURES * 48;
+    char *msg = malloc(max);
+    if (!msg) return;
+
+    uint32_t now = now_ms();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int pos = snprintf(msg, max, "{\"event\":\"cluster\",\"node\":%d,\"leader\":%d,\"nodes\":[",
+                       s_st.self, cluster_proto_leader(&s_st, now));
+    bool first = true;
+    for (int i = 0; i < CLUSTER_MAX_NODES; i++) {
+        if (!cluster_proto_alive(&s_st, i, now)) continue;
+        const cluster_node_t *n = &s_st.nodes[i];
+        pos += snprintf(msg + pos, max - pos,
+                        "%s{\"node\":%d,\"proxy\":%s,\"load\":%d,\"client\":%s}",
+                        first ? "" : ",", i,
+                        (n->flags & CLUSTER_FLAG_PROXY_UP) ? "true" : "false", n->load,
+                        (n->flags & CLUSTER_FLAG_CLIENT) ? "true" : "false");
+        first = false;
+    }
+    pos += snprintf(msg + pos, max - pos, "],\"fixtures\":[");
+    first = true;
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES; i++) {
+        const cluster_fixture_t *f = &s_st.fixtures[i];
+        if (!f->unicast) continue;
+        pos += snprintf(msg + pos, max - pos, "%s{\"unicast\":%u,\"owner\":%d,\"hops\":%d}",
+                        first ? "" : ",", f->unicast,
+                        f->owner == CLUSTER_NO_OWNER ? -1 : f->owner,
+                        f->hops >= CLUSTER_HOPS_UNKNOWN ? (f->hops == CLUSTER_UNREACHABLE ? -1 : 0)
+                                                         : f->hops);
+        first = false;
+    }
+    xSemaphoreGive(s_lock);
+    snprintf(msg + pos, max - pos, "]}");
+
+    ws_server_send(msg);
+    free(msg);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+// Several bridges behind one phone connection, for more fixtures than one
+// radio and its proxy links can carry.
+//
+// Bridges with the same BRIDGE_CLUSTER_PORT and secret find each other by
+// broadcast, or through BRIDGE_CLUSTER_PEERS, and elect the lowest
+// BRIDGE_CLUSTER_NODE as leader (cluster_proto.h). The phone can talk to
+// any of them: a member passes its commands to the leader. The leader
+// keeps the fixture list, owns the routing and sends each per-fixture
+// command to the owning bridge. add_light only goes into the cluster's
+// fixture list; the owner registers the light when it is assigned.
+// set_keys and stop_all go to every bridge. Events from any bridge are
+// relayed to the one holding the phone.
+//
+// Each bridge sends as src_address + node index, so every bridge has its
+// own mesh source address and with it its own SEQ space. Reserve that many
+// addresses after the phone's src_address.
+//
+// {"cmd":"cluster"} replies with a "cluster" event:
+//   {"node","leader","nodes":[{"node","proxy","load","client"}],
+//    "fixtures":[{"unicast","owner","hops"}]}
+
+esp_err_t cluster_start(void);
+
+// Route a phone command. true if another bridge handles it and it must
+// not run here. May rewrite set_keys for this bridge's source address.
+bool cluster_route(cJSON *root);
+
+// Pass an event on to the bridge holding the phone; false if none does
+bool cluster_relay_event(const char *json);
+
+// Send the "cluster" event
+void cluster_report(void);
@@ -0,0 +1,371 @@
+/*
+ * cluster_proto.c
+ *
+ * Wire format, leader election and fixture ownership for bridge clusters.
+ */
+
+#include "cluster_proto.h"
+#include <string.h>
+
+// MARK: - Helpers
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void copy_str(char *dst, size_t size, const char *src, size_t len)
+{
+    if (len >= size) len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+void cluster_proto_init(cluster_state_t *st, uint8_t self, uint32_t boot, uint8_t capacity)
+{
+    memset(st, 0, sizeof(*st));
+    st->self = self;
+    st->boot = boot;
+    st->capacity = capacity;
+    st->nodes[self].seen = true;
+    st->nodes[self].boot = boot;
+}
+
+// MARK: - Membership
+
+size_t cluster_proto_header(const cluster_state_t *st, uint8_t *out, cluster_msg_t type,
+                            uint32_t counter)
+{
+    out[0] = 'B';
+    out[1] = CLUSTER_VERSION;
+    out[2] = (uint8_t)type;
+    out[3] = st->self;
+    put_le32(out + 4, st->boot);
+    put_le32(out + 8, counter);
+    return CLUSTER_HEADER_LEN;
+}
+
+bool cluster_proto_alive(const cluster_state_t *st, uint8_t node, uint32_t now_ms)
+{
+    if (node >= CLUSTER_MAX_NODES) return false;
+    if (node == st->self) return true;
+    const cluster_node_t *n = &st->nodes[node];
+    return n->seen && now_ms - n->last_ms < CLUSTER_DEAD_MS;
+}
+
+bool cluster_proto_accept(cluster_state_t *st, const uint8_t *buf, size_t len, uint32_t now_ms,
+                          cluster_msg_t *type, uint8_t *node)
+{
+    if (len < CLUSTER_HEADER_LEN || buf[0] != 'B' || buf[1] != CLUSTER_VERSION) return false;
+
+    uint8_t idx = buf[3];
+    uint32_t boot = get_le32(buf + 4);
+    uint32_t counter = get_le32(buf + 8);
+    if (idx >= CLUSTER_MAX_NODES || idx == st->self) return false;
+
+    cluster_node_t *n = &st->nodes[idx];
+    if (!n->seen || boot != n->boot) {
+        if (buf[2] != CLUSTER_MSG_HELLO || cluster_proto_alive(st, idx, now_ms)) return false;
+        n->seen = true;
+        n->boot = boot;
+        n->flags = 0;
+        n->load = 0;
+    } else if (counter <= n->counter) {
+        return false;
+    }
+    n->counter = counter;
+
+    *type = (cluster_msg_t)buf[2];
+    *node = idx;
+    return true;
+}
+
+uint8_t cluster_proto_leader(const cluster_state_t *st, uint32_t now_ms)
+{
+    for (uint8_t i = 0; i < CLUSTER_MAX_NODES; i++) {
+        if (cluster_proto_alive(st, i, now_ms)) return i;
+    }
+    return st->self;
+}
+
+uint8_t cluster_proto_client_node(const cluster_state_t *st, uint32_t now_ms)
+{
+    for (uint8_t i = 0; i < CLUSTER_MAX_NODES; i++) {
+        if (cluster_proto_alive(st, i, now_ms) && (st->nodes[i].flags & CLUSTER_FLAG_CLIENT)) {
+            return i;
+        }
+    }
+    return CLUSTER_NO_OWNER;
+}
+
+// MARK: - Messages
+
+size_t cluster_proto_write_hello(uint8_t *out, size_t max, uint8_t flags, uint8_t load,
+                                 const uint16_t *unicasts, const uint8_t *hops, int n)
+{
+    if (max < 3) return 0;
+    size_t pos = 3;
+    int count = 0;
+    for (int i = 0; i < n && pos + 3 <= max; i++, count++) {
+        put_le16(out + pos, unicasts[i]);
+        out[pos + 2] = hops[i];
+        pos += 3;
+    }
+    out[0] = flags;
+    out[1] = load;
+    out[2] = (uint8_t)count;
+    return pos;
+}
+
+bool cluster_proto_read_hello(cluster_state_t *st, uint8_t node, const uint8_t *body,
+                              size_t len, uint32_t now_ms)
+{
+    if (len < 3 || len < 3 + (size_t)body[2] * 3) return false;
+
+    cluster_node_t *n = &st->nodes[node];
+    n->flags = body[0];
+    n->load = body[1];
+    n->last_ms = now_ms;
+
+    for (int i = 0; i < body[2]; i++) {
+        const uint8_t *e = body + 3 + i * 3;
+        cluster_fixture_t *f = cluster_proto_find(st, get_le16(e));
+        if (!f || f->owner != node) continue;
+        f->hops = e[2];
+        if (e[2] != CLUSTER_UNREACHABLE) {
+            f->unreachable_ms = 0;
+            f->tried = 0;
+        } else if (!f->unreachable_ms) {
+            f->unreachable_ms = now_ms | 1;
+        }
+    }
+    return true;
+}
+
+size_t cluster_proto_write_assign(const cluster_state_t *st, uint8_t *out, size_t max)
+{
+    size_t pos = 2;
+    uint16_t count = 0;
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES && pos + 3 <= max; i++) {
+        const cluster_fixture_t *f = &st->fixtures[i];
+        if (!f->unicast) continue;
+        put_le16(out + pos, f->unicast);
+        out[pos + 2] = f->owner;
+        pos += 3;
+        count++;
+    }
+    put_le16(out, count);
+    return pos;
+}
+
+bool cluster_proto_read_assign(cluster_state_t *st, const uint8_t *body, size_t len)
+{
+    if (len < 2) return false;
+    uint16_t count = get_le16(body);
+    if (len < 2 + (size_t)count * 3) return false;
+
+    bool changed = false;
+    for (int i = 0; i < count; i++) {
+        const uint8_t *e = body + 2 + i * 3;
+        cluster_fixture_t *f = cluster_proto_find(st, get_le16(e));
+        // Details arrive by FIXTURE; a fixture we haven't heard of yet is
+        // picked up from the next ASSIGN after it
+        if (!f || f->owner == e[2]) continue;
+        f->owner = e[2];
+        f->unreachable_ms = 0;
+        changed = true;
+    }
+    return changed;
+}
+
+size_t cluster_proto_write_fixture(const cluster_fixture_t *f, bool add, uint8_t *out, size_t max)
+{
+    size_t id_len = strlen(f->id);
+    size_t name_len = strlen(f->name);
+    size_t need = 4 + (f->has_key ? 16 : 0) + 1 + id_len + 1 + name_len;
+    if (need > max) return 0;
+
+    size_t pos = 0;
+    out[pos++] = add ? 1 : 0;
+    put_le16(out + pos, f->unicast);
+    pos += 2;
+    out[pos++] = f->has_key ? 1 : 0;
+    if (f->has_key) {
+        memcpy(out + pos, f->device_key, 16);
+        pos += 16;
+    }
+    out[pos++] = (uint8_t)id_len;
+    memcpy(out + pos, f->id, id_len);
+    pos += id_len;
+    out[pos++] = (uint8_t)name_len;
+    memcpy(out + pos, f->name, name_len);
+    pos += name_len;
+    return pos;
+}
+
+bool cluster_proto_read_fixture(cluster_state_t *st, const uint8_t *body, size_t len,
+                                uint16_t *unicast, bool *added)
+{
+    if (len < 4) return false;
+    size_t pos = 0;
+    bool add = body[pos++] != 0;
+    uint16_t uni = get_le16(body + pos);
+    pos += 2;
+    bool has_key = body[pos++] != 0;
+    const uint8_t *key = NULL;
+    if (has_key) {
+        if (pos + 16 > len) return false;
+        key = body + pos;
+        pos += 16;
+    }
+    if (pos + 1 > len || pos + 1 + body[pos] > len) return false;
+    size_t id_len = body[pos++];
+    const char *id = (const char *)body + pos;
+    pos += id_len;
+    if (pos + 1 > len || pos + 1 + body[pos] > len) return false;
+    size_t name_len = body[pos++];
+    const char *name = (const char *)body + pos;
+
+    *unicast = uni;
+    *added = add;
+    if (!add) {
+        cluster_proto_remove(st, uni);
+        return true;
+    }
+
+    char id_buf[40], name_buf[32];
+    copy_str(id_buf, sizeof(id_buf), id, id_len);
+    copy_str(name_buf, sizeof(name_buf), name, name_len);
+    return cluster_proto_add(st, id_buf, uni, name_buf, key) != NULL;
+}
+
+// MARK: - Fixtures
+
+cluster_fixture_t *cluster_proto_find(cluster_state_t *st, uint16_t unicast)
+{
+    if (!unicast) return NULL;
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES; i++) {
+        if (st->fixtures[i].unicast == unicast) return &st->fixtures[i];
+    }
+    return NULL;
+}
+
+cluster_fixture_t *cluster_proto_add(cluster_state_t *st, const char *id, uint16_t unicast,
+                                     const char *name, const uint8_t *device_key)
+{
+    if (!unicast) return NULL;
+    cluster_fixture_t *f = cluster_proto_find(st, unicast);
+    if (!f) {
+        for (int i = 0; i < CLUSTER_MAX_FIXTURES && !f; i++) {
+            if (!st->fixtures[i].unicast) f = &st->fixtures[i];
+        }
+        if (!f) return NULL;
+        memset(f, 0, sizeof(*f));
+        f->unicast = unicast;
+        f->owner = CLUSTER_NO_OWNER;
+        f->hops = CLUSTER_HOPS_UNKNOWN;
+    }
+
+    copy_str(f->id, sizeof(f->id), id ? id : "", id ? strlen(id) : 0);
+    copy_str(f->name, sizeof(f->name), name ? name : "", name ? strlen(name) : 0);
+    if (device_key) {
+        memcpy(f->device_key, device_key, 16);
+        f->has_key = true;
+    }
+    return f;
+}
+
+void cluster_proto_remove(cluster_state_t *st, uint16_t unicast)
+{
+    cluster_fixture_t *f = cluster_proto_find(st, unicast);
+    if (f) memset(f, 0, sizeof(*f));
+}
+
+// Least loaded live node for a fixture: nodes with a proxy link first,
+// then nodes that haven't failed to reach it, then fewest fixtures
+static uint8_t pick_owner(const cluster_state_t *st, const cluster_fixture_t *f,
+                          const uint8_t *load, uint32_t now_ms)
+{
+    uint8_t best = CLUSTER_NO_OWNER;
+    int best_score = 0;
+    for (uint8_t i = 0; i < CLUSTER_MAX_NODES; i++) {
+        if (!cluster_proto_alive(st, i, now_ms) || load[i] >= st->capacity) continue;
+        int score = load[i];
+        if (!(st->nodes[i].flags & CLUSTER_FLAG_PROXY_UP)) score += 2000;
+        if (f->tried & (1u << i)) score += 1000;
+        if (best == CLUSTER_NO_OWNER || score < best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+bool cluster_proto_assign(cluster_state_t *st, uint32_t now_ms)
+{
+    uint8_t load[CLUSTER_MAX_NODES] = { 0 };
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES; i++) {
+        const cluster_fixture_t *f = &st->fixtures[i];
+        if (f->unicast && f->owner < CLUSTER_MAX_NODES && cluster_proto_alive(st, f->owner, now_ms)) {
+            load[f->owner]++;
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < CLUSTER_MAX_FIXTURES; i++) {
+        cluster_fixture_t *f = &st->fixtures[i];
+        if (!f->unicast) continue;
+
+        bool owner_live = f->owner < CLUSTER_MAX_NODES && cluster_proto_alive(st, f->owner, now_ms);
+        bool stuck = f->unreachable_ms && now_ms - f->unreachable_ms >= CLUSTER_REHOME_MS;
+        if (owner_live && !stuck) continue;
+
+        if (stuck && f->owner < CLUSTER_MAX_NODES) f->tried |= 1u << f->owner;
+        if (owner_live) load[f->owner]--;
+        uint8_t best = pick_owner(st, f, load, now_ms);
+
+        // Everyone has had a go: stay put and give it another period
+        if (best == CLUSTER_NO_OWNER || (owner_live && (f->tried & (1u << best)))) {
+            if (owner_live) {
+                load[f->owner]++;
+                f->unreachable_ms = now_ms | 1;
+                f->tried = 1u << f->owner;
+            } else if (f->owner != CLUSTER_NO_OWNER) {
+                // Nobody to hand it to: start over once a node turns up
+                f->owner = CLUSTER_NO_OWNER;
+                f->unreachable_ms = 0;
+                f->tried = 0;
+                changed = true;
+            }
+            continue;
+        }
+
+        load[best]++;
+        if (best != f->owner) {
+            f->owner = best;
+            f->hops = CLUSTER_HOPS_UNKNOWN;
+            changed = true;
+        }
+        f->unreachable_ms = 0;
+    }
+    return changed;
+}
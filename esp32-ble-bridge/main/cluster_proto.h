@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Inter-bridge protocol, election and fixture ownership. Plain C with no
+// IDF dependencies: cluster.c supplies the sockets and clock, so the same
+// logic runs in a host build.
+//
+// Datagram: 'B', version (1), type, node, boot u32 LE, counter u32 LE,
+// body, tag (first 8 bytes of AES-CMAC over everything before it, keyed
+// from the cluster secret). counter increases by one per datagram from a
+// node within one boot.
+//
+//   HELLO    every CLUSTER_HELLO_MS from every node:
+//            flags, load, n, n x (unicast u16, hops) for its fixtures
+//   ASSIGN   from the leader: n u16, n x (unicast u16, owner)
+//   FIXTURE  from the leader: op (1 add, 0 remove), unicast u16, has_key,
+//            [device key 16], id_len, id, name_len, name
+//   COMMAND  a phone command as JSON, to the leader or from it to an owner
+//   EVENT    a phone event as JSON, to the node holding the phone
+//
+// The leader is the lowest node index heard within CLUSTER_DEAD_MS. It
+// gives each fixture an owner: the current one while it has a proxy link
+// and reaches the fixture, otherwise the least loaded live node with a
+// proxy link that hasn't already failed to reach it.
+
+#define CLUSTER_VERSION         1
+#define CLUSTER_MAX_NODES       16
+#define CLUSTER_MAX_FIXTURES    128
+#define CLUSTER_NO_OWNER        0xFF
+
+#define CLUSTER_HELLO_MS        1000
+#define CLUSTER_DEAD_MS         3500    // Silent this long: failed over
+#define CLUSTER_REHOME_MS       10000   // Unreachable this long: moved
+
+#define CLUSTER_HEADER_LEN      12
+#define CLUSTER_TAG_LEN         8
+#define CLUSTER_MAX_DATAGRAM    1400
+
+// Per-fixture hops in HELLO
+#define CLUSTER_HOPS_UNKNOWN    0xFE    // Reachable, hops not measured
+#define CLUSTER_UNREACHABLE     0xFF
+
+// HELLO flags
+#define CLUSTER_FLAG_PROXY_UP   0x01
+#define CLUSTER_FLAG_CLIENT     0x02    // Holds the phone's WebSocket
+
+typedef enum {
+    CLUSTER_MSG_HELLO = 1,
+    CLUSTER_MSG_ASSIGN,
+    CLUSTER_MSG_FIXTURE,
+    CLUSTER_MSG_COMMAND,
+    CLUSTER_MSG_EVENT,
+} cluster_msg_t;
+
+typedef struct {
+    bool seen;
+    uint32_t boot;
+    uint32_t counter;       // Newest counter accepted in this boot
+    uint32_t last_ms;       // Last HELLO
+    uint8_t flags;
+    uint8_t load;           // Lights in its registry
+} cluster_node_t;
+
+typedef struct {
+    uint16_t unicast;       // 0 = free
+    uint8_t owner;
+    uint8_t hops;           // As the owner last reported it
+    uint16_t tried;         // Owners that failed to reach it, bit per node
+    uint32_t unreachable_ms;    // Since when the owner can't reach it, 0 = fine
+    bool has_key;
+    uint8_t device_key[16];
+    char id[40];
+    char name[32];
+} cluster_fixture_t;
+
+typedef struct {
+    uint8_t self;
+    uint32_t boot;
+    uint8_t capacity;       // Fixtures one node can own
+    cluster_node_t nodes[CLUSTER_MAX_NODES];
+    cluster_fixture_t fixtures[CLUSTER_MAX_FIXTURES];
+} cluster_state_t;
+
+void cluster_proto_init(cluster_state_t *st, uint8_t self, uint32_t boot, uint8_t capacity);
+
+// MARK: - Membership
+
+// Header for a datagram from this node; returns CLUSTER_HEADER_LEN
+size_t cluster_proto_header(const cluster_state_t *st, uint8_t *out, cluster_msg_t type,
+                            uint32_t counter);
+
+// Check the header of an authenticated datagram and record the sender.
+// A new boot is only taken from a HELLO of a node that has gone silent,
+// so replayed traffic from an earlier boot can't reset its counter.
+// Returns false for our own index, replays and malformed headers.
+bool cluster_proto_accept(cluster_state_t *st, const uint8_t *buf, size_t len, uint32_t now_ms,
+                          cluster_msg_t *type, uint8_t *node);
+
+bool cluster_proto_alive(const cluster_state_t *st, uint8_t node, uint32_t now_ms);
+uint8_t cluster_proto_leader(const cluster_state_t *st, uint32_t now_ms);
+
+// Lowest live node holding the phone, or CLUSTER_NO_OWNER
+uint8_t cluster_proto_client_node(const cluster_state_t *st, uint32_t now_ms);
+
+// MARK: - Messages
+
+size_t cluster_proto_write_hello(uint8_t *out, size_t max, uint8_t flags, uint8_t load,
+                                 const uint16_t *unicasts, const uint8_t *hops, int n);
+bool cluster_proto_read_hello(cluster_state_t *st, uint8_t node, const uint8_t *body,
+                              size_t len, uint32_t now_ms);
+
+size_t cluster_proto_write_assign(const cluster_state_t *st, uint8_t *out, size_t max);
+// Take the leader's owners; true if any changed
+bool cluster_proto_read_assign(cluster_state_t *st, const uint8_t *body, size_t len);
+
+size_t cluster_proto_write_fixture(const cluster_fixture_t *f, bool add, uint8_t *out, size_t max);
+// Apply an add or remove; *unicast and *added say which
+bool cluster_proto_read_fixture(cluster_state_t *st, const uint8_t *body, size_t len,
+                                uint16_t *unicast, bool *added);
+
+// MARK: - Fixtures
+
+cluster_fixture_t *cluster_proto_find(cluster_state_t *st, uint16_t unicast);
+
+// Add or update; NULL if the table is full. Keeps the owner of a known one.
+cluster_fixture_t *cluster_proto_add(cluster_state_t *st, const char *id, uint16_t unicast,
+                                     const char *name, const uint8_t *device_key);
+void cluster_proto_remove(cluster_state_t *st, uint16_t unicast);
+
+// Leader: (re)assign owners. true if any owner changed.
+bool cluster_proto_assign(cluster_state_t *st, uint32_t now_ms);
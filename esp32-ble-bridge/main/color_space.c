@@ -0,0 +1,130 @@
+/*
+ * color_space.c
+ *
+ * Perceptual hue tables and mired interpolation.
+ */
+
+#include "color_space.h"
+#include <math.h>
+#include <stdbool.h>
+#include "esp_log.h"
+
+static const char *TAG = "color";
+
+#define HUE_STEPS   360     // Fixture hue table, one entry per degree
+#define INV_STEPS   720     // Perceptual hue table, one per half degree
+#define ARC_SUB     8       // Samples per degree when measuring the circle
+
+static float s_to_perceptual[HUE_STEPS + 1];
+static float s_from_perceptual[INV_STEPS + 1];
+static bool s_ready = false;
+
+// Fully saturated fixture color at hue h (HSV, S = V = 1, as linear
+// light) in OKLab
+static void hue_to_oklab(double h, double lab[3])
+{
+    double x = fmod(h, 360.0) / 60.0;
+    double f = x - floor(x);
+    double r, g, b;
+    switch ((int)x) {
+    case 0:  r = 1;     g = f;     b = 0;     break;
+    case 1:  r = 1 - f; g = 1;     b = 0;     break;
+    case 2:  r = 0;     g = 1;     b = f;     break;
+    case 3:  r = 0;     g = 1 - f; b = 1;     break;
+    case 4:  r = f;     g = 0;     b = 1;     break;
+    default: r = 1;     g = 0;     b = 1 - f; break;
+    }
+
+    double l = cbrt(0.4122214708 * r + 0.5363325363 * g + 0.0514459929 * b);
+    double m = cbrt(0.2119034982 * r + 0.6806995451 * g + 0.1073969566 * b);
+    double s = cbrt(0.0883024619 * r + 0.2817188376 * g + 0.6299787005 * b);
+
+    lab[0] = 0.2104542553 * l + 0.7936177850 * m - 0.0040720468 * s;
+    lab[1] = 1.9779984951 * l - 2.4285922050 * m + 0.4505937099 * s;
+    lab[2] = 0.0259040371 * l + 0.7827717662 * m - 0.8086757660 * s;
+}
+
+void color_space_init(void)
+{
+    if (s_ready) return;
+
+    // Distance travelled along the hue circle up to each degree
+    double prev[3], lab[3], arc = 0;
+    hue_to_oklab(0, prev);
+    s_to_perceptual[0] = 0;
+    for (int i = 1; i <= HUE_STEPS * ARC_SUB; i++) {
+        hue_to_oklab((double)i / ARC_SUB, lab);
+        double dl = lab[0] - prev[0], da = lab[1] - prev[1], db = lab[2] - prev[2];
+        arc += sqrt(dl * dl + da * da + db * db);
+        prev[0] = lab[0];
+        prev[1] = lab[1];
+        prev[2] = lab[2];
+        if (i % ARC_SUB == 0) s_to_perceptual[i / ARC_SUB] = (float)arc;
+    }
+    for (int i = 0; i <= HUE_STEPS; i++) {
+        s_to_perceptual[i] = (float)(s_to_perceptual[i] * 360.0 / arc);
+    }
+
+    // Invert; the forward table only ever rises
+    int h = 0;
+    for (int i = 0; i <= INV_STEPS; i++) {
+        float p = i * 360.0f / INV_STEPS;
+        while (h < HUE_STEPS - 1 && s_to_perceptual[h + 1] < p) h++;
+        float span = s_to_perceptual[h + 1] - s_to_perceptual[h];
+        float frac = span > 0 ? (p - s_to_perceptual[h]) / span : 0;
+        s_from_perceptual[i] = fminf(h + frac, 360.0f);
+    }
+
+    s_ready = true;
+    ESP_LOGI(TAG, "Hue tables built: 60 deg (yellow) is %.0f perceptual, 180 (cyan) %.0f",
+             s_to_perceptual[60], s_to_perceptual[180]);
+}
+
+static float wrap(float h)
+{
+    h = fmodf(h, 360.0f);
+    return h < 0 ? h + 360.0f : h;
+}
+
+// Linear between the two nearest entries of a 0-360 table
+static float lookup(const float *table, int steps, float x)
+{
+    float pos = x * steps / 360.0f;
+    int i = (int)pos;
+    if (i >= steps) return table[steps];
+    return table[i] + (table[i + 1] - table[i]) * (pos - i);
+}
+
+float color_hue_to_perceptual(float hue)
+{
+    return lookup(s_to_perceptual, HUE_STEPS, wrap(hue));
+}
+
+float color_hue_from_perceptual(float p)
+{
+    float h = lookup(s_from_perceptual, INV_STEPS, wrap(p));
+    return h >= 360.0f ? 0 : h;
+}
+
+float color_hue_delta(float a, float b)
+{
+    float d = color_hue_to_perceptual(b) - color_hue_to_perceptual(a);
+    if (d > 180) d -= 360;
+    if (d < -180) d += 360;
+    return d;
+}
+
+float color_hue_lerp(float a, float b, float t)
+{
+    return color_hue_from_perceptual(color_hue_to_perceptual(a) + color_hue_delta(a, b) * t);
+}
+
+int color_cct_lerp(int from_kelvin, int to_kelvin, float t)
+{
+    if (from_kelvin <= 0 || to_kelvin <= 0) {
+        return from_kelvin + (int)lroundf((to_kelvin - from_kelvin) * t);
+    }
+    float ma = 1e6f / from_kelvin;
+    float mb = 1e6f / to_kelvin;
+    return (int)lroundf(1e6f / (ma + (mb - ma) * t));
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Perceptual interpolation for fades and sweeps.
+//
+// Fixture hue degrees are not evenly spaced to the eye: a linear walk
+// races through yellow and cyan and crawls through green and blue. The
+// perceptual hue here is the fixture hue re-spaced by distance in OKLab
+// along the fully saturated hue circle, scaled to 0-360, so equal steps
+// look equal. Tables are built once by color_space_init; the conversions
+// are a table lookup and a lerp, cheap enough for every rendered frame.
+//
+// CCT moves in mireds (1e6 / kelvin), where equal steps look roughly
+// equal; in kelvin a fade spends most of its time where nothing changes.
+
+void color_space_init(void);
+
+// Fixture hue (0-360) to perceptual hue (0-360), and back
+float color_hue_to_perceptual(float hue);
+float color_hue_from_perceptual(float p);
+
+// Shortest signed perceptual distance from fixture hue a to b (-180..180)
+float color_hue_delta(float a, float b);
+
+// Fixture hue at fraction t from a to b, the short way round
+float color_hue_lerp(float a, float b, float t);
+
+// Kelvin at fraction t from a to b, evenly in mireds
+int color_cct_lerp(int from_kelvin, int to_kelvin, float t);
@@ -0,0 +1,573 @@
+/*
+ * command.c
+ *
+ * Lighting, registry, effect, rules and cue commands shared by every way
+ * a command reaches the bridge.
+ */
+
+#include "command.h"
+#include <string.h>
+#include <stdio.h>
+#include "esp_log.h"
+
+#include "mesh_crypto.h"
+#include "ble_mesh.h"
+#include "light_registry.h"
+#include "effect_engine.h"
+#include "monitor.h"
+#include "heap_health.h"
+#include "rules.h"
+#include "cluster.h"
+#include "cue_player.h"
+#include "ws_server.h"
+
+static const char *TAG = "command";
+
+int command_parse_hex(const char *hex, uint8_t *out, int max_len)
+{
+    if (!hex) return 0;
+    int len = strlen(hex);
+    int byte_count = len / 2;
+    if (byte_count > max_len) byte_count = max_len;
+    for (int i = 0; i < byte_count; i++) {
+        unsigned int b;
+        if (sscanf(hex + i * 2, "%2x", &b) != 1) return i;
+        out[i] = (uint8_t)b;
+    }
+    return byte_count;
+}
+
+// MARK: - State commands
+
+typedef struct {
+    const char *cmd;
+    const char *fields[3];  // Required besides unicast
+    cJSON_bool (*is[3])(const cJSON *);
+} state_spec_t;
+
+static const state_spec_t s_state_specs[] = {
+    { "set_cct", { "intensity", "cct_kelvin" }, { cJSON_IsNumber, cJSON_IsNumber } },
+    { "set_hsi", { "intensity", "hue", "saturation" }, { cJSON_IsNumber, cJSON_IsNumber, cJSON_IsNumber } },
+    { "sleep", { "on" }, { cJSON_IsBool } },
+    { "update_effect", { "params" }, { cJSON_IsObject } },
+};
+
+uint16_t command_state_target(cJSON *root)
+{
+    cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    if (!cJSON_IsString(cmd) || !cJSON_IsNumber(uni)) return 0;
+    if (uni->valueint <= 0 || uni->valueint > 0xFFFF) return 0;
+
+    for (size_t i = 0; i < sizeof(s_state_specs) / sizeof(s_state_specs[0]); i++) {
+        const state_spec_t *spec = &s_state_specs[i];
+        if (strcmp(cmd->valuestring, spec->cmd) != 0) continue;
+        for (int f = 0; f < 3 && spec->fields[f]; f++) {
+            if (!spec->is[f](cJSON_GetObjectItem(root, spec->fields[f]))) return 0;
+        }
+        return (uint16_t)uni->valueint;
+    }
+    return 0;
+}
+
+// MARK: - Handlers
+
+static void handle_set_keys(cJSON *root)
+{
+    cJSON *nk = cJSON_GetObjectItem(root, "network_key");
+    cJSON *ak = cJSON_GetObjectItem(root, "app_key");
+    cJSON *iv = cJSON_GetObjectItem(root, "iv_index");
+    cJSON *src = cJSON_GetObjectItem(root, "src_address");
+
+    if (!nk || !ak || !iv) {
+        ESP_LOGE(TAG, "set_keys: missing fields");
+        return;
+    }
+
+    uint8_t network_key[16], app_key[16];
+    command_parse_hex(nk->valuestring, network_key, 16);
+    command_parse_hex(ak->valuestring, app_key, 16);
+    uint32_t iv_index = (uint32_t)iv->valuedouble;
+    uint16_t src_addr = src ? (uint16_t)src->valueint : 0x0001;
+
+    if (mesh_crypto_keys_match(network_key, app_key, iv_index, src_addr)) {
+        ESP_LOGI(TAG, "set_keys: keys unchanged, keeping current state");
+        return;
+    }
+
+    mesh_crypto_init(network_key, app_key, iv_index, src_addr);
+    ESP_LOGI(TAG, "Mesh keys configured, iv_index=0x%08lX src=0x%04X",
+             (unsigned long)iv_index, src_addr);
+}
+
+static void handle_add_light(cJSON *root)
+{
+    cJSON *id = cJSON_GetObjectItem(root, "id");
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    cJSON *name = cJSON_GetObjectItem(root, "name");
+    cJSON *dk = cJSON_GetObjectItem(root, "device_key");
+
+    if (!id || !uni) {
+        ESP_LOGE(TAG, "add_light: missing fields");
+        return;
+    }
+
+    light_registry_add(id->valuestring, (uint16_t)uni->valueint,
+                       name ? name->valuestring : "");
+
+    // Lets the bridge's config client reach lights the phone provisioned
+    uint8_t device_key[16];
+    if (dk && command_parse_hex(dk->valuestring, device_key, 16) == 16) {
+        light_registry_set_device_key((uint16_t)uni->valueint, device_key);
+    }
+
+    // If proxy is already connected, immediately mark this light as reachable
+    if (ble_mesh_is_proxy_connected()) {
+        ws_server_notify_light_status((uint16_t)uni->valueint, true);
+    }
+}
+
+static void handle_remove_light(cJSON *root)
+{
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    if (!uni) return;
+
+    uint16_t unicast = (uint16_t)uni->valueint;
+    effect_engine_stop(unicast);
+    light_registry_remove(unicast);
+}
+
+static void handle_connect(cJSON *root)
+{
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    if (!uni) return;
+
+    uint16_t unicast = (uint16_t)uni->valueint;
+
+    // Register the light if not already known
+    light_entry_t light;
+    if (!light_registry_lookup(unicast, &light)) {
+        // Auto-register with a placeholder id
+        char auto_id[32];
+        snprintf(auto_id, sizeof(auto_id), "auto-%04X", unicast);
+        if (!light_registry_add(auto_id, unicast, "")) {
+            ws_server_notify_error("Failed to register light");
+            return;
+        }
+    }
+
+    // If proxy is already connected, all lights are reachable
+    if (ble_mesh_is_proxy_connected()) {
+        light_registry_set_connected(unicast, true);
+        ws_server_notify_light_status(unicast, true);
+        return;
+    }
+
+    // Connect to any mesh proxy node — once connected, all lights are reachable
+    ESP_LOGI(TAG, "Connecting to mesh proxy for light 0x%04X...", unicast);
+    ble_mesh_connect_proxy();
+}
+
+static void handle_disconnect(cJSON *root)
+{
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    if (!uni) return;
+
+    uint16_t unicast = (uint16_t)uni->valueint;
+    light_entry_t light;
+    if (!light_registry_lookup(unicast, &light) || !light.connected) return;
+
+    // Stop any running effect
+    effect_engine_stop(unicast);
+
+    // Mark this light as disconnected (proxy stays up for other lights)
+    light_registry_set_connected(unicast, false);
+    ws_server_notify_light_status(unicast, false);
+}
+
+static bool handle_set_cct(cJSON *root)
+{
+    uint16_t unicast = command_state_target(root);
+    if (!unicast) return false;
+
+    cJSON *intensity = cJSON_GetObjectItem(root, "intensity");
+    cJSON *cct = cJSON_GetObjectItem(root, "cct_kelvin");
+    cJSON *sleep = cJSON_GetObjectItem(root, "sleep_mode");
+    int sleep_mode = sleep ? sleep->valueint : 1;
+
+    light_shadow_t shadow = {
+        .kind = SHADOW_CCT,
+        .intensity = intensity->valuedouble,
+        .cct_kelvin = cct->valueint,
+        .sleep_mode = sleep_mode,
+    };
+    light_registry_set_shadow(unicast, &shadow);
+
+    return ble_mesh_send_cct(unicast, intensity->valuedouble, cct->valueint, sleep_mode) == ESP_OK;
+}
+
+static bool handle_set_hsi(cJSON *root)
+{
+    uint16_t unicast = command_state_target(root);
+    if (!unicast) return false;
+
+    cJSON *intensity = cJSON_GetObjectItem(root, "intensity");
+    cJSON *hue = cJSON_GetObjectItem(root, "hue");
+    cJSON *sat = cJSON_GetObjectItem(root, "saturation");
+    cJSON *cct = cJSON_GetObjectItem(root, "cct_kelvin");
+    cJSON *sleep = cJSON_GetObjectItem(root, "sleep_mode");
+
+    int cct_kelvin = cct ? cct->valueint : 5600;
+    int sleep_mode = sleep ? sleep->valueint : 1;
+
+    light_shadow_t shadow = {
+        .kind = SHADOW_HSI,
+        .intensity = intensity->valuedouble,
+        .hue = hue->valueint,
+        .saturation = sat->valueint,
+        .cct_kelvin = cct_kelvin,
+        .sleep_mode = sleep_mode,
+    };
+    light_registry_set_shadow(unicast, &shadow);
+
+    return ble_mesh_send_hsi(unicast, intensity->valuedouble, hue->valueint, sat->valueint,
+                             cct_kelvin, sleep_mode) == ESP_OK;
+}
+
+static bool handle_sleep(cJSON *root)
+{
+    uint16_t unicast = command_state_target(root);
+    if (!unicast) return false;
+
+    bool awake = cJSON_IsTrue(cJSON_GetObjectItem(root, "on"));
+
+    // Waking restores the fixture's own last look, so only the sleep state
+    // itself becomes the shadow.
+    light_shadow_t shadow = {
+        .kind = SHADOW_SLEEP,
+        .sleep_mode = awake ? 1 : 0,
+    };
+    light_registry_set_shadow(unicast, &shadow);
+
+    return ble_mesh_send_sleep(unicast, awake) == ESP_OK;
+}
+
+static void handle_set_effect(cJSON *root)
+{
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    cJSON *type = cJSON_GetObjectItem(root, "effect_type");
+    cJSON *intensity = cJSON_GetObjectItem(root, "intensity");
+    cJSON *frq = cJSON_GetObjectItem(root, "frequency");
+    cJSON *cct = cJSON_GetObjectItem(root, "cct_kelvin");
+    cJSON *color = cJSON_GetObjectItem(root, "cop_car_color");
+    cJSON *mode = cJSON_GetObjectItem(root, "effect_mode");
+    cJSON *hue = cJSON_GetObjectItem(root, "hue");
+    cJSON *sat = cJSON_GetObjectItem(root, "saturation");
+
+    if (!uni || !type) return;
+
+    light_shadow_t shadow = {
+        .kind = SHADOW_HW_EFFECT,
+        .effect_type = type->valueint,
+        .intensity = intensity ? intensity->valuedouble : 50.0,
+        .frq = frq ? frq->valueint : 8,
+        .cct_kelvin = cct ? cct->valueint : 5600,
+        .cop_car_color = color ? color->valueint : 0,
+        .effect_mode = mode ? mode->valueint : 0,
+        .hue = hue ? hue->valueint : 0,
+        .saturation = sat ? sat->valueint : 100,
+    };
+    light_registry_set_shadow((uint16_t)uni->valueint, &shadow);
+
+    ble_mesh_send_effect(
+        (uint16_t)uni->valueint,
+        shadow.effect_type,
+        shadow.intensity,
+        shadow.frq,
+        shadow.cct_kelvin,
+        shadow.cop_car_color,
+        shadow.effect_mode,
+        shadow.hue,
+        shadow.saturation
+    );
+}
+
+static void handle_start_effect(cJSON *root)
+{
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    cJSON *engine = cJSON_GetObjectItem(root, "engine");
+    cJSON *params = cJSON_GetObjectItem(root, "params");
+
+    if (!uni || !engine) return;
+
+    uint16_t unicast = (uint16_t)uni->valueint;
+    const char *engine_name = engine->valuestring;
+
+    // Map engine name to effect type
+    effect_type_t etype = EFFECT_NONE;
+    if (strcmp(engine_name, "pulsing") == 0) etype = EFFECT_PULSING;
+    else if (strcmp(engine_name, "strobe") == 0) etype = EFFECT_STROBE;
+    else if (strcmp(engine_name, "fire") == 0) etype = EFFECT_FIRE;
+    else if (strcmp(engine_name, "candle") == 0) etype = EFFECT_CANDLE;
+    else if (strcmp(engine_name, "lightning") == 0) etype = EFFECT_LIGHTNING;
+    else if (strcmp(engine_name, "tv") == 0) etype = EFFECT_TV_FLICKER;
+    else if (strcmp(engine_name, "party") == 0) etype = EFFECT_PARTY;
+    else if (strcmp(engine_name, "explosion") == 0) etype = EFFECT_EXPLOSION;
+    else if (strcmp(engine_name, "welding") == 0) etype = EFFECT_WELDING;
+    else if (strcmp(engine_name, "faulty_bulb") == 0) etype = EFFECT_FAULTY_BULB;
+    else if (strcmp(engine_name, "paparazzi") == 0) etype = EFFECT_PAPARAZZI;
+    else {
+        ESP_LOGW(TAG, "Unknown engine: %s", engine_name);
+        return;
+    }
+
+    // Parse parameters
+    effect_params_t ep = {0};
+    effect_params_from_json(&ep, engine_name, params);
+
+    // Stop any existing effect on this light
+    effect_engine_stop(unicast);
+
+    light_shadow_t shadow = {
+        .kind = SHADOW_SW_EFFECT,
+        .effect_type = etype,
+        .intensity = ep.intensity,
+        .effect_params = ep,
+    };
+    light_registry_set_shadow(unicast, &shadow);
+
+    // Start new effect
+    effect_engine_start(unicast, etype, &ep);
+    ESP_LOGI(TAG, "Started %s effect on unicast 0x%04X", engine_name, unicast);
+}
+
+static bool handle_update_effect(cJSON *root)
+{
+    uint16_t unicast = command_state_target(root);
+    if (!unicast) return false;
+
+    // Parse partial params and merge
+    effect_params_t ep = {0};
+    effect_params_from_json(&ep, NULL, cJSON_GetObjectItem(root, "params"));
+    effect_engine_update(unicast, &ep);
+    light_registry_set_effect_params(unicast, &ep);
+    return true;
+}
+
+static void handle_stop_effect(cJSON *root)
+{
+    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
+    if (!uni) return;
+
+    uint16_t unicast = (uint16_t)uni->valueint;
+    effect_engine_stop(unicast);
+
+    // The light holds whatever the last frame was; nothing to replay
+    light_shadow_t shadow = { .kind = SHADOW_NONE };
+    light_registry_set_shadow(unicast, &shadow);
+}
+
+static void handle_stop_all(void)
+{
+    cue_player_stop();
+    effect_engine_stop_all();
+}
+
+static void handle_effect_stats(void)
+{
+    effect_stats_t stats[MAX_LIGHTS];
+    int n = effect_engine_get_stats(stats, MAX_LIGHTS);
+
+    char msg[1024];
+    int pos = snprintf(msg, sizeof(msg), "{\"event\":\"effect_stats\",\"effects\":[");
+    for (int i = 0; i < n && pos < (int)sizeof(msg) - 96; i++) {
+        pos += snprintf(msg + pos, sizeof(msg) - pos,
+                        "%s{\"unicast\":%d,\"type\":%d,\"steps\":%lu,\"sent\":%lu,\"skipped\":%lu}",
+                        i ? "," : "", stats[i].unicast, stats[i].type,
+                        (unsigned long)stats[i].steps,
+                        (unsigned long)(stats[i].steps - stats[i].skipped),
+                        (unsigned long)stats[i].skipped);
+    }
+    snprintf(msg + pos, sizeof(msg) - pos, "]}");
+    ws_server_send(msg);
+}
+
+// {"cmd":"monitor","rate":10} streams output frames (see monitor.h); rate 0 stops
+static void handle_monitor(cJSON *root)
+{
+    cJSON *rate = cJSON_GetObjectItem(root, "rate");
+    int hz = (rate && cJSON_IsNumber(rate)) ? rate->valueint : 0;
+    if (hz <= 0) {
+        monitor_stop();
+        return;
+    }
+    if (monitor_start(hz) != ESP_OK) {
+        ws_server_notify_error("monitor: rate must be 1-20 Hz");
+    }
+}
+
+// {"cmd":"rules","rules":[...]} installs and saves a rule table (see
+// rules.h); without "rules" it reports the current one
+static void handle_rules(cJSON *root)
+{
+    cJSON *rules = cJSON_GetObjectItem(root, "rules");
+    if (rules) {
+        esp_err_t err = rules_set(rules, true);
+        if (err == ESP_ERR_INVALID_ARG) {
+            ws_server_notify_error("rules: invalid rule");
+        } else if (err == ESP_ERR_INVALID_SIZE) {
+            ws_server_notify_error("rules: table too large");
+        } else if (err != ESP_OK) {
+            ws_server_notify_error("rules: installed but not saved");
+        }
+    }
+    rules_report();
+}
+
+// {"cmd":"input","name":"btn1","value":1} feeds an external value (button,
+// OSC, DMX channel) to the rules engine
+static void handle_input(cJSON *root)
+{
+    cJSON *name = cJSON_GetObjectItem(root, "name");
+    cJSON *value = cJSON_GetObjectItem(root, "value");
+    if (!name || !cJSON_IsString(name)) return;
+    rules_post_input(name->valuestring, (value && cJSON_IsNumber(value)) ? value->valuedouble : 1.0);
+}
+
+// {"cmd":"cues","cues":[...]} loads a cue list (see cue_player.h); without
+// "cues" it reports the player
+static void handle_cues(cJSON *root)
+{
+    cJSON *cues = cJSON_GetObjectItem(root, "cues");
+    if (cues) {
+        esp_err_t err = cue_player_load(cues);
+        if (err == ESP_ERR_INVALID_ARG) {
+            ws_server_notify_error("cues: invalid cue");
+        } else if (err == ESP_ERR_INVALID_SIZE) {
+            ws_server_notify_error("cues: list too large");
+        } else if (err != ESP_OK) {
+            ws_server_notify_error("cues: out of memory");
+        }
+    }
+    cue_player_report();
+}
+
+// {"cmd":"cue_go"} runs the next cue, {"cmd":"cue_go","cue":N} cue N
+static esp_err_t handle_cue_go(cJSON *root)
+{
+    cJSON *cue = cJSON_GetObjectItem(root, "cue");
+    int index = cJSON_IsNumber(cue) ? cue->valueint : -1;
+    if (cJSON_IsNumber(cue) && index < 0) index = 0;
+    esp_err_t err = cue_player_go(index);
+    if (err != ESP_OK) {
+        ws_server_notify_error("cue_go: no such cue");
+    }
+    return err;
+}
+
+// MARK: - Dispatch
+
+bool command_dispatch(cJSON *root)
+{
+    cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
+    if (!cmd || !cJSON_IsString(cmd)) return false;
+    const char *cmd_str = cmd->valuestring;
+
+    if (strcmp(cmd_str, "set_keys") == 0) {
+        handle_set_keys(root);
+    } else if (strcmp(cmd_str, "add_light") == 0) {
+        handle_add_light(root);
+    } else if (strcmp(cmd_str, "remove_light") == 0) {
+        handle_remove_light(root);
+    } else if (strcmp(cmd_str, "connect") == 0) {
+        handle_connect(root);
+    } else if (strcmp(cmd_str, "disconnect") == 0) {
+        handle_disconnect(root);
+    } else if (strcmp(cmd_str, "set_cct") == 0) {
+        handle_set_cct(root);
+    } else if (strcmp(cmd_str, "set_hsi") == 0) {
+        handle_set_hsi(root);
+    } else if (strcmp(cmd_str, "sleep") == 0) {
+        handle_sleep(root);
+    } else if (strcmp(cmd_str, "set_effect") == 0) {
+        handle_set_effect(root);
+    } else if (strcmp(cmd_str, "start_effect") == 0) {
+        handle_start_effect(root);
+    } else if (strcmp(cmd_str, "update_effect") == 0) {
+        handle_update_effect(root);
+    } else if (strcmp(cmd_str, "stop_effect") == 0) {
+        handle_stop_effect(root);
+    } else if (strcmp(cmd_str, "stop_all") == 0) {
+        handle_stop_all();
+    } else if (strcmp(cmd_str, "effect_stats") == 0) {
+        handle_effect_stats();
+    } else if (strcmp(cmd_str, "monitor") == 0) {
+        handle_monitor(root);
+    } else if (strcmp(cmd_str, "health") == 0) {
+        heap_health_report();
+    } else if (strcmp(cmd_str, "rules") == 0) {
+        handle_rules(root);
+    } else if (strcmp(cmd_str, "input") == 0) {
+        handle_input(root);
+    } else if (strcmp(cmd_str, "cluster") == 0) {
+        cluster_report();
+    } else if (strcmp(cmd_str, "cues") == 0) {
+        handle_cues(root);
+    } else if (strcmp(cmd_str, "cue_go") == 0) {
+        handle_cue_go(root);
+    } else if (strcmp(cmd_str, "cue_stop") == 0) {
+        cue_player_stop();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool apply_state_local(cJSON *root)
+{
+    const char *cmd = cJSON_GetObjectItem(root, "cmd")->valuestring;
+    if (strcmp(cmd, "set_cct") == 0) return handle_set_cct(root);
+    if (strcmp(cmd, "set_hsi") == 0) return handle_set_hsi(root);
+    if (strcmp(cmd, "sleep") == 0) return handle_sleep(root);
+    return handle_update_effect(root);
+}
+
+// Absolute state commands, also accepted from the UDP channel
+bool command_apply_state(cJSON *root)
+{
+    if (!command_state_target(root)) return false;
+    if (cluster_route(root)) return true;
+    return apply_state_local(root);
+}
+
+// Lighting commands, also run by the rules engine
+bool command_apply_action(cJSON *root)
+{
+    if (command_apply_state(root)) return true;
+
+    cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
+    if (!cmd || !cJSON_IsString(cmd)) return false;
+
+    // A GO button
+    if (strcmp(cmd->valuestring, "cue_go") == 0) {
+        if (cluster_route(root)) return true;
+        return handle_cue_go(root) == ESP_OK;
+    }
+
+    if (strcmp(cmd->valuestring, "set_effect") != 0 && strcmp(cmd->valuestring, "start_effect") != 0 &&
+        strcmp(cmd->valuestring, "stop_effect") != 0 && strcmp(cmd->valuestring, "stop_all") != 0) {
+        return false;
+    }
+    if (cluster_route(root)) return true;
+
+    if (strcmp(cmd->valuestring, "set_effect") == 0) {
+        handle_set_effect(root);
+    } else if (strcmp(cmd->valuestring, "start_effect") == 0) {
+        handle_start_effect(root);
+    } else if (strcmp(cmd->valuestring, "stop_effect") == 0) {
+        handle_stop_effect(root);
+    } else {
+        handle_stop_all();
+    }
+    return true;
+}
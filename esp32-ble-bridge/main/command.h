@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cJSON.h"
+
+// The phone's lighting and registry commands, independent of how they
+// arrived. The WebSocket server, the UDP channel, the rules engine, the cue
+// player and the cluster all end up here, on the ESP32 and in the host
+// daemon alike. Radio-specific commands (bearer, provisioning, config
+// client, capture) stay with ws_server.
+
+// Run a command here, without cluster routing. false if it isn't one of
+// the commands handled here.
+bool command_dispatch(cJSON *root);
+
+// The light a well-formed set_cct, set_hsi, sleep or update_effect
+// addresses, or 0 for anything else. These carry absolute state, so they
+// may arrive out of order over UDP; callers check before ordering them.
+uint16_t command_state_target(cJSON *root);
+
+// Apply one of the state commands above, routed through the cluster.
+// false if it is malformed or the mesh wouldn't take it, and for any other
+// command.
+bool command_apply_state(cJSON *root);
+
+// Apply a lighting command: the state commands above plus set_effect,
+// start_effect, stop_effect, stop_all and cue_go; false for anything else,
+// and for a cue_go the player couldn't run
+bool command_apply_action(cJSON *root);
+
+// Hex string to bytes; returns the number of bytes parsed
+int command_parse_hex(const char *hex, uint8_t *out, int max_len);
@@ -0,0 +1,891 @@
+/*
+ * cue_player.c
+ *
+ * Tracking cue list with per-attribute change detection.
+ */
+
+#include "cue_player.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_crc.h"
+
+#include "light_registry.h"
+#include "ws_server.h"
+#include "command.h"
+#include "color_space.h"
+#include "show_codec.h"
+#include "rules.h"
+
+static const char *TAG = "cues";
+
+#define TICK_MS         40
+
+// Smallest move a fade step is sent for; the last step is always exact
+#define STEP_INTENSITY  5       // Tenths of a percent
+#define STEP_MIRED      3.0f
+#define STEP_HUE        2.0f    // Perceptual degrees
+#define NO_GO           -2
+
+// Attributes of a look
+#define ATTR_ON         0x01
+#define ATTR_MODE       0x02
+#define ATTR_INTENSITY  0x04
+#define ATTR_CCT        0x08
+#define ATTR_HUE        0x10
+#define ATTR_SAT        0x20
+#define ATTR_ALL        0x3F
+
+// Values of on and mode in a binary list's attribute flags
+#define CUE_FLAG_ON     0x40
+#define CUE_FLAG_HSI    0x80
+
+typedef enum {
+    MODE_CCT = 0,
+    MODE_HSI,
+} look_mode_t;
+
+typedef struct {
+    uint8_t mask;           // Attributes present
+    bool on;
+    uint8_t mode;           // look_mode_t
+    float intensity;        // Percent
+    int16_t cct_kelvin;
+    int16_t hue;
+    int16_t saturation;
+} look_t;
+
+typedef struct {
+    uint16_t unicast;
+    look_t look;            // Only what this cue changes
+} change_t;
+
+typedef struct {
+    uint32_t fade_ms;
+    uint16_t first;         // Into s_changes
+    uint16_t count;
+} cue_t;
+
+// A command as the fixture sees it
+typedef struct {
+    shadow_kind_t kind;     // SHADOW_NONE until something was sent
+    int intensity;          // Tenths of a percent, the wire resolution
+    int cct_kelvin;
+    int hue;
+    int saturation;
+} sent_t;
+
+typedef struct {
+    uint16_t unicast;
+    look_t out;             // What the light shows; partial mask = unknown
+    look_t from;            // Fade endpoints
+    look_t end;
+    look_t to;              // Tracked target, out once the fade is done
+    uint8_t fading;         // Attributes still moving
+    sent_t sent;
+} track_t;
+
+// Attributes a list never sets
+static const look_t k_default_look = {
+    .mask = ATTR_ALL,
+    .on = true,
+    .mode = MODE_CCT,
+    .intensity = 50.0f,
+    .cct_kelvin = 5600,
+    .hue = 0,
+    .saturation = 100,
+};
+
+static SemaphoreHandle_t s_mutex = NULL;
+static TaskHandle_t s_task = NULL;
+
+static cue_t *s_cues = NULL;
+static change_t *s_changes = NULL;
+static int s_count = 0;
+static bool s_loaded = false;
+static uint32_t s_digest = 0;       // See cue_player_digest
+static int s_current = -1;          // Last cue run
+static int s_pending = NO_GO;       // GO waiting for the task
+static bool s_keep_position = false;    // Restored with no list; see cue_player_resume
+
+static track_t s_tracks[CUE_LIGHTS_MAX];
+static int s_track_count = 0;
+
+static bool s_fading = false;
+static int64_t s_fade_start_us = 0;
+static uint32_t s_fade_ms = 0;
+
+static uint32_t s_go_sends = 0;     // Commands the running cue has cost
+static uint32_t s_sends = 0;
+static uint32_t s_skipped = 0;      // Fade steps that rounded to the last command
+
+// MARK: - Looks
+
+static void merge(look_t *dst, const look_t *src)
+{
+    if (src->mask & ATTR_ON) dst->on = src->on;
+    if (src->mask & ATTR_MODE) dst->mode = src->mode;
+    if (src->mask & ATTR_INTENSITY) dst->intensity = src->intensity;
+    if (src->mask & ATTR_CCT) dst->cct_kelvin = src->cct_kelvin;
+    if (src->mask & ATTR_HUE) dst->hue = src->hue;
+    if (src->mask & ATTR_SAT) dst->saturation = src->saturation;
+    dst->mask |= src->mask;
+}
+
+// Take the attributes dst lacks from src
+static void fill(look_t *dst, const look_t *src)
+{
+    look_t missing = *src;
+    missing.mask = src->mask & ~dst->mask;
+    merge(dst, &missing);
+}
+
+// Attributes that reach the fixture in this look
+static uint8_t visible(const look_t *l)
+{
+    if (!l->on) return ATTR_ON;
+    return l->mode == MODE_HSI ? ATTR_ALL : (ATTR_ON | ATTR_MODE | ATTR_INTENSITY | ATTR_CCT);
+}
+
+static uint8_t differing(const look_t *a, const look_t *b)
+{
+    uint8_t d = 0;
+    if (a->on != b->on) d |= ATTR_ON;
+    if (a->mode != b->mode) d |= ATTR_MODE;
+    if (fabsf(a->intensity - b->intensity) >= 0.05f) d |= ATTR_INTENSITY;
+    if (a->cct_kelvin != b->cct_kelvin) d |= ATTR_CCT;
+    if (a->hue != b->hue) d |= ATTR_HUE;
+    if (a->saturation != b->saturation) d |= ATTR_SAT;
+    return d & (visible(a) | visible(b));
+}
+
+// CCT in mireds, hue the short way round in perceptual hue (color_space.h)
+static void blend(const look_t *a, const look_t *b, float t, look_t *out)
+{
+    *out = *b;
+    out->intensity = a->intensity + (b->intensity - a->intensity) * t;
+    out->cct_kelvin = (int16_t)color_cct_lerp(a->cct_kelvin, b->cct_kelvin, t);
+    out->saturation = (int16_t)lroundf(a->saturation + (b->saturation - a->saturation) * t);
+    out->hue = (int16_t)(lroundf(color_hue_lerp(a->hue, b->hue, t)) % 360);
+}
+
+static bool parse_look(const cJSON *j, look_t *l)
+{
+    memset(l, 0, sizeof(*l));
+
+    cJSON *v = cJSON_GetObjectItem(j, "on");
+    if (cJSON_IsBool(v)) {
+        l->on = cJSON_IsTrue(v);
+        l->mask |= ATTR_ON;
+    }
+    v = cJSON_GetObjectItem(j, "mode");
+    if (cJSON_IsString(v)) {
+        if (strcmp(v->valuestring, "cct") == 0) {
+            l->mode = MODE_CCT;
+        } else if (strcmp(v->valuestring, "hsi") == 0) {
+            l->mode = MODE_HSI;
+        } else {
+            return false;
+        }
+        l->mask |= ATTR_MODE;
+    }
+    v = cJSON_GetObjectItem(j, "intensity");
+    if (cJSON_IsNumber(v)) {
+        l->intensity = (float)fmin(fmax(v->valuedouble, 0.0), 100.0);
+        l->mask |= ATTR_INTENSITY;
+    }
+    v = cJSON_GetObjectItem(j, "cct_kelvin");
+    if (cJSON_IsNumber(v)) {
+        l->cct_kelvin = (int16_t)fmin(fmax(v->valuedouble, 1000.0), 20000.0);
+        l->mask |= ATTR_CCT;
+    }
+    v = cJSON_GetObjectItem(j, "hue");
+    if (cJSON_IsNumber(v)) {
+        l->hue = (int16_t)((v->valueint % 360 + 360) % 360);
+        l->mask |= ATTR_HUE;
+    }
+    v = cJSON_GetObjectItem(j, "saturation");
+    if (cJSON_IsNumber(v)) {
+        l->saturation = (int16_t)fmin(fmax(v->valuedouble, 0.0), 100.0);
+        l->mask |= ATTR_SAT;
+    }
+    return true;
+}
+
+// MARK: - Output
+
+static track_t *track_for(uint16_t unicast)
+{
+    for (int i = 0; i < s_track_count; i++) {
+        if (s_tracks[i].unicast == unicast) return &s_tracks[i];
+    }
+    if (s_track_count == CUE_LIGHTS_MAX) return NULL;
+    track_t *tr = &s_tracks[s_track_count++];
+    memset(tr, 0, sizeof(*tr));
+    tr->unicast = unicast;
+    return tr;
+}
+
+// Forget what we sent if someone else has driven the light since
+static void check_shadow(track_t *tr)
+{
+    light_entry_t e;
+    if (tr->sent.kind == SHADOW_NONE || !light_registry_lookup(tr->unicast, &e)) return;
+
+    const light_shadow_t *s = &e.shadow;
+    bool same = s->kind == tr->sent.kind;
+    if (same && s->kind == SHADOW_SLEEP) {
+        same = s->sleep_mode == 0;
+    } else if (same) {
+        same = (int)lround(s->intensity * 10.0) == tr->sent.intensity &&
+               s->cct_kelvin == tr->sent.cct_kelvin &&
+               (s->kind != SHADOW_HSI ||
+                (s->hue == tr->sent.hue && s->saturation == tr->sent.saturation));
+    }
+    if (!same) {
+        tr->out.mask = 0;
+        memset(&tr->sent, 0, sizeof(tr->sent));
+    }
+}
+
+static bool small_step(const sent_t *a, const sent_t *b)
+{
+    if (a->kind != b->kind || abs(a->intensity - b->intensity) >= STEP_INTENSITY) return false;
+    if (a->cct_kelvin > 0 && b->cct_kelvin > 0 &&
+        fabsf(1e6f / a->cct_kelvin - 1e6f / b->cct_kelvin) >= STEP_MIRED) {
+        return false;
+    }
+    return fabsf(color_hue_delta(a->hue, b->hue)) < STEP_HUE && a->saturation == b->saturation;
+}
+
+// The command a look becomes
+static sent_t sent_of(const look_t *l)
+{
+    sent_t s = { .kind = SHADOW_SLEEP };
+    if (l->on) {
+        s.kind = l->mode == MODE_HSI ? SHADOW_HSI : SHADOW_CCT;
+        s.intensity = (int)lroundf(l->intensity * 10.0f);
+        s.cct_kelvin = l->cct_kelvin;
+        if (s.kind == SHADOW_HSI) {
+            s.hue = l->hue;
+            s.saturation = l->saturation;
+        }
+    }
+    return s;
+}
+
+// Runs on the dispatcher, in turn with the phone's commands
+static void apply_look(void *arg)
+{
+    cJSON *cmd = arg;
+    command_apply_state(cmd);
+    cJSON_Delete(cmd);
+}
+
+static void send_look(track_t *tr, const look_t *l, bool exact)
+{
+    sent_t s = sent_of(l);
+    bool same = s.kind == tr->sent.kind && s.intensity == tr->sent.intensity &&
+                s.cct_kelvin == tr->sent.cct_kelvin && s.hue == tr->sent.hue &&
+                s.saturation == tr->sent.saturation;
+    if (same || (!exact && small_step(&s, &tr->sent))) {
+        s_skipped++;
+        return;
+    }
+
+    cJSON *cmd = cJSON_CreateObject();
+    if (!cmd) return;
+    cJSON_AddNumberToObject(cmd, "unicast", tr->unicast);
+    if (s.kind == SHADOW_SLEEP) {
+        cJSON_AddStringToObject(cmd, "cmd", "sleep");
+        cJSON_AddBoolToObject(cmd, "on", false);
+    } else {
+        cJSON_AddStringToObject(cmd, "cmd", s.kind == SHADOW_HSI ? "set_hsi" : "set_cct");
+        cJSON_AddNumberToObject(cmd, "intensity", s.intensity / 10.0);
+        cJSON_AddNumberToObject(cmd, "cct_kelvin", s.cct_kelvin);
+        if (s.kind == SHADOW_HSI) {
+            cJSON_AddNumberToObject(cmd, "hue", s.hue);
+            cJSON_AddNumberToObject(cmd, "saturation", s.saturation);
+        }
+    }
+    // Not counted as sent if it can't be queued, so the next step retries
+    if (ws_server_queue_work(apply_look, cmd) != ESP_OK) {
+        ESP_LOGD(TAG, "0x%04X: dispatcher busy", tr->unicast);
+        cJSON_Delete(cmd);
+        return;
+    }
+
+    tr->sent = s;
+    s_sends++;
+    s_go_sends++;
+}
+
+// MARK: - Playback
+
+static void report_done(void)
+{
+    char body[64];
+    snprintf(body, sizeof(body), "\"cue\":%d,\"sends\":%lu", s_current, (unsigned long)s_go_sends);
+    ws_server_send_event("cue_done", body);
+    rules_post_cue_done(s_current);
+}
+
+// Hold every light at its current step
+static void stop_locked(void)
+{
+    for (int i = 0; i < s_track_count; i++) {
+        s_tracks[i].fading = 0;
+    }
+    s_fading = false;
+}
+
+// Track through cues 0..index: the latest value of every attribute
+static int build_targets(int index, uint16_t *unicasts, look_t *looks)
+{
+    int n = 0;
+    for (int c = 0; c <= index; c++) {
+        const cue_t *cue = &s_cues[c];
+        for (int k = 0; k < cue->count; k++) {
+            const change_t *ch = &s_changes[cue->first + k];
+            int i = 0;
+            while (i < n && unicasts[i] != ch->unicast) i++;
+            if (i == n) {
+                unicasts[n] = ch->unicast;
+                memset(&looks[n], 0, sizeof(looks[n]));
+                n++;
+            }
+            merge(&looks[i], &ch->look);
+        }
+    }
+    return n;
+}
+
+static void go_locked(int index)
+{
+    static uint16_t unicasts[CUE_LIGHTS_MAX];
+    static look_t looks[CUE_LIGHTS_MAX];
+
+    if (index >= s_count) return;
+    stop_locked();
+    s_current = index;
+    s_go_sends = 0;
+
+    uint32_t fade_ms = s_cues[index].fade_ms;
+    int n = build_targets(index, unicasts, looks);
+    int changed = 0;
+    bool any_fade = false;
+
+    for (int i = 0; i < n; i++) {
+        track_t *tr = track_for(unicasts[i]);
+        if (!tr) continue;
+        check_shadow(tr);
+
+        bool known = tr->out.mask == ATTR_ALL;
+        look_t to = looks[i];
+        if (known) fill(&to, &tr->out);
+        fill(&to, &k_default_look);
+
+        uint8_t attrs = known ? differing(&tr->out, &to) : visible(&to);
+        tr->to = to;
+        if (!attrs) {
+            // Tracked values moved, the output didn't
+            tr->out = to;
+            continue;
+        }
+        changed++;
+
+        if (!known || fade_ms == 0) {
+            send_look(tr, &to, true);
+            tr->out = to;
+            continue;
+        }
+
+        // Fade up from dark, fade down before sleeping, and take a new
+        // mode's color at once
+        tr->from = tr->out;
+        tr->end = to;
+        if (!tr->from.on) {
+            tr->from = to;
+            tr->from.intensity = 0;
+        } else if (!to.on) {
+            tr->end = tr->from;
+            tr->end.intensity = 0;
+        } else if (tr->from.mode != to.mode) {
+            tr->from.mode = to.mode;
+            tr->from.cct_kelvin = to.cct_kelvin;
+            tr->from.hue = to.hue;
+            tr->from.saturation = to.saturation;
+        }
+        tr->fading = attrs;
+        any_fade = true;
+    }
+
+    char body[96];
+    snprintf(body, sizeof(body), "\"cue\":%d,\"lights\":%d,\"changed\":%d,\"fade_ms\":%lu",
+             index, n, changed, (unsigned long)fade_ms);
+    ws_server_send_event("cue", body);
+    ESP_LOGI(TAG, "GO %d: %d of %d light(s) change", index, changed, n);
+
+    if (any_fade) {
+        s_fade_start_us = esp_timer_get_time();
+        s_fade_ms = fade_ms;
+        s_fading = true;
+    } else {
+        report_done();
+    }
+}
+
+static void step_locked(int64_t now)
+{
+    float t = (float)(now - s_fade_start_us) / (s_fade_ms * 1000.0f);
+    bool done = t >= 1.0f;
+
+    for (int i = 0; i < s_track_count; i++) {
+        track_t *tr = &s_tracks[i];
+        if (!tr->fading) continue;
+
+        look_t cur;
+        if (done) {
+            cur = tr->to;
+            tr->fading = 0;
+        } else {
+            blend(&tr->from, &tr->end, t, &cur);
+        }
+        send_look(tr, &cur, done);
+        tr->out = cur;
+    }
+
+    if (done) {
+        s_fading = false;
+        report_done();
+    }
+}
+
+static void cue_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, s_fading ? pdMS_TO_TICKS(TICK_MS) : portMAX_DELAY);
+
+        xSemaphoreTake(s_mutex, portMAX_DELAY);
+        if (s_pending != NO_GO) {
+            int index = s_pending;
+            s_pending = NO_GO;
+            go_locked(index);
+        }
+        if (s_fading) step_locked(esp_timer_get_time());
+        xSemaphoreGive(s_mutex);
+    }
+}
+
+// MARK: - Loading
+
+// Count a light the list drives; false once there are too many
+static bool note_light(uint16_t *lights, int *count, uint16_t unicast)
+{
+    int k = 0;
+    while (k < *count && lights[k] != unicast) k++;
+    if (k < *count) return true;
+    if (*count == CUE_LIGHTS_MAX) return false;
+    lights[(*count)++] = unicast;
+    return true;
+}
+
+static uint32_t crc_varint(uint32_t crc, uint32_t v)
+{
+    uint8_t b[5];
+    int n = 0;
+    while (v >= 0x80) {
+        b[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    b[n++] = (uint8_t)v;
+    return esp_crc32_le(crc, b, n);
+}
+
+// The list re-encoded the way read_change reads it
+static uint32_t list_digest(const cue_t *cue_tab, int n, const change_t *changes, int used)
+{
+    uint32_t crc = crc_varint(0, (uint32_t)n);
+    crc = crc_varint(crc, (uint32_t)used);
+    int32_t unicast = 0;
+    for (int i = 0; i < n; i++) {
+        crc = crc_varint(crc, cue_tab[i].fade_ms);
+        crc = crc_varint(crc, cue_tab[i].count);
+        for (int k = 0; k < cue_tab[i].count; k++) {
+            const change_t *ch = &changes[cue_tab[i].first + k];
+            const look_t *l = &ch->look;
+            crc = crc_varint(crc, show_zigzag_encode(ch->unicast - unicast));
+            unicast = ch->unicast;
+
+            uint32_t flags = l->mask;
+            if ((l->mask & ATTR_ON) && l->on) flags |= CUE_FLAG_ON;
+            if ((l->mask & ATTR_MODE) && l->mode == MODE_HSI) flags |= CUE_FLAG_HSI;
+            crc = crc_varint(crc, flags);
+            if (l->mask & ATTR_INTENSITY) crc = crc_varint(crc, (uint32_t)lroundf(l->intensity * 10.0f));
+            if (l->mask & ATTR_CCT) crc = crc_varint(crc, (uint32_t)l->cct_kelvin);
+            if (l->mask & ATTR_HUE) crc = crc_varint(crc, (uint32_t)l->hue);
+            if (l->mask & ATTR_SAT) crc = crc_varint(crc, (uint32_t)l->saturation);
+        }
+    }
+    return crc;
+}
+
+// Swap in a parsed list; takes the tables
+static void install(cue_t *cue_tab, int n, change_t *changes, int used,
+                    const uint16_t *lights, int light_count)
+{
+    uint32_t digest = list_digest(cue_tab, n, changes, used);
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    stop_locked();
+    free(s_cues);
+    free(s_changes);
+    s_cues = cue_tab;
+    s_changes = changes;
+    s_count = n;
+    s_loaded = true;
+    s_digest = digest;
+    s_current = s_keep_position && s_current < n ? s_current : -1;
+    s_keep_position = false;
+    s_pending = NO_GO;
+
+    // Keep what we know about lights the new list still drives
+    int kept = 0;
+    for (int i = 0; i < s_track_count; i++) {
+        for (int k = 0; k < light_count; k++) {
+            if (s_tracks[i].unicast == lights[k]) {
+                s_tracks[kept++] = s_tracks[i];
+                break;
+            }
+        }
+    }
+    s_track_count = kept;
+    xSemaphoreGive(s_mutex);
+
+    ESP_LOGI(TAG, "%d cue(s), %d change(s), %d light(s)", n, used, light_count);
+}
+
+// One change of a binary list: unicast delta, attribute flags, values
+static esp_err_t read_change(cue_varint_fn next, void *ctx, int32_t *unicast, change_t *ch)
+{
+    uint32_t zz, flags, v;
+    esp_err_t err = next(ctx, &zz);
+    if (err == ESP_OK) err = next(ctx, &flags);
+    if (err != ESP_OK) return err == ESP_ERR_NOT_FOUND ? ESP_ERR_INVALID_SIZE : err;
+
+    *unicast = (int32_t)((uint32_t)*unicast + (uint32_t)show_zigzag_decode(zz));
+    if (*unicast <= 0 || *unicast > 0x7FFF || (flags & ~0xFFu)) return ESP_ERR_INVALID_ARG;
+    ch->unicast = (uint16_t)*unicast;
+
+    look_t *l = &ch->look;
+    memset(l, 0, sizeof(*l));
+    l->mask = flags & ATTR_ALL;
+    l->on = (flags & CUE_FLAG_ON) != 0;
+    l->mode = (flags & CUE_FLAG_HSI) ? MODE_HSI : MODE_CCT;
+
+    static const uint8_t k_values[] = { ATTR_INTENSITY, ATTR_CCT, ATTR_HUE, ATTR_SAT };
+    for (size_t i = 0; i < sizeof(k_values); i++) {
+        if (!(l->mask & k_values[i])) continue;
+        err = next(ctx, &v);
+        if (err != ESP_OK) return err == ESP_ERR_NOT_FOUND ? ESP_ERR_INVALID_SIZE : err;
+        switch (k_values[i]) {
+        case ATTR_INTENSITY:
+            if (v > 1000) return ESP_ERR_INVALID_ARG;
+            l->intensity = v / 10.0f;
+            break;
+        case ATTR_CCT:
+            if (v < 1000 || v > 20000) return ESP_ERR_INVALID_ARG;
+            l->cct_kelvin = (int16_t)v;
+            break;
+        case ATTR_HUE:
+            if (v >= 360) return ESP_ERR_INVALID_ARG;
+            l->hue = (int16_t)v;
+            break;
+        default:
+            if (v > 100) return ESP_ERR_INVALID_ARG;
+            l->saturation = (int16_t)v;
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+// MARK: - Warm restart
+
+#define SNAP_ON         0x01
+#define SNAP_HSI        0x02
+
+static void pack_look(const look_t *l, cue_look_snapshot_t *p)
+{
+    p->mask = l->mask;
+    p->flags = (l->on ? SNAP_ON : 0) | (l->mode == MODE_HSI ? SNAP_HSI : 0);
+    p->saturation = (uint8_t)l->saturation;
+    p->intensity = (uint16_t)lroundf(l->intensity * 10.0f);
+    p->cct_kelvin = (uint16_t)l->cct_kelvin;
+    p->hue = (uint16_t)((l->hue % 360 + 360) % 360);
+}
+
+static void unpack_look(const cue_look_snapshot_t *p, look_t *l)
+{
+    memset(l, 0, sizeof(*l));
+    l->mask = p->mask & ATTR_ALL;
+    l->on = (p->flags & SNAP_ON) != 0;
+    l->mode = (p->flags & SNAP_HSI) ? MODE_HSI : MODE_CCT;
+    l->intensity = (p->intensity > 1000 ? 1000 : p->intensity) / 10.0f;
+    l->cct_kelvin = (int16_t)(p->cct_kelvin > 20000 ? 20000 : p->cct_kelvin);
+    l->hue = (int16_t)(p->hue % 360);
+    l->saturation = p->saturation > 100 ? 100 : p->saturation;
+}
+
+void cue_player_snapshot(cue_snapshot_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->cue = -1;
+    if (!s_mutex) return;
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    out->cue = (int16_t)s_current;
+    if (s_fading) {
+        int64_t elapsed = (esp_timer_get_time() - s_fade_start_us) / 1000;
+        out->fade_ms = s_fade_ms;
+        out->fade_elapsed_ms = elapsed < 0 ? 0 : elapsed > s_fade_ms ? s_fade_ms : (uint32_t)elapsed;
+    }
+    out->track_count = (uint16_t)s_track_count;
+    for (int i = 0; i < s_track_count; i++) {
+        const track_t *tr = &s_tracks[i];
+        cue_track_snapshot_t *t = &out->tracks[i];
+        t->unicast = tr->unicast;
+        t->fading = s_fading ? tr->fading : 0;
+        pack_look(&tr->out, &t->out);
+        pack_look(&tr->end, &t->end);
+        pack_look(&tr->to, &t->to);
+    }
+    xSemaphoreGive(s_mutex);
+}
+
+void cue_player_resume(const cue_snapshot_t *snap)
+{
+    if (!s_mutex || !s_task || snap->track_count > CUE_LIGHTS_MAX) return;
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    stop_locked();
+    // A list the phone loaded since the reset takes the position as it is
+    int cue = snap->cue >= 0 ? snap->cue : -1;
+    s_keep_position = s_count == 0;
+    s_current = s_keep_position || cue < s_count ? cue : -1;
+
+    uint8_t fading = 0;
+    s_track_count = snap->track_count;
+    for (int i = 0; i < s_track_count; i++) {
+        const cue_track_snapshot_t *t = &snap->tracks[i];
+        track_t *tr = &s_tracks[i];
+        memset(tr, 0, sizeof(*tr));
+        tr->unicast = t->unicast;
+        unpack_look(&t->out, &tr->out);
+        unpack_look(&t->end, &tr->end);
+        unpack_look(&t->to, &tr->to);
+        // Finish from where it got to, over what the fade had left
+        tr->from = tr->out;
+        tr->fading = t->fading & ATTR_ALL;
+        if (tr->out.mask == ATTR_ALL) tr->sent = sent_of(&tr->out);
+        fading |= tr->fading;
+    }
+    if (fading) {
+        uint32_t left = snap->fade_ms > snap->fade_elapsed_ms ? snap->fade_ms - snap->fade_elapsed_ms : 0;
+        s_fade_ms = left ? left : 1;
+        s_fade_start_us = esp_timer_get_time();
+        s_fading = true;
+    }
+    xSemaphoreGive(s_mutex);
+
+    ESP_LOGI(TAG, "Resumed at cue %d: %d light(s)%s", cue, snap->track_count,
+             fading ? ", finishing a fade" : "");
+    if (fading) xTaskNotifyGive(s_task);
+}
+
+// MARK: - Public
+
+esp_err_t cue_player_load(const cJSON *cues)
+{
+    if (!s_mutex || !cJSON_IsArray(cues)) return ESP_ERR_INVALID_ARG;
+    int n = cJSON_GetArraySize(cues);
+    if (n < 0 || n > CUE_MAX) return ESP_ERR_INVALID_SIZE;
+
+    size_t total = 0;
+    for (int i = 0; i < n; i++) {
+        cJSON *lights = cJSON_GetObjectItem(cJSON_GetArrayItem(cues, i), "lights");
+        if (lights && !cJSON_IsArray(lights)) return ESP_ERR_INVALID_ARG;
+        size_t count = (size_t)cJSON_GetArraySize(lights);
+        if (count > CUE_CHANGES_MAX - total) return ESP_ERR_INVALID_SIZE;
+        total += count;
+    }
+
+    cue_t *cue_tab = calloc(n ? (size_t)n : 1, sizeof(cue_t));
+    change_t *changes = calloc(total ? total : 1, sizeof(change_t));
+    if (!cue_tab || !changes) {
+        free(cue_tab);
+        free(changes);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Parse everything before touching the live list
+    uint16_t lights[CUE_LIGHTS_MAX];
+    int light_count = 0;
+    int used = 0;
+    esp_err_t err = ESP_OK;
+    for (int i = 0; i < n && err == ESP_OK; i++) {
+        const cJSON *c = cJSON_GetArrayItem(cues, i);
+        cJSON *fade = cJSON_GetObjectItem(c, "fade_ms");
+        cue_tab[i].fade_ms = cJSON_IsNumber(fade) && fade->valuedouble > 0 ? (uint32_t)fade->valuedouble : 0;
+        cue_tab[i].first = (uint16_t)used;
+
+        const cJSON *l;
+        cJSON_ArrayForEach(l, cJSON_GetObjectItem(c, "lights")) {
+            cJSON *uni = cJSON_GetObjectItem(l, "unicast");
+            change_t *ch = &changes[used];
+            if (!cJSON_IsNumber(uni) || uni->valueint <= 0 || !parse_look(l, &ch->look)) {
+                ESP_LOGW(TAG, "Cue %d is invalid, list unchanged", i);
+                err = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            ch->unicast = (uint16_t)uni->valueint;
+            if (!note_light(lights, &light_count, ch->unicast)) {
+                err = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            used++;
+        }
+        cue_tab[i].count = (uint16_t)(used - cue_tab[i].first);
+    }
+    if (err != ESP_OK) {
+        free(cue_tab);
+        free(changes);
+        return err;
+    }
+
+    install(cue_tab, n, changes, used, lights, light_count);
+    return ESP_OK;
+}
+
+esp_err_t cue_player_load_binary(cue_varint_fn next, void *ctx)
+{
+    if (!s_mutex || !next) return ESP_ERR_INVALID_ARG;
+
+    uint32_t n, total;
+    esp_err_t err = next(ctx, &n);
+    if (err == ESP_OK) err = next(ctx, &total);
+    if (err != ESP_OK) return err == ESP_ERR_NOT_FOUND ? ESP_ERR_INVALID_SIZE : err;
+    if (n > CUE_MAX || total > CUE_CHANGES_MAX) return ESP_ERR_INVALID_SIZE;
+
+    cue_t *cue_tab = calloc(n ? n : 1, sizeof(cue_t));
+    change_t *changes = calloc(total ? total : 1, sizeof(change_t));
+    if (!cue_tab || !changes) {
+        free(cue_tab);
+        free(changes);
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint16_t lights[CUE_LIGHTS_MAX];
+    int light_count = 0;
+    uint32_t used = 0;
+    int32_t unicast = 0;
+    for (uint32_t i = 0; i < n && err == ESP_OK; i++) {
+        uint32_t count;
+        err = next(ctx, &cue_tab[i].fade_ms);
+        if (err == ESP_OK) err = next(ctx, &count);
+        if (err == ESP_ERR_NOT_FOUND) err = ESP_ERR_INVALID_SIZE;
+        if (err != ESP_OK) break;
+        if (count > total - used) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        cue_tab[i].first = (uint16_t)used;
+        cue_tab[i].count = (uint16_t)count;
+        for (uint32_t k = 0; k < count && err == ESP_OK; k++, used++) {
+            err = read_change(next, ctx, &unicast, &changes[used]);
+            if (err == ESP_OK && !note_light(lights, &light_count, changes[used].unicast)) {
+                err = ESP_ERR_INVALID_SIZE;
+            }
+        }
+    }
+    // Exactly the changes announced, and nothing after the last cue
+    uint32_t extra;
+    if (err == ESP_OK && used != total) err = ESP_ERR_INVALID_SIZE;
+    if (err == ESP_OK) {
+        esp_err_t end = next(ctx, &extra);
+        if (end != ESP_ERR_NOT_FOUND) err = end == ESP_OK ? ESP_ERR_INVALID_SIZE : end;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Binary cue list rejected (%s), list unchanged", esp_err_to_name(err));
+        free(cue_tab);
+        free(changes);
+        return err;
+    }
+
+    install(cue_tab, (int)n, changes, (int)used, lights, light_count);
+    return ESP_OK;
+}
+
+esp_err_t cue_player_go(int index)
+{
+    if (!s_mutex || !s_task) return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    if (index < 0) index = (s_pending != NO_GO ? s_pending : s_current) + 1;
+    bool valid = index < s_count;
+    if (valid) s_pending = index;
+    xSemaphoreGive(s_mutex);
+
+    if (!valid) return ESP_ERR_NOT_FOUND;
+    xTaskNotifyGive(s_task);
+    return ESP_OK;
+}
+
+void cue_player_stop(void)
+{
+    if (!s_mutex) return;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    s_pending = NO_GO;
+    stop_locked();
+    xSemaphoreGive(s_mutex);
+}
+
+void cue_player_report(void)
+{
+    char body[160];
+    if (s_mutex) xSemaphoreTake(s_mutex, portMAX_DELAY);
+    snprintf(body, sizeof(body),
+             "\"count\":%d,\"cue\":%d,\"fading\":%s,\"lights\":%d,\"sends\":%lu,\"skipped\":%lu",
+             s_count, s_current, s_fading ? "true" : "false", s_track_count,
+             (unsigned long)s_sends, (unsigned long)s_skipped);
+    if (s_mutex) xSemaphoreGive(s_mutex);
+    ws_server_send_event("cues", body);
+}
+
+bool cue_player_digest(uint32_t *crc)
+{
+    if (!s_mutex) return false;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    bool loaded = s_loaded;
+    *crc = s_digest;
+    xSemaphoreGive(s_mutex);
+    return loaded;
+}
+
+esp_err_t cue_player_init(void)
+{
+    s_mutex = xSemaphoreCreateMutex();
+    if (!s_mutex) return ESP_ERR_NO_MEM;
+    color_space_init();
+
+    if (xTaskCreate(cue_task, "cues", 4096, NULL, 5, &s_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+// Cue list played on the bridge, console style: a cue stores only what it
+// changes and everything else tracks through from earlier cues.
+//
+// {"cmd":"cues","cues":[cue, ...]} loads a list (RAM only); {"cmd":"cues"}
+// alone reports the player. A cue:
+//   {"fade_ms":N, "lights":[{"unicast":N, "on":bool, "mode":"cct"|"hsi",
+//     "intensity":X, "cct_kelvin":N, "hue":N, "saturation":N}, ...]}
+// where every light field but unicast is optional. {"cmd":"cue_go"} runs
+// the next cue, {"cmd":"cue_go","cue":N} jumps to cue N with the state
+// tracked up to it, {"cmd":"cue_stop"} holds the lights where they are.
+//
+// On GO the player compares the tracked target with what each light is
+// showing, attribute by attribute. Lights with nothing to change aren't
+// sent anything, and only the changed attributes fade, CCT in mireds and
+// hue in perceptual hue (color_space.h). During a fade a step goes out
+// only once it has moved a visible amount (0.5% intensity, 3 mireds, 2
+// degrees of perceptual hue) from the last one sent, so a fade over a
+// small range costs a handful of messages however long it is. A GO sends
+// a "cue" event and the end of its fade a "cue_done" event with the
+// number of commands it cost; the end also fires cue_done rules (rules.h).
+//
+// Commands go through command_apply_state on the WebSocket dispatcher
+// (ws_server_queue_work), in turn with the phone's, so a cluster leader
+// drives lights owned by other bridges too. Lights changed behind the
+// player's back (their shadow no longer matches) are resent in full on the
+// next GO.
+//
+// The same list can come from the show store's scene asset (show_player.h)
+// in binary form, every number a LEB128 varint:
+//   cue count, change count over the whole list, then per cue
+//     fade_ms, change count, then per change
+//       unicast as a zigzag delta from the previous change's (from 0),
+//       attribute flags: 0x01 on, 0x02 mode, 0x04 intensity, 0x08 CCT,
+//         0x10 hue, 0x20 saturation present; 0x40 on = true, 0x80 mode =
+//         HSI,
+//       then the values present, in that order: intensity in tenths of a
+//       percent, cct_kelvin, hue, saturation.
+
+#define CUE_MAX             128
+#define CUE_CHANGES_MAX     512     // Light entries over the whole list
+#define CUE_LIGHTS_MAX      32      // Lights one list can drive
+
+esp_err_t cue_player_init(void);
+
+// Replace the list from a JSON array. The current output is kept; the next
+// GO runs cue 0.
+esp_err_t cue_player_load(const cJSON *cues);
+
+// Next varint of a binary list. ESP_ERR_NOT_FOUND at the end; any other
+// error aborts the load with it.
+typedef esp_err_t (*cue_varint_fn)(void *ctx, uint32_t *value);
+
+// Replace the list from its binary form. The whole input must be one list;
+// anything after the last cue is an error. ESP_ERR_INVALID_SIZE for a
+// truncated or oversized list, ESP_ERR_INVALID_ARG for a value out of
+// range.
+esp_err_t cue_player_load_binary(cue_varint_fn next, void *ctx);
+
+// Run cue index, or the next one for index < 0. Returns at once; the
+// player task does the work.
+esp_err_t cue_player_go(int index);
+
+// Freeze a running fade where it is
+void cue_player_stop(void);
+
+// Send the "cues" event
+void cue_player_report(void);
+
+// CRC-32 of the loaded list in its binary form, as the phone encodes it
+// (ShowEncoder.cueList), so the ready event can tell the phone whether
+// the list it has is already here. false if no list is loaded.
+bool cue_player_digest(uint32_t *crc);
+
+// What the player is showing, as the warm-restart checkpoint keeps it
+// (checkpoint.h). A look packs intensity in tenths of a percent and
+// flags 0x01 on, 0x02 HSI; mask says which attributes are known.
+typedef struct {
+    uint8_t mask;
+    uint8_t flags;
+    uint8_t saturation;
+    uint16_t intensity;
+    uint16_t cct_kelvin;
+    uint16_t hue;
+} cue_look_snapshot_t;
+
+typedef struct {
+    uint16_t unicast;
+    uint8_t fading;                 // Attributes still moving
+    cue_look_snapshot_t out;        // Showing now
+    cue_look_snapshot_t end;        // Where the running fade goes
+    cue_look_snapshot_t to;         // Tracked target
+} cue_track_snapshot_t;
+
+typedef struct {
+    int16_t cue;                    // Last cue run, -1 for none
+    uint16_t track_count;
+    uint32_t fade_ms;               // The running fade, 0 if none
+    uint32_t fade_elapsed_ms;
+    cue_track_snapshot_t tracks[CUE_LIGHTS_MAX];
+} cue_snapshot_t;
+
+// Zeroes out first, so it can go into a CRC as it is
+void cue_player_snapshot(cue_snapshot_t *out);
+
+// Pick up after a warm restart: the output is known again, and a fade that
+// was running finishes over the time it had left. The list itself is RAM
+// only; the first one loaded afterwards keeps the restored position, so
+// the phone sending it again and a GO runs the cue after.
+void cue_player_resume(const cue_snapshot_t *snap);
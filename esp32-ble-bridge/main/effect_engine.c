@@ -9,11 +9,18 @@
 #include "effect_engine.h"
 #include "ble_mesh.h"
 #include "light_registry.h"
+#include "sidus_protocol.h"
+#include "monitor.h"
+#include "heap_health.h"
+#include "checkpoint.h"
+#include "color_space.h"
 
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "esp_random.h"
@@ -46,11 +53,22 @@ static int rand_int(int lo, int hi)
 static effect_instance_t s_instances[MAX_LIGHTS];
 static bool s_initialized = false;
 
+/* Steps run on the esp_timer task while start, update and stop come from
+ * the dispatcher and the checkpoint task.  esp_timer_stop doesn't wait for
+ * a callback already running, so each step runs under s_run_lock, and the
+ * public calls take it before touching an instance or its lookahead ring. */
+static SemaphoreHandle_t s_run_lock = NULL;
+
 /* -----------------------------------------------------------------------
  * Timer context — passed through one-shot timer callbacks
  *
  * We pack auxiliary data (fade targets, step counters, sweep parameters)
- * into this small heap-allocated struct.  It is freed by the callback.
+ * into this small struct.  Each slot keeps one timer and one context for
+ * the life of the bridge, so stepping an effect never touches the heap.
+ *
+ * A context is armed from the WS, rules and cue tasks as well as from the
+ * esp_timer task, so it is filled on the caller's stack and copied in and
+ * out under s_ctx_lock; the timer callback never sees a half-written one.
  * ----------------------------------------------------------------------- */
 
 typedef struct {
@@ -58,8 +76,13 @@ typedef struct {
     int tag;
     double d1, d2, d3;
     int i1, i2;
+    int64_t deadline_us;
 } timer_ctx_t;
 
+static timer_ctx_t s_ctx[MAX_LIGHTS];
+static esp_timer_handle_t s_timers[MAX_LIGHTS];
+static portMUX_TYPE s_ctx_lock = portMUX_INITIALIZER_UNLOCKED;
+
 /* Callback tag values */
 enum {
     /* Faulty Bulb */
@@ -91,66 +114,156 @@ enum {
 static void timer_dispatch(void *arg);
 
 /* -----------------------------------------------------------------------
- * arm_timer — create a one-shot esp_timer, deleting any previous one on
- *             the same instance.
+ * TX bursts — a step whose exact time doesn't matter moves to the next
+ * tick of a grid shared by every light, at most one connection interval
+ * apart (never earlier, so a step can run late by up to a tick but never
+ * early).  Writes for several lights then reach the controller together
+ * and share connection events, instead of each claiming the radio from
+ * WiFi on its own.  Flash ends and grid-timed steps keep their time.
+ * ----------------------------------------------------------------------- */
+
+#ifndef CONFIG_BRIDGE_TX_BURST_MS
+#define CONFIG_BRIDGE_TX_BURST_MS 10
+#endif
+
+static bool tag_is_exact(int tag)
+{
+    switch (tag) {
+    case CB_PAPARAZZI_OFF:
+    case CB_PAPARAZZI_BURST_OFF:
+    case CB_SOFTWARE_STROBE_OFF:
+    case CB_SOFTWARE_LIGHTNING_OFF:
+    case CB_SOFTWARE_WELD_OFF:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Burst grid spacing in microseconds, 0 when bursts are off */
+static int64_t burst_quantum(void)
+{
+    if (CONFIG_BRIDGE_TX_BURST_MS <= 0) return 0;
+
+    int64_t q = CONFIG_BRIDGE_TX_BURST_MS * 1000;
+    uint32_t conn_int = ble_mesh_conn_interval_us();
+    if (conn_int && conn_int < q) q = conn_int;
+    return q;
+}
+
+static int64_t burst_align(int64_t now, int64_t us)
+{
+    int64_t q = burst_quantum();
+    if (!q) return us;
+
+    int64_t t = (now + us + q - 1) / q * q;
+    if (t - now < 50) t += q;
+    return t - now;
+}
+
+/* -----------------------------------------------------------------------
+ * arm_timer — (re)start the slot's one-shot esp_timer, replacing any step
+ *             still pending on the same instance.
  * ----------------------------------------------------------------------- */
 
-static void arm_timer(effect_instance_t *inst, double delay_sec, int tag,
-                      double d1, double d2, double d3, int i1, int i2)
+static void arm_timer_ex(effect_instance_t *inst, double delay_sec, bool exact, int tag,
+                         double d1, double d2, double d3, int i1, int i2)
 {
     if (!inst->running) return;
 
-    timer_ctx_t *ctx = calloc(1, sizeof(timer_ctx_t));
-    if (!ctx) {
-        ESP_LOGE(TAG, "arm_timer: alloc failed");
-        return;
-    }
-    ctx->inst = inst;
-    ctx->tag  = tag;
-    ctx->d1   = d1;
-    ctx->d2   = d2;
-    ctx->d3   = d3;
-    ctx->i1   = i1;
-    ctx->i2   = i2;
-
-    /* Delete the previous timer if present. */
-    if (inst->timer) {
-        esp_timer_stop((esp_timer_handle_t)inst->timer);
-        esp_timer_delete((esp_timer_handle_t)inst->timer);
-        inst->timer = NULL;
+    int slot = inst - s_instances;
+    if (!s_timers[slot]) {
+        esp_timer_create_args_t args = {
+            .callback        = timer_dispatch,
+            .arg             = &s_ctx[slot],
+            .dispatch_method = ESP_TIMER_TASK,
+            .name            = "fx",
+        };
+        esp_err_t err = esp_timer_create(&args, &s_timers[slot]);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "esp_timer_create: %s", esp_err_to_name(err));
+            s_timers[slot] = NULL;
+            return;
+        }
     }
+    esp_timer_handle_t handle = s_timers[slot];
+    esp_timer_stop(handle);
 
-    esp_timer_create_args_t args = {
-        .callback        = timer_dispatch,
-        .arg             = ctx,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name            = "fx",
+    int64_t now = esp_timer_get_time();
+    int64_t us = (int64_t)(delay_sec * 1e6);
+    if (!exact) us = burst_align(now, us);
+    if (us < 50) us = 50;
+
+    timer_ctx_t ctx = {
+        .inst = inst,
+        .tag  = tag,
+        .d1   = d1,
+        .d2   = d2,
+        .d3   = d3,
+        .i1   = i1,
+        .i2   = i2,
+        .deadline_us = now + us,
     };
-    esp_timer_handle_t handle = NULL;
-    esp_err_t err = esp_timer_create(&args, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_timer_create: %s", esp_err_to_name(err));
-        free(ctx);
-        return;
-    }
+    portENTER_CRITICAL(&s_ctx_lock);
+    s_ctx[slot] = ctx;
+    portEXIT_CRITICAL(&s_ctx_lock);
     inst->timer = handle;
 
-    int64_t us = (int64_t)(delay_sec * 1e6);
-    if (us < 50) us = 50;
-    err = esp_timer_start_once(handle, us);
+    esp_err_t err = esp_timer_start_once(handle, us);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_timer_start_once: %s", esp_err_to_name(err));
-        esp_timer_delete(handle);
         inst->timer = NULL;
-        free(ctx);
     }
 }
 
+static inline void arm_timer(effect_instance_t *inst, double delay_sec, int tag,
+                             double d1, double d2, double d3, int i1, int i2)
+{
+    arm_timer_ex(inst, delay_sec, tag_is_exact(tag), tag, d1, d2, d3, i1, i2);
+}
+
 static inline void arm_simple(effect_instance_t *inst, double delay_sec, int tag)
 {
     arm_timer(inst, delay_sec, tag, 0, 0, 0, 0, 0);
 }
 
+/* -----------------------------------------------------------------------
+ * Fixed grid — periodic effects step at origin + k * period in absolute
+ * esp_timer time, so a late callback never shifts the rest of the pattern.
+ * ----------------------------------------------------------------------- */
+
+static void grid_begin(effect_instance_t *inst, int64_t origin_us, double period)
+{
+    inst->grid_origin_us = origin_us;
+    inst->grid_period = period;
+    inst->grid_slot = -1;
+}
+
+/// The latest slot that has come due.  A step that ran late skips the
+/// slots it missed; the result is always past the previous slot.
+static int64_t grid_take(effect_instance_t *inst, int64_t now_us)
+{
+    int64_t period_us = (int64_t)(inst->grid_period * 1e6);
+    int64_t k = (now_us - inst->grid_origin_us) / period_us;
+    if (k <= inst->grid_slot) k = inst->grid_slot + 1;
+    inst->grid_slot = k;
+    return k;
+}
+
+static int64_t grid_time(const effect_instance_t *inst, int64_t k)
+{
+    return inst->grid_origin_us + (int64_t)((double)k * inst->grid_period * 1e6);
+}
+
+/// Arm a timer for slot k plus offset seconds.  The grid already fixes
+/// the time, so it is not moved to a TX burst.
+static void arm_grid(effect_instance_t *inst, int64_t k, double offset, int tag)
+{
+    int64_t deadline = grid_time(inst, k) + (int64_t)(offset * 1e6);
+    arm_timer_ex(inst, (double)(deadline - esp_timer_get_time()) / 1e6, true, tag,
+                 0, 0, 0, 0, 0);
+}
+
 /* -----------------------------------------------------------------------
  * Color-send helpers
  * ----------------------------------------------------------------------- */
@@ -189,12 +302,24 @@ static void send_color_hue(effect_instance_t *inst, double intensity,
     }
 }
 
-/* ===================================================================== *
- *  FAULTY BULB ENGINE                                                    *
- * ===================================================================== */
+/// Build the access message send_color_hue would send, with an optional CCT
+/// override (cct < 0 = the configured one).
+static void pack_color(effect_instance_t *inst, double intensity, int sleep_mode,
+                       int hue_override, int cct_override, uint8_t out[11])
+{
+    const effect_params_t *p = &inst->params;
+    if (p->color_mode == COLOR_MODE_HSI || hue_override >= 0) {
+        int h = (hue_override >= 0) ? hue_override : p->hue;
+        int c = (cct_override >= 0) ? cct_override : p->hsi_cct;
+        sidus_build_access_hsi(intensity, h, p->saturation, c, sleep_mode, out);
+    } else {
+        int c = (cct_override >= 0) ? cct_override : p->cct_kelvin;
+        sidus_build_access_cct(intensity, c, sleep_mode, out);
+    }
+}
 
-/* Send intensity with warmth-shifted CCT. */
-static void faulty_send(effect_instance_t *inst, double percent, int sleep_mode)
+/* Warmth-shifted CCT for a faulty-bulb intensity. */
+static int faulty_cct(effect_instance_t *inst, double percent)
 {
     const effect_params_t *p = &inst->params;
     int adjusted_cct;
@@ -203,12 +328,318 @@ static void faulty_send(effect_instance_t *inst, double percent, int sleep_mode)
         double dip = fmax(0, fmin(1, (p->faulty_max - percent) / (p->faulty_max - p->faulty_min)));
         double shift = dip * (p->faulty_warmth / 100.0);
         int base_cct = (p->color_mode == COLOR_MODE_HSI) ? p->hsi_cct : p->cct_kelvin;
-        adjusted_cct = (int)(base_cct + (double)(p->faulty_warmest_cct - base_cct) * shift);
+        adjusted_cct = color_cct_lerp(base_cct, p->faulty_warmest_cct, (float)shift);
         ESP_LOGD(TAG, "FaultyBulb: i=%d%% dip=%.2f shift=%.2f base=%dK warm=%dK -> %dK",
                  (int)percent, dip, shift, base_cct, p->faulty_warmest_cct, adjusted_cct);
     } else {
         adjusted_cct = (p->color_mode == COLOR_MODE_HSI) ? p->hsi_cct : p->cct_kelvin;
     }
+    return adjusted_cct;
+}
+
+/* -----------------------------------------------------------------------
+ * Lookahead — pre-rendered frames for deterministic segments
+ *
+ * Pulsing, the explosion decay, party hue sweeps and faulty-bulb fades are
+ * pure functions of their start values and the step number.  Right after a
+ * frame goes out, the next few are encrypted (SEQ included), so at the next
+ * deadline only the GATT write is left.  effect_engine_update bumps
+ * params_gen, which drops whatever was rendered with the old params.
+ *
+ * Frames that would look the same as the last one sent are rendered as
+ * skips (no PDU, no SEQ): see la_noticeable.
+ * ----------------------------------------------------------------------- */
+
+#ifndef CONFIG_BRIDGE_EFFECT_LOOKAHEAD
+#define CONFIG_BRIDGE_EFFECT_LOOKAHEAD 8
+#endif
+#define LA_DEPTH CONFIG_BRIDGE_EFFECT_LOOKAHEAD
+#define LA_RING  (LA_DEPTH > 0 ? LA_DEPTH : 1)
+
+typedef enum {
+    SEG_NONE = 0,
+    SEG_PULSE,      /* a = start phase */
+    SEG_DECAY,      /* a = flash intensity */
+    SEG_SWEEP,      /* a = start hue, b = perceptual delta, total = steps */
+    SEG_FADE,       /* a = start intensity, b = target, total = steps */
+} seg_kind_t;
+
+/* Step filter thresholds */
+#ifdef CONFIG_BRIDGE_STEP_FILTER
+#define STEP_FILTER 1
+#else
+#define STEP_FILTER 0
+#endif
+#ifndef CONFIG_BRIDGE_JND_LIGHTNESS
+#define CONFIG_BRIDGE_JND_LIGHTNESS 10
+#endif
+#ifndef CONFIG_BRIDGE_JND_MIRED
+#define CONFIG_BRIDGE_JND_MIRED 3
+#endif
+#ifndef CONFIG_BRIDGE_JND_HUE
+#define CONFIG_BRIDGE_JND_HUE 2
+#endif
+#ifndef CONFIG_BRIDGE_STEP_MAX_INTERVAL_MS
+#define CONFIG_BRIDGE_STEP_MAX_INTERVAL_MS 250
+#endif
+
+/* Seconds per frame of each segment kind, at frame scale 100% */
+static const double s_seg_dt[] = { 0, 0.03, 0.04, 0.03, 0.02 };
+
+/* Percent applied to s_seg_dt by the performance profile.  An int so the
+ * timer task always reads a whole value. */
+static volatile int s_frame_pct = 100;
+
+static double seg_dt(seg_kind_t kind)
+{
+    return s_seg_dt[kind] * s_frame_pct / 100.0;
+}
+
+/* What a frame puts on the light. */
+typedef struct {
+    bool valid;
+    int n;
+    double level;       /* Intensity as sent */
+    int sleep_mode;
+    int cct;            /* Kelvin */
+    int hue;            /* -1 in CCT mode */
+    uint8_t access[11];
+} la_out_t;
+
+typedef struct {
+    mesh_frame_t frame;
+    int n;
+    double intensity;
+    bool last;
+    bool skip;          /* Not noticeably different: nothing to send */
+    la_out_t out;
+} la_frame_t;
+
+typedef struct {
+    seg_kind_t kind;
+    uint32_t gen;       /* params_gen the ring was rendered with */
+    double a, b;
+    int total;
+    double dt;          /* Seconds per frame, fixed for the segment */
+    int due;            /* next frame number to send */
+    int next;           /* next frame number to render */
+    bool ended;         /* last frame already rendered */
+    la_out_t ref;       /* Last output rendered to be sent */
+    la_out_t sent;      /* Last output actually sent */
+    int head, count;
+    la_frame_t ring[LA_RING];
+} lookahead_t;
+
+static lookahead_t s_lookahead[MAX_LIGHTS];
+
+static lookahead_t *la_of(effect_instance_t *inst)
+{
+    return &s_lookahead[inst - s_instances];
+}
+
+/* Pulsing level at a given phase (seconds into the cycle). */
+static double pulse_level(const effect_params_t *p, double phase)
+{
+    double lo = fmin(p->pulsing_min, p->pulsing_max);
+    double hi = fmax(p->pulsing_min, p->pulsing_max);
+    double period = 4.0 * pow(0.80, p->frequency);
+    double sine = (sin(phase * 2.0 * M_PI / period) + 1.0) / 2.0;
+    double norm = (p->pulsing_shape - 50.0) / 50.0;
+    double exp_ = pow(10.0, -norm * 0.8);
+    double shaped = pow(sine, exp_);
+    return lo + (hi - lo) * shaped;
+}
+
+/* CIE L* of an intensity percentage taken as relative luminance. */
+static double lightness(double percent)
+{
+    double y = fmax(0, percent) / 100.0;
+    return y > 0.008856 ? 116.0 * cbrt(y) - 16.0 : 903.3 * y;
+}
+
+/* Would a light showing `ref` visibly change on receiving `o`?  Lightness
+ * in L*, CCT in mireds and perceptual hue (scaled by saturation) each
+ * have a just-noticeable difference.  Identical access bytes (e.g. two
+ * levels that round to the same 0-1000 value) never count. */
+static bool la_noticeable(const effect_instance_t *inst, const lookahead_t *la,
+                          const la_out_t *ref, const la_out_t *o, bool last)
+{
+    if (!STEP_FILTER || !ref->valid || last) return true;
+    if (o->sleep_mode != ref->sleep_mode) return true;
+    if (memcmp(o->access, ref->access, sizeof(o->access)) == 0) return false;
+
+    /* Keep the light in step even through long imperceptible stretches */
+    if ((o->n - ref->n) * la->dt * 1000.0 >= CONFIG_BRIDGE_STEP_MAX_INTERVAL_MS)
+        return true;
+
+    if (fabs(lightness(o->level) - lightness(ref->level)) * 10.0 >= CONFIG_BRIDGE_JND_LIGHTNESS)
+        return true;
+    if (o->cct > 0 && ref->cct > 0 &&
+        fabs(1e6 / o->cct - 1e6 / ref->cct) >= CONFIG_BRIDGE_JND_MIRED)
+        return true;
+    if (o->hue >= 0 && ref->hue >= 0) {
+        double dh = fabsf(color_hue_delta(ref->hue, o->hue));
+        if (dh * inst->params.saturation / 100.0 >= CONFIG_BRIDGE_JND_HUE) return true;
+    }
+    return false;
+}
+
+/* Encrypt frame n of the current segment.  Frames start at 1. */
+static void la_render(effect_instance_t *inst, lookahead_t *la, int n, la_frame_t *f)
+{
+    const effect_params_t *p = &inst->params;
+    double v = 0;
+    int hue = -1, cct = -1, sleep_mode = 1;
+    bool last = false;
+
+    switch (la->kind) {
+    case SEG_PULSE:
+        v = pulse_level(p, la->a + n * la->dt);
+        if (v < 1.0) sleep_mode = 0;
+        break;
+    case SEG_DECAY:
+        v = la->a * pow(0.88, n * la->dt / s_seg_dt[SEG_DECAY]);
+        if (v < 2.0) { v = 0; sleep_mode = 0; last = true; }
+        break;
+    case SEG_SWEEP: {
+        /* Even steps in perceptual hue; two table lookups per frame */
+        float p0 = color_hue_to_perceptual((float)la->a);
+        hue = (int)lroundf(color_hue_from_perceptual(p0 + (float)(la->b * n / la->total))) % 360;
+        v = p->intensity;
+        last = n >= la->total;
+        break;
+    }
+    case SEG_FADE:
+        v = (n >= la->total) ? la->b : la->a + (la->b - la->a) * (double)n / (double)la->total;
+        cct = faulty_cct(inst, v);
+        last = n > la->total;
+        break;
+    default:
+        break;
+    }
+
+    la_out_t *o = &f->out;
+    o->valid = true;
+    o->n = n;
+    o->level = sleep_mode ? v : 0;
+    o->sleep_mode = sleep_mode;
+    bool hsi = p->color_mode == COLOR_MODE_HSI || hue >= 0;
+    o->hue = hsi ? (hue >= 0 ? hue : p->hue) : -1;
+    o->cct = cct >= 0 ? cct : (hsi ? p->hsi_cct : p->cct_kelvin);
+    pack_color(inst, o->level, sleep_mode, hue, cct, o->access);
+
+    f->n = n;
+    f->intensity = v;
+    f->last = last;
+    f->skip = !la_noticeable(inst, la, &la->ref, o, last);
+    f->frame.len = 0;
+    if (f->skip) return;
+
+    la->ref = *o;
+    if (ble_mesh_prerender(inst->unicast, o->access, sizeof(o->access), &f->frame) != ESP_OK)
+        f->frame.len = 0;
+}
+
+/* Discard rendered frames; rendering resumes at frame n. */
+static void la_drop(effect_instance_t *inst, lookahead_t *la, int n)
+{
+    la->gen = inst->params_gen;
+    la->next = n;
+    la->ended = false;
+    la->ref = la->sent;
+    la->head = 0;
+    la->count = 0;
+}
+
+/* Top the ring up to LA_DEPTH frames. */
+static void la_fill(effect_instance_t *inst)
+{
+    lookahead_t *la = la_of(inst);
+    while (la->kind != SEG_NONE && !la->ended && la->count < LA_DEPTH) {
+        la_frame_t *f = &la->ring[(la->head + la->count) % LA_RING];
+        la_render(inst, la, la->next++, f);
+        la->ended = f->last;
+        la->count++;
+    }
+}
+
+static void la_begin(effect_instance_t *inst, seg_kind_t kind, double a, double b, int total)
+{
+    lookahead_t *la = la_of(inst);
+    la->kind = kind;
+    la->a = a;
+    la->b = b;
+    la->total = total < 1 ? 1 : total;
+    la->dt = seg_dt(kind);
+    la->due = 1;
+    la->sent.valid = false;
+    la_drop(inst, la, 1);
+    la_fill(inst);
+}
+
+/* Send frame n, dropping any rendered frames before it (skipped slots).
+ * Returns true if it was the segment's last frame. */
+static bool la_send_at(effect_instance_t *inst, int n, double *intensity)
+{
+    lookahead_t *la = la_of(inst);
+    la_frame_t f;
+    esp_err_t err = ESP_ERR_INVALID_VERSION;
+
+    la->due = n + 1;
+    while (la->count > 0 && la->ring[la->head].n < n) {
+        la->head = (la->head + 1) % LA_RING;
+        la->count--;
+    }
+
+    if (la->gen == inst->params_gen && la->count > 0 && la->ring[la->head].n == n) {
+        f = la->ring[la->head];
+        la->head = (la->head + 1) % LA_RING;
+        la->count--;
+        err = f.skip ? ESP_OK : ble_mesh_send_frame(&f.frame);
+    }
+    if (err == ESP_ERR_INVALID_VERSION) {
+        /* Nothing rendered, params changed, keys reloaded, or a live
+         * command to this light overtook the rendered SEQs. */
+        la_drop(inst, la, n + 1);
+        la_render(inst, la, n, &f);
+        la->ended = f.last;
+        if (!f.skip) ble_mesh_send_frame(&f.frame);
+    }
+
+    inst->steps++;
+    if (f.skip) {
+        inst->steps_skipped++;
+    } else {
+        la->sent = f.out;
+        monitor_record(inst->unicast, f.out.hue >= 0 ? MONITOR_MODE_HSI : MONITOR_MODE_CCT,
+                       f.out.level, f.out.cct, f.out.hue < 0 ? 0 : f.out.hue,
+                       inst->params.saturation, f.out.sleep_mode, 0);
+    }
+    *intensity = f.intensity;
+    if (f.last) {
+        la->kind = SEG_NONE;
+        la->count = 0;
+    } else {
+        la_fill(inst);
+    }
+    return f.last;
+}
+
+/* Send the segment's next frame. */
+static bool la_send(effect_instance_t *inst, double *intensity)
+{
+    return la_send_at(inst, la_of(inst)->due, intensity);
+}
+
+/* ===================================================================== *
+ *  FAULTY BULB ENGINE                                                    *
+ * ===================================================================== */
+
+/* Send intensity with warmth-shifted CCT. */
+static void faulty_send(effect_instance_t *inst, double percent, int sleep_mode)
+{
+    const effect_params_t *p = &inst->params;
+    int adjusted_cct = faulty_cct(inst, percent);
 
     if (p->color_mode == COLOR_MODE_HSI)
         send_hsi(inst, percent, p->hue, p->saturation, adjusted_cct, sleep_mode);
@@ -248,16 +679,14 @@ static void faulty_schedule(effect_instance_t *inst)
 static void faulty_fade(effect_instance_t *inst, double target, int steps, double dt)
 {
     if (!inst->running) return;
+    if (la_of(inst)->kind != SEG_FADE)
+        la_begin(inst, SEG_FADE, inst->current_intensity, target, steps);
+
+    la_send(inst, &inst->current_intensity);
     if (steps <= 0) {
-        inst->current_intensity = target;
-        faulty_send(inst, target, 1);
         faulty_schedule(inst);
         return;
     }
-    double interp = inst->current_intensity +
-                    (target - inst->current_intensity) / (double)steps;
-    inst->current_intensity = interp;
-    faulty_send(inst, interp, 1);
 
     /* d1=target, d2=dt, i1=steps-1 */
     arm_timer(inst, dt, CB_FAULTY_FADE, target, dt, 0, steps - 1, 0);
@@ -318,9 +747,10 @@ static void faulty_fire(effect_instance_t *inst)
             faulty_send(inst, target, 1);
         faulty_schedule(inst);
     } else {
-        double dt = 0.02;
+        double dt = seg_dt(SEG_FADE);
         int total = (int)(p->faulty_transition / dt);
         if (total < 1) total = 1;
+        la_begin(inst, SEG_FADE, inst->current_intensity, target, total);
         faulty_fade(inst, target, total, dt);
     }
 }
@@ -420,11 +850,8 @@ static void sw_schedule(effect_instance_t *inst)
         iv = bg * rand_double(0.5, 1.5);
         break;
     }
-    case EFFECT_PULSING:
-        iv = 0.03;
-        break;
     case EFFECT_EXPLOSION:
-        iv = 0.04;
+        iv = la_of(inst)->kind == SEG_DECAY ? la_of(inst)->dt : seg_dt(SEG_DECAY);
         break;
     case EFFECT_STROBE:
         iv = 0.5 / p->strobe_hz;
@@ -454,48 +881,67 @@ static void sw_sweep_step(effect_instance_t *inst, double start_hue, double delt
         sw_fire(inst);
         return;
     }
-    double frac = (double)step / (double)total_steps;
-    double hue = start_hue + delta * frac;
-    if (hue < 0) hue += 360;
-    if (hue >= 360) hue -= 360;
-    send_color_hue(inst, inst->params.intensity, 1, (int)hue);
+    if (la_of(inst)->kind != SEG_SWEEP)
+        la_begin(inst, SEG_SWEEP, start_hue, delta, total_steps);
+
+    double level;
+    la_send(inst, &level);
 
     /* d1=start_hue, d2=delta, d3=dt, i1=step+1, i2=total_steps */
     arm_timer(inst, dt, CB_SOFTWARE_PARTY_SWEEP_STEP,
               start_hue, delta, dt, step + 1, total_steps);
 }
 
+/* Steps and shortest-way perceptual hue delta for a sweep at dt per step. */
+static void sw_sweep_plan(double start_hue, double end_hue, double duration, double dt,
+                          double *delta, int *total)
+{
+    *total = (int)(duration / dt);
+    if (*total < 1) *total = 1;
+
+    *delta = color_hue_delta((float)start_hue, (float)end_hue);
+}
+
 /* Start a hue sweep from start_hue to end_hue. */
 static void sw_sweep_start(effect_instance_t *inst, double start_hue,
                            double end_hue, double duration)
 {
     if (!inst->running) return;
-    if (duration <= 0.03) { sw_fire(inst); return; }
-
-    double dt = 0.03;
-    int total = (int)(duration / dt);
-    if (total < 1) total = 1;
 
-    double delta = end_hue - start_hue;
-    if (delta > 180) delta -= 360;
-    if (delta < -180) delta += 360;
+    /* Keep the frame period the sweep was planned with during the hold */
+    lookahead_t *la = la_of(inst);
+    double dt = la->kind == SEG_SWEEP ? la->dt : seg_dt(SEG_SWEEP);
+    if (duration <= dt) { sw_fire(inst); return; }
 
+    double delta;
+    int total;
+    sw_sweep_plan(start_hue, end_hue, duration, dt, &delta, &total);
     sw_sweep_step(inst, start_hue, delta, 1, total, dt);
 }
 
-/* Strobe flash cycle. */
+/* Strobe flash cycle.  Flashes sit on a grid of 1/strobe_hz from the first
+ * flash; a tempo change re-anchors the grid at the current flash. */
+#define STROBE_FLASH 0.010
+
 static void sw_strobe(effect_instance_t *inst)
 {
     if (!inst->running || !inst->strobe_running) return;
-    double flash_ms = 0.010;
-    double cycle = 1.0 / inst->params.strobe_hz;
-    double off_dur = fmax(0.01, cycle - flash_ms);
+    double cycle = fmax(1.0 / inst->params.strobe_hz, STROBE_FLASH + 0.01);
+    int64_t now = esp_timer_get_time();
+
+    if (cycle != inst->grid_period) grid_begin(inst, now, cycle);
+    int64_t k = grid_take(inst, now);
+
+    /* Too late for a full flash in this slot: skip it rather than
+     * flashing short or pushing the next one back. */
+    if (now - grid_time(inst, k) > (int64_t)(STROBE_FLASH * 1e6 / 2)) {
+        arm_grid(inst, k + 1, 0, CB_SOFTWARE_STROBE_NEXT);
+        return;
+    }
 
     send_color(inst, inst->params.intensity, 1);
     inst->current_intensity = inst->params.intensity;
-
-    /* d1 = off_dur */
-    arm_timer(inst, flash_ms, CB_SOFTWARE_STROBE_OFF, off_dur, 0, 0, 0, 0);
+    arm_grid(inst, k, STROBE_FLASH, CB_SOFTWARE_STROBE_OFF);
 }
 
 /* Welding burst cycle. */
@@ -557,21 +1003,22 @@ static void sw_fire(effect_instance_t *inst)
     }
 
     case EFFECT_PULSING: {
-        double lo = fmin(p->pulsing_min, p->pulsing_max);
-        double hi = fmax(p->pulsing_min, p->pulsing_max);
-        double period = 4.0 * pow(0.80, p->frequency);
-        inst->phase_time += 0.03;
-        double sine = (sin(inst->phase_time * 2.0 * M_PI / period) + 1.0) / 2.0;
-        double norm = (p->pulsing_shape - 50.0) / 50.0;
-        double exp_ = pow(10.0, -norm * 0.8);
-        double shaped = pow(sine, exp_);
-        double t = lo + (hi - lo) * shaped;
-        inst->current_intensity = t;
-        if (t < 1.0)
-            send_color(inst, 0, 0);
-        else
-            send_color(inst, t, 1);
-        sw_schedule(inst);
+        /* Frame n is grid slot n: phase start + n * dt, due at
+         * origin + n * dt.  Slots missed under load are skipped. */
+        int64_t now = esp_timer_get_time();
+        lookahead_t *la = la_of(inst);
+        if (la->kind != SEG_PULSE) {
+            la_begin(inst, SEG_PULSE, inst->phase_time, 0, 0);
+            /* Origin on a burst tick, so frames share bursts with other lights */
+            int64_t origin = now - (int64_t)(la->dt * 1e6);
+            int64_t q = burst_quantum();
+            if (q) origin -= origin % q;
+            grid_begin(inst, origin, la->dt);
+        }
+        int64_t n = grid_take(inst, now);
+        inst->phase_time = la->a + (double)n * la->dt;
+        la_send_at(inst, (int)n, &inst->current_intensity);
+        arm_grid(inst, n + 1, 0, CB_SOFTWARE_STEP);
         break;
     }
 
@@ -581,17 +1028,16 @@ static void sw_fire(effect_instance_t *inst)
             inst->current_intensity = p->intensity;
             send_color(inst, p->intensity, 1);
             inst->phase_time = 1.0;
+            /* The decay is fixed from here: a * 0.88^n until below 2 */
+            la_begin(inst, SEG_DECAY, p->intensity, 0, 0);
         } else if (inst->phase_time > 0) {
-            inst->current_intensity *= 0.88;
-            if (inst->current_intensity < 2.0) {
-                send_color(inst, 0, 0);
-                inst->current_intensity = 0;
+            if (la_of(inst)->kind != SEG_DECAY)
+                la_begin(inst, SEG_DECAY, inst->current_intensity, 0, 0);
+            if (la_send(inst, &inst->current_intensity)) {
                 inst->phase_time = 0;
                 double gap = 2.0 * pow(0.80, p->frequency) * rand_double(0.5, 1.5);
                 arm_simple(inst, gap, CB_SOFTWARE_STEP);
                 return;
-            } else {
-                send_color(inst, inst->current_intensity, 1);
             }
         } else {
             inst->phase_time = 0;
@@ -619,6 +1065,13 @@ static void sw_fire(effect_instance_t *inst)
             double hold = total_iv * (1 - tfrac);
             double sweep = total_iv * tfrac;
             double next_hue = biased_hue(inst, p->party_colors[next_idx]);
+            if (sweep > seg_dt(SEG_SWEEP)) {
+                /* Render the sweep's first frames while the color holds. */
+                double delta;
+                int steps;
+                sw_sweep_plan(cur_hue, next_hue, sweep, seg_dt(SEG_SWEEP), &delta, &steps);
+                la_begin(inst, SEG_SWEEP, cur_hue, delta, steps);
+            }
             /* d1=cur_hue, d2=next_hue, d3=sweep */
             arm_timer(inst, hold, CB_SOFTWARE_PARTY_SWEEP_START,
                       cur_hue, next_hue, sweep, 0, 0);
@@ -646,24 +1099,38 @@ static void sw_fire(effect_instance_t *inst)
  * Timer dispatch — the single callback for every one-shot timer.
  * ----------------------------------------------------------------------- */
 
+static void run_step(const timer_ctx_t *c);
+
 static void timer_dispatch(void *arg)
 {
-    timer_ctx_t *ctx = (timer_ctx_t *)arg;
-    effect_instance_t *inst = ctx->inst;
-
-    if (!inst->running) {
-        free(ctx);
-        return;
+    xSemaphoreTake(s_run_lock, portMAX_DELAY);
+
+    /* Copy out; the step may re-arm and overwrite the slot's ctx. */
+    timer_ctx_t ctx;
+    portENTER_CRITICAL(&s_ctx_lock);
+    ctx = *(const timer_ctx_t *)arg;
+    portEXIT_CRITICAL(&s_ctx_lock);
+
+    /* A firing that waited out a stop and restart finds the new effect's
+     * ctx, which its own timer will run when it is due. */
+    if (ctx.inst && ctx.inst->running && esp_timer_get_time() >= ctx.deadline_us) {
+        run_step(&ctx);
     }
+    xSemaphoreGive(s_run_lock);
+}
+
+static void run_step(const timer_ctx_t *c)
+{
+    timer_ctx_t ctx = *c;
+    effect_instance_t *inst = ctx.inst;
 
-    /* Extract fields before freeing ctx. */
-    int tag   = ctx->tag;
-    double d1 = ctx->d1;
-    double d2 = ctx->d2;
-    double d3 = ctx->d3;
-    int i1    = ctx->i1;
-    int i2    = ctx->i2;
-    free(ctx);
+    int tag   = ctx.tag;
+    double d1 = ctx.d1;
+    double d2 = ctx.d2;
+    double d3 = ctx.d3;
+    int i1    = ctx.i1;
+    int i2    = ctx.i2;
+    heap_health_note_latency(esp_timer_get_time() - ctx.deadline_us);
 
     switch (tag) {
 
@@ -702,11 +1169,10 @@ static void timer_dispatch(void *arg)
         break;
 
     case CB_SOFTWARE_STROBE_OFF:
-        /* d1=off_dur */
         if (!inst->strobe_running) break;
         send_color(inst, 0, 0);
         inst->current_intensity = 0;
-        arm_simple(inst, d1, CB_SOFTWARE_STROBE_NEXT);
+        arm_grid(inst, inst->grid_slot + 1, 0, CB_SOFTWARE_STROBE_NEXT);
         break;
 
     case CB_SOFTWARE_STROBE_NEXT:
@@ -762,18 +1228,23 @@ static void timer_dispatch(void *arg)
 void effect_engine_init(void)
 {
     if (s_initialized) return;
+    s_run_lock = xSemaphoreCreateMutex();
     memset(s_instances, 0, sizeof(s_instances));
+    color_space_init();
     s_initialized = true;
     ESP_LOGI(TAG, "effect engine initialized (max %d lights)", MAX_LIGHTS);
 }
 
-effect_instance_t *effect_engine_start(uint16_t unicast, effect_type_t type,
-                                       const effect_params_t *params)
-{
-    if (!s_initialized) effect_engine_init();
+static void stop_locked(uint16_t unicast);
 
+/* Start with the runtime phase given (a fresh start passes zeros).
+ * Called with s_run_lock held. */
+static effect_instance_t *start_at(uint16_t unicast, effect_type_t type,
+                                   const effect_params_t *params,
+                                   double phase_time, int party_color_index)
+{
     /* Stop any existing effect on this light. */
-    effect_engine_stop(unicast);
+    stop_locked(unicast);
 
     /* Find a free slot. */
     effect_instance_t *inst = NULL;
@@ -789,16 +1260,18 @@ effect_instance_t *effect_engine_start(uint16_t unicast, effect_type_t type,
     }
 
     memset(inst, 0, sizeof(*inst));
+    memset(la_of(inst), 0, sizeof(lookahead_t));
     inst->unicast = unicast;
     inst->type    = type;
     if (params) inst->params = *params;
     inst->current_intensity = inst->params.intensity;
-    inst->phase_time = 0;
+    inst->phase_time = phase_time;
+    if (party_color_index >= 0 && party_color_index < inst->params.party_color_count)
+        inst->party_color_index = party_color_index;
     inst->running = true;
 
     /* Link to light registry. */
-    light_entry_t *light = light_registry_find_by_unicast(unicast);
-    if (light) light->active_effect = inst;
+    light_registry_set_active_effect(unicast, type);
 
     ESP_LOGI(TAG, "start effect %d on 0x%04x", type, unicast);
 
@@ -825,13 +1298,38 @@ effect_instance_t *effect_engine_start(uint16_t unicast, effect_type_t type,
     return inst;
 }
 
+effect_instance_t *effect_engine_start(uint16_t unicast, effect_type_t type,
+                                       const effect_params_t *params)
+{
+    if (!s_initialized) effect_engine_init();
+    xSemaphoreTake(s_run_lock, portMAX_DELAY);
+    effect_instance_t *inst = start_at(unicast, type, params, 0, 0);
+    xSemaphoreGive(s_run_lock);
+    return inst;
+}
+
+effect_instance_t *effect_engine_resume(const effect_snapshot_t *snap)
+{
+    /* Explosion's phase only says whether a decay is under way, which
+     * doesn't survive the restart; start it from its idle state. */
+    double phase = snap->type == EFFECT_EXPLOSION ? 0 : snap->phase_time;
+    if (!s_initialized) effect_engine_init();
+    xSemaphoreTake(s_run_lock, portMAX_DELAY);
+    effect_instance_t *inst = start_at(snap->unicast, snap->type, &snap->params, phase,
+                                       snap->party_color_index);
+    xSemaphoreGive(s_run_lock);
+    return inst;
+}
+
 void effect_engine_update(uint16_t unicast, const effect_params_t *params)
 {
-    if (!params) return;
+    if (!params || !s_initialized) return;
+    xSemaphoreTake(s_run_lock, portMAX_DELAY);
     for (int i = 0; i < MAX_LIGHTS; i++) {
         if (s_instances[i].running && s_instances[i].unicast == unicast) {
             /* Preserve runtime state, only update parameters. */
             s_instances[i].params = *params;
+            s_instances[i].params_gen++;
 
             /* If party colors changed, clamp index. */
             if (s_instances[i].party_color_index >= params->party_color_count &&
@@ -840,12 +1338,13 @@ void effect_engine_update(uint16_t unicast, const effect_params_t *params)
             }
 
             ESP_LOGD(TAG, "updated params for 0x%04x", unicast);
-            return;
+            break;
         }
     }
+    xSemaphoreGive(s_run_lock);
 }
 
-void effect_engine_stop(uint16_t unicast)
+static void stop_locked(uint16_t unicast)
 {
     for (int i = 0; i < MAX_LIGHTS; i++) {
         effect_instance_t *inst = &s_instances[i];
@@ -855,13 +1354,16 @@ void effect_engine_stop(uint16_t unicast)
 
             if (inst->timer) {
                 esp_timer_stop((esp_timer_handle_t)inst->timer);
-                esp_timer_delete((esp_timer_handle_t)inst->timer);
                 inst->timer = NULL;
             }
+            memset(la_of(inst), 0, sizeof(lookahead_t));
+            if (inst->steps > 0) {
+                ESP_LOGI(TAG, "0x%04x: %lu of %lu smooth steps below threshold", unicast,
+                         (unsigned long)inst->steps_skipped, (unsigned long)inst->steps);
+            }
 
             /* Unlink from light registry. */
-            light_entry_t *light = light_registry_find_by_unicast(unicast);
-            if (light) light->active_effect = NULL;
+            light_registry_set_active_effect(unicast, EFFECT_NONE);
 
             ESP_LOGI(TAG, "stopped effect on 0x%04x", unicast);
             return;
@@ -869,16 +1371,75 @@ void effect_engine_stop(uint16_t unicast)
     }
 }
 
+void effect_engine_stop(uint16_t unicast)
+{
+    /* Whatever replaces it, a restored effect must not come back on top. */
+    checkpoint_drop_pending(unicast);
+
+    if (!s_initialized) return;
+    xSemaphoreTake(s_run_lock, portMAX_DELAY);
+    stop_locked(unicast);
+    xSemaphoreGive(s_run_lock);
+}
+
 void effect_engine_stop_all(void)
 {
+    checkpoint_drop_pending(0);
+    if (!s_initialized) return;
+    xSemaphoreTake(s_run_lock, portMAX_DELAY);
     for (int i = 0; i < MAX_LIGHTS; i++) {
         if (s_instances[i].running) {
-            effect_engine_stop(s_instances[i].unicast);
+            stop_locked(s_instances[i].unicast);
         }
     }
+    xSemaphoreGive(s_run_lock);
     ESP_LOGI(TAG, "all effects stopped");
 }
 
+int effect_engine_get_stats(effect_stats_t *out, int max)
+{
+    if (!s_initialized) return 0;
+    int n = 0;
+    xSemaphoreTake(s_run_lock, portMAX_DELAY);
+    for (int i = 0; i < MAX_LIGHTS && n < max; i++) {
+        const effect_instance_t *inst = &s_instances[i];
+        if (!inst->running) continue;
+        out[n].unicast = inst->unicast;
+        out[n].type = inst->type;
+        out[n].steps = inst->steps;
+        out[n].skipped = inst->steps_skipped;
+        n++;
+    }
+    xSemaphoreGive(s_run_lock);
+    return n;
+}
+
+int effect_engine_snapshot(effect_snapshot_t *out, int max)
+{
+    if (!s_initialized) return 0;
+    int n = 0;
+    xSemaphoreTake(s_run_lock, portMAX_DELAY);
+    for (int i = 0; i < MAX_LIGHTS && n < max; i++) {
+        const effect_instance_t *inst = &s_instances[i];
+        if (!inst->running) continue;
+        out[n].unicast = inst->unicast;
+        out[n].type = inst->type;
+        out[n].params = inst->params;
+        out[n].phase_time = inst->phase_time;
+        out[n].party_color_index = inst->party_color_index;
+        n++;
+    }
+    xSemaphoreGive(s_run_lock);
+    return n;
+}
+
+void effect_engine_set_frame_scale(int percent)
+{
+    if (percent < 50) percent = 50;
+    if (percent > 400) percent = 400;
+    s_frame_pct = percent;
+}
+
 /* ===================================================================== *
  *  JSON PARAMETER PARSING                                                *
  * ===================================================================== */
@@ -69,6 +69,12 @@ struct effect_instance {
     bool strobe_running;
     int party_color_index;
     int weld_remaining;
+    uint32_t params_gen;  // Bumped by effect_engine_update
+    int64_t grid_origin_us;  // Periodic effects: esp_timer time of slot 0
+    double grid_period;      // Seconds between slots
+    int64_t grid_slot;       // Last slot run
+    uint32_t steps;          // Smooth-segment steps run
+    uint32_t steps_skipped;  // ...of which not sent (below the perceptual threshold)
     void *timer;  // esp_timer_handle_t
     bool running;
 };
@@ -90,6 +96,38 @@ void effect_engine_stop(uint16_t unicast);
 // Stop all running effects
 void effect_engine_stop_all(void);
 
+// Step filter counts of a running effect
+typedef struct {
+    uint16_t unicast;
+    effect_type_t type;
+    uint32_t steps;
+    uint32_t skipped;
+} effect_stats_t;
+
+// Fill out[] for up to max running effects; returns how many
+int effect_engine_get_stats(effect_stats_t *out, int max);
+
+// A running effect as the warm-restart checkpoint keeps it: enough to
+// start it again where it left off (see checkpoint.h)
+typedef struct {
+    uint16_t unicast;
+    effect_type_t type;
+    effect_params_t params;
+    double phase_time;
+    int party_color_index;
+} effect_snapshot_t;
+
+// Fill out[] for up to max running effects; returns how many
+int effect_engine_snapshot(effect_snapshot_t *out, int max);
+
+// Start an effect from a snapshot, keeping its phase
+effect_instance_t *effect_engine_resume(const effect_snapshot_t *snap);
+
+// Frame period of smooth segments (pulsing, explosion decay, party sweeps,
+// faulty fades) as a percent of the designed rate's period: 100 = as
+// designed, 200 = half the frames. Applies from each effect's next segment.
+void effect_engine_set_frame_scale(int percent);
+
 // Parse effect parameters from JSON fields into an effect_params_t
 void effect_params_from_json(effect_params_t *params, const char *engine_name,
                               const void *json_params);
@@ -0,0 +1,240 @@
+/*
+ * heap_health.c
+ *
+ * Periodic heap sampling, allocation counters and step lateness, with a
+ * drift warning against a settled baseline.
+ */
+
+#include "heap_health.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+#include "cJSON.h"
+
+#include "ws_server.h"
+
+static const char *TAG = "heap_health";
+
+#ifndef CONFIG_BRIDGE_HEALTH_INTERVAL_S
+#define CONFIG_BRIDGE_HEALTH_INTERVAL_S 60
+#endif
+
+#define BASELINE_AFTER_US   (10LL * 60 * 1000000)   // Let connections and caches settle
+#define FRAG_DRIFT_PCT      20                      // Points over the baseline
+#define LATE_SLACK_US       2000
+
+typedef struct {
+    size_t free;
+    size_t largest;
+    size_t min_free;
+    int frag;                   // Percent
+} heap_sample_t;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_allocs[HEAP_SITE_COUNT];
+static uint32_t s_frees[HEAP_SITE_COUNT];
+
+// Lateness accumulated over the current interval, and since boot
+static int64_t s_late_sum = 0;
+static uint32_t s_late_n = 0;
+static int64_t s_late_max = 0;
+static int64_t s_late_peak = 0;
+
+static esp_timer_handle_t s_timer = NULL;
+static heap_sample_t s_last;
+static int64_t s_last_late_avg = 0;
+static int64_t s_last_late_max = 0;
+
+static bool s_have_baseline = false;
+static heap_sample_t s_base;
+static int64_t s_base_late_avg = 0;
+static bool s_warning = false;
+
+// MARK: - Counters
+
+void heap_health_count_alloc(heap_site_t site)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_allocs[site]++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void heap_health_count_free(heap_site_t site)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_frees[site]++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void heap_health_note_latency(int64_t late_us)
+{
+    if (late_us < 0) late_us = 0;
+    portENTER_CRITICAL(&s_lock);
+    s_late_sum += late_us;
+    s_late_n++;
+    if (late_us > s_late_max) s_late_max = late_us;
+    if (late_us > s_late_peak) s_late_peak = late_us;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static void *json_malloc(size_t size)
+{
+    void *p = malloc(size);
+    if (p) heap_health_count_alloc(HEAP_SITE_JSON);
+    return p;
+}
+
+static void json_free(void *p)
+{
+    if (p) heap_health_count_free(HEAP_SITE_JSON);
+    free(p);
+}
+
+// MARK: - Sampling
+
+static heap_sample_t take_sample(void)
+{
+    heap_sample_t s = {
+        .free = heap_caps_get_free_size(MALLOC_CAP_8BIT),
+        .largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+        .min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+    };
+    s.frag = s.free ? (int)(100 - (uint64_t)s.largest * 100 / s.free) : 0;
+    return s;
+}
+
+static void check_drift(const heap_sample_t *s, int64_t late_avg)
+{
+    const char *reason = NULL;
+    if (s->frag > s_base.frag + FRAG_DRIFT_PCT) {
+        reason = "fragmentation";
+    } else if (s->largest < s_base.largest / 2) {
+        reason = "largest_block";
+    } else if (late_avg > 2 * s_base_late_avg + LATE_SLACK_US) {
+        reason = "step_latency";
+    }
+
+    // Edge-triggered: one event per excursion, not one per sample
+    if (reason && !s_warning) {
+        ESP_LOGW(TAG, "Drift (%s): free %u largest %u frag %d%% late %lld us",
+                 reason, (unsigned)s->free, (unsigned)s->largest, s->frag, (long long)late_avg);
+        char body[192];
+        snprintf(body, sizeof(body),
+                 "\"reason\":\"%s\",\"free\":%u,\"largest\":%u,\"frag\":%d,"
+                 "\"base_frag\":%d,\"base_largest\":%u,\"late_avg_us\":%lld",
+                 reason, (unsigned)s->free, (unsigned)s->largest, s->frag,
+                 s_base.frag, (unsigned)s_base.largest, (long long)late_avg);
+        ws_server_send_event("health_warning", body);
+    }
+    s_warning = reason != NULL;
+}
+
+static void health_tick(void *arg)
+{
+    heap_sample_t s = take_sample();
+
+    portENTER_CRITICAL(&s_lock);
+    int64_t late_avg = s_late_n ? s_late_sum / s_late_n : 0;
+    int64_t late_max = s_late_max;
+    s_late_sum = 0;
+    s_late_n = 0;
+    s_late_max = 0;
+    portEXIT_CRITICAL(&s_lock);
+
+    s_last = s;
+    s_last_late_avg = late_avg;
+    s_last_late_max = late_max;
+
+    if (!s_have_baseline) {
+        if (esp_timer_get_time() >= BASELINE_AFTER_US) {
+            s_base = s;
+            s_base_late_avg = late_avg;
+            s_have_baseline = true;
+            ESP_LOGI(TAG, "Baseline: free %u largest %u frag %d%% late %lld us",
+                     (unsigned)s.free, (unsigned)s.largest, s.frag, (long long)late_avg);
+        }
+        return;
+    }
+    check_drift(&s, late_avg);
+}
+
+// MARK: - Public
+
+esp_err_t heap_health_init(void)
+{
+    cJSON_Hooks hooks = {
+        .malloc_fn = json_malloc,
+        .free_fn = json_free,
+    };
+    cJSON_InitHooks(&hooks);
+
+    s_last = take_sample();
+
+    esp_timer_create_args_t args = {
+        .callback = health_tick,
+        .name = "health",
+    };
+    esp_err_t err = esp_timer_create(&args, &s_timer);
+    if (err != ESP_OK) return err;
+    err = esp_timer_start_periodic(s_timer, CONFIG_BRIDGE_HEALTH_INTERVAL_S * 1000000LL);
+    if (err != ESP_OK) return err;
+
+    ESP_LOGI(TAG, "Sampling every %d s, free %u largest %u",
+             CONFIG_BRIDGE_HEALTH_INTERVAL_S, (unsigned)s_last.free, (unsigned)s_last.largest);
+    return ESP_OK;
+}
+
+void heap_health_get_stats(heap_health_stats_t *out)
+{
+    heap_sample_t s = take_sample();
+
+    *out = (heap_health_stats_t) {
+        .uptime_us = esp_timer_get_time(),
+        .free = s.free,
+        .largest = s.largest,
+        .min_free = s.min_free,
+        .frag = s.frag,
+    };
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < HEAP_SITE_COUNT; i++) {
+        out->allocs[i] = s_allocs[i];
+        out->live[i] = s_allocs[i] - s_frees[i];
+    }
+    out->late_peak_us = s_late_peak;
+    portEXIT_CRITICAL(&s_lock);
+
+    // Written only by health_tick
+    out->have_baseline = s_have_baseline;
+    out->base_frag = s_base.frag;
+    out->base_largest = s_base.largest;
+    out->late_avg_us = s_last_late_avg;
+    out->late_max_us = s_last_late_max;
+    out->warning = s_warning;
+}
+
+void heap_health_report(void)
+{
+    heap_health_stats_t st;
+    heap_health_get_stats(&st);
+
+    char body[384];
+    snprintf(body, sizeof(body),
+             "\"uptime_s\":%lld,\"free\":%u,\"largest\":%u,\"min_free\":%u,\"frag\":%d,"
+             "\"base_frag\":%d,\"base_largest\":%d,"
+             "\"late_avg_us\":%lld,\"late_max_us\":%lld,\"late_peak_us\":%lld,"
+             "\"ws_allocs\":%lu,\"json_allocs\":%lu,\"json_live\":%lu",
+             (long long)(st.uptime_us / 1000000), (unsigned)st.free, (unsigned)st.largest,
+             (unsigned)st.min_free, st.frag,
+             st.have_baseline ? st.base_frag : -1,
+             st.have_baseline ? (int)st.base_largest : -1,
+             (long long)st.late_avg_us, (long long)st.late_max_us, (long long)st.late_peak_us,
+             (unsigned long)st.allocs[HEAP_SITE_WS_RX],
+             (unsigned long)st.allocs[HEAP_SITE_JSON],
+             (unsigned long)st.live[HEAP_SITE_JSON]);
+    ws_server_send_event("health", body);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Long-run health of the bridge: heap fragmentation, allocation churn at
+// the hot call sites, and how late effect steps fire. The heap is sampled
+// periodically; once the bridge has settled (about ten minutes after boot),
+// that sample becomes the baseline. If fragmentation, the largest free block
+// or step lateness drift well past it, a "health_warning" event is sent.
+//
+// {"cmd":"health"} replies with a "health" event:
+//   uptime_s, free, largest, min_free   - heap now (bytes)
+//   frag                                - 1 - largest/free, in percent
+//   base_frag, base_largest             - the baseline (-1 until taken)
+//   late_avg_us, late_max_us            - effect step lateness, last interval
+//   late_peak_us                        - worst step lateness since boot
+//   ws_allocs, json_allocs, json_live   - allocations at the counted sites
+
+typedef enum {
+    HEAP_SITE_WS_RX = 0,    // WebSocket frames too large for the static buffer
+    HEAP_SITE_JSON,         // cJSON nodes and strings
+    HEAP_SITE_COUNT,
+} heap_site_t;
+
+esp_err_t heap_health_init(void);
+
+void heap_health_count_alloc(heap_site_t site);
+void heap_health_count_free(heap_site_t site);
+
+// How late a timed step fired relative to its deadline
+void heap_health_note_latency(int64_t late_us);
+
+// Everything the "health" event carries, for code on the bridge itself
+// (the host soak runner): heap now, the baseline, lateness and the counters
+typedef struct {
+    int64_t uptime_us;
+    size_t free;
+    size_t largest;
+    size_t min_free;
+    int frag;                       // Percent
+    bool have_baseline;
+    int base_frag;
+    size_t base_largest;
+    int64_t late_avg_us;            // Last sampling interval
+    int64_t late_max_us;
+    int64_t late_peak_us;           // Since boot
+    uint32_t allocs[HEAP_SITE_COUNT];
+    uint32_t live[HEAP_SITE_COUNT]; // Allocated and not yet freed
+    bool warning;                   // A drift excursion is in progress
+} heap_health_stats_t;
+
+void heap_health_get_stats(heap_health_stats_t *out);
+
+// Send the "health" event
+void heap_health_report(void);
@@ -1,80 +1,399 @@
 #include "light_registry.h"
 #include <string.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
 #include "esp_log.h"
 
 static const char *TAG = "light_reg";
 
-static light_entry_t lights[MAX_LIGHTS];
+// One registry slot. `seq` is odd while a writer is updating `entry`;
+// `key` mirrors (registered << 16 | unicast) so lookups can find the right
+// slot with a single atomic load before copying anything.
+typedef struct {
+    atomic_uint seq;
+    atomic_uint key;
+    light_entry_t entry;
+} slot_t;
+
+#define KEY_REGISTERED 0x10000u
+
+static slot_t slots[MAX_LIGHTS];
+static atomic_uint s_version;
+
+// Serializes writers. Held only while an entry is being rewritten, never
+// across logging or I/O, so readers on the other core spin for microseconds.
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// MARK: - Seqlock primitives
+
+static void write_begin(slot_t *s)
+{
+    unsigned v = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, v + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void write_end(slot_t *s)
+{
+    const light_entry_t *e = &s->entry;
+    atomic_store_explicit(&s->key, e->registered ? (KEY_REGISTERED | e->unicast) : 0,
+                          memory_order_relaxed);
+    unsigned v = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, v + 1, memory_order_release);
+}
+
+static void read_entry(slot_t *s, light_entry_t *out)
+{
+    for (;;) {
+        unsigned before = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (before & 1) continue;  // Writer mid-update on the other core
+        memcpy(out, &s->entry, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) == before) return;
+    }
+}
+
+// Slot index for a unicast address, or -1. Wait-free.
+static int find_slot(uint16_t unicast)
+{
+    unsigned want = KEY_REGISTERED | unicast;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (atomic_load_explicit(&slots[i].key, memory_order_acquire) == want) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void bump_version(void)
+{
+    atomic_fetch_add_explicit(&s_version, 1, memory_order_relaxed);
+}
+
+// MARK: - Lifecycle
 
 void light_registry_init(void)
 {
-    memset(lights, 0, sizeof(lights));
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        atomic_init(&slots[i].seq, 0);
+        atomic_init(&slots[i].key, 0);
+        memset(&slots[i].entry, 0, sizeof(light_entry_t));
+    }
+    atomic_init(&s_version, 0);
     ESP_LOGI(TAG, "Light registry initialized (max %d)", MAX_LIGHTS);
 }
 
-light_entry_t *light_registry_add(const char *id, uint16_t unicast, const char *name)
+bool light_registry_add(const char *id, uint16_t unicast, const char *name)
 {
-    // Check if already registered
-    light_entry_t *existing = light_registry_find_by_unicast(unicast);
-    if (existing) {
+    int idx;
+    bool updated = false;
+
+    portENTER_CRITICAL(&s_lock);
+    idx = find_slot(unicast);
+    if (idx >= 0) {
         // Update existing entry
-        strncpy(existing->id, id, sizeof(existing->id) - 1);
-        strncpy(existing->name, name, sizeof(existing->name) - 1);
-        ESP_LOGI(TAG, "Updated light unicast=0x%04X name=%s", unicast, name);
-        return existing;
+        updated = true;
+    } else {
+        // Find empty slot
+        for (int i = 0; i < MAX_LIGHTS; i++) {
+            if (!slots[i].entry.registered) { idx = i; break; }
+        }
+    }
+    if (idx >= 0) {
+        slot_t *s = &slots[idx];
+        write_begin(s);
+        if (!updated) {
+            memset(&s->entry, 0, sizeof(light_entry_t));
+            s->entry.unicast = unicast;
+            s->entry.registered = true;
+        }
+        strncpy(s->entry.id, id, sizeof(s->entry.id) - 1);
+        strncpy(s->entry.name, name, sizeof(s->entry.name) - 1);
+        write_end(s);
+        bump_version();
     }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (idx < 0) {
+        ESP_LOGE(TAG, "No free slots for light unicast=0x%04X", unicast);
+        return false;
+    }
+    ESP_LOGI(TAG, "%s light[%d] unicast=0x%04X name=%s",
+             updated ? "Updated" : "Added", idx, unicast, name);
+    return true;
+}
+
+void light_registry_remove(uint16_t unicast)
+{
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot(unicast);
+    if (idx >= 0) {
+        write_begin(&slots[idx]);
+        memset(&slots[idx].entry, 0, sizeof(light_entry_t));
+        write_end(&slots[idx]);
+        bump_version();
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (idx >= 0) {
+        ESP_LOGI(TAG, "Removed light[%d] unicast=0x%04X", idx, unicast);
+    }
+}
 
-    // Find empty slot
+void light_registry_clear(void)
+{
+    portENTER_CRITICAL(&s_lock);
     for (int i = 0; i < MAX_LIGHTS; i++) {
-        if (!lights[i].registered) {
-            strncpy(lights[i].id, id, sizeof(lights[i].id) - 1);
-            lights[i].unicast = unicast;
-            strncpy(lights[i].name, name, sizeof(lights[i].name) - 1);
-            lights[i].registered = true;
-            lights[i].connected = false;
-            lights[i].active_effect = NULL;
-            ESP_LOGI(TAG, "Added light[%d] unicast=0x%04X name=%s", i, unicast, name);
-            return &lights[i];
+        write_begin(&slots[i]);
+        memset(&slots[i].entry, 0, sizeof(light_entry_t));
+        write_end(&slots[i]);
+    }
+    bump_version();
+    portEXIT_CRITICAL(&s_lock);
+    ESP_LOGI(TAG, "Registry cleared");
+}
+
+// MARK: - Readers
+
+bool light_registry_lookup(uint16_t unicast, light_entry_t *out)
+{
+    int idx = find_slot(unicast);
+    if (idx < 0) return false;
+    read_entry(&slots[idx], out);
+    // The slot may have been reused between find_slot and the copy
+    return out->registered && out->unicast == unicast;
+}
+
+bool light_registry_read_slot(int slot, light_entry_t *out)
+{
+    if (slot < 0 || slot >= MAX_LIGHTS) return false;
+    read_entry(&slots[slot], out);
+    return out->registered;
+}
+
+// MARK: - Field updates
+
+void light_registry_set_connected(uint16_t unicast, bool connected)
+{
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot(unicast);
+    if (idx >= 0) {
+        write_begin(&slots[idx]);
+        slots[idx].entry.connected = connected;
+        write_end(&slots[idx]);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void light_registry_set_active_effect(uint16_t unicast, int effect_type)
+{
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot(unicast);
+    if (idx >= 0) {
+        write_begin(&slots[idx]);
+        slots[idx].entry.active_effect = effect_type;
+        write_end(&slots[idx]);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void light_registry_set_device_key(uint16_t unicast, const uint8_t device_key[16])
+{
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot(unicast);
+    if (idx >= 0) {
+        write_begin(&slots[idx]);
+        memcpy(slots[idx].entry.device_key, device_key, 16);
+        slots[idx].entry.has_device_key = true;
+        write_end(&slots[idx]);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+bool light_registry_claim_seq(uint16_t unicast, uint32_t seq)
+{
+    bool ok = true;
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot(unicast);
+    if (idx >= 0) {
+        if (seq <= slots[idx].entry.last_seq) {
+            ok = false;
+        } else {
+            write_begin(&slots[idx]);
+            slots[idx].entry.last_seq = seq;
+            write_end(&slots[idx]);
         }
     }
+    portEXIT_CRITICAL(&s_lock);
+    return ok;
+}
 
-    ESP_LOGE(TAG, "No free slots for light unicast=0x%04X", unicast);
-    return NULL;
+// MARK: - Digests
+
+#define FNV_OFFSET 0x811C9DC5u
+#define FNV_PRIME  0x01000193u
+
+static uint32_t fnv1a(uint32_t h, const void *data, int len)
+{
+    const uint8_t *p = data;
+    for (int i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static uint32_t fnv1a_u32(uint32_t h, uint32_t v)
+{
+    uint8_t be[4] = { v >> 24, v >> 16, v >> 8, v };
+    return fnv1a(h, be, 4);
 }
 
-light_entry_t *light_registry_find_by_unicast(uint16_t unicast)
+// id || 0x00 || unicast (big-endian) || name
+uint32_t light_registry_entry_digest(const light_entry_t *light)
 {
+    static const uint8_t sep = 0;
+    uint8_t uni[2] = { light->unicast >> 8, light->unicast & 0xFF };
+    uint32_t h = FNV_OFFSET;
+    h = fnv1a(h, light->id, strnlen(light->id, sizeof(light->id)));
+    h = fnv1a(h, &sep, 1);
+    h = fnv1a(h, uni, 2);
+    h = fnv1a(h, light->name, strnlen(light->name, sizeof(light->name)));
+    return h;
+}
+
+uint32_t light_registry_digest(void)
+{
+    light_entry_t e;
+    uint32_t h = FNV_OFFSET;
     for (int i = 0; i < MAX_LIGHTS; i++) {
-        if (lights[i].registered && lights[i].unicast == unicast) {
-            return &lights[i];
+        if (light_registry_read_slot(i, &e)) {
+            h = fnv1a_u32(h, light_registry_entry_digest(&e));
         }
     }
-    return NULL;
+    return h;
 }
 
-light_entry_t *light_registry_get_all(int *count)
+uint32_t light_registry_shadow_digest(void)
 {
-    *count = MAX_LIGHTS;
-    return lights;
+    light_entry_t e;
+    uint32_t h = FNV_OFFSET;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (!light_registry_read_slot(i, &e)) continue;
+        const light_shadow_t *s = &e.shadow;
+        h = fnv1a_u32(h, e.unicast);
+        h = fnv1a_u32(h, s->kind);
+        h = fnv1a_u32(h, (uint32_t)(s->intensity * 10.0));
+        h = fnv1a_u32(h, s->cct_kelvin);
+        h = fnv1a_u32(h, s->hue);
+        h = fnv1a_u32(h, s->saturation);
+        h = fnv1a_u32(h, s->sleep_mode);
+        h = fnv1a_u32(h, s->effect_type);
+        h = fnv1a_u32(h, s->frq);
+        h = fnv1a_u32(h, s->cop_car_color);
+        h = fnv1a_u32(h, s->effect_mode);
+        if (s->kind == SHADOW_SW_EFFECT) {
+            h = fnv1a_u32(h, s->effect_params.color_mode);
+            h = fnv1a_u32(h, (uint32_t)(s->effect_params.frequency * 100.0));
+            h = fnv1a_u32(h, s->effect_params.party_color_count);
+        }
+    }
+    return h;
 }
 
-void light_registry_remove(uint16_t unicast)
+uint32_t light_registry_version(void)
+{
+    return atomic_load_explicit(&s_version, memory_order_relaxed);
+}
+
+// MARK: - Desired-state shadow
+
+// Software effects re-render every step, so they heal on their own.
+static bool shadow_is_replayable(const light_shadow_t *s)
+{
+    return s->kind == SHADOW_CCT || s->kind == SHADOW_HSI ||
+           s->kind == SHADOW_SLEEP || s->kind == SHADOW_HW_EFFECT;
+}
+
+void light_registry_set_shadow(uint16_t unicast, const light_shadow_t *shadow)
+{
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot(unicast);
+    if (idx >= 0) {
+        write_begin(&slots[idx]);
+        slots[idx].entry.shadow = *shadow;
+        slots[idx].entry.shadow.dirty = false;
+        write_end(&slots[idx]);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void light_registry_set_effect_params(uint16_t unicast, const effect_params_t *params)
+{
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot(unicast);
+    if (idx >= 0 && slots[idx].entry.shadow.kind == SHADOW_SW_EFFECT) {
+        write_begin(&slots[idx]);
+        slots[idx].entry.shadow.effect_params = *params;
+        slots[idx].entry.shadow.intensity = params->intensity;
+        write_end(&slots[idx]);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void light_registry_mark_dirty(uint16_t unicast)
+{
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot(unicast);
+    if (idx >= 0 && shadow_is_replayable(&slots[idx].entry.shadow)) {
+        write_begin(&slots[idx]);
+        slots[idx].entry.shadow.dirty = true;
+        write_end(&slots[idx]);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+int light_registry_mark_all_dirty(void)
 {
+    int n = 0;
+    portENTER_CRITICAL(&s_lock);
     for (int i = 0; i < MAX_LIGHTS; i++) {
-        if (lights[i].registered && lights[i].unicast == unicast) {
-            ESP_LOGI(TAG, "Removed light[%d] unicast=0x%04X", i, unicast);
-            memset(&lights[i], 0, sizeof(light_entry_t));
-            return;
+        light_entry_t *e = &slots[i].entry;
+        if (e->registered && shadow_is_replayable(&e->shadow)) {
+            write_begin(&slots[i]);
+            e->shadow.dirty = true;
+            write_end(&slots[i]);
+            n++;
         }
     }
+    portEXIT_CRITICAL(&s_lock);
+    return n;
 }
 
-void light_registry_clear(void)
+bool light_registry_take_dirty(light_entry_t *out)
 {
+    bool found = false;
+    portENTER_CRITICAL(&s_lock);
     for (int i = 0; i < MAX_LIGHTS; i++) {
-        if (lights[i].registered) {
-            ESP_LOGI(TAG, "Clearing light[%d] unicast=0x%04X", i, lights[i].unicast);
+        light_entry_t *e = &slots[i].entry;
+        if (e->registered && e->shadow.dirty) {
+            write_begin(&slots[i]);
+            e->shadow.dirty = false;
+            write_end(&slots[i]);
+            *out = *e;
+            found = true;
+            break;
         }
     }
-    memset(lights, 0, sizeof(lights));
+    portEXIT_CRITICAL(&s_lock);
+    return found;
+}
+
+bool light_registry_has_dirty(void)
+{
+    light_entry_t e;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (light_registry_read_slot(i, &e) && e.shadow.dirty) return true;
+    }
+    return false;
 }
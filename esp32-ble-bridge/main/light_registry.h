@@ -2,10 +2,38 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "effect_engine.h"
 
+// The host daemon (host/) sets its own, having no radio to limit it
+#ifndef MAX_LIGHTS
 #define MAX_LIGHTS 9
+#endif
 
-typedef struct effect_instance effect_instance_t; // forward decl
+// What the light should currently be showing
+typedef enum {
+    SHADOW_NONE = 0,        // Nothing set from the bridge yet
+    SHADOW_CCT,
+    SHADOW_HSI,
+    SHADOW_SLEEP,           // sleep_mode holds on (1) / off (0)
+    SHADOW_HW_EFFECT,       // Built-in fixture effect (set_effect)
+    SHADOW_SW_EFFECT,       // Software effect streamed by the effect engine
+} shadow_kind_t;
+
+// Desired-state shadow. Replayed after proxy recovery or a fixture reboot.
+typedef struct {
+    shadow_kind_t kind;
+    double intensity;
+    int cct_kelvin;
+    int hue;
+    int saturation;
+    int sleep_mode;
+    int effect_type;        // Sidus effect type, or effect_type_t for SW effects
+    int frq;
+    int cop_car_color;
+    int effect_mode;
+    effect_params_t effect_params;  // SW effects: everything to start it again
+    bool dirty;             // Light may not match the shadow, needs replay
+} light_shadow_t;
 
 typedef struct {
     char id[64];                // UUID string from phone
@@ -13,12 +41,68 @@ typedef struct {
     bool registered;            // Has been added via add_light
     bool connected;             // Reachable via mesh proxy
     char name[64];              // Human-readable name
-    effect_instance_t *active_effect; // NULL if no effect running
+    int active_effect;          // effect_type_t of the running effect, 0 if none
+    light_shadow_t shadow;      // Desired output
+    bool has_device_key;        // Provisioned by the bridge
+    uint8_t device_key[16];     // For config messages to this node
+    uint32_t last_seq;          // Newest SEQ sent to it, see light_registry_claim_seq
 } light_entry_t;
 
+// The registry is shared between the httpd task, the BLE callback task and
+// the esp_timer task. Readers never get pointers into it: every read copies
+// an entry out under a per-slot sequence lock, retrying only if a writer was
+// mid-update. Writers publish whole entries inside a short critical section.
+
 void light_registry_init(void);
-light_entry_t *light_registry_add(const char *id, uint16_t unicast, const char *name);
-light_entry_t *light_registry_find_by_unicast(uint16_t unicast);
-light_entry_t *light_registry_get_all(int *count);
+
+// Add or update a light. Returns false if the registry is full.
+bool light_registry_add(const char *id, uint16_t unicast, const char *name);
 void light_registry_remove(uint16_t unicast);
 void light_registry_clear(void);
+
+// Copy the entry for a unicast address. Returns false if not registered.
+bool light_registry_lookup(uint16_t unicast, light_entry_t *out);
+
+// Copy slot 0..MAX_LIGHTS-1. Returns false if the slot is empty.
+bool light_registry_read_slot(int slot, light_entry_t *out);
+
+void light_registry_set_connected(uint16_t unicast, bool connected);
+void light_registry_set_active_effect(uint16_t unicast, int effect_type);
+void light_registry_set_device_key(uint16_t unicast, const uint8_t device_key[16]);
+
+// Record the SEQ of a PDU about to go to a light. Returns false if it is
+// not newer than the last one claimed: the light would drop it, so an
+// overtaken pre-rendered frame must not be sent. Kept for as long as the
+// light is registered; an unregistered address always claims.
+bool light_registry_claim_seq(uint16_t unicast, uint32_t seq);
+
+// Digest of one entry's id, unicast and name (FNV-1a 32). The phone computes
+// the same value to decide whether add_light needs to be re-sent.
+uint32_t light_registry_entry_digest(const light_entry_t *light);
+
+// Digest over all registered entries, and over all shadows.
+uint32_t light_registry_digest(void);
+uint32_t light_registry_shadow_digest(void);
+
+// Bumped on every add/remove/clear.
+uint32_t light_registry_version(void);
+
+// Record the desired output for a light (clears its dirty flag).
+void light_registry_set_shadow(uint16_t unicast, const light_shadow_t *shadow);
+
+// New parameters for the software effect the shadow holds (update_effect).
+// No-op if the shadow is anything else.
+void light_registry_set_effect_params(uint16_t unicast, const effect_params_t *params);
+
+// Flag a light whose output may be stale (e.g. a send failed).
+void light_registry_mark_dirty(uint16_t unicast);
+
+// Flag every light with a replayable shadow. Returns how many were flagged.
+int light_registry_mark_all_dirty(void);
+
+// Copy out the next light whose shadow needs replaying and clear its dirty
+// flag. Returns false if all lights are in sync.
+bool light_registry_take_dirty(light_entry_t *out);
+
+// True if any light still needs replaying.
+bool light_registry_has_dirty(void);
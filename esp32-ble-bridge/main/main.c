@@ -11,6 +11,15 @@
 #include "ble_mesh.h"
 #include "light_registry.h"
 #include "effect_engine.h"
+#include "show_store.h"
+#include "heap_health.h"
+#include "udp_control.h"
+#include "perf_profile.h"
+#include "checkpoint.h"
+#include "rules.h"
+#include "cue_player.h"
+#include "show_player.h"
+#include "cluster.h"
 
 static const char *TAG = "main";
 
@@ -27,8 +36,10 @@ void app_main(void)
     ESP_ERROR_CHECK(ret);
 
     // Initialize subsystems
+    heap_health_init();
     light_registry_init();
     effect_engine_init();
+    show_store_init();
 
     // Initialize BLE
     ret = ble_mesh_init();
@@ -36,6 +47,15 @@ void app_main(void)
         ESP_LOGE(TAG, "BLE init failed: %s", esp_err_to_name(ret));
     }
 
+    // Rules react to mesh events from the start, phone or not
+    rules_init();
+    cue_player_init();
+    show_player_init();
+
+    // Pick up where a reset left off; effects resume once the mesh is back
+    checkpoint_restore();
+    checkpoint_start();
+
     // Initialize WiFi
     ret = wifi_init_sta();
     if (ret != ESP_OK) {
@@ -43,6 +63,9 @@ void app_main(void)
         // Could start soft-AP mode here as fallback
     }
 
+    // Apply the saved performance profile now that both radios are up
+    perf_profile_init();
+
     // Start mDNS advertisement
     if (wifi_is_connected()) {
         wifi_start_mdns();
@@ -54,6 +77,18 @@ void app_main(void)
         ESP_LOGE(TAG, "WebSocket server start failed: %s", esp_err_to_name(ret));
     }
 
+    // Start the UDP side channel for state commands
+    ret = udp_control_start();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "UDP control start failed: %s", esp_err_to_name(ret));
+    }
+
+    // Join other bridges, if this one is configured for a cluster
+    ret = cluster_start();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Cluster start failed: %s", esp_err_to_name(ret));
+    }
+
     ESP_LOGI(TAG, "Bridge ready, waiting for phone connection on port 8765");
 
     // Main loop - just keep alive, everything is event-driven
@@ -0,0 +1,184 @@
+/*
+ * mesh_adv.c
+ *
+ * Mesh ADV bearer transmitter. PDUs are queued and advertised one at a time:
+ *   config raw adv data -> start advertising -> hold for N intervals -> stop
+ * Each step completes in a GAP event, which kicks the next step.
+ */
+
+#include "mesh_adv.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "mesh_crypto.h"
+#include "mesh_capture.h"
+
+static const char *TAG = "mesh_adv";
+
+#define ADV_QUEUE_LEN 8
+
+typedef struct {
+    uint8_t data[31];
+    uint8_t len;
+} adv_item_t;
+
+static adv_item_t s_queue[ADV_QUEUE_LEN];
+static int s_head = 0;
+static int s_count = 0;
+static bool s_busy = false;         // An item is being advertised
+static uint32_t s_dropped = 0;
+
+static int s_retransmit = MESH_ADV_DEFAULT_RETRANSMIT;
+static int s_interval_ms = MESH_ADV_DEFAULT_INTERVAL_MS;
+
+static esp_timer_handle_t s_hold_timer = NULL;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Advertise the item at the head of the queue, if idle.
+static void start_next(void)
+{
+    adv_item_t item;
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_busy || s_count == 0) {
+        portEXIT_CRITICAL(&s_lock);
+        return;
+    }
+    s_busy = true;
+    item = s_queue[s_head];
+    portEXIT_CRITICAL(&s_lock);
+
+    esp_err_t err = esp_ble_gap_config_adv_data_raw(item.data, item.len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "config_adv_data_raw failed: %s", esp_err_to_name(err));
+        portENTER_CRITICAL(&s_lock);
+        s_busy = false;
+        portEXIT_CRITICAL(&s_lock);
+    }
+}
+
+// Drop the head item and move on.
+static void finish_current(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    if (s_count > 0) {
+        s_head = (s_head + 1) % ADV_QUEUE_LEN;
+        s_count--;
+    }
+    s_busy = false;
+    portEXIT_CRITICAL(&s_lock);
+    start_next();
+}
+
+static void hold_timer_cb(void *arg)
+{
+    esp_ble_gap_stop_advertising();
+}
+
+esp_err_t mesh_adv_init(void)
+{
+    esp_timer_create_args_t args = {
+        .callback = hold_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mesh_adv",
+    };
+    esp_err_t err = esp_timer_create(&args, &s_hold_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "timer create failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "ADV bearer ready (retransmit=%d interval=%dms)", s_retransmit, s_interval_ms);
+    return ESP_OK;
+}
+
+void mesh_adv_set_params(int retransmit_count, int interval_ms)
+{
+    if (retransmit_count < 0) retransmit_count = 0;
+    if (retransmit_count > 7) retransmit_count = 7;
+    if (interval_ms < 20) interval_ms = 20;
+    if (interval_ms > 320) interval_ms = 320;
+    s_retransmit = retransmit_count;
+    s_interval_ms = interval_ms;
+    ESP_LOGI(TAG, "ADV params: retransmit=%d interval=%dms", s_retransmit, s_interval_ms);
+}
+
+esp_err_t mesh_adv_send(const uint8_t *proxy_pdu, int proxy_len)
+{
+    if (!s_hold_timer) return ESP_ERR_INVALID_STATE;
+
+    adv_item_t item;
+    int len = mesh_crypto_proxy_to_adv(proxy_pdu, proxy_len, item.data, sizeof(item.data));
+    if (len == 0) return ESP_ERR_INVALID_SIZE;
+    item.len = (uint8_t)len;
+
+    bool dropped = false;
+    portENTER_CRITICAL(&s_lock);
+    if (s_count == ADV_QUEUE_LEN) {
+        // Keep the item on air; drop the oldest one still waiting behind it
+        for (int i = 1; i < ADV_QUEUE_LEN - 1; i++) {
+            s_queue[(s_head + i) % ADV_QUEUE_LEN] = s_queue[(s_head + i + 1) % ADV_QUEUE_LEN];
+        }
+        s_count--;
+        s_dropped++;
+        dropped = true;
+    }
+    s_queue[(s_head + s_count) % ADV_QUEUE_LEN] = item;
+    s_count++;
+    portEXIT_CRITICAL(&s_lock);
+    mesh_capture_pdu(MESH_CAPTURE_LINK_ADV, MESH_CAPTURE_TX, proxy_pdu, proxy_len);
+
+    if (dropped) {
+        ESP_LOGW(TAG, "ADV queue full, dropped oldest (%lu total)", (unsigned long)s_dropped);
+    }
+    start_next();
+    return ESP_OK;
+}
+
+void mesh_adv_handle_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    switch (event) {
+    case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT: {
+        if (!s_busy) break;
+        if (param->adv_data_raw_cmpl.status != 0) {
+            ESP_LOGE(TAG, "adv data set failed: %d", param->adv_data_raw_cmpl.status);
+            finish_current();
+            break;
+        }
+        // Interval in 0.625 ms units
+        uint16_t units = (uint16_t)(s_interval_ms * 1000 / 625);
+        esp_ble_adv_params_t adv_params = {
+            .adv_int_min = units,
+            .adv_int_max = units,
+            .adv_type = ADV_TYPE_NONCONN_IND,
+            .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+            .channel_map = ADV_CHNL_ALL,
+            .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+        };
+        if (esp_ble_gap_start_advertising(&adv_params) != ESP_OK) {
+            finish_current();
+        }
+        break;
+    }
+
+    case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+        if (!s_busy) break;
+        if (param->adv_start_cmpl.status != 0) {
+            ESP_LOGE(TAG, "adv start failed: %d", param->adv_start_cmpl.status);
+            finish_current();
+            break;
+        }
+        // Original transmission plus retransmissions
+        esp_timer_start_once(s_hold_timer, (uint64_t)(s_retransmit + 1) * s_interval_ms * 1000);
+        break;
+
+    case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
+        if (s_busy) finish_current();
+        break;
+
+    default:
+        break;
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+
+// Mesh ADV bearer transmitter.
+//
+// Injects network PDUs directly as non-connectable advertisements (AD type
+// 0x2A) so every fixture in radio range hears them without going through a
+// GATT proxy connection event. Each PDU is advertised for
+// (retransmit_count + 1) advertising intervals, then the next queued PDU
+// goes out.
+
+#define MESH_ADV_DEFAULT_RETRANSMIT  2
+#define MESH_ADV_DEFAULT_INTERVAL_MS 20
+
+// Create the transmit timer. Call after the GAP callback is registered.
+esp_err_t mesh_adv_init(void);
+
+// Retransmit count (0-7) and interval between transmissions (20-320 ms).
+void mesh_adv_set_params(int retransmit_count, int interval_ms);
+
+// Queue a proxy PDU from mesh_crypto_create_standard_pdu for broadcast.
+// If the queue is full the oldest PDU is dropped.
+esp_err_t mesh_adv_send(const uint8_t *proxy_pdu, int proxy_len);
+
+// Forward GAP advertising events from the BLE GAP callback.
+void mesh_adv_handle_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
@@ -0,0 +1,250 @@
+/*
+ * mesh_capture.c
+ *
+ * Ring of proxy PDUs written and received, exported as pcapng over HTTP.
+ */
+
+#include "mesh_capture.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "mesh_crypto.h"
+
+static const char *TAG = "mesh_capture";
+
+#ifndef CONFIG_BRIDGE_CAPTURE_RECORDS
+#define CONFIG_BRIDGE_CAPTURE_RECORDS 256
+#endif
+
+#define CAPTURE_SNAP    72          // Longest PDU kept; longer ones are truncated
+#define CAPTURE_LINKS   (MESH_CAPTURE_LINK_ADV + 1)
+#define DLT_USER0       147
+
+typedef struct {
+    uint32_t id;                    // Sequence number of the record
+    int64_t ts_us;
+    uint8_t link;
+    uint8_t dir;
+    uint8_t caplen;
+    uint8_t origlen;
+    uint8_t data[CAPTURE_SNAP];
+} cap_record_t;
+
+static cap_record_t *s_ring = NULL;
+static uint32_t s_next_id = 0;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// MARK: - Capture
+
+esp_err_t mesh_capture_enable(bool on)
+{
+    if (CONFIG_BRIDGE_CAPTURE_RECORDS <= 0) return ESP_ERR_NOT_SUPPORTED;
+
+    cap_record_t *old;
+    cap_record_t *ring = NULL;
+    if (on) {
+        ring = calloc(CONFIG_BRIDGE_CAPTURE_RECORDS, sizeof(cap_record_t));
+        if (!ring) return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    old = s_ring;
+    s_ring = ring;
+    s_next_id = 0;
+    portEXIT_CRITICAL(&s_lock);
+    free(old);
+
+    ESP_LOGI(TAG, "Capture %s (%d records)", on ? "on" : "off", CONFIG_BRIDGE_CAPTURE_RECORDS);
+    return ESP_OK;
+}
+
+void mesh_capture_pdu(uint8_t link, mesh_capture_dir_t dir, const uint8_t *pdu, int len)
+{
+    if (!s_ring || len <= 0) return;
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    if (s_ring) {
+        cap_record_t *r = &s_ring[s_next_id % CONFIG_BRIDGE_CAPTURE_RECORDS];
+        r->id = s_next_id++;
+        r->ts_us = now;
+        r->link = link < CAPTURE_LINKS ? link : MESH_CAPTURE_LINK_ADV;
+        r->dir = (uint8_t)dir;
+        r->origlen = len > 255 ? 255 : (uint8_t)len;
+        r->caplen = len > CAPTURE_SNAP ? CAPTURE_SNAP : (uint8_t)len;
+        memcpy(r->data, pdu, r->caplen);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+// MARK: - pcapng
+
+static int put32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, 4);   // pcapng is written in host order; the BOM says which
+    return 4;
+}
+
+static int put16(uint8_t *p, uint16_t v)
+{
+    memcpy(p, &v, 2);
+    return 2;
+}
+
+static int pad4(int n)
+{
+    return (n + 3) & ~3;
+}
+
+// Option with a padded value
+static int put_option(uint8_t *p, uint16_t code, const void *val, int len)
+{
+    int n = put16(p, code);
+    n += put16(p + n, (uint16_t)len);
+    memcpy(p + n, val, len);
+    memset(p + n + len, 0, pad4(len) - len);
+    return n + pad4(len);
+}
+
+// Close a block: end-of-options if asked, then the trailing length
+static int end_block(uint8_t *block, int n, bool options)
+{
+    if (options) n += put32(block + n, 0);
+    n += 4;
+    put32(block + 4, n);
+    put32(block + n - 4, n);
+    return n;
+}
+
+static int section_header(uint8_t *b)
+{
+    int n = put32(b, 0x0A0D0D0A);
+    n += 4;                                     // Length, filled in by end_block
+    n += put32(b + n, 0x1A2B3C4D);              // Byte-order magic
+    n += put16(b + n, 1);
+    n += put16(b + n, 0);
+    n += put32(b + n, 0xFFFFFFFF);              // Section length unknown
+    n += put32(b + n, 0xFFFFFFFF);
+    return end_block(b, n, false);
+}
+
+static int interface_block(uint8_t *b, int link)
+{
+    char name[16];
+    if (link == MESH_CAPTURE_LINK_ADV) snprintf(name, sizeof(name), "adv");
+    else snprintf(name, sizeof(name), "conn %d", link);
+
+    int n = put32(b, 0x00000001);
+    n += 4;
+    n += put16(b + n, DLT_USER0);
+    n += put16(b + n, 0);
+    n += put32(b + n, CAPTURE_SNAP);
+    n += put_option(b + n, 2, name, strlen(name));   // if_name
+    return end_block(b, n, true);
+}
+
+// Comment for a complete Network PDU: header fields, plus the access
+// payload if it decrypts under our AppKey
+static int annotate(const cap_record_t *r, char *out, int max)
+{
+    if (r->caplen != r->origlen || r->caplen < 2 || r->data[0] != 0x00) return 0;
+
+    mesh_rx_pdu_t rx;
+    if (!mesh_crypto_decode_network(r->data + 1, r->caplen - 1, &rx)) return 0;
+
+    int n = snprintf(out, max, "%04X->%04X SEQ %lu TTL %u%s", rx.src, rx.dst,
+                     (unsigned long)rx.seq, rx.ttl, rx.ctl ? " CTL" : "");
+    uint8_t access[16];
+    int alen = mesh_crypto_decrypt_app_access(&rx, access, sizeof(access));
+    if (alen > 0 && n < max) {
+        n += snprintf(out + n, max - n, " access");
+        for (int i = 0; i < alen && n < max; i++) {
+            n += snprintf(out + n, max - n, " %02X", access[i]);
+        }
+    }
+    return n < max ? n : max - 1;
+}
+
+static int packet_block(uint8_t *b, const cap_record_t *r, bool decrypt)
+{
+    uint64_t ts = (uint64_t)r->ts_us;
+    int n = put32(b, 0x00000006);
+    n += 4;
+    n += put32(b + n, r->link);
+    n += put32(b + n, (uint32_t)(ts >> 32));
+    n += put32(b + n, (uint32_t)ts);
+    n += put32(b + n, r->caplen);
+    n += put32(b + n, r->origlen);
+    memcpy(b + n, r->data, r->caplen);
+    memset(b + n + r->caplen, 0, pad4(r->caplen) - r->caplen);
+    n += pad4(r->caplen);
+
+    uint32_t flags = r->dir == MESH_CAPTURE_RX ? 0x1 : 0x2;    // inbound / outbound
+    n += put_option(b + n, 2, &flags, 4);                      // epb_flags
+
+    char comment[96];
+    int clen = decrypt ? annotate(r, comment, sizeof(comment)) : 0;
+    if (clen > 0) n += put_option(b + n, 1, comment, clen);    // opt_comment
+    return end_block(b, n, true);
+}
+
+static esp_err_t capture_handler(httpd_req_t *req)
+{
+    bool decrypt = false;
+    char query[32];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        char val[4];
+        decrypt = httpd_query_key_value(query, "decrypt", val, sizeof(val)) == ESP_OK &&
+                  val[0] == '1';
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    bool on = s_ring != NULL;
+    uint32_t end = s_next_id;
+    portEXIT_CRITICAL(&s_lock);
+    if (!on) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "capture is off");
+
+    uint32_t start = end > CONFIG_BRIDGE_CAPTURE_RECORDS ? end - CONFIG_BRIDGE_CAPTURE_RECORDS : 0;
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"bridge.pcapng\"");
+
+    uint8_t block[256];
+    esp_err_t err = httpd_resp_send_chunk(req, (char *)block, section_header(block));
+    for (int link = 0; link < CAPTURE_LINKS && err == ESP_OK; link++) {
+        err = httpd_resp_send_chunk(req, (char *)block, interface_block(block, link));
+    }
+
+    // Records keep being written while we stream; one that was overwritten
+    // since the snapshot is skipped
+    for (uint32_t id = start; id < end && err == ESP_OK; id++) {
+        cap_record_t r;
+        bool ok = false;
+        portENTER_CRITICAL(&s_lock);
+        if (s_ring && s_ring[id % CONFIG_BRIDGE_CAPTURE_RECORDS].id == id) {
+            r = s_ring[id % CONFIG_BRIDGE_CAPTURE_RECORDS];
+            ok = true;
+        }
+        portEXIT_CRITICAL(&s_lock);
+        if (!ok) continue;
+        err = httpd_resp_send_chunk(req, (char *)block, packet_block(block, &r, decrypt));
+    }
+
+    if (err == ESP_OK) err = httpd_resp_send_chunk(req, NULL, 0);
+    return err;
+}
+
+esp_err_t mesh_capture_register(httpd_handle_t server)
+{
+    httpd_uri_t uri = {
+        .uri = "/capture.pcapng",
+        .method = HTTP_GET,
+        .handler = capture_handler,
+    };
+    return httpd_register_uri_handler(server, &uri);
+}
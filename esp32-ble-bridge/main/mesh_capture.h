@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Capture ring of mesh traffic: every proxy PDU written to a GATT link or
+// queued on the ADV bearer, and every proxy notification received. Off by
+// default; the ring is only allocated while capturing.
+//
+// GET /capture.pcapng exports it as pcapng. There is one interface per
+// link: "conn N" for GATT connection N and "adv" for the ADV bearer. The
+// link type is DLT_USER0 (147), and each packet is a raw proxy PDU. To
+// decode it in Wireshark, map DLT_USER 147 to the payload protocol
+// "btmesh.proxy" (Preferences > Protocols > DLT_USER). Packet direction
+// is in epb_flags. Timestamps count from bridge boot.
+// GET /capture.pcapng?decrypt=1 also puts a comment on each complete
+// Network PDU. The comment holds its SRC, DST, SEQ and TTL, plus the
+// access payload when it decrypts under the loaded AppKey.
+
+#define MESH_CAPTURE_LINK_ADV 9
+
+typedef enum {
+    MESH_CAPTURE_TX = 0,
+    MESH_CAPTURE_RX,
+} mesh_capture_dir_t;
+
+// Start (clearing the ring) or stop capturing.
+esp_err_t mesh_capture_enable(bool on);
+
+void mesh_capture_pdu(uint8_t link, mesh_capture_dir_t dir, const uint8_t *pdu, int len);
+
+esp_err_t mesh_capture_register(httpd_handle_t server);
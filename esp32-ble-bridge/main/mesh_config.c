@@ -0,0 +1,543 @@
+/*
+ * mesh_config.c
+ *
+ * Configuration Client, ported from MeshConfigManager.swift. The app sends
+ * one message per fixture and waits a fixed delay; here every step waits
+ * for the fixture's status message instead, and a window of fixtures is
+ * configured in parallel so a whole rig finishes in a few round trips.
+ */
+
+#include "mesh_config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#include "ble_mesh.h"
+#include "ws_server.h"
+#include "topology.h"
+
+static const char *TAG = "mesh_config";
+
+#ifndef CONFIG_BRIDGE_CONFIG_WINDOW
+#define CONFIG_BRIDGE_CONFIG_WINDOW 8
+#endif
+
+#define CONFIG_WINDOW       CONFIG_BRIDGE_CONFIG_WINDOW
+#define TICK_MS             20
+#define SENDS_PER_TICK      2       // Keeps bursts from starving live traffic
+#define RESPONSE_TIMEOUT_MS 1000    // Grows with every attempt
+#define MAX_ATTEMPTS        4
+#define MAX_SEGMENTS        2       // Largest message here is AppKey Add (24 bytes)
+
+// Config opcodes
+#define OP_APPKEY_ADD           0x00
+#define OP_APPKEY_STATUS        0x8003
+#define OP_MODEL_APP_BIND       0x803D
+#define OP_MODEL_APP_STATUS     0x803E
+#define OP_MODEL_PUB_SET        0x03
+#define OP_MODEL_PUB_STATUS     0x8019
+#define OP_MODEL_SUB_ADD        0x801B  // SIG and vendor models alike
+#define OP_MODEL_SUB_STATUS     0x801F
+#define OP_RELAY_SET            0x8023
+#define OP_RELAY_STATUS         0x8028
+#define OP_HEARTBEAT_PUB_SET    0x8039
+#define OP_HEARTBEAT_PUB_STATUS 0x06
+
+// Status codes worth retrying rather than failing the fixture
+#define STATUS_TEMP_UNABLE      0x10
+#define STATUS_UNSPECIFIED      0x11
+
+// Same model set as the app: SIG light servers plus the Sidus vendor model
+static const struct {
+    uint32_t id;
+    bool vendor;
+} s_models[] = {
+    { 0x1000, false },      // Generic OnOff Server
+    { 0x1300, false },      // Light Lightness Server
+    { 0x1303, false },      // Light CTL Server
+    { 0x1307, false },      // Light HSL Server
+    { 0x00000211, true },   // Sidus vendor model (company 0x0211)
+};
+#define NUM_MODELS ((int)(sizeof(s_models) / sizeof(s_models[0])))
+
+typedef enum {
+    TARGET_QUEUED = 0,
+    TARGET_ACTIVE,
+    TARGET_DONE,
+    TARGET_FAILED,
+} target_state_t;
+
+typedef struct {
+    mesh_config_target_t t;
+    target_state_t state;
+    int step;                   // Next step of the plan
+} config_target_t;
+
+// One fixture in flight
+typedef struct {
+    int target;                 // Index into s_targets, -1 = free
+    bool waiting;               // Message out, waiting for its status
+    int attempts;
+    int64_t deadline_us;
+
+    // Expected response: status opcode echoing the request parameters
+    uint16_t status_op;
+    bool has_status_byte;       // Relay Status has no status code
+    uint8_t params[20];
+    int params_len;
+
+    // Last transmission, for resending segments the node didn't get
+    uint8_t pdus[MAX_SEGMENTS][MESH_PDU_MAX];
+    int lens[MAX_SEGMENTS];
+    int seg_count;
+    uint16_t seq_zero;
+
+    // Filled in on the BTC task, consumed by the tick
+    bool got_status;
+    uint8_t status;
+    uint32_t seg_missing;
+} config_slot_t;
+
+static config_target_t s_targets[MESH_CONFIG_MAX_TARGETS];
+static int s_target_count = 0;
+static int s_next_target = 0;
+static uint16_t s_groups[MESH_CONFIG_MAX_GROUPS];
+static int s_group_count = 0;
+static bool s_full = false;
+
+static config_slot_t s_slots[CONFIG_WINDOW];
+static volatile bool s_busy = false;
+static volatile bool s_cancel = false;
+static int s_done = 0;
+static int s_failed = 0;
+static int64_t s_start_us = 0;
+
+// Slots are advanced on the esp_timer task; responses arrive on the BTC task
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_timer = NULL;
+
+// MARK: - Plan
+
+// Full: AppKey Add, bind every model, vendor publication, relay, heartbeat
+// publication, then every model subscribed to every group. Regroup: relay,
+// heartbeats and subscriptions (the app's sendGroupSubscriptionsOnly).
+static int plan_length(void)
+{
+    return (s_full ? 1 + NUM_MODELS + 1 : 0) + 2 + s_group_count * NUM_MODELS;
+}
+
+static int put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v & 0xFF);
+    p[1] = (uint8_t)(v >> 8);
+    return 2;
+}
+
+static int put_model(uint8_t *p, int model)
+{
+    uint32_t id = s_models[model].id;
+    if (!s_models[model].vendor) return put_le16(p, (uint16_t)id);
+    put_le16(p, (uint16_t)(id & 0xFFFF));
+    put_le16(p + 2, (uint16_t)(id >> 16));
+    return 4;
+}
+
+static int put_opcode(uint8_t *p, uint16_t op)
+{
+    if (op < 0x80) {
+        p[0] = (uint8_t)op;
+        return 1;
+    }
+    p[0] = (uint8_t)(op >> 8);
+    p[1] = (uint8_t)(op & 0xFF);
+    return 2;
+}
+
+// Fill in the request parameters and expected status for one step.
+// Returns the request opcode.
+static uint16_t step_request(config_slot_t *sl, uint16_t unicast, int step)
+{
+    uint8_t *p = sl->params;
+    int n = 0;
+    uint16_t op;
+
+    sl->has_status_byte = true;
+
+    if (s_full && step == 0) {
+        // NetKeyIndex 0 | AppKeyIndex 0 packed in 3 bytes, then the key
+        op = OP_APPKEY_ADD;
+        sl->status_op = OP_APPKEY_STATUS;
+        memset(p, 0, 3);
+        n = 3;
+        mesh_crypto_get_app_key(p + n);
+        n += 16;
+    } else if (s_full && step <= NUM_MODELS) {
+        op = OP_MODEL_APP_BIND;
+        sl->status_op = OP_MODEL_APP_STATUS;
+        n += put_le16(p + n, unicast);
+        n += put_le16(p + n, 0);                        // AppKeyIndex
+        n += put_model(p + n, step - 1);
+    } else if (s_full && step == NUM_MODELS + 1) {
+        // Vendor model publishes its status to the bridge every 5 s
+        op = OP_MODEL_PUB_SET;
+        sl->status_op = OP_MODEL_PUB_STATUS;
+        n += put_le16(p + n, unicast);
+        n += put_le16(p + n, mesh_crypto_get_src());
+        n += put_le16(p + n, 0);                        // AppKeyIndex, CredentialFlag 0
+        p[n++] = 7;                                     // Publish TTL
+        p[n++] = (1 << 6) | 5;                          // 1 s resolution x 5 steps
+        p[n++] = 0x00;                                  // No retransmit
+        n += put_model(p + n, NUM_MODELS - 1);
+    } else {
+        if (s_full) step -= NUM_MODELS + 2;
+        if (step == 0) {
+            // Relay on, 3 retransmits at 30 ms steps
+            op = OP_RELAY_SET;
+            sl->status_op = OP_RELAY_STATUS;
+            sl->has_status_byte = false;
+            p[n++] = 0x01;
+            p[n++] = (3 & 0x07) | ((2 & 0x1F) << 3);
+        } else if (step == 1) {
+            // Periodic heartbeats to the bridge for the topology map
+            op = OP_HEARTBEAT_PUB_SET;
+            sl->status_op = OP_HEARTBEAT_PUB_STATUS;
+            n += put_le16(p + n, mesh_crypto_get_src());
+            p[n++] = 0xFF;                              // CountLog: indefinitely
+            p[n++] = TOPOLOGY_HB_PERIOD_LOG;
+            p[n++] = 7;                                 // TTL
+            n += put_le16(p + n, 0);                    // No feature-change triggers
+            n += put_le16(p + n, 0);                    // NetKeyIndex
+        } else {
+            int group = (step - 2) / NUM_MODELS;
+            int model = (step - 2) % NUM_MODELS;
+            // The model ID's length tells a vendor model apart
+            op = OP_MODEL_SUB_ADD;
+            sl->status_op = OP_MODEL_SUB_STATUS;
+            n += put_le16(p + n, unicast);
+            n += put_le16(p + n, s_groups[group]);
+            n += put_model(p + n, model);
+        }
+    }
+
+    sl->params_len = n;
+    return op;
+}
+
+// Build the access message for one step. The parameters (everything after
+// the opcode) are also what the status message echoes back.
+static int build_step(config_slot_t *sl, uint16_t unicast, int step, uint8_t *msg)
+{
+    uint16_t op = step_request(sl, unicast, step);
+    int len = put_opcode(msg, op);
+    memcpy(msg + len, sl->params, sl->params_len);
+    return len + sl->params_len;
+}
+
+// MARK: - Events
+
+static void send_progress(const config_target_t *t, const char *state, const char *reason)
+{
+    char body[160];
+    int pos = snprintf(body, sizeof(body), "\"unicast\":%u,\"step\":%d,\"steps\":%d,\"state\":\"%s\"",
+                       t->t.unicast, t->step, plan_length(), state);
+    if (reason) {
+        snprintf(body + pos, sizeof(body) - pos, ",\"reason\":\"%s\"", reason);
+    }
+    ws_server_send_event("config_progress", body);
+}
+
+// MARK: - Tick
+
+static void send_step(config_slot_t *sl)
+{
+    config_target_t *t = &s_targets[sl->target];
+    uint8_t msg[32];
+    config_slot_t next = *sl;
+
+    int len = build_step(&next, t->t.unicast, t->step, msg);
+    int count = len > 0 ? mesh_crypto_create_devkey_pdus(msg, len, t->t.unicast, t->t.device_key,
+                                                         next.pdus, next.lens, MAX_SEGMENTS,
+                                                         &next.seq_zero)
+                        : 0;
+    next.seg_count = count;
+    next.attempts++;
+    next.waiting = true;
+    next.got_status = false;
+    next.seg_missing = 0;
+    next.deadline_us = esp_timer_get_time() +
+                       (int64_t)RESPONSE_TIMEOUT_MS * next.attempts * 1000;
+
+    portENTER_CRITICAL(&s_lock);
+    *sl = next;
+    portEXIT_CRITICAL(&s_lock);
+
+    // Nothing went out: the deadline turns this into a retry
+    if (count > 0) {
+        ble_mesh_send_pdus(sl->pdus, sl->lens, count);
+    }
+}
+
+static void finish_target(config_slot_t *sl, target_state_t state, const char *reason)
+{
+    config_target_t *t = &s_targets[sl->target];
+    t->state = state;
+    if (state == TARGET_DONE) {
+        s_done++;
+        ESP_LOGI(TAG, "0x%04X configured", t->t.unicast);
+        send_progress(t, "done", NULL);
+    } else {
+        s_failed++;
+        ESP_LOGW(TAG, "0x%04X failed at step %d: %s", t->t.unicast, t->step, reason);
+        send_progress(t, "failed", reason);
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    sl->target = -1;
+    sl->waiting = false;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static void finish_run(void)
+{
+    esp_timer_stop(s_timer);
+    s_busy = false;
+
+    int ms = (int)((esp_timer_get_time() - s_start_us) / 1000);
+    ESP_LOGI(TAG, "Run complete: %d configured, %d failed in %d ms", s_done, s_failed, ms);
+
+    char body[96];
+    snprintf(body, sizeof(body), "\"done\":%d,\"failed\":%d,\"ms\":%d", s_done, s_failed, ms);
+    ws_server_send_event("config_done", body);
+}
+
+static void config_tick(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    int sends = 0;
+    bool any_active = false;
+
+    for (int i = 0; i < CONFIG_WINDOW; i++) {
+        config_slot_t *sl = &s_slots[i];
+
+        if (sl->target < 0) {
+            if (s_cancel || s_next_target >= s_target_count) continue;
+            portENTER_CRITICAL(&s_lock);
+            sl->target = s_next_target++;
+            sl->attempts = 0;
+            sl->waiting = false;
+            portEXIT_CRITICAL(&s_lock);
+            s_targets[sl->target].state = TARGET_ACTIVE;
+        }
+        any_active = true;
+        config_target_t *t = &s_targets[sl->target];
+
+        portENTER_CRITICAL(&s_lock);
+        bool got = sl->got_status;
+        uint8_t status = sl->status;
+        uint32_t missing = sl->seg_missing;
+        sl->got_status = false;
+        sl->seg_missing = 0;
+        portEXIT_CRITICAL(&s_lock);
+
+        if (sl->waiting) {
+            if (got && status == 0) {
+                t->step++;
+                sl->attempts = 0;
+                sl->waiting = false;
+                if (t->step >= plan_length()) {
+                    finish_target(sl, TARGET_DONE, NULL);
+                    continue;
+                }
+                send_progress(t, "running", NULL);
+            } else if (got && status != STATUS_TEMP_UNABLE && status != STATUS_UNSPECIFIED) {
+                char reason[24];
+                snprintf(reason, sizeof(reason), "status 0x%02X", status);
+                finish_target(sl, TARGET_FAILED, reason);
+                continue;
+            } else if (got || now >= sl->deadline_us) {
+                if (sl->attempts >= MAX_ATTEMPTS) {
+                    finish_target(sl, TARGET_FAILED, got ? "busy" : "timeout");
+                    continue;
+                }
+                sl->waiting = false;
+            } else if (missing) {
+                // Segment Ack: resend only the segments the node is missing
+                for (int s = 0; s < sl->seg_count; s++) {
+                    if (missing & (1u << s)) ble_mesh_send_pdus(&sl->pdus[s], &sl->lens[s], 1);
+                }
+                continue;
+            } else {
+                continue;
+            }
+        }
+
+        if (sends < SENDS_PER_TICK) {
+            send_step(sl);
+            sends++;
+        }
+    }
+
+    if (!any_active) finish_run();
+}
+
+// MARK: - Receive
+
+static config_slot_t *find_slot_locked(uint16_t unicast)
+{
+    for (int i = 0; i < CONFIG_WINDOW; i++) {
+        if (s_slots[i].target >= 0 && s_slots[i].waiting &&
+            s_targets[s_slots[i].target].t.unicast == unicast) {
+            return &s_slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Lower transport Segment Acknowledgment (CTL, opcode 0x00):
+// OBO | SeqZero (13) | RFU (2), BlockAck (32)
+static void handle_segment_ack(const mesh_rx_pdu_t *rx)
+{
+    const uint8_t *t = rx->transport;
+    if (rx->transport_len < 7 || t[0] != 0x00) return;
+
+    uint16_t seq_zero = (uint16_t)(((t[1] & 0x7F) << 6) | (t[2] >> 2));
+    uint32_t block = ((uint32_t)t[3] << 24) | ((uint32_t)t[4] << 16) |
+                     ((uint32_t)t[5] << 8) | t[6];
+
+    portENTER_CRITICAL(&s_lock);
+    config_slot_t *sl = find_slot_locked(rx->src);
+    if (sl && sl->seg_count > 1 && sl->seq_zero == seq_zero && block != 0) {
+        uint32_t all = (1u << sl->seg_count) - 1;
+        sl->seg_missing = all & ~block;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void mesh_config_handle_rx(const mesh_rx_pdu_t *rx)
+{
+    if (!s_busy || rx->dst != mesh_crypto_get_src()) return;
+
+    if (rx->ctl) {
+        handle_segment_ack(rx);
+        return;
+    }
+
+    uint8_t key[16];
+    bool found = false;
+    portENTER_CRITICAL(&s_lock);
+    config_slot_t *sl = find_slot_locked(rx->src);
+    if (sl) {
+        memcpy(key, s_targets[sl->target].t.device_key, 16);
+        found = true;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (!found) return;
+
+    // Every status we wait for fits an unsegmented access message
+    uint8_t msg[16];
+    int len = mesh_crypto_decrypt_devkey_access(rx, key, msg, sizeof(msg));
+    if (len < 2) return;
+
+    uint16_t op;
+    int op_len;
+    if ((msg[0] & 0xC0) == 0x80) {
+        op = (uint16_t)((msg[0] << 8) | msg[1]);
+        op_len = 2;
+    } else if ((msg[0] & 0x80) == 0) {
+        op = msg[0];
+        op_len = 1;
+    } else {
+        return;                                 // Vendor opcode, not ours
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    sl = find_slot_locked(rx->src);
+    if (sl && sl->status_op == op && !sl->has_status_byte) {
+        // Relay Status carries the resulting state only. A fixture without
+        // relay support (0x02) is still usable, so any answer moves on.
+        sl->status = 0x00;
+        sl->got_status = true;
+    } else if (sl && sl->status_op == op && len > op_len) {
+        // The status echoes the request parameters; a late copy of an
+        // earlier step's status (e.g. another subscription) won't match.
+        const uint8_t *echo = msg + op_len + 1;
+        int echo_len = len - op_len - 1;
+        int cmp = echo_len < sl->params_len ? echo_len : sl->params_len;
+        if (memcmp(echo, sl->params, cmp) == 0) {
+            sl->status = msg[op_len];
+            sl->got_status = true;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (op == OP_RELAY_STATUS && len > op_len && msg[op_len] != 0x01) {
+        ESP_LOGW(TAG, "0x%04X relay state %u", rx->src, msg[op_len]);
+    }
+}
+
+// MARK: - Public API
+
+esp_err_t mesh_config_init(void)
+{
+    for (int i = 0; i < CONFIG_WINDOW; i++) {
+        s_slots[i].target = -1;
+    }
+
+    esp_timer_create_args_t args = {
+        .callback = config_tick,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mesh_config",
+    };
+    esp_err_t err = esp_timer_create(&args, &s_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "timer create failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t mesh_config_start(const mesh_config_target_t *targets, int count,
+                            const uint16_t *groups, int group_count, bool full)
+{
+    if (s_busy || !mesh_crypto_is_initialized()) return ESP_ERR_INVALID_STATE;
+    if (count <= 0 || count > MESH_CONFIG_MAX_TARGETS ||
+        group_count < 0 || group_count > MESH_CONFIG_MAX_GROUPS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(s_targets, 0, sizeof(s_targets));
+    for (int i = 0; i < count; i++) {
+        s_targets[i].t = targets[i];
+    }
+    memcpy(s_groups, groups, group_count * sizeof(uint16_t));
+    s_target_count = count;
+    s_group_count = group_count;
+    s_full = full;
+    s_next_target = 0;
+    s_done = 0;
+    s_failed = 0;
+    s_cancel = false;
+    for (int i = 0; i < CONFIG_WINDOW; i++) {
+        s_slots[i].target = -1;
+        s_slots[i].waiting = false;
+    }
+
+    s_start_us = esp_timer_get_time();
+    s_busy = true;
+    ESP_LOGI(TAG, "Configuring %d fixture(s), %d group(s), %d steps each, window %d",
+             count, group_count, plan_length(), CONFIG_WINDOW);
+    return esp_timer_start_periodic(s_timer, TICK_MS * 1000);
+}
+
+void mesh_config_cancel(void)
+{
+    if (s_busy) s_cancel = true;
+}
+
+bool mesh_config_is_busy(void)
+{
+    return s_busy;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "mesh_crypto.h"
+
+// Bridge-side Configuration Client.
+//
+// Runs the post-provisioning sequence from MeshConfigManager.swift (AppKey
+// Add, model binds, vendor publication, relay, group subscriptions, plus
+// heartbeat publication for the topology map) for many
+// fixtures at once through the existing proxies. Each fixture has one
+// message in flight; a window of fixtures runs in parallel. Every step waits
+// for its decoded status message and is retried on timeout or a transient
+// failure status. Progress goes to the phone as config_progress events.
+
+// Fixtures per configuration run
+#define MESH_CONFIG_MAX_TARGETS 64
+
+// Group addresses per run
+#define MESH_CONFIG_MAX_GROUPS 8
+
+typedef struct {
+    uint16_t unicast;           // Primary element address
+    uint8_t device_key[16];
+} mesh_config_target_t;
+
+esp_err_t mesh_config_init(void);
+
+// Configure the targets. full = the whole post-provisioning sequence;
+// otherwise relay + group subscriptions only (re-grouping configured lights).
+// ESP_ERR_INVALID_STATE if a run is in progress or no keys are loaded.
+esp_err_t mesh_config_start(const mesh_config_target_t *targets, int count,
+                            const uint16_t *groups, int group_count, bool full);
+
+// Stop starting new fixtures. Steps in flight finish or time out.
+void mesh_config_cancel(void);
+
+bool mesh_config_is_busy(void);
+
+// Network PDUs received from the proxies while a run is in progress.
+void mesh_config_handle_rx(const mesh_rx_pdu_t *rx);
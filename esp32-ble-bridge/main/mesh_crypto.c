@@ -10,6 +10,7 @@
 #include "mesh_crypto.h"
 
 #include <string.h>
+#include <stdatomic.h>
 #include <mbedtls/cipher.h>
 #include <mbedtls/cmac.h>
 #include <mbedtls/aes.h>
@@ -30,10 +31,14 @@ static uint8_t  s_encryption_key[16];
 static uint8_t  s_privacy_key[16];
 static uint8_t  s_nid;
 static uint8_t  s_aid;
+static uint8_t  s_identity_key[16];
 
-static uint32_t s_sequence_number = 0x010000;  // Start high to avoid replay rejection
+// Start high to avoid replay rejection. Atomic: PDUs are encrypted on
+// several tasks (several worker threads on the host) at once.
+static _Atomic uint32_t s_sequence_number = 0x010000;
 
 static bool s_initialized = false;
+static uint32_t s_key_generation = 0;  // Bumped on every mesh_crypto_init
 
 // ---------------------------------------------------------------------------
 // Forward declarations (internal helpers)
@@ -46,6 +51,9 @@ static void aes_ecb_block(const uint8_t key[16], const uint8_t in[16],
 static int  aes_ccm_encrypt(const uint8_t key[16], const uint8_t nonce[13],
                             const uint8_t *plaintext, int pt_len,
                             int mic_size, uint8_t *out);
+static int  aes_ccm_decrypt(const uint8_t key[16], const uint8_t nonce[13],
+                            const uint8_t *ciphertext, int ct_len,
+                            int mic_size, uint8_t *out);
 
 static void build_application_nonce(uint32_t seq, uint16_t src, uint16_t dst,
                                     uint32_t iv_index, uint8_t nonce[13]);
@@ -55,6 +63,9 @@ static void build_network_nonce(uint8_t ctl, uint8_t ttl, uint32_t seq,
 static void obfuscate(uint8_t ctl_ttl, uint32_t seq, uint16_t src,
                       const uint8_t *enc_payload, const uint8_t priv_key[16],
                       uint32_t iv_index, uint8_t out[6]);
+static int  build_network_pdu(uint8_t ctl, uint8_t ttl, uint32_t seq, uint16_t dst,
+                              const uint8_t *ltp, int ltp_len,
+                              uint8_t *out_pdu, int out_max);
 
 // ---------------------------------------------------------------------------
 // Key derivation: s1
@@ -137,6 +148,19 @@ uint8_t mesh_crypto_k4(const uint8_t n[16])
     return result[15] & 0x3F;
 }
 
+// ---------------------------------------------------------------------------
+// Key derivation: k1
+// ---------------------------------------------------------------------------
+
+void mesh_crypto_k1(const uint8_t *n, int n_len, const uint8_t salt[16],
+                    const uint8_t *p, int p_len, uint8_t out[16])
+{
+    // T = AES-CMAC(SALT, N); k1 = AES-CMAC(T, P)
+    uint8_t t[16];
+    aes_cmac(salt, n, n_len, t);
+    aes_cmac(t, p, p_len, out);
+}
+
 // ---------------------------------------------------------------------------
 // Initialization
 // ---------------------------------------------------------------------------
@@ -160,7 +184,15 @@ void mesh_crypto_init(const uint8_t *network_key, const uint8_t *app_key,
     // Derive AID from app key via k4
     s_aid = mesh_crypto_k4(s_app_key);
 
+    // IdentityKey = k1(NetKey, s1("nkik"), "id128" || 0x01)
+    const uint8_t nkik[] = { 'n', 'k', 'i', 'k' };
+    const uint8_t id128[] = { 'i', 'd', '1', '2', '8', 0x01 };
+    uint8_t salt[16];
+    mesh_crypto_s1(nkik, sizeof(nkik), salt);
+    mesh_crypto_k1(s_network_key, 16, salt, id128, sizeof(id128), s_identity_key);
+
     s_initialized = true;
+    s_key_generation++;
 
     ESP_LOGI(TAG, "NID = 0x%02X, AID = 0x%02X", s_nid, s_aid);
 
@@ -180,9 +212,97 @@ bool mesh_crypto_is_initialized(void)
     return s_initialized;
 }
 
+bool mesh_crypto_keys_match(const uint8_t *network_key, const uint8_t *app_key,
+                            uint32_t iv_index, uint16_t src_address)
+{
+    return s_initialized &&
+           memcmp(s_network_key, network_key, 16) == 0 &&
+           memcmp(s_app_key, app_key, 16) == 0 &&
+           s_iv_index == iv_index &&
+           s_src_address == src_address;
+}
+
+bool mesh_crypto_keys_digest(uint8_t out[8])
+{
+    if (!s_initialized) return false;
+
+    uint8_t m[16 + 16 + 4 + 2];
+    memcpy(m, s_network_key, 16);
+    memcpy(m + 16, s_app_key, 16);
+    m[32] = (uint8_t)((s_iv_index >> 24) & 0xFF);
+    m[33] = (uint8_t)((s_iv_index >> 16) & 0xFF);
+    m[34] = (uint8_t)((s_iv_index >>  8) & 0xFF);
+    m[35] = (uint8_t)( s_iv_index        & 0xFF);
+    m[36] = (uint8_t)((s_src_address >> 8) & 0xFF);
+    m[37] = (uint8_t)( s_src_address       & 0xFF);
+
+    uint8_t full[16];
+    mesh_crypto_s1(m, sizeof(m), full);
+    memcpy(out, full, 8);
+    return true;
+}
+
 uint32_t mesh_crypto_get_seq(void)
 {
-    return s_sequence_number;
+    return atomic_load(&s_sequence_number);
+}
+
+void mesh_crypto_advance_seq(uint32_t seq)
+{
+    uint32_t cur = atomic_load(&s_sequence_number);
+    while (seq > cur && !atomic_compare_exchange_weak(&s_sequence_number, &cur, seq)) {
+    }
+}
+
+// Reserve count consecutive SEQs; returns the first
+static uint32_t take_seq(uint32_t count)
+{
+    return atomic_fetch_add(&s_sequence_number, count) + 1;
+}
+
+uint32_t mesh_crypto_key_generation(void)
+{
+    return s_key_generation;
+}
+
+bool mesh_crypto_get_network(uint8_t network_key[16], uint32_t *iv_index)
+{
+    if (!s_initialized) return false;
+    memcpy(network_key, s_network_key, 16);
+    *iv_index = s_iv_index;
+    return true;
+}
+
+bool mesh_crypto_get_app_key(uint8_t app_key[16])
+{
+    if (!s_initialized) return false;
+    memcpy(app_key, s_app_key, 16);
+    return true;
+}
+
+uint16_t mesh_crypto_get_src(void)
+{
+    return s_src_address;
+}
+
+void mesh_crypto_aes_cmac(const uint8_t key[16], const uint8_t *msg, int msg_len,
+                          uint8_t out[16])
+{
+    aes_cmac(key, msg, msg_len, out);
+}
+
+int mesh_crypto_ccm_encrypt(const uint8_t key[16], const uint8_t nonce[13],
+                            const uint8_t *plaintext, int pt_len,
+                            int mic_size, uint8_t *out)
+{
+    return aes_ccm_encrypt(key, nonce, plaintext, pt_len, mic_size, out);
+}
+
+int mesh_crypto_ccm_decrypt(const uint8_t key[16], const uint8_t nonce[13],
+                            const uint8_t *ciphertext, int ct_len,
+                            int mic_size, uint8_t *out)
+{
+    return aes_ccm_decrypt(key, nonce, ciphertext, ct_len, mic_size, out);
 }
 
 // ---------------------------------------------------------------------------
@@ -208,6 +328,14 @@ static void build_application_nonce(uint32_t seq, uint16_t src, uint16_t dst,
     nonce[12] = (uint8_t)( iv_index        & 0xFF);
 }
 
+// Same layout as the application nonce with type 0x02 (ASZMIC = 0)
+static void build_device_nonce(uint32_t seq, uint16_t src, uint16_t dst,
+                               uint32_t iv_index, uint8_t nonce[13])
+{
+    build_application_nonce(seq, src, dst, iv_index, nonce);
+    nonce[0] = 0x02;                           // Device nonce type
+}
+
 static void build_network_nonce(uint8_t ctl, uint8_t ttl, uint32_t seq,
                                 uint16_t src, uint32_t iv_index,
                                 uint8_t nonce[13])
@@ -426,25 +554,64 @@ static int aes_ccm_encrypt(const uint8_t key[16], const uint8_t nonce[13],
     return pt_len + mic_size;
 }
 
+/**
+ * AES-CCM decrypt and verify.
+ *
+ * CTR mode is its own inverse, so running the encryptor over the ciphertext
+ * recovers the plaintext; re-encrypting that plaintext must then reproduce
+ * the received MIC.
+ *
+ * Returns the plaintext length, or -1 if the MIC doesn't match.
+ */
+static int aes_ccm_decrypt(const uint8_t key[16], const uint8_t nonce[13],
+                           const uint8_t *ciphertext, int ct_len,
+                           int mic_size, uint8_t *out)
+{
+    int pt_len = ct_len - mic_size;
+    if (pt_len < 0 || pt_len > 64) return -1;
+
+    uint8_t plain[64 + 8];
+    uint8_t check[64 + 8];
+    if (aes_ccm_encrypt(key, nonce, ciphertext, pt_len, mic_size, plain) == 0) return -1;
+    if (aes_ccm_encrypt(key, nonce, plain, pt_len, mic_size, check) == 0) return -1;
+
+    uint8_t diff = 0;
+    for (int i = 0; i < mic_size; i++) {
+        diff |= check[pt_len + i] ^ ciphertext[pt_len + i];
+    }
+    if (diff != 0) return -1;
+
+    memcpy(out, plain, pt_len);
+    return pt_len;
+}
+
 // ---------------------------------------------------------------------------
 // Create standard mesh proxy PDU
 // ---------------------------------------------------------------------------
 
 int mesh_crypto_create_standard_pdu(const uint8_t *access_message, int access_len,
                                     uint16_t dst, uint8_t *out_pdu, int out_max)
+{
+    return mesh_crypto_create_standard_pdu_ttl(access_message, access_len, dst, 7,
+                                               out_pdu, out_max, NULL);
+}
+
+int mesh_crypto_create_standard_pdu_ttl(const uint8_t *access_message, int access_len,
+                                        uint16_t dst, uint8_t ttl,
+                                        uint8_t *out_pdu, int out_max, uint32_t *out_seq)
 {
     if (!s_initialized) {
         ESP_LOGE(TAG, "Not initialized");
         return 0;
     }
 
-    s_sequence_number++;
-    uint32_t seq = s_sequence_number;
+    uint32_t seq = take_seq(1);
     uint16_t src = s_src_address;
-    uint8_t ttl = 7;
+    ttl &= 0x7F;
+    if (out_seq) *out_seq = seq;
 
-    ESP_LOGI(TAG, "[Std] dst=0x%04X seq=0x%06lX access_len=%d",
-             dst, (unsigned long)seq, access_len);
+    ESP_LOGI(TAG, "[Std] dst=0x%04X seq=0x%06lX ttl=%d access_len=%d",
+             dst, (unsigned long)seq, ttl, access_len);
 
     // --- Encrypt access layer with app key (AES-CCM, 4-byte MIC) ---
 
@@ -469,67 +636,210 @@ int mesh_crypto_create_standard_pdu(const uint8_t *access_message, int access_le
     memcpy(lower_transport + 1, encrypted_access, enc_access_len);
     int ltp_len = 1 + enc_access_len;
 
-    // --- Build network PDU ---
+    int pos = build_network_pdu(0, ttl, seq, dst, lower_transport, ltp_len,
+                                out_pdu, out_max);
+    if (pos == 0) {
+        ESP_LOGE(TAG, "[Std] Failed to build network PDU");
+        return 0;
+    }
+
+    ESP_LOGI(TAG, "[Std] Proxy PDU (%d bytes)", pos);
+
+    return pos;
+}
+
+// ---------------------------------------------------------------------------
+// Network layer
+// ---------------------------------------------------------------------------
+
+/**
+ * Wrap a lower transport PDU from our SRC in an encrypted, obfuscated
+ * network PDU behind a complete proxy header (SAR=complete, type Network).
+ * CTL messages get the 8-byte NetMIC.
+ *
+ * Returns the proxy PDU length, or 0 on failure.
+ */
+static int build_network_pdu(uint8_t ctl, uint8_t ttl, uint32_t seq, uint16_t dst,
+                             const uint8_t *ltp, int ltp_len,
+                             uint8_t *out_pdu, int out_max)
+{
+    uint16_t src = s_src_address;
+    int mic_size = ctl ? 8 : 4;
+
     uint8_t ivi = (uint8_t)(s_iv_index & 0x01);
     uint8_t nid_byte = (ivi << 7) | (s_nid & 0x7F);
-    uint8_t ctl_ttl = (0 << 7) | (ttl & 0x7F);  // CTL=0 for access message
+    uint8_t ctl_ttl = (ctl << 7) | (ttl & 0x7F);
 
     uint8_t net_nonce[13];
-    build_network_nonce(0, ttl, seq, src, s_iv_index, net_nonce);
+    build_network_nonce(ctl, ttl, seq, src, s_iv_index, net_nonce);
 
     // DST + lower transport PDU
     uint8_t dst_transport[64];
+    if (ltp_len > (int)sizeof(dst_transport) - 2) return 0;
     dst_transport[0] = (uint8_t)((dst >> 8) & 0xFF);
     dst_transport[1] = (uint8_t)( dst       & 0xFF);
-    memcpy(dst_transport + 2, lower_transport, ltp_len);
+    memcpy(dst_transport + 2, ltp, ltp_len);
     int dst_transport_len = 2 + ltp_len;
 
-    // Encrypt with network key (4-byte NetMIC for unsegmented)
-    uint8_t encrypted_net[64];
+    uint8_t encrypted_net[64 + 8];
     int enc_net_len = aes_ccm_encrypt(s_encryption_key, net_nonce,
                                       dst_transport, dst_transport_len,
-                                      4, encrypted_net);
-    if (enc_net_len == 0) {
-        ESP_LOGE(TAG, "[Std] Failed to encrypt network layer");
-        return 0;
-    }
+                                      mic_size, encrypted_net);
+    if (enc_net_len == 0) return 0;
 
-    // --- Obfuscate ---
     uint8_t obfuscated_header[6];
     obfuscate(ctl_ttl, seq, src, encrypted_net, s_privacy_key,
               s_iv_index, obfuscated_header);
 
-    // --- Assemble final proxy PDU ---
     // Proxy header (1) + NID (1) + obfuscated (6) + encrypted net payload
-    int network_pdu_len = 1 + 6 + enc_net_len;
-    int total_len = 1 + network_pdu_len;  // proxy header + network PDU
-
+    int total_len = 1 + 1 + 6 + enc_net_len;
     if (total_len > out_max) {
-        ESP_LOGE(TAG, "[Std] Output buffer too small (%d > %d)", total_len, out_max);
+        ESP_LOGE(TAG, "Output buffer too small (%d > %d)", total_len, out_max);
         return 0;
     }
 
     int pos = 0;
-
-    // Proxy PDU header: SAR=complete (0x00), Type=Network PDU (0x00) => 0x00
-    out_pdu[pos++] = 0x00;
-
-    // IVI/NID byte
+    out_pdu[pos++] = 0x00;      // SAR=complete, Type=Network PDU
     out_pdu[pos++] = nid_byte;
-
-    // Obfuscated header (6 bytes)
     memcpy(out_pdu + pos, obfuscated_header, 6);
     pos += 6;
-
-    // Encrypted network payload
     memcpy(out_pdu + pos, encrypted_net, enc_net_len);
     pos += enc_net_len;
 
-    ESP_LOGI(TAG, "[Std] Proxy PDU (%d bytes)", pos);
-
     return pos;
 }
 
+// ---------------------------------------------------------------------------
+// Device-key (configuration) messages
+// ---------------------------------------------------------------------------
+
+int mesh_crypto_create_devkey_pdus(const uint8_t *access_message, int access_len,
+                                   uint16_t dst, const uint8_t dev_key[16],
+                                   uint8_t pdus[][MESH_PDU_MAX], int *lens, int max_pdus,
+                                   uint16_t *seq_zero)
+{
+    if (!s_initialized) {
+        ESP_LOGE(TAG, "Not initialized");
+        return 0;
+    }
+
+    // Upper transport PDU = access message + 32-bit TransMIC (SZMIC=0)
+    int upper_len = access_len + 4;
+    int seg_count = upper_len <= 15 ? 1 : (upper_len + 11) / 12;
+    if (access_len <= 0 || upper_len > 64 || seg_count > max_pdus || seg_count > 32) {
+        ESP_LOGE(TAG, "[Dev] Access message too long (%d bytes)", access_len);
+        return 0;
+    }
+
+    // SeqAuth is the SEQ of the first segment; each segment takes its own SEQ
+    uint32_t seq_auth = take_seq(seg_count);
+    *seq_zero = (uint16_t)(seq_auth & 0x1FFF);
+
+    uint8_t dev_nonce[13];
+    build_device_nonce(seq_auth, s_src_address, dst, s_iv_index, dev_nonce);
+
+    uint8_t upper[64 + 4];
+    if (aes_ccm_encrypt(dev_key, dev_nonce, access_message, access_len, 4, upper) == 0) {
+        ESP_LOGE(TAG, "[Dev] Failed to encrypt access layer");
+        return 0;
+    }
+
+    uint8_t ltp[16];
+    if (seg_count == 1) {
+        // SEG=0, AKF=0, AID=0
+        ltp[0] = 0x00;
+        memcpy(ltp + 1, upper, upper_len);
+        lens[0] = build_network_pdu(0, 7, seq_auth, dst, ltp, 1 + upper_len,
+                                    pdus[0], MESH_PDU_MAX);
+        return lens[0] > 0 ? 1 : 0;
+    }
+
+    uint8_t seg_n = (uint8_t)(seg_count - 1);
+    for (int seg_o = 0; seg_o < seg_count; seg_o++) {
+        int off = seg_o * 12;
+        int chunk = upper_len - off < 12 ? upper_len - off : 12;
+
+        // SEG=1 AKF=0 AID=0 | SZMIC SeqZero[12:6] | SeqZero[5:0] SegO[4:3] | SegO[2:0] SegN
+        ltp[0] = 0x80;
+        ltp[1] = (uint8_t)((*seq_zero >> 6) & 0x7F);
+        ltp[2] = (uint8_t)(((*seq_zero & 0x3F) << 2) | ((seg_o >> 3) & 0x03));
+        ltp[3] = (uint8_t)(((seg_o & 0x07) << 5) | (seg_n & 0x1F));
+        memcpy(ltp + 4, upper + off, chunk);
+
+        lens[seg_o] = build_network_pdu(0, 7, seq_auth + seg_o, dst, ltp, 4 + chunk,
+                                        pdus[seg_o], MESH_PDU_MAX);
+        if (lens[seg_o] == 0) return 0;
+    }
+
+    ESP_LOGI(TAG, "[Dev] dst=0x%04X access_len=%d -> %d segment(s)", dst, access_len, seg_count);
+    return seg_count;
+}
+
+bool mesh_crypto_decode_network(const uint8_t *net_pdu, int len, mesh_rx_pdu_t *out)
+{
+    // NID + header + DST + at least one transport byte + NetMIC
+    if (!s_initialized || len < 1 + 6 + 2 + 1 + 4 || len > 29) return false;
+    if ((net_pdu[0] & 0x7F) != s_nid) return false;
+
+    // IVI tells us whether the sender is still on the previous IV index
+    uint32_t iv_index = s_iv_index;
+    if ((net_pdu[0] >> 7) != (iv_index & 0x01)) {
+        if (iv_index == 0) return false;
+        iv_index--;
+    }
+
+    // With an all-zero header obfuscate() returns the PECB itself
+    uint8_t pecb[6];
+    obfuscate(0, 0, 0, net_pdu + 7, s_privacy_key, iv_index, pecb);
+    uint8_t hdr[6];
+    for (int i = 0; i < 6; i++) hdr[i] = net_pdu[1 + i] ^ pecb[i];
+
+    out->ctl = (hdr[0] & 0x80) != 0;
+    out->ttl = hdr[0] & 0x7F;
+    out->seq = ((uint32_t)hdr[1] << 16) | ((uint32_t)hdr[2] << 8) | hdr[3];
+    out->src = (uint16_t)((hdr[4] << 8) | hdr[5]);
+    out->iv_index = iv_index;
+
+    uint8_t net_nonce[13];
+    build_network_nonce(out->ctl, out->ttl, out->seq, out->src, iv_index, net_nonce);
+
+    uint8_t plain[32];
+    int pt_len = aes_ccm_decrypt(s_encryption_key, net_nonce, net_pdu + 7, len - 7,
+                                 out->ctl ? 8 : 4, plain);
+    if (pt_len < 3 || pt_len - 2 > (int)sizeof(out->transport)) return false;
+
+    out->dst = (uint16_t)((plain[0] << 8) | plain[1]);
+    out->transport_len = pt_len - 2;
+    memcpy(out->transport, plain + 2, out->transport_len);
+    return true;
+}
+
+int mesh_crypto_decrypt_devkey_access(const mesh_rx_pdu_t *rx, const uint8_t dev_key[16],
+                                      uint8_t *out, int out_max)
+{
+    // Unsegmented access message with AKF=0
+    if (rx->ctl || rx->transport_len < 1 + 1 + 4 || (rx->transport[0] & 0xC0) != 0) return -1;
+    if (rx->transport_len - 1 - 4 > out_max) return -1;
+
+    uint8_t dev_nonce[13];
+    build_device_nonce(rx->seq, rx->src, rx->dst, rx->iv_index, dev_nonce);
+    return aes_ccm_decrypt(dev_key, dev_nonce, rx->transport + 1, rx->transport_len - 1,
+                           4, out);
+}
+
+int mesh_crypto_decrypt_app_access(const mesh_rx_pdu_t *rx, uint8_t *out, int out_max)
+{
+    // Unsegmented access message with AKF=1
+    if (!s_initialized || rx->ctl || rx->transport_len < 1 + 1 + 4 ||
+        (rx->transport[0] & 0xC0) != 0x40) return -1;
+    if (rx->transport_len - 1 - 4 > out_max) return -1;
+
+    uint8_t app_nonce[13];
+    build_application_nonce(rx->seq, rx->src, rx->dst, rx->iv_index, app_nonce);
+    return aes_ccm_decrypt(s_app_key, app_nonce, rx->transport + 1, rx->transport_len - 1,
+                           4, out);
+}
+
 // ---------------------------------------------------------------------------
 // Create proxy filter setup PDU
 // ---------------------------------------------------------------------------
@@ -541,8 +851,7 @@ int mesh_crypto_create_proxy_filter_setup(uint8_t *out_pdu, int out_max)
         return 0;
     }
 
-    s_sequence_number++;
-    uint32_t seq = s_sequence_number;
+    uint32_t seq = take_seq(1);
     uint16_t src = s_src_address;
     uint16_t dst = 0x0000;  // Proxy config messages use DST=0x0000
 
@@ -611,3 +920,47 @@ int mesh_crypto_create_proxy_filter_setup(uint8_t *out_pdu, int out_max)
 
     return pos;
 }
+
+// ---------------------------------------------------------------------------
+// Node Identity
+// ---------------------------------------------------------------------------
+
+uint16_t mesh_crypto_match_node_identity(const uint8_t hash[8], const uint8_t random[8],
+                                         const uint16_t *candidates, int count)
+{
+    if (!s_initialized) return 0;
+
+    // Hash = e(IdentityKey, Padding(6 x 0x00) || Random || Address)[8..15]
+    uint8_t in[16];
+    uint8_t out[16];
+    memset(in, 0, 6);
+    memcpy(in + 6, random, 8);
+
+    for (int i = 0; i < count; i++) {
+        in[14] = (uint8_t)(candidates[i] >> 8);
+        in[15] = (uint8_t)(candidates[i] & 0xFF);
+        aes_ecb_block(s_identity_key, in, out);
+        if (memcmp(out + 8, hash, 8) == 0) return candidates[i];
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// ADV bearer encoding
+// ---------------------------------------------------------------------------
+
+int mesh_crypto_proxy_to_adv(const uint8_t *proxy_pdu, int proxy_len,
+                             uint8_t *out_ad, int out_max)
+{
+    // Proxy header must be SAR=complete, Type=Network PDU
+    if (proxy_len < 2 || proxy_pdu[0] != 0x00) return 0;
+
+    int net_len = proxy_len - 1;
+    int ad_len = 2 + net_len;  // length byte + AD type + network PDU
+    if (ad_len > 31 || ad_len > out_max) return 0;
+
+    out_ad[0] = (uint8_t)(1 + net_len);  // AD length covers type + data
+    out_ad[1] = MESH_AD_TYPE_MESSAGE;
+    memcpy(out_ad + 2, proxy_pdu + 1, net_len);
+    return ad_len;
+}
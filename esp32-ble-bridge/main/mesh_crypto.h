@@ -11,20 +11,120 @@ void mesh_crypto_init(const uint8_t *network_key, const uint8_t *app_key,
 // Check if crypto is initialized
 bool mesh_crypto_is_initialized(void);
 
+// True if these keys are exactly the ones already loaded.
+bool mesh_crypto_keys_match(const uint8_t *network_key, const uint8_t *app_key,
+                            uint32_t iv_index, uint16_t src_address);
+
+// 8-byte digest of the loaded keys: s1(NetKey || AppKey || IV || SRC)[0..7].
+// Lets the phone skip set_keys without the bridge echoing key material.
+// Returns false if no keys are loaded.
+bool mesh_crypto_keys_digest(uint8_t out[8]);
+
 // Create a standard mesh proxy PDU from an access message.
 // Returns PDU length, or 0 on failure. Output buffer must be >= 64 bytes.
 int mesh_crypto_create_standard_pdu(const uint8_t *access_message, int access_len,
                                      uint16_t dst, uint8_t *out_pdu, int out_max);
 
+// Same as mesh_crypto_create_standard_pdu with an explicit TTL. TTL 0 is
+// never relayed, so it only reaches the node behind a direct proxy link.
+// *out_seq (if not NULL) gets the SEQ the PDU was sent with; with other
+// tasks encrypting at the same time mesh_crypto_get_seq may be past it.
+int mesh_crypto_create_standard_pdu_ttl(const uint8_t *access_message, int access_len,
+                                        uint16_t dst, uint8_t ttl,
+                                        uint8_t *out_pdu, int out_max, uint32_t *out_seq);
+
+// Largest proxy PDU produced for one network PDU (one GATT write)
+#define MESH_PDU_MAX 32
+
+// Encrypt an access message with a node's device key (configuration
+// messages). Upper transport PDUs over 15 bytes are split into 12-byte
+// segments, one proxy PDU each. Writes up to max_pdus PDUs into pdus and
+// their lengths into lens; *seq_zero gets the SeqZero the node will
+// acknowledge. Returns the PDU count, or 0 on failure.
+int mesh_crypto_create_devkey_pdus(const uint8_t *access_message, int access_len,
+                                   uint16_t dst, const uint8_t dev_key[16],
+                                   uint8_t pdus[][MESH_PDU_MAX], int *lens, int max_pdus,
+                                   uint16_t *seq_zero);
+
+// A network PDU received from a proxy, decrypted and deobfuscated
+typedef struct {
+    bool ctl;                   // Control message (8-byte NetMIC)
+    uint8_t ttl;
+    uint32_t seq;
+    uint32_t iv_index;
+    uint16_t src;
+    uint16_t dst;
+    uint8_t transport[16];      // Lower transport PDU
+    int transport_len;
+} mesh_rx_pdu_t;
+
+// Decode a network PDU (proxy header stripped). Returns false if it isn't
+// for our NetKey or fails authentication.
+bool mesh_crypto_decode_network(const uint8_t *net_pdu, int len, mesh_rx_pdu_t *out);
+
+// Decrypt an unsegmented device-key access message (AKF=0) from rx.
+// Returns the access message length, or -1 if it doesn't authenticate.
+int mesh_crypto_decrypt_devkey_access(const mesh_rx_pdu_t *rx, const uint8_t dev_key[16],
+                                      uint8_t *out, int out_max);
+
+// Decrypt an unsegmented AppKey access message (AKF=1) from rx with the
+// loaded AppKey. Returns the access message length, or -1.
+int mesh_crypto_decrypt_app_access(const mesh_rx_pdu_t *rx, uint8_t *out, int out_max);
+
+// Match a proxy Node Identity advertisement (hash || random, 8 bytes each)
+// against candidate unicast addresses. Returns the matching address or 0.
+uint16_t mesh_crypto_match_node_identity(const uint8_t hash[8], const uint8_t random[8],
+                                         const uint16_t *candidates, int count);
+
 // Create proxy filter setup PDU (blacklist mode).
 // Returns PDU length, or 0 on failure. Output buffer must be >= 64 bytes.
 int mesh_crypto_create_proxy_filter_setup(uint8_t *out_pdu, int out_max);
 
+// Mesh ADV bearer AD type (Mesh Message)
+#define MESH_AD_TYPE_MESSAGE 0x2A
+
+// Re-wrap a proxy PDU from mesh_crypto_create_standard_pdu as a mesh ADV
+// bearer advertisement: [len][0x2A][network PDU]. Only complete Network PDUs
+// (proxy header 0x00) fit. Returns AD length, or 0 if the PDU is not
+// eligible or exceeds the 31-byte advertising payload. Pure; no radio access.
+int mesh_crypto_proxy_to_adv(const uint8_t *proxy_pdu, int proxy_len,
+                             uint8_t *out_ad, int out_max);
+
 // Get current sequence number
 uint32_t mesh_crypto_get_seq(void);
 
+// Move the sequence number forward to at least seq (never back). Used at
+// boot so a restored bridge doesn't reuse numbers the fixtures already saw.
+void mesh_crypto_advance_seq(uint32_t seq);
+
+// Changes whenever keys are (re)loaded; PDUs encrypted earlier are void.
+uint32_t mesh_crypto_key_generation(void);
+
+// Copy out the loaded NetKey and IV index (for provisioning new devices).
+// Returns false if no keys are loaded.
+bool mesh_crypto_get_network(uint8_t network_key[16], uint32_t *iv_index);
+
+// Copy out the loaded AppKey (for AppKey Add). Returns false if none.
+bool mesh_crypto_get_app_key(uint8_t app_key[16]);
+
+// Our own unicast address (SRC of everything the bridge sends)
+uint16_t mesh_crypto_get_src(void);
+
+// AES primitives shared with the provisioning layer
+void mesh_crypto_aes_cmac(const uint8_t key[16], const uint8_t *msg, int msg_len,
+                          uint8_t out[16]);
+int mesh_crypto_ccm_encrypt(const uint8_t key[16], const uint8_t nonce[13],
+                            const uint8_t *plaintext, int pt_len,
+                            int mic_size, uint8_t *out);
+// Returns the plaintext length, or -1 if the MIC doesn't match.
+int mesh_crypto_ccm_decrypt(const uint8_t key[16], const uint8_t nonce[13],
+                            const uint8_t *ciphertext, int ct_len,
+                            int mic_size, uint8_t *out);
+
 // Key derivation functions (exposed for testing)
 void mesh_crypto_s1(const uint8_t *m, int m_len, uint8_t out[16]);
 void mesh_crypto_k2(const uint8_t n[16], const uint8_t *p, int p_len,
                      uint8_t *out_nid, uint8_t out_enc[16], uint8_t out_priv[16]);
 uint8_t mesh_crypto_k4(const uint8_t n[16]);
+void mesh_crypto_k1(const uint8_t *n, int n_len, const uint8_t salt[16],
+                    const uint8_t *p, int p_len, uint8_t out[16]);
@@ -0,0 +1,239 @@
+/*
+ * monitor.c
+ *
+ * Delta-encoded, decimated stream of rendered light output.
+ */
+
+#include "monitor.h"
+#include <string.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "light_registry.h"
+#include "ws_server.h"
+#include "ble_mesh.h"
+
+static const char *TAG = "monitor";
+
+#define KEYFRAME_US     5000000
+#define RECORD_MAX      12          // unicast + mask + every field
+#define TX_GAP_US       3000        // BLE quiet time before a frame goes out
+
+enum {
+    F_INTENSITY = 0x01,
+    F_CCT       = 0x02,
+    F_HUE       = 0x04,
+    F_SAT       = 0x08,
+    F_SLEEP     = 0x10,
+    F_EFFECT    = 0x20,
+    F_MODE      = 0x40,
+    F_ALL       = 0x7F,
+};
+
+typedef struct {
+    uint16_t unicast;           // 0 = free
+    uint16_t intensity;         // 0-1000, as the Sidus payload carries it
+    uint16_t cct;
+    uint16_t hue;
+    uint8_t sat;
+    uint8_t sleep;
+    uint8_t effect;
+    uint8_t mode;
+} mon_state_t;
+
+static mon_state_t s_now[MAX_LIGHTS];       // Latest output, written on send
+static mon_state_t s_reported[MAX_LIGHTS];  // As of the last frame sent
+static uint8_t s_hw_effect[MAX_LIGHTS];
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_timer_handle_t s_timer = NULL;
+static esp_timer_handle_t s_retry = NULL;   // Deferred tick, arg non-NULL
+static uint32_t s_deferred = 0;            // Under s_lock; read from httpd
+static int64_t s_last_keyframe = 0;
+static bool s_need_keyframe = true;
+static uint8_t s_seq = 0;
+static uint8_t s_frame[4 + MAX_LIGHTS * RECORD_MAX];
+
+// MARK: - Recording
+
+void monitor_record(uint16_t unicast, monitor_mode_t mode, double intensity, int cct_kelvin,
+                    int hue, int saturation, int sleep_mode, int hw_effect)
+{
+    portENTER_CRITICAL(&s_lock);
+    int slot = -1;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (s_now[i].unicast == unicast) { slot = i; break; }
+        if (slot < 0 && s_now[i].unicast == 0) slot = i;
+    }
+    if (slot >= 0) {
+        mon_state_t *m = &s_now[slot];
+        m->unicast = unicast;
+        m->mode = (uint8_t)mode;
+        m->intensity = (uint16_t)fmax(0, fmin(1000, round(intensity * 10.0)));
+        m->sleep = (uint8_t)sleep_mode;
+        if (mode == MONITOR_MODE_CCT || mode == MONITOR_MODE_HSI || mode == MONITOR_MODE_HW_EFFECT) {
+            m->cct = (uint16_t)cct_kelvin;
+        }
+        if (mode == MONITOR_MODE_HSI || mode == MONITOR_MODE_HW_EFFECT) {
+            m->hue = (uint16_t)hue;
+            m->sat = (uint8_t)saturation;
+        }
+        s_hw_effect[slot] = (uint8_t)hw_effect;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+// MARK: - Frames
+
+static uint8_t diff_mask(const mon_state_t *a, const mon_state_t *b)
+{
+    uint8_t mask = 0;
+    if (a->intensity != b->intensity) mask |= F_INTENSITY;
+    if (a->cct != b->cct) mask |= F_CCT;
+    if (a->hue != b->hue) mask |= F_HUE;
+    if (a->sat != b->sat) mask |= F_SAT;
+    if (a->sleep != b->sleep) mask |= F_SLEEP;
+    if (a->effect != b->effect) mask |= F_EFFECT;
+    if (a->mode != b->mode) mask |= F_MODE;
+    return mask;
+}
+
+static int put_record(uint8_t *p, const mon_state_t *m, uint8_t mask)
+{
+    int n = 0;
+    p[n++] = m->unicast & 0xFF;
+    p[n++] = m->unicast >> 8;
+    p[n++] = mask;
+    if (mask & F_INTENSITY) { p[n++] = m->intensity & 0xFF; p[n++] = m->intensity >> 8; }
+    if (mask & F_CCT)       { p[n++] = m->cct & 0xFF;       p[n++] = m->cct >> 8; }
+    if (mask & F_HUE)       { p[n++] = m->hue & 0xFF;       p[n++] = m->hue >> 8; }
+    if (mask & F_SAT)       p[n++] = m->sat;
+    if (mask & F_SLEEP)     p[n++] = m->sleep;
+    if (mask & F_EFFECT)    p[n++] = m->effect;
+    if (mask & F_MODE)      p[n++] = m->mode;
+    return n;
+}
+
+static void monitor_tick(void *arg)
+{
+    if (!ws_server_has_client()) return;
+
+    // Frames aren't urgent: right after a BLE burst, wait for the gap
+    // behind it (once per tick) instead of contending for the radio
+    int64_t idle = ble_mesh_tx_idle_us();
+    if (!arg && idle < TX_GAP_US) {
+        portENTER_CRITICAL(&s_lock);
+        s_deferred++;
+        portEXIT_CRITICAL(&s_lock);
+        esp_timer_start_once(s_retry, TX_GAP_US - idle);
+        return;
+    }
+
+    mon_state_t now[MAX_LIGHTS];
+    uint8_t hw_effect[MAX_LIGHTS];
+    portENTER_CRITICAL(&s_lock);
+    memcpy(now, s_now, sizeof(now));
+    memcpy(hw_effect, s_hw_effect, sizeof(hw_effect));
+    portEXIT_CRITICAL(&s_lock);
+
+    // Effect state comes from the registry; it also tells us which lights
+    // were removed since they were last sent to
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (!now[i].unicast) continue;
+        light_entry_t light;
+        if (!light_registry_lookup(now[i].unicast, &light)) {
+            portENTER_CRITICAL(&s_lock);
+            if (s_now[i].unicast == now[i].unicast) memset(&s_now[i], 0, sizeof(s_now[i]));
+            portEXIT_CRITICAL(&s_lock);
+            now[i].unicast = 0;
+            continue;
+        }
+        now[i].effect = light.active_effect ? (uint8_t)light.active_effect
+                      : now[i].mode == MONITOR_MODE_HW_EFFECT ? hw_effect[i] : 0;
+    }
+
+    int64_t t = esp_timer_get_time();
+    bool key = s_need_keyframe || t - s_last_keyframe >= KEYFRAME_US;
+
+    int len = 4;
+    int count = 0;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (!now[i].unicast) continue;
+        uint8_t mask = key ? F_ALL
+                     : s_reported[i].unicast != now[i].unicast ? F_ALL
+                     : diff_mask(&now[i], &s_reported[i]);
+        if (!mask) continue;
+        len += put_record(s_frame + len, &now[i], mask);
+        count++;
+    }
+    if (!count && !key) return;
+
+    s_frame[0] = 'M';
+    s_frame[1] = key ? 0x01 : 0x00;
+    s_frame[2] = s_seq;
+    s_frame[3] = (uint8_t)count;
+    if (ws_server_send_binary(s_frame, len) != ESP_OK) return;
+
+    s_seq++;
+    memcpy(s_reported, now, sizeof(s_reported));
+    if (key) {
+        s_need_keyframe = false;
+        s_last_keyframe = t;
+    }
+}
+
+// MARK: - Subscription
+
+esp_err_t monitor_start(int rate_hz)
+{
+    if (rate_hz < 1 || rate_hz > 20) return ESP_ERR_INVALID_ARG;
+
+    monitor_stop();
+    if (!s_retry) {
+        esp_timer_create_args_t retry_args = {
+            .callback = monitor_tick,
+            .arg = &s_retry,
+            .name = "monitor_gap",
+        };
+        esp_err_t err = esp_timer_create(&retry_args, &s_retry);
+        if (err != ESP_OK) return err;
+    }
+
+    esp_timer_create_args_t args = {
+        .callback = monitor_tick,
+        .name = "monitor",
+    };
+    esp_err_t err = esp_timer_create(&args, &s_timer);
+    if (err != ESP_OK) return err;
+
+    s_need_keyframe = true;
+    err = esp_timer_start_periodic(s_timer, 1000000 / rate_hz);
+    if (err != ESP_OK) {
+        esp_timer_delete(s_timer);
+        s_timer = NULL;
+        return err;
+    }
+    ESP_LOGI(TAG, "Streaming output at %d Hz", rate_hz);
+    return ESP_OK;
+}
+
+void monitor_stop(void)
+{
+    if (!s_timer) return;
+    esp_timer_stop(s_retry);
+    esp_timer_stop(s_timer);
+    esp_timer_delete(s_timer);
+    s_timer = NULL;
+    memset(s_reported, 0, sizeof(s_reported));
+    ESP_LOGI(TAG, "Stopped");
+}
+
+uint32_t monitor_deferred(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    uint32_t n = s_deferred;
+    portEXIT_CRITICAL(&s_lock);
+    return n;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Live output monitor: what the bridge actually rendered for each light
+// (not what the phone asked for), streamed to the phone as binary
+// WebSocket frames at a rate the phone picks.
+//
+// Frame: 'M', flags (bit 0 = keyframe), seq u8, count u8, then count
+// records of: unicast u16 LE, field mask u8, then the fields in the mask,
+// in bit order:
+//   0x01 intensity u16 LE (0-1000)    0x02 CCT u16 LE (Kelvin)
+//   0x04 hue u16 LE                   0x08 saturation u8
+//   0x10 sleep mode u8                0x20 effect u8 (see below)
+//   0x40 mode u8 (monitor_mode_t)
+// Records only carry fields that changed since the previous frame, and a
+// light with no changes is left out. A keyframe carries every field of
+// every light; one is sent on subscribe and then every few seconds.
+// Effect is the running software effect (effect_type_t), else the Sidus
+// effect type in MONITOR_MODE_HW_EFFECT, else 0.
+
+typedef enum {
+    MONITOR_MODE_NONE = 0,
+    MONITOR_MODE_CCT,
+    MONITOR_MODE_HSI,
+    MONITOR_MODE_SLEEP,
+    MONITOR_MODE_HW_EFFECT,
+} monitor_mode_t;
+
+// Note a message sent to a light. Cheap; called on every send, streaming
+// or not, so a new subscriber's first keyframe is complete.
+void monitor_record(uint16_t unicast, monitor_mode_t mode, double intensity, int cct_kelvin,
+                    int hue, int saturation, int sleep_mode, int hw_effect);
+
+// Stream at rate_hz (1-20) to the connected client, replacing any
+// previous subscription.
+esp_err_t monitor_start(int rate_hz);
+
+void monitor_stop(void);
+
+// Frames held back to let a BLE burst finish first
+uint32_t monitor_deferred(void);
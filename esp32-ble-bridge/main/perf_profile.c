@@ -0,0 +1,132 @@
+/*
+ * perf_profile.c
+ *
+ * Coordinated WiFi, BLE link and effect timing presets, persisted in NVS.
+ */
+
+#include "perf_profile.h"
+#include <string.h>
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "nvs.h"
+
+#include "wifi.h"
+#include "ble_mesh.h"
+#include "effect_engine.h"
+#include "ws_server.h"
+
+static const char *TAG = "perf_profile";
+
+#define NVS_NAMESPACE   "perf"
+#define NVS_KEY         "profile"
+
+typedef struct {
+    const char *name;
+    wifi_ps_type_t wifi_ps;
+    ble_link_params_t link;
+    int frame_pct;              // Smooth effect frame period, percent
+} perf_profile_t;
+
+// Supervision timeouts stay well above (1 + latency) * max interval * 2
+static const perf_profile_t s_profiles[] = {
+    {
+        .name = "live",
+        .wifi_ps = WIFI_PS_MIN_MODEM,
+        .link = {
+            .scan_interval = 0x50, .scan_window = 0x30,     // 50 / 30 ms
+            .conn_min_int = 6, .conn_max_int = 12,          // 7.5-15 ms
+            .conn_latency = 0, .conn_timeout = 400,         // 4 s
+        },
+        .frame_pct = 100,
+    },
+    {
+        .name = "coex",
+        .wifi_ps = WIFI_PS_MIN_MODEM,
+        .link = {
+            .scan_interval = 0xA0, .scan_window = 0x20,     // 100 / 20 ms
+            .conn_min_int = 24, .conn_max_int = 40,         // 30-50 ms
+            .conn_latency = 0, .conn_timeout = 500,
+        },
+        .frame_pct = 150,
+    },
+    {
+        .name = "idle",
+        .wifi_ps = WIFI_PS_MAX_MODEM,
+        .link = {
+            .scan_interval = 0x320, .scan_window = 0x30,    // 500 / 30 ms
+            .conn_min_int = 80, .conn_max_int = 160,        // 100-200 ms
+            .conn_latency = 4, .conn_timeout = 600,
+        },
+        .frame_pct = 200,
+    },
+};
+#define PROFILE_COUNT (int)(sizeof(s_profiles) / sizeof(s_profiles[0]))
+
+static const perf_profile_t *s_current = &s_profiles[0];
+
+static const perf_profile_t *find_profile(const char *name)
+{
+    for (int i = 0; i < PROFILE_COUNT; i++) {
+        if (strcmp(s_profiles[i].name, name) == 0) return &s_profiles[i];
+    }
+    return NULL;
+}
+
+static void apply(const perf_profile_t *p)
+{
+    wifi_set_power_save(p->wifi_ps);
+    ble_mesh_set_link_params(&p->link);
+    effect_engine_set_frame_scale(p->frame_pct);
+    s_current = p;
+    ESP_LOGI(TAG, "Profile \"%s\": ps %d, conn %d-%d, scan %d/%d, frames %d%%",
+             p->name, p->wifi_ps, p->link.conn_min_int, p->link.conn_max_int,
+             p->link.scan_window, p->link.scan_interval, p->frame_pct);
+}
+
+esp_err_t perf_profile_init(void)
+{
+    char name[16] = "";
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        size_t len = sizeof(name);
+        if (nvs_get_str(nvs, NVS_KEY, name, &len) != ESP_OK) name[0] = '\0';
+        nvs_close(nvs);
+    }
+
+    const perf_profile_t *p = find_profile(name);
+    apply(p ? p : &s_profiles[0]);
+    return ESP_OK;
+}
+
+esp_err_t perf_profile_select(const char *name)
+{
+    const perf_profile_t *p = name ? find_profile(name) : NULL;
+    if (!p) return ESP_ERR_NOT_FOUND;
+
+    apply(p);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) return err;
+    err = nvs_set_str(nvs, NVS_KEY, p->name);
+    if (err == ESP_OK) err = nvs_commit(nvs);
+    nvs_close(nvs);
+    return err;
+}
+
+const char *perf_profile_name(void)
+{
+    return s_current->name;
+}
+
+void perf_profile_report(void)
+{
+    char body[128];
+    int pos = snprintf(body, sizeof(body), "\"name\":\"%s\",\"profiles\":[", s_current->name);
+    for (int i = 0; i < PROFILE_COUNT; i++) {
+        pos += snprintf(body + pos, sizeof(body) - pos, "%s\"%s\"", i ? "," : "", s_profiles[i].name);
+    }
+    snprintf(body + pos, sizeof(body) - pos, "]");
+    ws_server_send_event("profile", body);
+}
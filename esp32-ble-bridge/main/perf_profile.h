@@ -0,0 +1,26 @@
+#pragma once
+
+#include "esp_err.h"
+
+// Named performance profiles. Each one sets WiFi power save, BLE scan duty
+// and proxy connection parameters, and the frame rate of smooth effects
+// together, so a stage's RF environment is tuned with one command:
+//   live  - lowest latency: short connection intervals, full frame rate
+//   coex  - busy RF: longer intervals and lighter scanning leave airtime
+//           for WiFi; smooth effects at 2/3 of the frame rate
+//   idle  - low power: max modem sleep, slow links, half the frame rate
+// The choice is kept in NVS and applied at boot.
+//
+// {"cmd":"profile","name":"coex"} switches; without a name it only
+// reports. Both reply with {"event":"profile","name":...,"profiles":[...]}.
+
+// Load the saved profile and apply it. Call once WiFi and BLE are up.
+esp_err_t perf_profile_init(void);
+
+// Apply and persist a profile by name.
+esp_err_t perf_profile_select(const char *name);
+
+const char *perf_profile_name(void);
+
+// Send the "profile" event
+void perf_profile_report(void);
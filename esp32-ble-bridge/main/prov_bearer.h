@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Between the provisioning state machine (provisioner.c) and the bearer
+// that carries its PDUs: PB-GATT on the ESP32 (provisioner_gatt.c), a
+// simulated device in the host tests.
+//
+// Links are numbered 0 to PROVISIONER_MAX_LINKS - 1. The provisioner hands
+// out the number in provisioner_link_found and the bearer keeps its own
+// per-link state (address, connection, SAR buffer) under the same number.
+//
+// The provisioner calls the bearer with its lock held, so the bearer must
+// answer later, from its own task, never from inside these calls.
+
+// MARK: - Bearer, called by the provisioner
+
+// Set up the bearer. Called once from provisioner_init.
+esp_err_t prov_bearer_init(void);
+
+// Start or stop looking for unprovisioned devices. ESP_ERR_INVALID_STATE
+// if the bearer isn't up yet.
+esp_err_t prov_bearer_scan(bool on);
+
+// Send one provisioning PDU (type byte first), segmented as the bearer needs.
+void prov_bearer_send(int link, const uint8_t *pdu, int len);
+
+// Close the link. A connected link answers with provisioner_link_closed;
+// one still connecting is forgotten at once, with no answer.
+void prov_bearer_close(int link);
+
+// MARK: - Provisioner, called by the bearer
+
+// An unprovisioned device was found. Returns the link to connect it on, or
+// -1 to ignore it (already on a link, failed too often, enough started).
+int provisioner_link_found(const uint8_t uuid[16], const char *name);
+
+// The connection is up; the bearer is discovering the service.
+void provisioner_link_connected(int link);
+
+// The bearer is ready to carry PDUs; the invite goes out.
+void provisioner_link_ready(int link);
+
+// A complete provisioning PDU from the device.
+void provisioner_link_pdu(int link, const uint8_t *pdu, int len);
+
+// The bearer gave up on the link (connect, discovery or SAR failure).
+void provisioner_link_failed(int link, const char *reason);
+
+// The connection is down. The link number is free again afterwards.
+void provisioner_link_closed(int link);
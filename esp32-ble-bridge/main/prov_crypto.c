@@ -0,0 +1,204 @@
+/*
+ * prov_crypto.c
+ *
+ * Provisioner side of the mesh provisioning protocol crypto, ported from
+ * ProvisioningCrypto.swift. ECDH runs on mbedtls; s1/k1/CMAC/CCM come from
+ * mesh_crypto.
+ */
+
+#include "prov_crypto.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "mbedtls/ecp.h"
+#include "mbedtls/ecdh.h"
+
+#include "mesh_crypto.h"
+
+static const char *TAG = "prov_crypto";
+
+void prov_crypto_init(prov_session_t *s, prov_rng_t rng, void *rng_ctx)
+{
+    memset(s, 0, sizeof(*s));
+    s->rng = rng;
+    s->rng_ctx = rng_ctx;
+}
+
+// MARK: - ECDH
+
+// Uncompressed SEC1 point (0x04 || X || Y) <-> raw X || Y
+static int write_point(const mbedtls_ecp_group *grp, const mbedtls_ecp_point *pt, uint8_t out[64])
+{
+    uint8_t sec1[65];
+    size_t olen = 0;
+    int ret = mbedtls_ecp_point_write_binary(grp, pt, MBEDTLS_ECP_PF_UNCOMPRESSED,
+                                             &olen, sec1, sizeof(sec1));
+    if (ret == 0 && olen == 65) memcpy(out, sec1 + 1, 64);
+    return ret;
+}
+
+static int read_point(const mbedtls_ecp_group *grp, mbedtls_ecp_point *pt, const uint8_t in[64])
+{
+    uint8_t sec1[65];
+    sec1[0] = 0x04;
+    memcpy(sec1 + 1, in, 64);
+    return mbedtls_ecp_point_read_binary(grp, pt, sec1, sizeof(sec1));
+}
+
+esp_err_t prov_crypto_keygen(prov_session_t *s)
+{
+    mbedtls_ecp_group grp;
+    mbedtls_mpi d;
+    mbedtls_ecp_point q;
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_mpi_init(&d);
+    mbedtls_ecp_point_init(&q);
+
+    int ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+    if (ret == 0) ret = mbedtls_ecp_gen_keypair(&grp, &d, &q, s->rng, s->rng_ctx);
+    if (ret == 0) ret = mbedtls_mpi_write_binary(&d, s->priv, 32);
+    if (ret == 0) ret = write_point(&grp, &q, s->pub);
+
+    mbedtls_ecp_point_free(&q);
+    mbedtls_mpi_free(&d);
+    mbedtls_ecp_group_free(&grp);
+
+    if (ret != 0) {
+        ESP_LOGE(TAG, "P-256 keygen failed: -0x%04X", (unsigned)-ret);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t prov_crypto_set_private_key(prov_session_t *s, const uint8_t priv[32])
+{
+    mbedtls_ecp_group grp;
+    mbedtls_mpi d;
+    mbedtls_ecp_point q;
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_mpi_init(&d);
+    mbedtls_ecp_point_init(&q);
+
+    int ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+    if (ret == 0) ret = mbedtls_mpi_read_binary(&d, priv, 32);
+    if (ret == 0) ret = mbedtls_ecp_check_privkey(&grp, &d);
+    if (ret == 0) ret = mbedtls_ecp_mul(&grp, &q, &d, &grp.G, s->rng, s->rng_ctx);
+    if (ret == 0) ret = write_point(&grp, &q, s->pub);
+    if (ret == 0) memcpy(s->priv, priv, 32);
+
+    mbedtls_ecp_point_free(&q);
+    mbedtls_mpi_free(&d);
+    mbedtls_ecp_group_free(&grp);
+
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Invalid private key: -0x%04X", (unsigned)-ret);
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t prov_crypto_ecdh(prov_session_t *s, const uint8_t dev_pub[64])
+{
+    mbedtls_ecp_group grp;
+    mbedtls_mpi d, z;
+    mbedtls_ecp_point peer;
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_mpi_init(&d);
+    mbedtls_mpi_init(&z);
+    mbedtls_ecp_point_init(&peer);
+
+    int ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+    if (ret == 0) ret = read_point(&grp, &peer, dev_pub);
+    // Rejects points off the curve (invalid-curve attacks)
+    if (ret == 0) ret = mbedtls_ecp_check_pubkey(&grp, &peer);
+    if (ret == 0) ret = mbedtls_mpi_read_binary(&d, s->priv, 32);
+    if (ret == 0) ret = mbedtls_ecdh_compute_shared(&grp, &z, &peer, &d, s->rng, s->rng_ctx);
+    if (ret == 0) ret = mbedtls_mpi_write_binary(&z, s->secret, 32);
+    if (ret == 0) memcpy(s->dev_pub, dev_pub, 64);
+
+    mbedtls_ecp_point_free(&peer);
+    mbedtls_mpi_free(&z);
+    mbedtls_mpi_free(&d);
+    mbedtls_ecp_group_free(&grp);
+
+    if (ret != 0) {
+        ESP_LOGE(TAG, "ECDH failed: -0x%04X", (unsigned)-ret);
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+// MARK: - Confirmation
+
+esp_err_t prov_crypto_make_random(prov_session_t *s)
+{
+    return s->rng(s->rng_ctx, s->prov_random, sizeof(s->prov_random)) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+void prov_crypto_derive_confirmation_key(prov_session_t *s, const uint8_t invite[1],
+                                         const uint8_t caps[11], const uint8_t start[5])
+{
+    uint8_t *p = s->conf_inputs;
+    memcpy(p, invite, 1);       p += 1;
+    memcpy(p, caps, 11);        p += 11;
+    memcpy(p, start, 5);        p += 5;
+    memcpy(p, s->pub, 64);      p += 64;
+    memcpy(p, s->dev_pub, 64);
+
+    // ConfirmationSalt = s1(ConfirmationInputs)
+    // ConfirmationKey  = k1(ECDHSecret, ConfirmationSalt, "prck")
+    static const uint8_t prck[] = { 'p', 'r', 'c', 'k' };
+    mesh_crypto_s1(s->conf_inputs, PROV_CONF_INPUTS_LEN, s->conf_salt);
+    mesh_crypto_k1(s->secret, 32, s->conf_salt, prck, sizeof(prck), s->conf_key);
+}
+
+void prov_crypto_confirmation(const prov_session_t *s, const uint8_t random[16],
+                              const uint8_t auth_value[16], uint8_t out[16])
+{
+    uint8_t m[32];
+    memcpy(m, random, 16);
+    memcpy(m + 16, auth_value, 16);
+    mesh_crypto_aes_cmac(s->conf_key, m, sizeof(m), out);
+}
+
+// MARK: - Session keys
+
+void prov_crypto_derive_session_keys(prov_session_t *s)
+{
+    static const uint8_t prsk[] = { 'p', 'r', 's', 'k' };
+    static const uint8_t prsn[] = { 'p', 'r', 's', 'n' };
+    static const uint8_t prdk[] = { 'p', 'r', 'd', 'k' };
+
+    // ProvisioningSalt = s1(ConfirmationSalt || RandomProvisioner || RandomDevice)
+    uint8_t m[48];
+    uint8_t prov_salt[16];
+    memcpy(m, s->conf_salt, 16);
+    memcpy(m + 16, s->prov_random, 16);
+    memcpy(m + 32, s->dev_random, 16);
+    mesh_crypto_s1(m, sizeof(m), prov_salt);
+
+    uint8_t nonce_full[16];
+    mesh_crypto_k1(s->secret, 32, prov_salt, prsk, sizeof(prsk), s->session_key);
+    mesh_crypto_k1(s->secret, 32, prov_salt, prsn, sizeof(prsn), nonce_full);
+    memcpy(s->session_nonce, nonce_full + 3, 13);   // 13 least significant octets
+    mesh_crypto_k1(s->secret, 32, prov_salt, prdk, sizeof(prdk), s->device_key);
+}
+
+void prov_crypto_encrypt_data(const prov_session_t *s, const uint8_t net_key[16],
+                              uint16_t key_index, uint8_t flags, uint32_t iv_index,
+                              uint16_t unicast, uint8_t out[PROV_DATA_ENC_LEN])
+{
+    uint8_t pt[PROV_DATA_LEN];
+    memcpy(pt, net_key, 16);
+    pt[16] = (uint8_t)(key_index >> 8);
+    pt[17] = (uint8_t)(key_index & 0xFF);
+    pt[18] = flags;
+    pt[19] = (uint8_t)(iv_index >> 24);
+    pt[20] = (uint8_t)(iv_index >> 16);
+    pt[21] = (uint8_t)(iv_index >> 8);
+    pt[22] = (uint8_t)(iv_index & 0xFF);
+    pt[23] = (uint8_t)(unicast >> 8);
+    pt[24] = (uint8_t)(unicast & 0xFF);
+
+    mesh_crypto_ccm_encrypt(s->session_key, s->session_nonce, pt, PROV_DATA_LEN, 8, out);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Mesh provisioning crypto (Mesh Profile 5.4.2): P-256 ECDH, confirmation,
+// session keys and provisioning data encryption. No radio or global state,
+// so a session can be driven from the spec's sample data on a host build.
+
+// Random source in mbedtls f_rng form (0 on success). Key generation, the
+// blinding in ECDH and the provisioner random all draw from it.
+typedef int (*prov_rng_t)(void *ctx, unsigned char *buf, size_t len);
+
+// Invite(1) || Capabilities(11) || Start(5) || PubKeyProvisioner(64) || PubKeyDevice(64)
+#define PROV_CONF_INPUTS_LEN 145
+
+// Provisioning Data: NetKey(16) KeyIndex(2) Flags(1) IVIndex(4) Unicast(2)
+#define PROV_DATA_LEN        25
+#define PROV_DATA_ENC_LEN    (PROV_DATA_LEN + 8)
+
+typedef struct {
+    uint8_t priv[32];               // Provisioner private key
+    uint8_t pub[64];                // Provisioner public key X || Y
+    uint8_t dev_pub[64];            // Device public key X || Y
+    uint8_t secret[32];             // ECDH shared secret
+    uint8_t conf_inputs[PROV_CONF_INPUTS_LEN];
+    uint8_t conf_salt[16];
+    uint8_t conf_key[16];
+    uint8_t prov_random[16];
+    uint8_t dev_random[16];
+    uint8_t session_key[16];
+    uint8_t session_nonce[13];
+    uint8_t device_key[16];
+    prov_rng_t rng;
+    void *rng_ctx;
+} prov_session_t;
+
+// Clear the session and set its random source.
+void prov_crypto_init(prov_session_t *s, prov_rng_t rng, void *rng_ctx);
+
+// Generate a fresh P-256 key pair.
+esp_err_t prov_crypto_keygen(prov_session_t *s);
+
+// Use a known private key instead (spec sample data); derives the public key.
+esp_err_t prov_crypto_set_private_key(prov_session_t *s, const uint8_t priv[32]);
+
+// Validate the device public key and compute the shared secret.
+esp_err_t prov_crypto_ecdh(prov_session_t *s, const uint8_t dev_pub[64]);
+
+// Fill ConfirmationInputs from the PDU values (without type bytes) and both
+// public keys, then derive ConfirmationSalt and ConfirmationKey.
+void prov_crypto_derive_confirmation_key(prov_session_t *s, const uint8_t invite[1],
+                                         const uint8_t caps[11], const uint8_t start[5]);
+
+// Draw RandomProvisioner.
+esp_err_t prov_crypto_make_random(prov_session_t *s);
+
+// Confirmation = AES-CMAC(ConfirmationKey, random || auth_value)
+void prov_crypto_confirmation(const prov_session_t *s, const uint8_t random[16],
+                              const uint8_t auth_value[16], uint8_t out[16]);
+
+// ProvisioningSalt, SessionKey, SessionNonce and DeviceKey. Needs both randoms.
+void prov_crypto_derive_session_keys(prov_session_t *s);
+
+// Encrypt the provisioning data with the session key (8-byte MIC).
+// Writes PROV_DATA_ENC_LEN bytes.
+void prov_crypto_encrypt_data(const prov_session_t *s, const uint8_t net_key[16],
+                              uint16_t key_index, uint8_t flags, uint32_t iv_index,
+                              uint16_t unicast, uint8_t out[PROV_DATA_ENC_LEN]);
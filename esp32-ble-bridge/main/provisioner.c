@@ -0,0 +1,658 @@
+/*
+ * provisioner.c
+ *
+ * Mesh provisioner, ported from ProvisioningManager.swift. Every link runs
+ * the same state machine:
+ *   invite -> capabilities -> start + public key -> public key ->
+ *   confirmation -> random -> data -> complete
+ * Each step is driven by an event from the bearer (prov_bearer.h) on that
+ * link, so links progress independently and the fleet is provisioned in
+ * parallel.
+ *
+ * The link table is shared by the bearer's task, the timeout timer and the
+ * crypto worker, and is only touched under s_lock. P-256 key generation
+ * and ECDH take tens of milliseconds each, so they run on the worker
+ * rather than holding up the bearer: the link waits (busy) until the
+ * worker hands the result back.
+ */
+
+#include "provisioner.h"
+
+#include <string.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+
+#include "prov_bearer.h"
+#include "prov_crypto.h"
+#include "mesh_crypto.h"
+#include "light_registry.h"
+#include "ws_server.h"
+
+static const char *TAG = "provisioner";
+
+#define PDU_TIMEOUT_MS      30000   // Same as the app
+#define MAX_ATTEMPTS        3
+#define FAILED_MEMORY       16
+#define CRYPTO_STACK        6144    // mbedtls ECP needs the room
+
+// Provisioning PDU types
+#define PROV_INVITE         0x00
+#define PROV_CAPABILITIES   0x01
+#define PROV_START          0x02
+#define PROV_PUBLIC_KEY     0x03
+#define PROV_CONFIRMATION   0x05
+#define PROV_RANDOM         0x06
+#define PROV_DATA           0x07
+#define PROV_COMPLETE       0x08
+#define PROV_FAILED         0x09
+
+typedef enum {
+    LINK_FREE = 0,
+    LINK_CONNECTING,
+    LINK_DISCOVERING,
+    LINK_INVITE_SENT,
+    LINK_PUBKEY_SENT,
+    LINK_CONFIRM_SENT,
+    LINK_RANDOM_SENT,
+    LINK_DATA_SENT,
+    LINK_CLOSING,
+} link_state_t;
+
+// Reported to the phone in provision_progress events
+static const char *s_state_names[] = {
+    "free", "connecting", "discovering", "invite", "public_key",
+    "confirmation", "random", "data", "closing",
+};
+
+typedef struct {
+    link_state_t state;
+    uint32_t gen;               // Bumped on release, so stale crypto results are dropped
+    bool busy;                  // Keygen or ECDH out on the worker
+    uint8_t uuid[16];
+    char name[32];
+    uint16_t unicast;           // 0 until capabilities arrive
+    uint8_t elements;
+    uint8_t invite[1];
+    uint8_t caps[11];
+    uint8_t start[5];
+    uint8_t dev_conf[16];
+    bool succeeded;
+    int64_t deadline_us;
+    prov_session_t crypto;
+} prov_link_t;
+
+// Keygen when the link is in LINK_INVITE_SENT, ECDH in LINK_PUBKEY_SENT
+typedef struct {
+    int link;
+    uint32_t gen;
+    link_state_t state;
+    uint8_t dev_pub[64];
+} crypto_job_t;
+
+static prov_link_t s_links[PROVISIONER_MAX_LINKS];
+static SemaphoreHandle_t s_lock = NULL;     // s_links and everything below
+static QueueHandle_t s_jobs = NULL;
+static esp_timer_handle_t s_timer = NULL;
+
+static bool s_active = false;
+static uint16_t s_next_unicast = 0;
+static int s_max_devices = 0;
+static int s_started = 0;       // Links opened that haven't failed
+static int s_done = 0;
+
+// Devices that failed, so one bad fixture isn't retried forever
+static struct {
+    uint8_t uuid[16];
+    uint8_t attempts;
+} s_failed[FAILED_MEMORY];
+static int s_failed_next = 0;
+
+// MARK: - Helpers
+
+static void lock(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+}
+
+static void unlock(void)
+{
+    xSemaphoreGive(s_lock);
+}
+
+static int prov_rng(void *ctx, unsigned char *buf, size_t len)
+{
+    esp_fill_random(buf, len);
+    return 0;
+}
+
+static void uuid_to_str(const uint8_t uuid[16], char out[37])
+{
+    snprintf(out, 37,
+             "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+             uuid[0], uuid[1], uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7],
+             uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+}
+
+static void to_hex(const uint8_t *data, int len, char *out)
+{
+    for (int i = 0; i < len; i++) sprintf(out + i * 2, "%02X", data[i]);
+    out[len * 2] = '\0';
+}
+
+static int link_id(const prov_link_t *l)
+{
+    return (int)(l - s_links);
+}
+
+// The link behind a bearer's link number, if it is in use
+static prov_link_t *link_at(int link)
+{
+    if (link < 0 || link >= PROVISIONER_MAX_LINKS) return NULL;
+    return s_links[link].state != LINK_FREE ? &s_links[link] : NULL;
+}
+
+static prov_link_t *find_link_by_uuid(const uint8_t uuid[16])
+{
+    for (int i = 0; i < PROVISIONER_MAX_LINKS; i++) {
+        if (s_links[i].state != LINK_FREE && memcmp(s_links[i].uuid, uuid, 16) == 0)
+            return &s_links[i];
+    }
+    return NULL;
+}
+
+static int count_links(void)
+{
+    int n = 0;
+    for (int i = 0; i < PROVISIONER_MAX_LINKS; i++) {
+        if (s_links[i].state != LINK_FREE) n++;
+    }
+    return n;
+}
+
+static int failed_attempts(const uint8_t uuid[16])
+{
+    for (int i = 0; i < FAILED_MEMORY; i++) {
+        if (s_failed[i].attempts && memcmp(s_failed[i].uuid, uuid, 16) == 0)
+            return s_failed[i].attempts;
+    }
+    return 0;
+}
+
+static void record_failure(const uint8_t uuid[16])
+{
+    for (int i = 0; i < FAILED_MEMORY; i++) {
+        if (s_failed[i].attempts && memcmp(s_failed[i].uuid, uuid, 16) == 0) {
+            s_failed[i].attempts++;
+            return;
+        }
+    }
+    memcpy(s_failed[s_failed_next].uuid, uuid, 16);
+    s_failed[s_failed_next].attempts = 1;
+    s_failed_next = (s_failed_next + 1) % FAILED_MEMORY;
+}
+
+// Lowest free address range at or above s_next_unicast. Registered lights
+// are assumed to have one element.
+static uint16_t alloc_unicast(int elements)
+{
+    uint16_t addr = s_next_unicast;
+    for (;;) {
+        if (addr == 0 || (uint32_t)addr + elements - 1 > 0x7FFF) return 0;
+
+        uint16_t clash_end = 0;
+        light_entry_t light;
+        for (int i = 0; i < MAX_LIGHTS && !clash_end; i++) {
+            if (light_registry_read_slot(i, &light) &&
+                light.unicast >= addr && light.unicast < addr + elements) {
+                clash_end = light.unicast + 1;
+            }
+        }
+        for (int i = 0; i < PROVISIONER_MAX_LINKS && !clash_end; i++) {
+            const prov_link_t *l = &s_links[i];
+            if (l->state == LINK_FREE || !l->unicast) continue;
+            if (l->unicast < addr + elements && addr < l->unicast + l->elements) {
+                clash_end = l->unicast + l->elements;
+            }
+        }
+        if (!clash_end) break;
+        addr = clash_end;
+    }
+    s_next_unicast = addr + elements;
+    return addr;
+}
+
+static void send_progress(const prov_link_t *l, const char *state, const char *reason)
+{
+    char uuid[37];
+    char body[160];
+    uuid_to_str(l->uuid, uuid);
+    if (reason) {
+        snprintf(body, sizeof(body), "\"uuid\":\"%s\",\"state\":\"%s\",\"reason\":\"%s\"",
+                 uuid, state, reason);
+    } else {
+        snprintf(body, sizeof(body), "\"uuid\":\"%s\",\"state\":\"%s\"", uuid, state);
+    }
+    ws_server_send_event("provision_progress", body);
+}
+
+static void set_state(prov_link_t *l, link_state_t state)
+{
+    l->state = state;
+    l->deadline_us = esp_timer_get_time() + (int64_t)PDU_TIMEOUT_MS * 1000;
+    send_progress(l, s_state_names[state], NULL);
+}
+
+static void stop_locked(void)
+{
+    if (!s_active) return;
+    s_active = false;
+    prov_bearer_scan(false);
+
+    char body[96];
+    snprintf(body, sizeof(body), "\"provisioned\":%d,\"next_unicast\":%u", s_done, s_next_unicast);
+    ws_server_send_event("provision_stopped", body);
+    ESP_LOGI(TAG, "Provisioning stopped, %d device(s) done", s_done);
+}
+
+// Free a link after its connection has closed.
+static void release_link(prov_link_t *l)
+{
+    uint32_t gen = l->gen;
+    memset(l, 0, sizeof(*l));
+    l->gen = gen + 1;
+
+    if (s_active && s_max_devices && s_done >= s_max_devices) {
+        ESP_LOGI(TAG, "Provisioned %d device(s), stopping", s_done);
+        stop_locked();
+    }
+}
+
+static void report_failure(prov_link_t *l, const char *reason)
+{
+    ESP_LOGW(TAG, "Link %d (%s) failed in %s: %s", link_id(l), l->name,
+             s_state_names[l->state], reason);
+    record_failure(l->uuid);
+    if (s_started > 0) s_started--;
+    send_progress(l, "failed", reason);
+}
+
+static void link_fail(prov_link_t *l, const char *reason)
+{
+    report_failure(l, reason);
+
+    if (l->state == LINK_CLOSING) return;
+    if (l->state == LINK_CONNECTING) {
+        // Nothing to wait for: the bearer drops the attempt at once
+        prov_bearer_close(link_id(l));
+        release_link(l);
+        return;
+    }
+    l->state = LINK_CLOSING;
+    prov_bearer_close(link_id(l));
+}
+
+static void link_send(prov_link_t *l, uint8_t type, const uint8_t *payload, int len)
+{
+    uint8_t pdu[1 + 64];
+    pdu[0] = type;
+    memcpy(pdu + 1, payload, len);
+    prov_bearer_send(link_id(l), pdu, len + 1);
+}
+
+// Hand keygen or ECDH for the link's current state to the worker.
+static void link_crypto(prov_link_t *l, const uint8_t *dev_pub)
+{
+    crypto_job_t job = { .link = link_id(l), .gen = l->gen, .state = l->state };
+    if (dev_pub) memcpy(job.dev_pub, dev_pub, 64);
+
+    // One job per link at most, and the queue holds one per link
+    l->busy = true;
+    if (xQueueSend(s_jobs, &job, 0) != pdTRUE) {
+        l->busy = false;
+        link_fail(l, "crypto busy");
+    }
+}
+
+static void link_complete(prov_link_t *l)
+{
+    char uuid[37];
+    char key_hex[33];
+    char body[320];
+    uuid_to_str(l->uuid, uuid);
+    to_hex(l->crypto.device_key, 16, key_hex);
+
+    if (light_registry_add(uuid, l->unicast, l->name)) {
+        light_registry_set_device_key(l->unicast, l->crypto.device_key);
+    } else {
+        ESP_LOGW(TAG, "Registry full, 0x%04X provisioned but not registered", l->unicast);
+    }
+
+    l->succeeded = true;
+    s_done++;
+    ESP_LOGI(TAG, "Provisioned %s as 0x%04X (%d element(s))", l->name, l->unicast, l->elements);
+
+    snprintf(body, sizeof(body),
+             "\"uuid\":\"%s\",\"unicast\":%u,\"elements\":%u,\"name\":\"%s\","
+             "\"device_key\":\"%s\",\"next_unicast\":%u",
+             uuid, l->unicast, l->elements, l->name, key_hex, s_next_unicast);
+    ws_server_send_event("provisioned", body);
+
+    l->state = LINK_CLOSING;
+    prov_bearer_close(link_id(l));
+}
+
+// MARK: - State machine
+
+// The key pair is ready: send Start and our public key.
+static void keygen_done(prov_link_t *l, esp_err_t err)
+{
+    if (err != ESP_OK) { link_fail(l, "keygen"); return; }
+
+    link_send(l, PROV_START, l->start, sizeof(l->start));
+    link_send(l, PROV_PUBLIC_KEY, l->crypto.pub, 64);
+    set_state(l, LINK_PUBKEY_SENT);
+}
+
+// The shared secret is ready: send our confirmation.
+static void ecdh_done(prov_link_t *l, esp_err_t err)
+{
+    if (err != ESP_OK) { link_fail(l, "bad public key"); return; }
+    prov_crypto_derive_confirmation_key(&l->crypto, l->invite, l->caps, l->start);
+
+    static const uint8_t auth_zero[16] = { 0 };
+    uint8_t conf[16];
+    if (prov_crypto_make_random(&l->crypto) != ESP_OK) { link_fail(l, "no random"); return; }
+    prov_crypto_confirmation(&l->crypto, l->crypto.prov_random, auth_zero, conf);
+
+    link_send(l, PROV_CONFIRMATION, conf, 16);
+    set_state(l, LINK_CONFIRM_SENT);
+}
+
+static void link_handle_pdu(prov_link_t *l, const uint8_t *pdu, int len)
+{
+    if (len < 1) return;
+    uint8_t type = pdu[0];
+    const uint8_t *p = pdu + 1;
+    int plen = len - 1;
+
+    if (type == PROV_FAILED) {
+        char reason[24];
+        snprintf(reason, sizeof(reason), "device error %d", plen > 0 ? p[0] : -1);
+        link_fail(l, reason);
+        return;
+    }
+
+    // The device has nothing to say while our keygen or ECDH is running
+    switch (l->busy ? LINK_FREE : l->state) {
+    case LINK_INVITE_SENT: {
+        if (type != PROV_CAPABILITIES || plen < 11) break;
+        memcpy(l->caps, p, 11);
+        l->elements = p[0];
+        uint16_t algorithms = (uint16_t)(p[1] << 8 | p[2]);
+        if (!(algorithms & 0x0001)) { link_fail(l, "no FIPS P-256"); return; }
+        if (l->elements == 0) { link_fail(l, "no elements"); return; }
+
+        l->unicast = alloc_unicast(l->elements);
+        if (!l->unicast) { link_fail(l, "address space full"); return; }
+
+        // FIPS P-256, no OOB public key, no OOB authentication
+        memset(l->start, 0, sizeof(l->start));
+        link_crypto(l, NULL);
+        return;
+    }
+
+    case LINK_PUBKEY_SENT:
+        if (type != PROV_PUBLIC_KEY || plen < 64) break;
+        link_crypto(l, p);
+        return;
+
+    case LINK_CONFIRM_SENT:
+        if (type != PROV_CONFIRMATION || plen < 16) break;
+        memcpy(l->dev_conf, p, 16);
+        link_send(l, PROV_RANDOM, l->crypto.prov_random, 16);
+        set_state(l, LINK_RANDOM_SENT);
+        return;
+
+    case LINK_RANDOM_SENT: {
+        if (type != PROV_RANDOM || plen < 16) break;
+        memcpy(l->crypto.dev_random, p, 16);
+
+        static const uint8_t auth_zero[16] = { 0 };
+        uint8_t expected[16];
+        prov_crypto_confirmation(&l->crypto, l->crypto.dev_random, auth_zero, expected);
+        if (memcmp(expected, l->dev_conf, 16) != 0) {
+            link_fail(l, "confirmation mismatch");
+            return;
+        }
+
+        uint8_t net_key[16];
+        uint32_t iv_index;
+        if (!mesh_crypto_get_network(net_key, &iv_index)) { link_fail(l, "no mesh keys"); return; }
+
+        prov_crypto_derive_session_keys(&l->crypto);
+        uint8_t data[PROV_DATA_ENC_LEN];
+        prov_crypto_encrypt_data(&l->crypto, net_key, 0, 0x00, iv_index, l->unicast, data);
+        link_send(l, PROV_DATA, data, sizeof(data));
+        set_state(l, LINK_DATA_SENT);
+        return;
+    }
+
+    case LINK_DATA_SENT:
+        if (type != PROV_COMPLETE) break;
+        link_complete(l);
+        return;
+
+    default:
+        break;
+    }
+
+    ESP_LOGW(TAG, "Unexpected PDU type 0x%02X in %s", type, s_state_names[l->state]);
+    link_fail(l, "unexpected PDU");
+}
+
+// Runs keygen and ECDH on a copy of the session, outside the lock. The
+// link may have failed or been reused meanwhile; then the result is dropped.
+static void crypto_task(void *arg)
+{
+    static prov_session_t work;
+    crypto_job_t job;
+    for (;;) {
+        if (xQueueReceive(s_jobs, &job, portMAX_DELAY) != pdTRUE) continue;
+        prov_link_t *l = &s_links[job.link];
+
+        lock();
+        bool current = l->gen == job.gen && l->state == job.state;
+        if (current) work = l->crypto;
+        unlock();
+        if (!current) continue;
+
+        esp_err_t err = job.state == LINK_INVITE_SENT ? prov_crypto_keygen(&work)
+                                                     : prov_crypto_ecdh(&work, job.dev_pub);
+
+        lock();
+        if (l->gen == job.gen && l->state == job.state) {
+            l->busy = false;
+            l->crypto = work;
+            if (job.state == LINK_INVITE_SENT) keygen_done(l, err);
+            else ecdh_done(l, err);
+        }
+        unlock();
+    }
+}
+
+static void timeout_tick(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    lock();
+    for (int i = 0; i < PROVISIONER_MAX_LINKS; i++) {
+        prov_link_t *l = &s_links[i];
+        if (l->state == LINK_FREE || l->state == LINK_CLOSING) continue;
+        if (now > l->deadline_us) link_fail(l, "timeout");
+    }
+    unlock();
+}
+
+// MARK: - Bearer events
+
+int provisioner_link_found(const uint8_t uuid[16], const char *name)
+{
+    lock();
+    prov_link_t *l = NULL;
+    if (s_active && !find_link_by_uuid(uuid) && failed_attempts(uuid) < MAX_ATTEMPTS &&
+        !(s_max_devices && s_started >= s_max_devices)) {
+        for (int i = 0; i < PROVISIONER_MAX_LINKS; i++) {
+            if (s_links[i].state == LINK_FREE) { l = &s_links[i]; break; }
+        }
+    }
+    if (!l) {
+        unlock();
+        return -1;
+    }
+
+    uint32_t gen = l->gen;
+    memset(l, 0, sizeof(*l));
+    l->gen = gen;
+    memcpy(l->uuid, uuid, 16);
+    prov_crypto_init(&l->crypto, prov_rng, NULL);
+    l->invite[0] = 0;           // No attention timer
+    if (name && name[0]) {
+        strncpy(l->name, name, sizeof(l->name) - 1);
+    } else {
+        snprintf(l->name, sizeof(l->name), "Fixture %02X%02X", uuid[14], uuid[15]);
+    }
+    s_started++;
+    set_state(l, LINK_CONNECTING);
+    int id = link_id(l);
+    ESP_LOGI(TAG, "Unprovisioned device %s, connecting on link %d", l->name, id);
+    unlock();
+    return id;
+}
+
+void provisioner_link_connected(int link)
+{
+    lock();
+    prov_link_t *l = link_at(link);
+    if (l && l->state == LINK_CONNECTING) set_state(l, LINK_DISCOVERING);
+    unlock();
+}
+
+void provisioner_link_ready(int link)
+{
+    lock();
+    prov_link_t *l = link_at(link);
+    if (l && l->state == LINK_DISCOVERING) {
+        link_send(l, PROV_INVITE, l->invite, sizeof(l->invite));
+        set_state(l, LINK_INVITE_SENT);
+    }
+    unlock();
+}
+
+void provisioner_link_pdu(int link, const uint8_t *pdu, int len)
+{
+    lock();
+    prov_link_t *l = link_at(link);
+    if (l && l->state != LINK_CLOSING) link_handle_pdu(l, pdu, len);
+    unlock();
+}
+
+void provisioner_link_failed(int link, const char *reason)
+{
+    lock();
+    prov_link_t *l = link_at(link);
+    if (l) link_fail(l, reason);
+    unlock();
+}
+
+void provisioner_link_closed(int link)
+{
+    lock();
+    prov_link_t *l = link_at(link);
+    if (l) {
+        if (l->state != LINK_CLOSING && !l->succeeded) report_failure(l, "disconnected");
+        release_link(l);
+    }
+    unlock();
+}
+
+// MARK: - Public API
+
+esp_err_t provisioner_init(void)
+{
+    memset(s_links, 0, sizeof(s_links));
+    s_lock = xSemaphoreCreateMutex();
+    s_jobs = xQueueCreate(PROVISIONER_MAX_LINKS, sizeof(crypto_job_t));
+    if (!s_lock || !s_jobs) return ESP_ERR_NO_MEM;
+    if (xTaskCreate(crypto_task, "prov_crypto", CRYPTO_STACK, NULL, 4, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "crypto task create failed");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_timer_create_args_t args = {
+        .callback = timeout_tick,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "prov_timeout",
+    };
+    esp_err_t err = esp_timer_create(&args, &s_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "timer create failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    return prov_bearer_init();
+}
+
+esp_err_t provisioner_start(uint16_t first_unicast, int max_devices)
+{
+    if (!mesh_crypto_is_initialized()) {
+        ESP_LOGE(TAG, "Cannot provision without mesh keys");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (first_unicast == 0 || first_unicast > 0x7FFF) return ESP_ERR_INVALID_ARG;
+
+    lock();
+    esp_err_t err = prov_bearer_scan(true);
+    if (err == ESP_OK) {
+        s_next_unicast = first_unicast;
+        s_max_devices = max_devices > 0 ? max_devices : 0;
+        s_started = count_links();
+        s_done = 0;
+        memset(s_failed, 0, sizeof(s_failed));
+        s_active = true;
+    }
+    unlock();
+    if (err != ESP_OK) return err;
+
+    esp_timer_stop(s_timer);
+    esp_timer_start_periodic(s_timer, 1000 * 1000);
+
+    ESP_LOGI(TAG, "Provisioning from 0x%04X (max %d)", first_unicast, max_devices);
+    return ESP_OK;
+}
+
+void provisioner_stop(void)
+{
+    lock();
+    stop_locked();
+    unlock();
+}
+
+bool provisioner_is_active(void)
+{
+    lock();
+    bool active = s_active;
+    unlock();
+    return active;
+}
+
+int provisioner_link_count(void)
+{
+    lock();
+    int n = count_links();
+    unlock();
+    return n;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Bridge-side mesh provisioner.
+//
+// Provisions several unprovisioned devices at once, one link each, over
+// the bearer in prov_bearer.h (PB-GATT on the ESP32, using whatever ACL
+// connections the mesh proxies leave free). Each device gets the next free
+// unicast range for its element count, is added to the light registry, and
+// is reported to the phone with its device key.
+
+// Parallel provisioning links (further capped by free ACL connections)
+#define PROVISIONER_MAX_LINKS 8
+
+// Set up the link table, the crypto worker and the bearer. Call after
+// ble_mesh_init.
+esp_err_t provisioner_init(void);
+
+// Start provisioning devices as they are found. Addresses are allocated
+// upward from first_unicast, skipping registered lights. Stops after
+// max_devices (0 = no limit). Needs mesh keys to be loaded.
+esp_err_t provisioner_start(uint16_t first_unicast, int max_devices);
+
+// Stop accepting new devices. Links in progress run to completion.
+void provisioner_stop(void);
+
+bool provisioner_is_active(void);
+
+// Links currently holding a connection.
+int provisioner_link_count(void);
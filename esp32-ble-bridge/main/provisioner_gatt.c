@@ -0,0 +1,353 @@
+/*
+ * provisioner_gatt.c
+ *
+ * PB-GATT bearer for provisioner.c: scanning for unprovisioned device
+ * beacons, one GATT connection per link, service discovery, and proxy SAR
+ * in both directions. Everything here runs on the BTC task.
+ */
+
+#include "provisioner_gatt.h"
+
+#include <string.h>
+#include <stdio.h>
+#include "esp_log.h"
+
+#include "provisioner.h"
+#include "prov_bearer.h"
+#include "ble_mesh.h"
+
+static const char *TAG = "prov_gatt";
+
+#define BLE_ACL_LIMIT       9       // CONFIG_BTDM_CTRL_BLE_MAX_CONN
+#define SCAN_SECONDS        30
+
+// Proxy PDU header: SAR (2 bits) | type (6 bits)
+#define PROXY_TYPE_PROV     0x03
+#define SAR_COMPLETE        0x00
+#define SAR_FIRST           0x40
+#define SAR_CONTINUE        0x80
+#define SAR_LAST            0xC0
+
+static esp_bt_uuid_t prov_service_uuid = { .len = ESP_UUID_LEN_16, .uuid.uuid16 = 0x1827 };
+static esp_bt_uuid_t prov_data_in_uuid = { .len = ESP_UUID_LEN_16, .uuid.uuid16 = 0x2ADB };
+static esp_bt_uuid_t prov_data_out_uuid = { .len = ESP_UUID_LEN_16, .uuid.uuid16 = 0x2ADC };
+
+// Bearer side of a link, under the provisioner's link number
+typedef struct {
+    bool in_use;
+    bool connected;
+    bool ready;                 // Notifications on, PDUs flow
+    uint8_t bda[6];
+    uint16_t conn_id;
+    uint16_t mtu;
+    uint16_t data_in;           // 2ADB
+    uint16_t data_out;          // 2ADC
+    uint8_t rx[80];             // SAR reassembly (largest PDU is 65 bytes)
+    int rx_len;
+} gatt_link_t;
+
+static gatt_link_t s_gl[PROVISIONER_MAX_LINKS];
+static esp_gatt_if_t s_gattc_if = ESP_GATT_IF_NONE;
+static bool s_scanning = false;
+
+// MARK: - Helpers
+
+static int find_by_conn_id(uint16_t conn_id)
+{
+    for (int i = 0; i < PROVISIONER_MAX_LINKS; i++) {
+        if (s_gl[i].in_use && s_gl[i].connected && s_gl[i].conn_id == conn_id) return i;
+    }
+    return -1;
+}
+
+static int find_by_addr(const uint8_t *bda)
+{
+    for (int i = 0; i < PROVISIONER_MAX_LINKS; i++) {
+        if (s_gl[i].in_use && memcmp(s_gl[i].bda, bda, 6) == 0) return i;
+    }
+    return -1;
+}
+
+static void start_scan(void)
+{
+    if (s_scanning) return;
+    s_scanning = true;
+
+    esp_ble_scan_params_t scan_params = {
+        .scan_type = BLE_SCAN_TYPE_ACTIVE,
+        .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+        .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
+        .scan_interval = 0x50,
+        .scan_window = 0x30,
+        .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE,
+    };
+    esp_ble_gap_set_scan_params(&scan_params);
+    esp_ble_gap_start_scanning(SCAN_SECONDS);
+}
+
+// Reassemble proxy SAR segments into one provisioning PDU.
+static void handle_notify(int link, const uint8_t *data, int len)
+{
+    gatt_link_t *g = &s_gl[link];
+    if (len < 2 || (data[0] & 0x3F) != PROXY_TYPE_PROV) return;
+
+    uint8_t sar = data[0] & 0xC0;
+    const uint8_t *seg = data + 1;
+    int n = len - 1;
+
+    if (sar == SAR_COMPLETE || sar == SAR_FIRST) g->rx_len = 0;
+    if (g->rx_len + n > (int)sizeof(g->rx)) {
+        g->rx_len = 0;
+        provisioner_link_failed(link, "PDU too long");
+        return;
+    }
+    memcpy(g->rx + g->rx_len, seg, n);
+    g->rx_len += n;
+
+    if (sar == SAR_COMPLETE || sar == SAR_LAST) {
+        int total = g->rx_len;
+        g->rx_len = 0;
+        provisioner_link_pdu(link, g->rx, total);
+    }
+}
+
+// MARK: - Bearer
+
+esp_err_t prov_bearer_init(void)
+{
+    memset(s_gl, 0, sizeof(s_gl));
+    esp_err_t err = esp_ble_gattc_app_register(PROVISIONER_APP_ID);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "GATTC app register failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t prov_bearer_scan(bool on)
+{
+    if (s_gattc_if == ESP_GATT_IF_NONE) return ESP_ERR_INVALID_STATE;
+    if (on) {
+        start_scan();
+    } else if (s_scanning) {
+        esp_ble_gap_stop_scanning();
+        s_scanning = false;
+    }
+    return ESP_OK;
+}
+
+// Send one provisioning PDU, split into proxy SAR segments if it doesn't
+// fit in the negotiated MTU.
+void prov_bearer_send(int link, const uint8_t *pdu, int total)
+{
+    gatt_link_t *g = &s_gl[link];
+    if (!g->in_use || !g->connected) return;
+
+    int chunk = g->mtu - 3 - 1;     // ATT header, then proxy header
+    uint8_t seg[1 + 65];
+    int off = 0;
+    while (off < total) {
+        int n = total - off < chunk ? total - off : chunk;
+        uint8_t sar;
+        if (off == 0 && n == total) sar = SAR_COMPLETE;
+        else if (off == 0) sar = SAR_FIRST;
+        else if (off + n == total) sar = SAR_LAST;
+        else sar = SAR_CONTINUE;
+
+        seg[0] = sar | PROXY_TYPE_PROV;
+        memcpy(seg + 1, pdu + off, n);
+        ble_mesh_write(s_gattc_if, g->conn_id, g->data_in, seg, n + 1);
+        off += n;
+    }
+}
+
+void prov_bearer_close(int link)
+{
+    gatt_link_t *g = &s_gl[link];
+    if (!g->in_use) return;
+    if (!g->connected) {
+        // A late OPEN_EVT finds no link and closes the connection itself
+        g->in_use = false;
+        return;
+    }
+    esp_ble_gattc_close(s_gattc_if, g->conn_id);
+}
+
+// MARK: - Scanning
+
+// Unprovisioned device beacon over PB-GATT: Service Data (0x16) for 0x1827
+// carrying the Device UUID (16) and OOB info (2).
+static bool adv_device_uuid(const uint8_t *adv, int adv_len, uint8_t uuid[16], char *name, int name_max)
+{
+    bool found = false;
+    int offset = 0;
+    name[0] = '\0';
+    while (offset < adv_len) {
+        uint8_t field_len = adv[offset];
+        if (field_len == 0 || offset + field_len >= adv_len) break;
+
+        const uint8_t *f = &adv[offset + 1];
+        if (field_len >= 19 && f[0] == 0x16 && f[1] == 0x27 && f[2] == 0x18) {
+            memcpy(uuid, &f[3], 16);
+            found = true;
+        } else if ((f[0] == 0x08 || f[0] == 0x09) && !name[0]) {
+            // Keep only characters that are safe inside a JSON string
+            int n = 0;
+            for (int i = 1; i < field_len && n < name_max - 1; i++) {
+                char c = (char)f[i];
+                if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\') name[n++] = c;
+            }
+            name[n] = '\0';
+        }
+
+        offset += field_len + 1;
+    }
+    return found;
+}
+
+static void handle_scan_result(esp_ble_gap_cb_param_t *param)
+{
+    uint8_t uuid[16];
+    char name[32];
+    int adv_len = param->scan_rst.adv_data_len + param->scan_rst.scan_rsp_len;
+    if (!adv_device_uuid(param->scan_rst.ble_adv, adv_len, uuid, name, sizeof(name))) return;
+
+    if (find_by_addr(param->scan_rst.bda) >= 0) return;
+    if (ble_mesh_proxy_link_count() + provisioner_link_count() >= BLE_ACL_LIMIT) return;
+
+    int link = provisioner_link_found(uuid, name);
+    if (link < 0) return;
+
+    gatt_link_t *g = &s_gl[link];
+    memset(g, 0, sizeof(*g));
+    g->in_use = true;
+    memcpy(g->bda, param->scan_rst.bda, 6);
+    g->conn_id = 0xFFFF;
+    g->mtu = 23;
+
+    ESP_LOGI(TAG, "Link %d: connecting to %02X:%02X:%02X:%02X:%02X:%02X", link,
+             g->bda[0], g->bda[1], g->bda[2], g->bda[3], g->bda[4], g->bda[5]);
+    esp_ble_gattc_open(s_gattc_if, param->scan_rst.bda, param->scan_rst.ble_addr_type, true);
+}
+
+void provisioner_handle_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    if (event != ESP_GAP_BLE_SCAN_RESULT_EVT) return;
+
+    if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT) {
+        if (s_scanning) handle_scan_result(param);
+    } else if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_CMPL_EVT) {
+        s_scanning = false;
+        if (provisioner_is_active()) start_scan();     // Keep looking until stopped
+    }
+}
+
+// MARK: - GATT
+
+void provisioner_handle_gattc_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+                                    esp_ble_gattc_cb_param_t *param)
+{
+    switch (event) {
+    case ESP_GATTC_REG_EVT:
+        if (param->reg.status == ESP_GATT_OK) {
+            s_gattc_if = gattc_if;
+            ESP_LOGI(TAG, "Provisioning GATTC registered, if=%d", gattc_if);
+        }
+        break;
+
+    case ESP_GATTC_OPEN_EVT: {
+        int link = find_by_addr(param->open.remote_bda);
+        if (link < 0) {
+            // Link timed out while connecting; drop the late connection
+            if (param->open.status == ESP_GATT_OK) esp_ble_gattc_close(gattc_if, param->open.conn_id);
+            break;
+        }
+        if (param->open.status != ESP_GATT_OK) {
+            s_gl[link].in_use = false;
+            provisioner_link_failed(link, "connect failed");
+            break;
+        }
+        gatt_link_t *g = &s_gl[link];
+        g->conn_id = param->open.conn_id;
+        g->connected = true;
+        provisioner_link_connected(link);
+        esp_ble_gattc_send_mtu_req(gattc_if, g->conn_id);
+        esp_ble_gattc_search_service(gattc_if, g->conn_id, &prov_service_uuid);
+        break;
+    }
+
+    case ESP_GATTC_CFG_MTU_EVT: {
+        int link = find_by_conn_id(param->cfg_mtu.conn_id);
+        if (link >= 0 && param->cfg_mtu.status == ESP_GATT_OK) s_gl[link].mtu = param->cfg_mtu.mtu;
+        break;
+    }
+
+    case ESP_GATTC_SEARCH_CMPL_EVT: {
+        int link = find_by_conn_id(param->search_cmpl.conn_id);
+        if (link < 0 || s_gl[link].ready) break;
+        gatt_link_t *g = &s_gl[link];
+
+        esp_gattc_char_elem_t elem;
+        uint16_t count = 1;
+        if (esp_ble_gattc_get_char_by_uuid(gattc_if, g->conn_id, 0x0001, 0xFFFF,
+                                           prov_data_in_uuid, &elem, &count) == ESP_GATT_OK && count) {
+            g->data_in = elem.char_handle;
+        }
+        count = 1;
+        if (esp_ble_gattc_get_char_by_uuid(gattc_if, g->conn_id, 0x0001, 0xFFFF,
+                                           prov_data_out_uuid, &elem, &count) == ESP_GATT_OK && count) {
+            g->data_out = elem.char_handle;
+        }
+        if (!g->data_in || !g->data_out) {
+            provisioner_link_failed(link, "no provisioning service");
+            break;
+        }
+
+        // Enable notifications on 2ADC; the invite goes out once the CCC write lands
+        esp_ble_gattc_register_for_notify(gattc_if, g->bda, g->data_out);
+        uint16_t notify_en = 1;
+        esp_ble_gattc_write_char_descr(gattc_if, g->conn_id, g->data_out + 1,
+                                       sizeof(notify_en), (uint8_t *)&notify_en,
+                                       ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+        break;
+    }
+
+    case ESP_GATTC_WRITE_DESCR_EVT: {
+        int link = find_by_conn_id(param->write.conn_id);
+        if (link < 0 || s_gl[link].ready) break;
+        if (param->write.status != ESP_GATT_OK) {
+            provisioner_link_failed(link, "notify enable failed");
+            break;
+        }
+        s_gl[link].ready = true;
+        provisioner_link_ready(link);
+        break;
+    }
+
+    case ESP_GATTC_NOTIFY_EVT: {
+        int link = find_by_conn_id(param->notify.conn_id);
+        if (link >= 0 && param->notify.handle == s_gl[link].data_out) {
+            handle_notify(link, param->notify.value, param->notify.value_len);
+        }
+        break;
+    }
+
+    case ESP_GATTC_CLOSE_EVT:
+    case ESP_GATTC_DISCONNECT_EVT: {
+        uint16_t conn_id = event == ESP_GATTC_CLOSE_EVT ? param->close.conn_id
+                                                        : param->disconnect.conn_id;
+        int link = find_by_conn_id(conn_id);
+        if (link < 0) break;
+        s_gl[link].in_use = false;
+        provisioner_link_closed(link);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+esp_gatt_if_t provisioner_gattc_if(void)
+{
+    return s_gattc_if;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "esp_gap_ble_api.h"
+#include "esp_gattc_api.h"
+
+// PB-GATT bearer for the provisioner (prov_bearer.h): scans for
+// unprovisioned devices (service 0x1827), connects, and carries
+// provisioning PDUs over 2ADB/2ADC with proxy SAR.
+
+// GATTC application ID for provisioning links (proxies use 0)
+#define PROVISIONER_APP_ID 1
+
+// The GATTC interface assigned to provisioning links.
+esp_gatt_if_t provisioner_gattc_if(void);
+
+// Forwarded from the BLE callbacks in ble_mesh.c.
+void provisioner_handle_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+void provisioner_handle_gattc_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+                                    esp_ble_gattc_cb_param_t *param);
@@ -0,0 +1,438 @@
+/*
+ * rules.c
+ *
+ * Trigger -> action table evaluated on the bridge.
+ */
+
+#include "rules.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "light_registry.h"
+#include "ws_server.h"
+#include "command.h"
+
+static const char *TAG = "rules";
+
+#define NVS_NAMESPACE   "rules"
+#define NVS_KEY         "table"
+#define NVS_MAX_LEN     4000        // nvs_set_str limit
+#define QUEUE_LEN       32
+#define NAME_LEN        16
+#define TIMER_MIN_MS    100
+#define IDLE_WAIT_MS    1000
+
+typedef enum {
+    TRIG_PROXY_UP = 0,
+    TRIG_PROXY_DOWN,
+    TRIG_LIGHT_STATUS,
+    TRIG_TIMER,
+    TRIG_INPUT,
+    TRIG_CUE_DONE,
+    TRIG_COUNT,
+} trigger_t;
+
+static const char *const k_trigger_names[TRIG_COUNT] = {
+    "proxy_up", "proxy_down", "light_status", "timer", "input", "cue_done",
+};
+
+typedef struct {
+    trigger_t trigger;
+    uint16_t unicast;           // light_status: 0 = any light
+    bool connected;             // light_status
+    int64_t period_us;          // timer
+    int64_t next_us;            // timer
+    char name[NAME_LEN];        // input
+    double min;                 // input threshold
+    bool armed;                 // input: value was below min last time
+    int cue;                    // cue_done: -1 = any cue
+    int64_t cooldown_us;
+    int64_t last_fired_us;
+    uint32_t fired;             // Actions that applied
+    uint32_t suppressed;        // Matches held off by the cooldown
+    cJSON *action;              // Owned
+} rule_t;
+
+typedef struct {
+    trigger_t trigger;
+    uint16_t unicast;
+    bool connected;
+    char name[NAME_LEN];
+    double value;
+    int cue;
+} rule_event_t;
+
+// An action on its way to the dispatcher, with the rule it came from
+typedef struct {
+    cJSON *action;              // Owned copy; the table may change meanwhile
+    int index;
+    uint32_t generation;
+    trigger_t trigger;
+} rule_work_t;
+
+static rule_t s_rules[RULES_MAX];
+static int s_count = 0;
+static uint32_t s_generation = 0;   // Bumped whenever the table is replaced
+static SemaphoreHandle_t s_mutex = NULL;
+static QueueHandle_t s_queue = NULL;
+static uint32_t s_dropped = 0;
+
+// Last reported states, to turn repeats into edges
+static int s_proxy_up = -1;
+static struct {
+    uint16_t unicast;
+    bool connected;
+} s_light_state[MAX_LIGHTS];
+
+// MARK: - Table
+
+static int trigger_from_name(const char *name)
+{
+    for (int i = 0; i < TRIG_COUNT; i++) {
+        if (strcmp(name, k_trigger_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static void clear_locked(void)
+{
+    for (int i = 0; i < s_count; i++) {
+        cJSON_Delete(s_rules[i].action);
+    }
+    memset(s_rules, 0, sizeof(s_rules));
+    s_count = 0;
+}
+
+static bool parse_rule(const cJSON *j, rule_t *r, int64_t now)
+{
+    cJSON *on = cJSON_GetObjectItem(j, "on");
+    cJSON *act = cJSON_GetObjectItem(j, "do");
+    if (!on || !cJSON_IsString(on) || !act || !cJSON_IsObject(act)) return false;
+    if (!cJSON_IsString(cJSON_GetObjectItem(act, "cmd"))) return false;
+
+    int trig = trigger_from_name(on->valuestring);
+    if (trig < 0) return false;
+
+    memset(r, 0, sizeof(*r));
+    r->trigger = (trigger_t)trig;
+
+    cJSON *v;
+    switch (r->trigger) {
+    case TRIG_LIGHT_STATUS:
+        v = cJSON_GetObjectItem(j, "unicast");
+        r->unicast = (v && cJSON_IsNumber(v)) ? (uint16_t)v->valueint : 0;
+        r->connected = cJSON_IsTrue(cJSON_GetObjectItem(j, "connected"));
+        break;
+    case TRIG_TIMER:
+        v = cJSON_GetObjectItem(j, "every_ms");
+        if (!v || !cJSON_IsNumber(v) || v->valuedouble < TIMER_MIN_MS) return false;
+        r->period_us = (int64_t)v->valuedouble * 1000;
+        r->next_us = now + r->period_us;
+        break;
+    case TRIG_INPUT:
+        v = cJSON_GetObjectItem(j, "name");
+        if (!v || !cJSON_IsString(v)) return false;
+        strncpy(r->name, v->valuestring, sizeof(r->name) - 1);
+        v = cJSON_GetObjectItem(j, "min");
+        r->min = (v && cJSON_IsNumber(v)) ? v->valuedouble : 0.5;
+        r->armed = true;
+        break;
+    case TRIG_CUE_DONE:
+        v = cJSON_GetObjectItem(j, "cue");
+        r->cue = (v && cJSON_IsNumber(v)) ? v->valueint : -1;
+        break;
+    default:
+        break;
+    }
+
+    v = cJSON_GetObjectItem(j, "cooldown_ms");
+    if (v && cJSON_IsNumber(v) && v->valuedouble > 0) {
+        r->cooldown_us = (int64_t)v->valuedouble * 1000;
+    }
+
+    r->action = cJSON_Duplicate(act, 1);
+    return r->action != NULL;
+}
+
+static esp_err_t save_table(const cJSON *rules)
+{
+    char *text = cJSON_PrintUnformatted(rules);
+    if (!text) return ESP_ERR_NO_MEM;
+
+    esp_err_t err = ESP_ERR_INVALID_SIZE;
+    if (strlen(text) < NVS_MAX_LEN) {
+        nvs_handle_t nvs;
+        err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+        if (err == ESP_OK) {
+            err = nvs_set_str(nvs, NVS_KEY, text);
+            if (err == ESP_OK) err = nvs_commit(nvs);
+            nvs_close(nvs);
+        }
+    }
+    cJSON_free(text);
+    return err;
+}
+
+esp_err_t rules_set(const cJSON *rules, bool save)
+{
+    if (!s_mutex || !cJSON_IsArray(rules)) return ESP_ERR_INVALID_ARG;
+    int n = cJSON_GetArraySize(rules);
+    if (n > RULES_MAX) return ESP_ERR_INVALID_SIZE;
+
+    // Parse everything before touching the live table
+    static rule_t parsed[RULES_MAX];
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < n; i++) {
+        if (!parse_rule(cJSON_GetArrayItem(rules, i), &parsed[i], now)) {
+            for (int k = 0; k < i; k++) cJSON_Delete(parsed[k].action);
+            ESP_LOGW(TAG, "Rule %d is invalid, table unchanged", i);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    clear_locked();
+    memcpy(s_rules, parsed, n * sizeof(rule_t));
+    s_count = n;
+    s_generation++;
+    xSemaphoreGive(s_mutex);
+
+    ESP_LOGI(TAG, "%d rule(s) installed", n);
+    return save ? save_table(rules) : ESP_OK;
+}
+
+static void load_table(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) return;
+
+    size_t len = 0;
+    char *text = NULL;
+    if (nvs_get_str(nvs, NVS_KEY, NULL, &len) == ESP_OK && len > 0 && (text = malloc(len))) {
+        if (nvs_get_str(nvs, NVS_KEY, text, &len) != ESP_OK) text[0] = '\0';
+    }
+    nvs_close(nvs);
+    if (!text) return;
+
+    cJSON *rules = cJSON_Parse(text);
+    free(text);
+    if (rules) {
+        rules_set(rules, false);
+        cJSON_Delete(rules);
+    }
+}
+
+// MARK: - Evaluation
+
+static bool matches(rule_t *r, const rule_event_t *ev)
+{
+    if (r->trigger != ev->trigger) return false;
+    switch (r->trigger) {
+    case TRIG_LIGHT_STATUS:
+        return (!r->unicast || r->unicast == ev->unicast) && r->connected == ev->connected;
+    case TRIG_INPUT: {
+        if (strcmp(r->name, ev->name) != 0) return false;
+        // Rising edge through the threshold
+        bool above = ev->value >= r->min;
+        bool fire = above && r->armed;
+        r->armed = !above;
+        return fire;
+    }
+    case TRIG_CUE_DONE:
+        return r->cue < 0 || r->cue == ev->cue;
+    default:
+        return true;
+    }
+}
+
+// Runs on the dispatcher, like a command from the phone
+static void run_action(void *arg)
+{
+    rule_work_t *w = arg;
+    if (command_apply_action(w->action)) {
+        xSemaphoreTake(s_mutex, portMAX_DELAY);
+        if (w->generation == s_generation) s_rules[w->index].fired++;
+        xSemaphoreGive(s_mutex);
+
+        char body[64];
+        snprintf(body, sizeof(body), "\"rule\":%d,\"on\":\"%s\"", w->index,
+                 k_trigger_names[w->trigger]);
+        ws_server_send_event("rule_fired", body);
+    } else {
+        ESP_LOGW(TAG, "Rule %d: action not applied", w->index);
+    }
+    cJSON_Delete(w->action);
+    free(w);
+}
+
+// Hand the action to the dispatcher. false if the cooldown held it off or
+// it couldn't be queued.
+static bool fire(rule_t *r, int index, int64_t now)
+{
+    if (r->cooldown_us && r->last_fired_us && now - r->last_fired_us < r->cooldown_us) {
+        r->suppressed++;
+        return false;
+    }
+    r->last_fired_us = now;
+
+    rule_work_t *w = malloc(sizeof(*w));
+    if (!w) return false;
+    *w = (rule_work_t) {
+        .action = cJSON_Duplicate(r->action, 1),
+        .index = index,
+        .generation = s_generation,
+        .trigger = r->trigger,
+    };
+    if (!w->action || ws_server_queue_work(run_action, w) != ESP_OK) {
+        ESP_LOGW(TAG, "Rule %d: dispatcher unavailable", index);
+        cJSON_Delete(w->action);
+        free(w);
+        return false;
+    }
+    return true;
+}
+
+// Repeated statuses (every light is re-announced when a proxy comes up)
+// aren't changes
+static bool light_changed(uint16_t unicast, bool connected)
+{
+    int free_slot = -1;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (s_light_state[i].unicast == unicast) {
+            bool changed = s_light_state[i].connected != connected;
+            s_light_state[i].connected = connected;
+            return changed;
+        }
+        if (!s_light_state[i].unicast && free_slot < 0) free_slot = i;
+    }
+    if (free_slot >= 0) {
+        s_light_state[free_slot].unicast = unicast;
+        s_light_state[free_slot].connected = connected;
+    }
+    return true;
+}
+
+static void handle_event(const rule_event_t *ev, int64_t now)
+{
+    if (ev->trigger == TRIG_LIGHT_STATUS && !light_changed(ev->unicast, ev->connected)) return;
+    if (ev->trigger == TRIG_PROXY_UP || ev->trigger == TRIG_PROXY_DOWN) {
+        int up = ev->trigger == TRIG_PROXY_UP;
+        if (up == s_proxy_up) return;
+        s_proxy_up = up;
+    }
+
+    int actions = 0;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    for (int i = 0; i < s_count && actions < RULES_ACTIONS_PER_EVENT; i++) {
+        if (matches(&s_rules[i], ev) && fire(&s_rules[i], i, now)) actions++;
+    }
+    xSemaphoreGive(s_mutex);
+}
+
+// Fire due timers; returns ms until the next one
+static int run_timers(int64_t now)
+{
+    int64_t wait = (int64_t)IDLE_WAIT_MS * 1000;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    for (int i = 0; i < s_count; i++) {
+        rule_t *r = &s_rules[i];
+        if (r->trigger != TRIG_TIMER) continue;
+        if (now >= r->next_us) {
+            fire(r, i, now);
+            // Skip missed periods rather than firing a burst
+            r->next_us += ((now - r->next_us) / r->period_us + 1) * r->period_us;
+        }
+        if (r->next_us - now < wait) wait = r->next_us - now;
+    }
+    xSemaphoreGive(s_mutex);
+    return (int)(wait / 1000) + 1;
+}
+
+static void rules_task(void *arg)
+{
+    int wait_ms = IDLE_WAIT_MS;
+    while (1) {
+        rule_event_t ev;
+        bool got = xQueueReceive(s_queue, &ev, pdMS_TO_TICKS(wait_ms)) == pdTRUE;
+        int64_t now = esp_timer_get_time();
+        if (got) handle_event(&ev, now);
+        wait_ms = run_timers(now);
+    }
+}
+
+// MARK: - Public
+
+static void post(const rule_event_t *ev)
+{
+    if (!s_queue) return;
+    if (xQueueSend(s_queue, ev, 0) != pdTRUE) s_dropped++;
+}
+
+void rules_post_proxy(bool up)
+{
+    rule_event_t ev = { .trigger = up ? TRIG_PROXY_UP : TRIG_PROXY_DOWN };
+    post(&ev);
+}
+
+void rules_post_light(uint16_t unicast, bool connected)
+{
+    rule_event_t ev = { .trigger = TRIG_LIGHT_STATUS, .unicast = unicast, .connected = connected };
+    post(&ev);
+}
+
+void rules_post_input(const char *name, double value)
+{
+    rule_event_t ev = { .trigger = TRIG_INPUT, .value = value };
+    strncpy(ev.name, name, sizeof(ev.name) - 1);
+    post(&ev);
+}
+
+void rules_post_cue_done(int cue)
+{
+    rule_event_t ev = { .trigger = TRIG_CUE_DONE, .cue = cue };
+    post(&ev);
+}
+
+void rules_report(void)
+{
+    // Two counts of up to 10 digits per rule fit
+    char body[64 + RULES_MAX * 24];
+    int pos = snprintf(body, sizeof(body), "\"count\":%d,\"dropped\":%lu,\"fired\":[",
+                       s_count, (unsigned long)s_dropped);
+    if (s_mutex) xSemaphoreTake(s_mutex, portMAX_DELAY);
+    for (int i = 0; i < s_count; i++) {
+        pos += snprintf(body + pos, sizeof(body) - pos, "%s%lu", i ? "," : "",
+                        (unsigned long)s_rules[i].fired);
+    }
+    pos += snprintf(body + pos, sizeof(body) - pos, "],\"suppressed\":[");
+    for (int i = 0; i < s_count; i++) {
+        pos += snprintf(body + pos, sizeof(body) - pos, "%s%lu", i ? "," : "",
+                        (unsigned long)s_rules[i].suppressed);
+    }
+    if (s_mutex) xSemaphoreGive(s_mutex);
+    snprintf(body + pos, sizeof(body) - pos, "]");
+    ws_server_send_event("rules", body);
+}
+
+esp_err_t rules_init(void)
+{
+    s_mutex = xSemaphoreCreateMutex();
+    s_queue = xQueueCreate(QUEUE_LEN, sizeof(rule_event_t));
+    if (!s_mutex || !s_queue) return ESP_ERR_NO_MEM;
+
+    load_table();
+
+    if (xTaskCreate(rules_task, "rules", 4096, NULL, 5, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Rules engine running, %d rule(s)", s_count);
+    return ESP_OK;
+}
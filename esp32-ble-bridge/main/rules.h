@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+// Rules that react on the bridge, without a round trip to the phone.
+//
+// {"cmd":"rules","rules":[rule, ...]} replaces the table and saves it to
+// NVS; {"cmd":"rules"} alone reports it. A rule is a trigger plus "do",
+// a lighting command as the phone would send it (set_cct, set_hsi, sleep,
+// set_effect, start_effect, stop_effect, stop_all, cue_go):
+//   {"on":"proxy_up"|"proxy_down", "do":{...}}
+//   {"on":"light_status", "unicast":N (optional), "connected":bool, "do":{...}}
+//   {"on":"timer", "every_ms":N, "do":{...}}
+//   {"on":"input", "name":"btn1", "min":X (default 0.5), "do":{...}}
+//   {"on":"cue_done", "cue":N (optional), "do":{...}}
+// "cooldown_ms" holds a rule off after it fires. Input rules fire when the
+// value rises to "min" or above. Values come from {"cmd":"input",
+// "name","value"}, which an OSC, DMX or button integration sends.
+// cue_done rules fire when a GO's fade has finished (cue_player.h), so a
+// rule can chain cues with {"cmd":"cue_go"}.
+//
+// Producers only queue events. The rules task checks at most RULES_MAX
+// rules per event and hands at most RULES_ACTIONS_PER_EVENT actions to the
+// command dispatcher (ws_server_queue_work), where they run in turn with
+// the phone's commands, so one event costs a bounded few milliseconds.
+// Each action that applies sends a "rule_fired" event. The "rules" event
+// counts, per rule, the actions that applied ("fired") and the matches the
+// cooldown held off ("suppressed").
+
+#define RULES_MAX 16
+#define RULES_ACTIONS_PER_EVENT 4
+
+esp_err_t rules_init(void);
+
+// Replace the table from a JSON array; optionally save it
+esp_err_t rules_set(const cJSON *rules, bool save);
+
+// Send the "rules" event
+void rules_report(void);
+
+// Event sources. Safe from any task; they never block.
+void rules_post_proxy(bool up);
+void rules_post_light(uint16_t unicast, bool connected);
+void rules_post_input(const char *name, double value);
+void rules_post_cue_done(int cue);
@@ -0,0 +1,125 @@
+/*
+ * show_codec.c
+ *
+ * Incremental LZSS (heatshrink format) decoder over a pull callback.
+ */
+
+#include "show_codec.h"
+#include <string.h>
+
+// MARK: - Input
+
+static int next_byte(show_decoder_t *d)
+{
+    if (d->in_pos >= d->in_len) {
+        int n = d->pull(d->ctx, d->in, sizeof(d->in));
+        if (n <= 0) {
+            if (n < 0) d->error = true;
+            return -1;
+        }
+        d->in_len = n;
+        d->in_pos = 0;
+    }
+    return d->in[d->in_pos++];
+}
+
+// Next `count` bits, MSB first; -1 at the end of input
+static int get_bits(show_decoder_t *d, int count)
+{
+    int v = 0;
+    for (int i = 0; i < count; i++) {
+        if (d->bits_left == 0) {
+            int b = next_byte(d);
+            if (b < 0) return -1;
+            d->bit_buf = (uint8_t)b;
+            d->bits_left = 8;
+        }
+        d->bits_left--;
+        v = (v << 1) | ((d->bit_buf >> d->bits_left) & 1);
+    }
+    return v;
+}
+
+// MARK: - Public
+
+bool show_codec_params_valid(show_codec_t codec, uint32_t window_sz2, uint32_t lookahead_sz2)
+{
+    if (codec == SHOW_CODEC_RAW) return true;
+    if (codec != SHOW_CODEC_LZSS) return false;
+    return window_sz2 >= 4 && window_sz2 <= SHOW_CODEC_MAX_WINDOW_SZ2 &&
+           lookahead_sz2 >= 3 && lookahead_sz2 < window_sz2;
+}
+
+esp_err_t show_decoder_init(show_decoder_t *d, show_codec_t codec, int window_sz2,
+                            int lookahead_sz2, show_codec_pull_t pull, void *ctx)
+{
+    if (!show_codec_params_valid(codec, window_sz2, lookahead_sz2)) return ESP_ERR_INVALID_ARG;
+
+    memset(d, 0, sizeof(*d));
+    d->codec = codec;
+    d->window_sz2 = (uint8_t)window_sz2;
+    d->lookahead_sz2 = (uint8_t)lookahead_sz2;
+    d->pull = pull;
+    d->ctx = ctx;
+    return ESP_OK;
+}
+
+int show_decoder_read(show_decoder_t *d, uint8_t *out, int len)
+{
+    int n = 0;
+
+    if (d->codec == SHOW_CODEC_RAW) {
+        while (n < len) {
+            int b = next_byte(d);
+            if (b < 0) break;
+            out[n++] = (uint8_t)b;
+        }
+        return d->error ? -1 : n;
+    }
+
+    const uint16_t mask = (uint16_t)((1 << d->window_sz2) - 1);
+    while (n < len) {
+        uint8_t c;
+        if (d->copy_left) {
+            c = d->window[(uint16_t)(d->head - d->copy_offset) & mask];
+            d->copy_left--;
+        } else {
+            int tag = get_bits(d, 1);
+            if (tag < 0) break;
+            if (tag) {
+                int lit = get_bits(d, 8);
+                if (lit < 0) break;
+                c = (uint8_t)lit;
+            } else {
+                int index = get_bits(d, d->window_sz2);
+                int count = index < 0 ? -1 : get_bits(d, d->lookahead_sz2);
+                if (count < 0) break;
+                d->copy_offset = (uint16_t)(index + 1);
+                d->copy_left = (uint16_t)(count + 1);
+                continue;
+            }
+        }
+        d->window[d->head++ & mask] = c;
+        out[n++] = c;
+    }
+    return d->error ? -1 : n;
+}
+
+esp_err_t show_varint_read(show_byte_read_t read, void *ctx, uint32_t *value)
+{
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t b;
+        int n = read(ctx, &b);
+        if (n < 0) return ESP_ERR_INVALID_STATE;
+        if (n == 0) return shift == 0 ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_SIZE;
+        // The fifth byte only has four bits left
+        if (shift == 28 && b > 0x0F) return ESP_ERR_INVALID_SIZE;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *value = v;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_SIZE;
+}
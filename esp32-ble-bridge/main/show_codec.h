@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Streaming decoder for compressed show assets.
+//
+// LZSS as heatshrink writes it: a stream of MSB-first bit fields, each
+// either 1 + literal byte, or 0 + (offset - 1) in window_sz2 bits + (count
+// - 1) in lookahead_sz2 bits, copying count bytes from offset back in the
+// output. The final byte is zero-padded. The decoder only keeps the window
+// (2^window_sz2 bytes), so assets never have to fit in RAM.
+//
+// Event tables go through a delta + varint step before compression (see
+// show_varint_read): sorted timestamps become small deltas, and similar
+// deltas compress well.
+
+typedef enum {
+    SHOW_CODEC_RAW = 0,
+    SHOW_CODEC_LZSS = 1,
+} show_codec_t;
+
+#define SHOW_CODEC_MAX_WINDOW_SZ2   10
+#define SHOW_CODEC_IN_CHUNK         64
+
+// Fills buf with up to max compressed bytes; returns the count, 0 at the
+// end of input, < 0 on error
+typedef int (*show_codec_pull_t)(void *ctx, uint8_t *buf, int max);
+
+typedef struct {
+    show_codec_t codec;
+    uint8_t window_sz2;
+    uint8_t lookahead_sz2;
+    show_codec_pull_t pull;
+    void *ctx;
+
+    uint8_t in[SHOW_CODEC_IN_CHUNK];
+    int in_len;
+    int in_pos;
+    uint8_t bit_buf;
+    int bits_left;
+
+    uint8_t window[1 << SHOW_CODEC_MAX_WINDOW_SZ2];
+    uint16_t head;
+    uint16_t copy_offset;
+    uint16_t copy_left;
+    bool error;
+} show_decoder_t;
+
+// Window 2^4..2^10 bytes, lookahead 2^3 up to below the window
+bool show_codec_params_valid(show_codec_t codec, uint32_t window_sz2, uint32_t lookahead_sz2);
+
+// ESP_ERR_INVALID_ARG for an unknown codec or window/lookahead out of range
+esp_err_t show_decoder_init(show_decoder_t *d, show_codec_t codec, int window_sz2,
+                            int lookahead_sz2, show_codec_pull_t pull, void *ctx);
+
+// Decode up to len bytes; returns the count (short only at the end of
+// input), or < 0 if the input could not be read
+int show_decoder_read(show_decoder_t *d, uint8_t *out, int len);
+
+// MARK: - Varints
+
+// Signed deltas are zigzag mapped before the varint step, so small values
+// of either sign stay short: 0, -1, 1, -2, 2 ... become 0, 1, 2, 3, 4 ...
+static inline uint32_t show_zigzag_encode(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (0u - ((uint32_t)v >> 31));
+}
+
+static inline int32_t show_zigzag_decode(uint32_t zz)
+{
+    return (int32_t)((zz >> 1) ^ (0u - (zz & 1)));
+}
+
+// One decoded byte for show_varint_read: 1, 0 at the end, < 0 on error
+typedef int (*show_byte_read_t)(void *ctx, uint8_t *b);
+
+// Next LEB128 varint, at most 5 bytes for 32 bits. ESP_ERR_NOT_FOUND at
+// the end of input, ESP_ERR_INVALID_SIZE on a truncated or overlong one,
+// ESP_ERR_INVALID_STATE if the read failed.
+esp_err_t show_varint_read(show_byte_read_t read, void *ctx, uint32_t *value);
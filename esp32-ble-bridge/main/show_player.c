@@ -0,0 +1,244 @@
+/*
+ * show_player.c
+ *
+ * Stored shows: the scene asset loaded into the cue player, and the
+ * timeline asset streamed as timed GOs.
+ */
+
+#include "show_player.h"
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "show_store.h"
+#include "cue_player.h"
+#include "ws_server.h"
+
+static const char *TAG = "show";
+
+// Longest sleep between checks; the next record is usually sooner
+#define MAX_WAIT_MS     1000
+
+static SemaphoreHandle_t s_mutex = NULL;
+static TaskHandle_t s_task = NULL;
+
+static show_store_reader_t s_scenes;    // Only open during a load
+static show_store_reader_t s_timeline;
+
+static bool s_playing = false;
+static int64_t s_start_us = 0;
+static int32_t s_next_ms = 0;           // Time of the record read ahead
+static uint32_t s_next_cue = 0;
+static uint32_t s_events = 0;           // Records played since the start
+static int s_last_cue = -1;
+
+// MARK: - Timeline
+
+static esp_err_t next_varint(void *ctx, uint32_t *value)
+{
+    return show_store_next_varint(ctx, value);
+}
+
+// Read the next record; ESP_ERR_NOT_FOUND at the end of the timeline
+static esp_err_t advance_locked(void)
+{
+    uint32_t cue;
+    esp_err_t err = show_store_next_delta(&s_timeline, &s_next_ms);
+    if (err != ESP_OK) return err;
+    err = show_store_next_varint(&s_timeline, &cue);
+    if (err == ESP_ERR_NOT_FOUND) return ESP_ERR_INVALID_SIZE;
+    if (err == ESP_OK) s_next_cue = cue;
+    return err;
+}
+
+static void report_locked(char *body, size_t len)
+{
+    snprintf(body, len, "\"playing\":%s,\"events\":%lu,\"cue\":%d",
+             s_playing ? "true" : "false", (unsigned long)s_events, s_last_cue);
+}
+
+// GO every record that is due. Returns false once the show is over.
+static bool play_due_locked(int64_t now)
+{
+    while (now >= s_start_us + (int64_t)s_next_ms * 1000) {
+        if (cue_player_go((int)s_next_cue) != ESP_OK) {
+            ESP_LOGW(TAG, "Record %lu: no cue %lu", (unsigned long)s_events,
+                     (unsigned long)s_next_cue);
+        }
+        s_last_cue = (int)s_next_cue;
+        s_events++;
+
+        esp_err_t err = advance_locked();
+        if (err == ESP_OK) continue;
+        s_playing = false;
+        if (err == ESP_ERR_NOT_FOUND) {
+            ESP_LOGI(TAG, "Show done after %lu record(s)", (unsigned long)s_events);
+        } else {
+            ESP_LOGW(TAG, "Timeline unreadable: %s", esp_err_to_name(err));
+            ws_server_notify_error("show: timeline replaced or damaged");
+        }
+        return false;
+    }
+    return true;
+}
+
+static void show_task(void *arg)
+{
+    char body[96];
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        bool ended = false;
+
+        xSemaphoreTake(s_mutex, portMAX_DELAY);
+        if (s_playing) {
+            int64_t now = esp_timer_get_time();
+            if (play_due_locked(now)) {
+                int64_t due_ms = (s_start_us + (int64_t)s_next_ms * 1000 - now + 999) / 1000;
+                if (due_ms > MAX_WAIT_MS) due_ms = MAX_WAIT_MS;
+                wait = pdMS_TO_TICKS(due_ms);
+                if (wait == 0) wait = 1;
+            } else {
+                report_locked(body, sizeof(body));
+                ended = true;
+            }
+        }
+        xSemaphoreGive(s_mutex);
+
+        if (ended) ws_server_send_event("show", body);
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+// MARK: - Public
+
+esp_err_t show_player_load(void)
+{
+    if (!s_mutex) return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    esp_err_t err = show_store_open(SHOW_STORE_SCENES, &s_scenes);
+    if (err == ESP_OK) err = cue_player_load_binary(next_varint, &s_scenes);
+    xSemaphoreGive(s_mutex);
+    return err;
+}
+
+esp_err_t show_player_play(void)
+{
+    if (!s_mutex || !s_task) return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = show_player_load();
+    if (err != ESP_OK) return err;
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    err = show_store_open(SHOW_STORE_TIMELINE, &s_timeline);
+    if (err == ESP_OK) {
+        s_next_ms = 0;
+        s_events = 0;
+        s_last_cue = -1;
+        err = advance_locked();
+        // An empty timeline is a show that is already over
+        s_playing = err == ESP_OK;
+        if (err == ESP_ERR_NOT_FOUND) err = ESP_OK;
+        s_start_us = esp_timer_get_time();
+    }
+    xSemaphoreGive(s_mutex);
+
+    if (err != ESP_OK) return err;
+    ESP_LOGI(TAG, "Show started");
+    xTaskNotifyGive(s_task);
+    show_player_report();
+    return ESP_OK;
+}
+
+void show_player_stop(void)
+{
+    if (!s_mutex) return;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    bool was_playing = s_playing;
+    s_playing = false;
+    xSemaphoreGive(s_mutex);
+
+    if (!was_playing) return;
+    cue_player_stop();
+    show_player_report();
+}
+
+void show_player_snapshot(show_snapshot_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->last_cue = -1;
+    if (!s_mutex) return;
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    if (s_playing) {
+        int64_t elapsed = (esp_timer_get_time() - s_start_us) / 1000;
+        out->playing = 1;
+        out->last_cue = (int16_t)s_last_cue;
+        out->generation = s_timeline.generation;
+        out->events = s_events;
+        out->elapsed_ms = elapsed < 0 ? 0 : (uint32_t)elapsed;
+    }
+    xSemaphoreGive(s_mutex);
+}
+
+esp_err_t show_player_resume(const show_snapshot_t *snap)
+{
+    if (!s_mutex || !s_task) return ESP_ERR_INVALID_STATE;
+    if (!snap->playing) return ESP_OK;
+
+    esp_err_t err = show_player_load();
+    if (err != ESP_OK) return err;
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    err = show_store_open(SHOW_STORE_TIMELINE, &s_timeline);
+    if (err == ESP_OK && s_timeline.generation != snap->generation) err = ESP_ERR_INVALID_STATE;
+    if (err == ESP_OK) {
+        // The record after the last one played is the one read ahead
+        s_next_ms = 0;
+        for (uint32_t i = 0; i <= snap->events && err == ESP_OK; i++) {
+            err = advance_locked();
+        }
+        s_events = snap->events;
+        s_last_cue = snap->last_cue;
+        s_playing = err == ESP_OK;
+        if (err == ESP_ERR_NOT_FOUND) err = ESP_OK;     // Nothing was left
+        s_start_us = esp_timer_get_time() - (int64_t)snap->elapsed_ms * 1000;
+    }
+    bool playing = s_playing;
+    xSemaphoreGive(s_mutex);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Show not resumed: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Show resumed at %lu ms, record %lu", (unsigned long)snap->elapsed_ms,
+             (unsigned long)snap->events);
+    if (playing) xTaskNotifyGive(s_task);
+    show_player_report();
+    return ESP_OK;
+}
+
+void show_player_report(void)
+{
+    char body[96];
+    if (!s_mutex) return;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    report_locked(body, sizeof(body));
+    xSemaphoreGive(s_mutex);
+    ws_server_send_event("show", body);
+}
+
+esp_err_t show_player_init(void)
+{
+    s_mutex = xSemaphoreCreateMutex();
+    if (!s_mutex) return ESP_ERR_NO_MEM;
+
+    if (xTaskCreate(show_task, "show", 3072, NULL, 5, &s_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
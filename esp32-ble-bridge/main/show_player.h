@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Plays a show out of the store (show_store.h): the scene asset is the cue
+// list, in the cue player's binary form (cue_player.h), and the timeline
+// asset says when each cue goes. A timeline is a list of records, each two
+// varints: the time in ms as a zigzag delta from the previous record's
+// (the first from the start of the show), then the cue index. Records are
+// read one ahead while playing, so a show of any length plays through one
+// store reader.
+//
+// {"cmd":"show_load"} loads the scenes into the cue player, for GOs by
+// hand. {"cmd":"show_play"} loads them and runs the timeline from the
+// start; {"cmd":"show_stop"} ends it and holds the lights where they are.
+// "show" events report {"playing","events","cue"}: records played and the
+// last cue they ran. A timeline replaced or damaged while playing ends the
+// show with an error.
+
+esp_err_t show_player_init(void);
+
+// Load the scene asset into the cue player. ESP_ERR_NOT_FOUND if none was
+// uploaded, otherwise what cue_player_load_binary returns.
+esp_err_t show_player_load(void);
+
+// Load the scenes and play the timeline from its start
+esp_err_t show_player_play(void);
+
+void show_player_stop(void);
+
+// Send the "show" event
+void show_player_report(void);
+
+// Warm restart (checkpoint.h): where a playing show had got to
+typedef struct {
+    uint8_t playing;
+    int16_t last_cue;               // -1 for none
+    uint32_t generation;            // Of the timeline asset being played
+    uint32_t events;                // Records played
+    uint32_t elapsed_ms;            // Since the start of the show
+} show_snapshot_t;
+
+// Zeroes out first, so it can go into a CRC as it is
+void show_player_snapshot(show_snapshot_t *out);
+
+// Carry on a show from a snapshot: load the scenes again, reopen the
+// timeline, read past the records already played and keep the start where
+// elapsed_ms puts it. ESP_ERR_INVALID_STATE if the timeline was replaced
+// since; a snapshot of a stopped show does nothing.
+esp_err_t show_player_resume(const show_snapshot_t *snap);
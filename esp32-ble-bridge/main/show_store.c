@@ -0,0 +1,569 @@
+/*
+ * show_store.c
+ *
+ * A/B slots for show assets on the "store" partition, filled by resumable
+ * chunked HTTP uploads, and streamed back through show_codec.
+ */
+
+#include "show_store.h"
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_crc.h"
+#include "esp_timer.h"
+
+#include "show_codec.h"
+#include "ws_server.h"
+
+static const char *TAG = "show_store";
+
+#define SECTOR_SIZE     4096
+#define SLOT_MAGIC      0x53485732  // "SHW2"; "SHOW" slots predate encodings and read as empty
+#define IO_CHUNK        1024
+
+// First bytes of a slot's header sector. Written last; a slot without a
+// valid header is empty.
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t length;
+    uint32_t crc;           // CRC-32 of the content as stored
+    uint8_t encoding;       // show_codec_t
+    uint8_t window_sz2;
+    uint8_t lookahead_sz2;
+    uint8_t reserved;
+    uint32_t raw_length;    // Decoded length
+    uint32_t events;        // Records in the asset, as the uploader counted them
+    uint32_t hdr_crc;       // CRC-32 of the fields above
+} slot_hdr_t;
+
+typedef struct {
+    int active;             // Slot holding the current content, -1 = none
+    uint32_t generation;
+    uint32_t length;
+    uint32_t crc;
+    uint8_t encoding;
+    uint8_t window_sz2;
+    uint8_t lookahead_sz2;
+    uint32_t raw_length;
+    uint32_t events;
+    uint32_t decode_us;     // Time to stream the whole asset through the decoder
+    // Upload into the other slot
+    bool uploading;
+    uint32_t up_length;
+    uint32_t up_crc;
+    slot_hdr_t up_hdr;      // Encoding fields for the commit
+    bool up_check_raw;
+    uint32_t up_raw_crc;    // CRC-32 of the decoded content, if the client sent it
+    uint32_t up_offset;     // Bytes received and checked
+    uint32_t up_erased;     // Bytes from the data start that are erased
+} kind_state_t;
+
+static const char *s_kind_names[SHOW_STORE_KINDS] = { "timeline", "scenes", "wavetables" };
+
+static const esp_partition_t *s_part = NULL;
+static uint32_t s_slot_size = 0;
+static kind_state_t s_kinds[SHOW_STORE_KINDS];
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t s_io[IO_CHUNK];  // Only used from the httpd task
+static show_store_reader_t s_check;   // Whole-asset decode at load and commit
+
+// MARK: - Slots
+
+static uint32_t slot_base(int kind, int slot)
+{
+    return (uint32_t)(kind * 2 + slot) * s_slot_size;
+}
+
+static uint32_t slot_capacity(void)
+{
+    return s_slot_size - SECTOR_SIZE;
+}
+
+static uint32_t hdr_crc(const slot_hdr_t *h)
+{
+    return esp_crc32_le(0, (const uint8_t *)h, offsetof(slot_hdr_t, hdr_crc));
+}
+
+static bool read_hdr(int kind, int slot, slot_hdr_t *h)
+{
+    if (esp_partition_read(s_part, slot_base(kind, slot), h, sizeof(*h)) != ESP_OK) return false;
+    return h->magic == SLOT_MAGIC && h->hdr_crc == hdr_crc(h) && h->length <= slot_capacity();
+}
+
+static esp_err_t open_slot(show_store_reader_t *r, int kind, int slot, uint32_t generation,
+                           const slot_hdr_t *h);
+static uint32_t time_decode(int kind, int slot, const slot_hdr_t *h, uint32_t *raw_crc);
+
+static void load_kind(int kind)
+{
+    kind_state_t *k = &s_kinds[kind];
+    memset(k, 0, sizeof(*k));
+    k->active = -1;
+
+    slot_hdr_t best = { 0 };
+    for (int slot = 0; slot < 2; slot++) {
+        slot_hdr_t h;
+        if (!read_hdr(kind, slot, &h)) continue;
+        if (k->active < 0 || h.generation > k->generation) {
+            k->active = slot;
+            k->generation = h.generation;
+            best = h;
+        }
+    }
+    if (k->active < 0) return;
+
+    k->length = best.length;
+    k->crc = best.crc;
+    k->encoding = best.encoding;
+    k->window_sz2 = best.window_sz2;
+    k->lookahead_sz2 = best.lookahead_sz2;
+    k->raw_length = best.raw_length;
+    k->events = best.events;
+    k->decode_us = time_decode(kind, k->active, &best, NULL);
+    ESP_LOGI(TAG, "%s: %lu bytes, %lu decoded (gen %lu, slot %d, %lu us to decode)",
+             s_kind_names[kind], (unsigned long)k->length, (unsigned long)k->raw_length,
+             (unsigned long)k->generation, k->active, (unsigned long)k->decode_us);
+}
+
+static int staging_slot(const kind_state_t *k)
+{
+    return k->active == 0 ? 1 : 0;
+}
+
+// MARK: - Reader
+
+static int pull_flash(void *ctx, uint8_t *buf, int max)
+{
+    show_store_reader_t *r = ctx;
+    if (r->live) {
+        portENTER_CRITICAL(&s_lock);
+        bool same = s_kinds[r->kind].generation == r->generation;
+        portEXIT_CRITICAL(&s_lock);
+        if (!same) return -1;
+    }
+
+    uint32_t n = r->length - r->pos;
+    if (n > (uint32_t)max) n = max;
+    if (n == 0) return 0;
+    if (esp_partition_read(s_part, r->base + r->pos, buf, n) != ESP_OK) return -1;
+    r->pos += n;
+    return n;
+}
+
+// One decoded byte for the varint reader
+static int read_byte(void *ctx, uint8_t *b)
+{
+    return show_store_stream(ctx, b, 1);
+}
+
+static esp_err_t open_slot(show_store_reader_t *r, int kind, int slot, uint32_t generation,
+                           const slot_hdr_t *h)
+{
+    r->kind = kind;
+    r->generation = generation;
+    r->live = false;
+    r->base = slot_base(kind, slot) + SECTOR_SIZE;
+    r->pos = 0;
+    r->length = h->length;
+    r->raw_left = h->raw_length;
+    return show_decoder_init(&r->dec, h->encoding, h->window_sz2, h->lookahead_sz2, pull_flash, r);
+}
+
+// Stream a whole slot through the decoder. Returns the time taken in us,
+// or UINT32_MAX if it doesn't decode to exactly raw_length bytes.
+static uint32_t time_decode(int kind, int slot, const slot_hdr_t *h, uint32_t *raw_crc)
+{
+    if (open_slot(&s_check, kind, slot, h->generation, h) != ESP_OK) return UINT32_MAX;
+
+    int64_t start = esp_timer_get_time();
+    uint32_t crc = 0;
+    int n;
+    while ((n = show_store_stream(&s_check, s_io, IO_CHUNK)) > 0) {
+        if (raw_crc) crc = esp_crc32_le(crc, s_io, n);
+    }
+    if (n < 0 || s_check.raw_left != 0) return UINT32_MAX;
+    if (raw_crc) *raw_crc = crc;
+    return (uint32_t)(esp_timer_get_time() - start);
+}
+
+// MARK: - Upload
+
+static esp_err_t begin_upload(int kind, uint32_t length, uint32_t crc, const slot_hdr_t *enc,
+                              bool check_raw, uint32_t raw_crc)
+{
+    kind_state_t *k = &s_kinds[kind];
+    // Invalidate the staging slot first so a half-written one is never loaded
+    esp_err_t err = esp_partition_erase_range(s_part, slot_base(kind, staging_slot(k)), SECTOR_SIZE);
+    if (err != ESP_OK) return err;
+
+    k->uploading = true;
+    k->up_length = length;
+    k->up_crc = crc;
+    k->up_hdr = *enc;
+    k->up_check_raw = check_raw;
+    k->up_raw_crc = raw_crc;
+    k->up_offset = 0;
+    k->up_erased = 0;
+    return ESP_OK;
+}
+
+static esp_err_t stage_write(int kind, uint32_t pos, const uint8_t *data, size_t len)
+{
+    kind_state_t *k = &s_kinds[kind];
+    uint32_t data_base = slot_base(kind, staging_slot(k)) + SECTOR_SIZE;
+
+    while (pos + len > k->up_erased) {
+        esp_err_t err = esp_partition_erase_range(s_part, data_base + k->up_erased, SECTOR_SIZE);
+        if (err != ESP_OK) return err;
+        k->up_erased += SECTOR_SIZE;
+    }
+    return esp_partition_write(s_part, data_base + pos, data, len);
+}
+
+// A chunk failed part way. Flash can't be rewritten without an erase, so
+// fall back to the start of the sector and erase it again on the resend.
+static void rollback(kind_state_t *k)
+{
+    k->up_offset &= ~(uint32_t)(SECTOR_SIZE - 1);
+    k->up_erased = k->up_offset;
+}
+
+// Check the staged content end to end, then make it active.
+static esp_err_t commit_upload(int kind)
+{
+    kind_state_t *k = &s_kinds[kind];
+    int slot = staging_slot(k);
+    uint32_t data_base = slot_base(kind, slot) + SECTOR_SIZE;
+
+    uint32_t crc = 0;
+    for (uint32_t pos = 0; pos < k->up_length; pos += IO_CHUNK) {
+        uint32_t n = k->up_length - pos < IO_CHUNK ? k->up_length - pos : IO_CHUNK;
+        esp_err_t err = esp_partition_read(s_part, data_base + pos, s_io, n);
+        if (err != ESP_OK) return err;
+        crc = esp_crc32_le(crc, s_io, n);
+    }
+    if (crc != k->up_crc) {
+        ESP_LOGW(TAG, "%s: content CRC %08lx, expected %08lx", s_kind_names[kind],
+                 (unsigned long)crc, (unsigned long)k->up_crc);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    slot_hdr_t h = k->up_hdr;
+    h.magic = SLOT_MAGIC;
+    h.generation = k->generation + 1;
+    h.length = k->up_length;
+    h.crc = crc;
+
+    // Decode it once: proves the stream expands to raw_length (and raw_crc
+    // when given) before it can replace good content, and times it
+    uint32_t raw_crc = 0;
+    uint32_t decode_us = time_decode(kind, slot, &h, &raw_crc);
+    if (decode_us == UINT32_MAX) {
+        ESP_LOGW(TAG, "%s: stream does not decode to %lu bytes", s_kind_names[kind],
+                 (unsigned long)h.raw_length);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (k->up_check_raw && raw_crc != k->up_raw_crc) {
+        ESP_LOGW(TAG, "%s: decoded CRC %08lx, expected %08lx", s_kind_names[kind],
+                 (unsigned long)raw_crc, (unsigned long)k->up_raw_crc);
+        return ESP_ERR_INVALID_CRC;
+    }
+    h.hdr_crc = hdr_crc(&h);
+    esp_err_t err = esp_partition_write(s_part, slot_base(kind, slot), &h, sizeof(h));
+    if (err != ESP_OK) return err;
+
+    portENTER_CRITICAL(&s_lock);
+    k->active = slot;
+    k->generation = h.generation;
+    k->length = h.length;
+    k->crc = h.crc;
+    k->encoding = h.encoding;
+    k->window_sz2 = h.window_sz2;
+    k->lookahead_sz2 = h.lookahead_sz2;
+    k->raw_length = h.raw_length;
+    k->events = h.events;
+    k->decode_us = decode_us;
+    k->uploading = false;
+    portEXIT_CRITICAL(&s_lock);
+
+    ESP_LOGI(TAG, "%s: committed %lu bytes, %lu decoded (gen %lu, %lu us to decode)",
+             s_kind_names[kind], (unsigned long)h.length, (unsigned long)h.raw_length,
+             (unsigned long)h.generation, (unsigned long)decode_us);
+
+    char body[256];
+    snprintf(body, sizeof(body),
+             "\"kind\":\"%s\",\"length\":%lu,\"raw_length\":%lu,\"ratio\":%.2f,"
+             "\"decode_us\":%lu,\"decode_ns_per_event\":%lu,\"generation\":%lu",
+             s_kind_names[kind], (unsigned long)h.length, (unsigned long)h.raw_length,
+             h.length ? (double)h.raw_length / h.length : 1.0, (unsigned long)decode_us,
+             (unsigned long)(h.events ? (uint64_t)decode_us * 1000 / h.events : 0),
+             (unsigned long)h.generation);
+    ws_server_send_event("store_updated", body);
+    return ESP_OK;
+}
+
+// MARK: - HTTP
+
+static int kind_from_uri(const char *uri)
+{
+    const char *name = uri + strlen("/store/");
+    size_t len = strcspn(name, "?");
+    for (int i = 0; i < SHOW_STORE_KINDS; i++) {
+        if (strlen(s_kind_names[i]) == len && strncmp(name, s_kind_names[i], len) == 0) return i;
+    }
+    return -1;
+}
+
+static bool query_u32(const char *query, const char *key, uint32_t *out)
+{
+    char val[16];
+    if (httpd_query_key_value(query, key, val, sizeof(val)) != ESP_OK) return false;
+    char *end;
+    *out = (uint32_t)strtoul(val, &end, 0);
+    return end != val && *end == '\0';
+}
+
+static esp_err_t reply(httpd_req_t *req, const char *status, uint32_t offset, bool done)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"offset\":%lu,\"done\":%s}", (unsigned long)offset,
+             done ? "true" : "false");
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, buf);
+}
+
+static esp_err_t get_handler(httpd_req_t *req)
+{
+    int kind = kind_from_uri(req->uri);
+    if (kind < 0) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "unknown kind");
+
+    kind_state_t k;
+    portENTER_CRITICAL(&s_lock);
+    k = s_kinds[kind];
+    portEXIT_CRITICAL(&s_lock);
+
+    bool have = k.active >= 0;
+    char buf[384];
+    snprintf(buf, sizeof(buf),
+             "{\"kind\":\"%s\",\"length\":%lu,\"crc\":%lu,\"generation\":%lu,"
+             "\"encoding\":\"%s\",\"raw_length\":%lu,\"ratio\":%.2f,\"events\":%lu,"
+             "\"decode_us\":%lu,\"decode_ns_per_event\":%lu,"
+             "\"capacity\":%lu,\"upload\":{\"offset\":%lu,\"length\":%lu}}",
+             s_kind_names[kind], (unsigned long)(have ? k.length : 0),
+             (unsigned long)k.crc, (unsigned long)k.generation,
+             k.encoding == SHOW_CODEC_LZSS ? "lzss" : "raw",
+             (unsigned long)(have ? k.raw_length : 0),
+             have && k.length ? (double)k.raw_length / k.length : 1.0,
+             (unsigned long)k.events, (unsigned long)k.decode_us,
+             (unsigned long)(k.events ? (uint64_t)k.decode_us * 1000 / k.events : 0),
+             (unsigned long)(s_part ? slot_capacity() : 0),
+             (unsigned long)(k.uploading ? k.up_offset : 0),
+             (unsigned long)(k.uploading ? k.up_length : 0));
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, buf);
+}
+
+static esp_err_t put_handler(httpd_req_t *req)
+{
+    int kind = kind_from_uri(req->uri);
+    if (kind < 0) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "unknown kind");
+    if (!s_part) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no store partition");
+
+    char query[256];
+    uint32_t offset, length, crc, chunk_crc;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        !query_u32(query, "offset", &offset) || !query_u32(query, "length", &length) ||
+        !query_u32(query, "crc", &crc) || !query_u32(query, "chunk_crc", &chunk_crc)) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "need offset, length, crc, chunk_crc");
+    }
+    if (length > slot_capacity()) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "larger than the slot");
+    }
+
+    kind_state_t *k = &s_kinds[kind];
+    if (offset == 0) {
+        // Encoding only matters on the first chunk
+        slot_hdr_t enc = { .encoding = SHOW_CODEC_RAW, .raw_length = length };
+        char val[16];
+        uint32_t window = 0, lookahead = 0, raw_crc = 0, events = 0;
+        if (httpd_query_key_value(query, "encoding", val, sizeof(val)) == ESP_OK &&
+            strcmp(val, "raw") != 0) {
+            if (strcmp(val, "lzss") != 0 || !query_u32(query, "window", &window) ||
+                !query_u32(query, "lookahead", &lookahead) ||
+                !query_u32(query, "raw_length", &enc.raw_length)) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                           "lzss needs window, lookahead, raw_length");
+            }
+            if (!show_codec_params_valid(SHOW_CODEC_LZSS, window, lookahead)) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "window or lookahead out of range");
+            }
+            enc.encoding = SHOW_CODEC_LZSS;
+            enc.window_sz2 = (uint8_t)window;
+            enc.lookahead_sz2 = (uint8_t)lookahead;
+        }
+        if (query_u32(query, "events", &events)) enc.events = events;
+        bool check_raw = query_u32(query, "raw_crc", &raw_crc);
+        if (begin_upload(kind, length, crc, &enc, check_raw, raw_crc) != ESP_OK) {
+            return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "erase failed");
+        }
+    } else if (!k->uploading || offset != k->up_offset ||
+               length != k->up_length || crc != k->up_crc) {
+        return reply(req, "409 Conflict", k->uploading ? k->up_offset : 0, false);
+    }
+    if (offset + req->content_len > length) {
+        return reply(req, HTTPD_400, k->up_offset, false);
+    }
+
+    // Stream the body to flash
+    uint32_t pos = offset;
+    uint32_t running = 0;
+    size_t remaining = req->content_len;
+    while (remaining > 0) {
+        int n = httpd_req_recv(req, (char *)s_io, remaining < IO_CHUNK ? remaining : IO_CHUNK);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+        if (n <= 0) {
+            // Connection gone; the client resumes from GET's offset
+            rollback(k);
+            return ESP_FAIL;
+        }
+        if (stage_write(kind, pos, s_io, n) != ESP_OK) {
+            rollback(k);
+            return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "flash write failed");
+        }
+        running = esp_crc32_le(running, s_io, n);
+        pos += n;
+        remaining -= n;
+    }
+
+    if (running != chunk_crc) {
+        rollback(k);
+        return reply(req, HTTPD_400, k->up_offset, false);
+    }
+    k->up_offset = pos;
+
+    if (pos < length) return reply(req, HTTPD_200, pos, false);
+
+    esp_err_t err = commit_upload(kind);
+    if (err != ESP_OK) {
+        k->uploading = false;
+        return reply(req, HTTPD_400, 0, false);
+    }
+    return reply(req, HTTPD_200, pos, true);
+}
+
+// MARK: - Public API
+
+esp_err_t show_store_init(void)
+{
+    s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "store");
+    if (!s_part) {
+        ESP_LOGW(TAG, "No \"store\" partition, uploads disabled");
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_slot_size = (s_part->size / (SHOW_STORE_KINDS * 2)) & ~(uint32_t)(SECTOR_SIZE - 1);
+
+    for (int i = 0; i < SHOW_STORE_KINDS; i++) load_kind(i);
+    ESP_LOGI(TAG, "Store ready: %lu bytes per asset", (unsigned long)slot_capacity());
+    return ESP_OK;
+}
+
+esp_err_t show_store_register(httpd_handle_t server)
+{
+    httpd_uri_t get_uri = {
+        .uri = "/store/*",
+        .method = HTTP_GET,
+        .handler = get_handler,
+    };
+    httpd_uri_t put_uri = {
+        .uri = "/store/*",
+        .method = HTTP_PUT,
+        .handler = put_handler,
+    };
+    esp_err_t err = httpd_register_uri_handler(server, &get_uri);
+    if (err == ESP_OK) err = httpd_register_uri_handler(server, &put_uri);
+    return err;
+}
+
+esp_err_t show_store_info(show_store_kind_t kind, uint32_t *length, uint32_t *generation,
+                          uint32_t *crc)
+{
+    if (kind >= SHOW_STORE_KINDS) return ESP_ERR_INVALID_ARG;
+
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&s_lock);
+    if (s_kinds[kind].active < 0) {
+        err = ESP_ERR_NOT_FOUND;
+    } else {
+        if (length) *length = s_kinds[kind].length;
+        if (generation) *generation = s_kinds[kind].generation;
+        if (crc) *crc = s_kinds[kind].crc;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return err;
+}
+
+esp_err_t show_store_read(show_store_kind_t kind, uint32_t offset, void *buf, size_t len)
+{
+    if (kind >= SHOW_STORE_KINDS) return ESP_ERR_INVALID_ARG;
+
+    portENTER_CRITICAL(&s_lock);
+    int slot = s_kinds[kind].active;
+    uint32_t length = s_kinds[kind].length;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (slot < 0) return ESP_ERR_NOT_FOUND;
+    if (offset + len > length) return ESP_ERR_INVALID_SIZE;
+    return esp_partition_read(s_part, slot_base(kind, slot) + SECTOR_SIZE + offset, buf, len);
+}
+
+esp_err_t show_store_open(show_store_kind_t kind, show_store_reader_t *r)
+{
+    if (kind >= SHOW_STORE_KINDS) return ESP_ERR_INVALID_ARG;
+
+    portENTER_CRITICAL(&s_lock);
+    kind_state_t k = s_kinds[kind];
+    portEXIT_CRITICAL(&s_lock);
+    if (k.active < 0) return ESP_ERR_NOT_FOUND;
+
+    slot_hdr_t h = {
+        .generation = k.generation,
+        .length = k.length,
+        .encoding = k.encoding,
+        .window_sz2 = k.window_sz2,
+        .lookahead_sz2 = k.lookahead_sz2,
+        .raw_length = k.raw_length,
+    };
+    esp_err_t err = open_slot(r, kind, k.active, k.generation, &h);
+    r->live = true;
+    return err;
+}
+
+int show_store_stream(show_store_reader_t *r, void *buf, size_t len)
+{
+    if (len > r->raw_left) len = r->raw_left;
+    if (len == 0) return 0;
+
+    int n = show_decoder_read(&r->dec, buf, (int)len);
+    // Stored bytes ran out before raw_length: truncated or swapped out
+    if (n < (int)len) return -1;
+    r->raw_left -= n;
+    return n;
+}
+
+esp_err_t show_store_next_varint(show_store_reader_t *r, uint32_t *value)
+{
+    return show_varint_read(read_byte, r, value);
+}
+
+esp_err_t show_store_next_delta(show_store_reader_t *r, int32_t *acc)
+{
+    uint32_t zz;
+    esp_err_t err = show_store_next_varint(r, &zz);
+    if (err != ESP_OK) return err;
+    *acc = (int32_t)((uint32_t)*acc + (uint32_t)show_zigzag_decode(zz));
+    return ESP_OK;
+}
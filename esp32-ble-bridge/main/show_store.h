@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "show_codec.h"
+
+// Show asset store on the "store" data partition.
+//
+// Each kind of asset has two slots. Uploads stream into the inactive slot
+// through a fixed buffer, so RAM use doesn't depend on upload size. The
+// slot becomes active only when its header is written after the whole
+// content has checked out, so a dropped or corrupt upload leaves the
+// previous content in place.
+//
+// Assets are stored as the phone encoded them and decoded while they are
+// read (show_codec.h), so a few hundred KB of curves and cue lists fit in
+// the space left beside the factory image. Event tables are written as
+// zigzag varint deltas (show_store_next_delta) before compression.
+//
+// HTTP, on the WebSocket server's port:
+//   GET /store/<kind>
+//       {"kind","length","crc","generation","encoding","raw_length",
+//        "ratio","events","decode_us","decode_ns_per_event","capacity",
+//        "upload":{"offset","length"}}
+//   PUT /store/<kind>?offset=O&length=L&crc=C&chunk_crc=K
+//       Body is the bytes at O of an L-byte asset whose CRC-32 is C; K is
+//       the CRC-32 of this body. offset=0 starts a new upload. Replies
+//       {"offset":next,"done":bool}; on a rejected chunk (409/400) "offset"
+//       is where the client must resume.
+//       The first chunk may add encoding=lzss&window=W&lookahead=A&
+//       raw_length=R (heatshrink -w W -l A output of R bytes), raw_crc
+//       (CRC-32 of the decoded bytes) and events (record count, for the
+//       per-event cost). The commit decodes the asset once to check it and
+//       time it; "store_updated" carries the ratio and decode cost.
+
+typedef enum {
+    SHOW_STORE_TIMELINE = 0,
+    SHOW_STORE_SCENES,
+    SHOW_STORE_WAVETABLES,
+    SHOW_STORE_KINDS,
+} show_store_kind_t;
+
+esp_err_t show_store_init(void);
+
+// Register the /store/* handlers. The server must use
+// httpd_uri_match_wildcard.
+esp_err_t show_store_register(httpd_handle_t server);
+
+// Active content of a kind. ESP_ERR_NOT_FOUND if nothing was uploaded.
+// The generation changes when a new upload is committed; a reader that
+// sees it change must start over (the old slot is reused by the next
+// upload). crc is the CRC-32 of the content as stored, the one the
+// uploader sent. Any out pointer may be NULL.
+esp_err_t show_store_info(show_store_kind_t kind, uint32_t *length, uint32_t *generation,
+                          uint32_t *crc);
+
+// Stored bytes, still encoded; only meaningful for raw assets
+esp_err_t show_store_read(show_store_kind_t kind, uint32_t offset, void *buf, size_t len);
+
+// Sequential decoded reader. About 1.2 KB: the decoder window plus a
+// small flash buffer, whatever the asset size.
+typedef struct {
+    show_store_kind_t kind;
+    uint32_t generation;
+    bool live;              // Fail once a new upload replaces the content
+    uint32_t base;
+    uint32_t pos;           // Stored bytes consumed
+    uint32_t length;
+    uint32_t raw_left;      // Decoded bytes still to come
+    show_decoder_t dec;
+} show_store_reader_t;
+
+esp_err_t show_store_open(show_store_kind_t kind, show_store_reader_t *r);
+
+// Next decoded bytes; returns the count, 0 at the end, or -1 if the
+// content was replaced (open again) or is damaged
+int show_store_stream(show_store_reader_t *r, void *buf, size_t len);
+
+// Next LEB128 varint. ESP_ERR_NOT_FOUND at the end of the asset,
+// ESP_ERR_INVALID_SIZE on a truncated or overlong one, ESP_ERR_INVALID_STATE
+// if the read failed.
+esp_err_t show_store_next_varint(show_store_reader_t *r, uint32_t *value);
+
+// Next zigzag varint, added to *acc: the event table encoding
+esp_err_t show_store_next_delta(show_store_reader_t *r, int32_t *acc);
@@ -0,0 +1,273 @@
+/*
+ * topology.c
+ *
+ * Per-proxy hop counts to each fixture, from heartbeats and received TTLs.
+ */
+
+#include "topology.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "light_registry.h"
+#include "ws_server.h"
+
+static const char *TAG = "topology";
+
+#define DEFAULT_TTL     7           // What every message used before
+#define TTL_MARGIN      1           // Room for a path one hop longer
+#define HB_PERIOD_US    ((1LL << (TOPOLOGY_HB_PERIOD_LOG - 1)) * 1000000)
+#define STALE_US        (3 * HB_PERIOD_US)
+#define SEQ_REORDER     64          // How far back a relayed copy can arrive
+
+// Lower transport CTL opcode of a Heartbeat message
+#define CTL_HEARTBEAT   0x0A
+
+typedef struct {
+    int64_t seen_us;                // 0 = not heard through this link
+    uint8_t hops;                   // 0 = no heartbeat through this link yet
+    int64_t hops_us;                // When hops was measured
+} link_seen_t;
+
+typedef struct {
+    uint16_t unicast;               // 0 = free
+    uint16_t features;              // From the last heartbeat
+    link_seen_t links[TOPOLOGY_MAX_LINKS];
+    int64_t heard_us;               // Last PDU through any link, 0 = unknown
+    uint32_t iv_index;              // Of the newest SEQ heard
+    uint32_t seq;
+} topo_entry_t;
+
+static topo_entry_t s_nodes[MAX_LIGHTS];
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// MARK: - Helpers
+
+static topo_entry_t *find_locked(uint16_t unicast)
+{
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (s_nodes[i].unicast == unicast) return &s_nodes[i];
+    }
+    return NULL;
+}
+
+// Claim a slot, reusing one whose fixture has gone quiet everywhere
+static topo_entry_t *claim_locked(uint16_t unicast, int64_t now)
+{
+    topo_entry_t *e = find_locked(unicast);
+    if (e) return e;
+    for (int i = 0; i < MAX_LIGHTS && !e; i++) {
+        topo_entry_t *c = &s_nodes[i];
+        bool quiet = true;
+        for (int l = 0; l < TOPOLOGY_MAX_LINKS; l++) {
+            if (c->links[l].seen_us && now - c->links[l].seen_us < STALE_US) quiet = false;
+        }
+        if (!c->unicast || quiet) e = c;
+    }
+    if (e) {
+        memset(e, 0, sizeof(*e));
+        e->unicast = unicast;
+    }
+    return e;
+}
+
+static bool fresh(const link_seen_t *s, int64_t now)
+{
+    return s->seen_us && now - s->seen_us < STALE_US;
+}
+
+// Fewest hops over all links, 0 if none measured
+static int best_hops_locked(const topo_entry_t *e, int64_t now, int skip_link)
+{
+    int best = 0;
+    for (int l = 0; l < TOPOLOGY_MAX_LINKS; l++) {
+        const link_seen_t *s = &e->links[l];
+        if (l == skip_link || !fresh(s, now) || !s->hops) continue;
+        if (!best || s->hops < best) best = s->hops;
+    }
+    return best;
+}
+
+// The proxy node forwards with TTL - 1 and only relays from 2 up, so a
+// fixture `hops` out needs TTL `hops`. Never more than the old default.
+static uint8_t ttl_for_hops(int hops)
+{
+    if (!hops) return DEFAULT_TTL;
+    int ttl = hops + TTL_MARGIN;
+    if (ttl < 2) ttl = 2;
+    return ttl < DEFAULT_TTL ? (uint8_t)ttl : DEFAULT_TTL;
+}
+
+// MARK: - Receive
+
+bool topology_note_rx(int link, const mesh_rx_pdu_t *rx)
+{
+    if (link < 0 || link >= TOPOLOGY_MAX_LINKS) return false;
+    if (rx->src == 0 || rx->src >= 0x8000 || rx->src == mesh_crypto_get_src()) return false;
+
+    // Only fixtures we drive; the table is sized for the registry
+    light_entry_t light;
+    if (!light_registry_lookup(rx->src, &light)) return false;
+
+    // Heartbeat: unsegmented CTL, InitTTL (7 bits), Features (16, BE)
+    bool heartbeat = rx->ctl && rx->transport_len >= 4 &&
+                     rx->transport[0] == CTL_HEARTBEAT;
+    int hops = 0;
+    uint16_t features = 0;
+    if (heartbeat) {
+        uint8_t init_ttl = rx->transport[1] & 0x7F;
+        if (rx->ttl > init_ttl) return false;   // Malformed, or not what we set
+        hops = init_ttl - rx->ttl + 1;
+        features = (uint16_t)((rx->transport[2] << 8) | rx->transport[3]);
+    }
+
+    int64_t now = esp_timer_get_time();
+    int old = -1;
+    bool rebooted = false;
+    portENTER_CRITICAL(&s_lock);
+    topo_entry_t *e = claim_locked(rx->src, now);
+    if (e) {
+        // A fixture that lost its SEQ, or that went silent on every link
+        // for three heartbeat periods, was power-cycled
+        if (e->heard_us) {
+            bool seq_reset = rx->iv_index == e->iv_index && rx->seq + SEQ_REORDER < e->seq;
+            rebooted = seq_reset || now - e->heard_us > STALE_US;
+        }
+        if (!e->heard_us || rebooted || rx->iv_index != e->iv_index || rx->seq > e->seq) {
+            e->iv_index = rx->iv_index;
+            e->seq = rx->seq;
+        }
+        e->heard_us = now;
+
+        link_seen_t *s = &e->links[link];
+        s->seen_us = now;
+        if (heartbeat) {
+            old = s->hops;
+            // Several copies of one heartbeat can arrive by different
+            // paths; keep the shortest until the next period
+            if (!s->hops || hops <= s->hops || now - s->hops_us > HB_PERIOD_US / 2) {
+                s->hops = (uint8_t)hops;
+                s->hops_us = now;
+            }
+            e->features = features;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (heartbeat && old >= 0 && old != hops) {
+        ESP_LOGD(TAG, "0x%04X: %d hop(s) via link %d", rx->src, hops, link);
+    }
+    return rebooted;
+}
+
+void topology_link_down(int link)
+{
+    if (link < 0 || link >= TOPOLOGY_MAX_LINKS) return;
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        topo_entry_t *e = &s_nodes[i];
+        memset(&e->links[link], 0, sizeof(link_seen_t));
+
+        // Out of earshot now, so a silence from here on says nothing
+        bool heard = false;
+        for (int l = 0; l < TOPOLOGY_MAX_LINKS; l++) heard |= e->links[l].seen_us != 0;
+        if (!heard) e->heard_us = 0;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+// MARK: - Queries
+
+uint8_t topology_ttl_for(uint16_t unicast)
+{
+    int64_t now = esp_timer_get_time();
+    int best = 0;
+    portENTER_CRITICAL(&s_lock);
+    topo_entry_t *e = find_locked(unicast);
+    if (e) best = best_hops_locked(e, now, -1);
+    portEXIT_CRITICAL(&s_lock);
+    return ttl_for_hops(best);
+}
+
+int topology_hops(uint16_t unicast, int link)
+{
+    if (link < 0 || link >= TOPOLOGY_MAX_LINKS) return -1;
+    int64_t now = esp_timer_get_time();
+    int hops = -1;
+    portENTER_CRITICAL(&s_lock);
+    topo_entry_t *e = find_locked(unicast);
+    if (e && fresh(&e->links[link], now)) hops = e->links[link].hops;
+    portEXIT_CRITICAL(&s_lock);
+    return hops;
+}
+
+int topology_link_exclusive(int link)
+{
+    if (link < 0 || link >= TOPOLOGY_MAX_LINKS) return 0;
+    int64_t now = esp_timer_get_time();
+    int count = 0;
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        topo_entry_t *e = &s_nodes[i];
+        const link_seen_t *s = &e->links[link];
+        if (!e->unicast || !fresh(s, now)) continue;
+
+        bool other = false;
+        for (int l = 0; l < TOPOLOGY_MAX_LINKS && !other; l++) {
+            if (l != link && fresh(&e->links[l], now)) other = true;
+        }
+        int others_best = best_hops_locked(e, now, link);
+        if (!other || (s->hops && others_best && s->hops < others_best)) count++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return count;
+}
+
+// MARK: - Report
+
+void topology_report(void)
+{
+    topo_entry_t nodes[MAX_LIGHTS];
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    memcpy(nodes, s_nodes, sizeof(nodes));
+    portEXIT_CRITICAL(&s_lock);
+
+    size_t max = 64 + MAX_LIGHTS * (96 + TOPOLOGY_MAX_LINKS * 4);
+    char *msg = malloc(max);
+    if (!msg) return;
+
+    int pos = snprintf(msg, max, "{\"event\":\"topology\",\"lights\":[");
+    bool first = true;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        const topo_entry_t *e = &nodes[i];
+        if (!e->unicast) continue;
+
+        int64_t last = 0;
+        for (int l = 0; l < TOPOLOGY_MAX_LINKS; l++) {
+            if (fresh(&e->links[l], now) && e->links[l].seen_us > last) last = e->links[l].seen_us;
+        }
+        if (!last) continue;
+
+        int best = best_hops_locked(e, now, -1);
+        pos += snprintf(msg + pos, max - pos,
+                        "%s{\"unicast\":%u,\"hops\":%d,\"ttl\":%d,\"features\":%u,"
+                        "\"age_s\":%lld,\"links\":[",
+                        first ? "" : ",", e->unicast, best,
+                        ttl_for_hops(best),
+                        e->features, (now - last) / 1000000);
+        for (int l = 0; l < TOPOLOGY_MAX_LINKS; l++) {
+            const link_seen_t *s = &e->links[l];
+            pos += snprintf(msg + pos, max - pos, "%s%d", l ? "," : "",
+                            fresh(s, now) ? s->hops : -1);
+        }
+        pos += snprintf(msg + pos, max - pos, "]}");
+        first = false;
+    }
+    snprintf(msg + pos, max - pos, "]}");
+    ws_server_send(msg);
+    free(msg);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mesh_crypto.h"
+
+// Where each fixture sits in the mesh, as seen through each proxy link.
+//
+// mesh_config turns on periodic heartbeats from every fixture to the
+// bridge. A heartbeat carries the TTL it was sent with, so the TTL it
+// arrives with gives the relay hops between the fixture and the proxy that
+// forwarded it (InitTTL - RxTTL + 1, 1 = the proxy node itself). Any other
+// traffic from a fixture only marks it reachable through that link.
+// Entries older than three heartbeat periods are forgotten.
+//
+// This is what picks the TTL for outgoing messages and which proxy gives
+// way to a hot fixture.
+//
+// {"cmd":"topology"} replies with a "topology" event:
+//   lights: [{unicast, hops, ttl, features, age_s, links: [hops per proxy
+//            slot, 0 = reachable with unknown hops, -1 = not heard]}]
+
+// Heartbeat period the fixtures are configured with: 2^(PERIOD_LOG-1) s
+#define TOPOLOGY_HB_PERIOD_LOG 5
+
+// Largest proxy slot count (the controller's connection limit)
+#define TOPOLOGY_MAX_LINKS 9
+
+// A network PDU that arrived through proxy slot `link`. true if it shows
+// the fixture rebooted: its SEQ went back by more than reordering
+// explains, or it was heard again after three heartbeat periods of
+// silence on every link.
+bool topology_note_rx(int link, const mesh_rx_pdu_t *rx);
+
+// The proxy in this slot went away; forget what it could reach
+void topology_link_down(int link);
+
+// TTL for a message to this fixture: enough for the shortest known path
+// plus a margin, or the full default when nothing is known
+uint8_t topology_ttl_for(uint16_t unicast);
+
+// Hops to the fixture through this link; 0 if reachable but not measured,
+// -1 if not heard through it
+int topology_hops(uint16_t unicast, int link);
+
+// Fixtures that no other link reaches as closely as this one
+int topology_link_exclusive(int link);
+
+// Send the "topology" event
+void topology_report(void);
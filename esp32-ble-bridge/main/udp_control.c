@@ -0,0 +1,246 @@
+/*
+ * udp_control.c
+ *
+ * Sequenced, authenticated UDP datagrams for idempotent light state.
+ */
+
+#include "udp_control.h"
+#include <string.h>
+#include <errno.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+#include "cJSON.h"
+
+#include "mesh_crypto.h"
+#include "light_registry.h"
+#include "ws_server.h"
+#include "command.h"
+
+static const char *TAG = "udp_control";
+
+#ifndef CONFIG_BRIDGE_UDP_PORT
+#define CONFIG_BRIDGE_UDP_PORT 8766
+#endif
+
+#define UDP_VERSION     1
+#define UDP_HEADER_LEN  10
+#define UDP_TAG_LEN     8
+#define UDP_MAX         512
+
+typedef struct {
+    uint16_t unicast;       // 0 = free
+    uint32_t seq;           // Newest seq applied to this light
+} seq_entry_t;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_running = false;
+static bool s_active = false;
+static uint32_t s_session = 0;
+static uint8_t s_token[16];
+static seq_entry_t s_seqs[MAX_LIGHTS];
+
+// Per-session counts, logged when the session ends. Under s_lock: the
+// dispatcher applies what the UDP task accepts.
+static uint32_t s_applied = 0;
+static uint32_t s_stale = 0;
+static uint32_t s_rejected = 0;
+
+// MARK: - Session
+
+bool udp_control_new_session(uint32_t *session, uint8_t token[16])
+{
+    if (!s_running) return false;
+
+    uint8_t t[16];
+    esp_fill_random(t, sizeof(t));
+    uint32_t id = esp_random();
+
+    portENTER_CRITICAL(&s_lock);
+    s_session = id;
+    memcpy(s_token, t, sizeof(t));
+    memset(s_seqs, 0, sizeof(s_seqs));
+    s_active = true;
+    s_applied = s_stale = s_rejected = 0;
+    portEXIT_CRITICAL(&s_lock);
+
+    *session = id;
+    memcpy(token, t, sizeof(t));
+    return true;
+}
+
+void udp_control_end_session(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    bool was = s_active;
+    s_active = false;
+    memset(s_token, 0, sizeof(s_token));
+    uint32_t applied = s_applied, stale = s_stale, rejected = s_rejected;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (was) {
+        ESP_LOGI(TAG, "Session ended: %lu applied, %lu stale, %lu rejected",
+                 (unsigned long)applied, (unsigned long)stale, (unsigned long)rejected);
+    }
+}
+
+uint16_t udp_control_port(void)
+{
+    return s_running ? CONFIG_BRIDGE_UDP_PORT : 0;
+}
+
+// MARK: - Datagrams
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Authenticate the datagram against the current session. Leaves the
+// payload NUL-terminated in place of the tag.
+static bool authenticate(uint8_t *buf, int len, uint32_t *seq)
+{
+    if (len < UDP_HEADER_LEN + UDP_TAG_LEN + 2) return false;
+    if (buf[0] != 'U' || buf[1] != UDP_VERSION) return false;
+
+    uint8_t token[16];
+    portENTER_CRITICAL(&s_lock);
+    bool ok = s_active && get_le32(buf + 2) == s_session;
+    memcpy(token, s_token, sizeof(token));
+    portEXIT_CRITICAL(&s_lock);
+    if (!ok) return false;
+
+    uint8_t mac[16];
+    int body = len - UDP_TAG_LEN;
+    mesh_crypto_aes_cmac(token, buf, body, mac);
+    uint8_t diff = 0;
+    for (int i = 0; i < UDP_TAG_LEN; i++) diff |= mac[i] ^ buf[body + i];
+    if (diff) return false;
+
+    *seq = get_le32(buf + 6);
+    buf[body] = '\0';
+    return true;
+}
+
+bool udp_control_claim_seq(uint16_t unicast, uint32_t seq)
+{
+    bool fresh = false;
+    portENTER_CRITICAL(&s_lock);
+    seq_entry_t *e = NULL;
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (s_seqs[i].unicast == unicast) { e = &s_seqs[i]; break; }
+        if (!e && s_seqs[i].unicast == 0) e = &s_seqs[i];
+    }
+    if (!s_active) {
+        fresh = true;           // No datagrams to order against
+    } else if (e && (e->unicast != unicast || seq > e->seq)) {
+        e->unicast = unicast;
+        e->seq = seq;
+        fresh = true;
+    } else {
+        s_stale++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return fresh;
+}
+
+bool udp_control_claim_command(cJSON *root)
+{
+    cJSON *seq = cJSON_GetObjectItem(root, "seq");
+    uint16_t unicast = command_state_target(root);
+    if (!cJSON_IsNumber(seq) || !unicast) return true;
+
+    return udp_control_claim_seq(unicast, (uint32_t)seq->valuedouble);
+}
+
+static void count(uint32_t *counter)
+{
+    portENTER_CRITICAL(&s_lock);
+    (*counter)++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+// Runs on the dispatcher, in turn with the phone's WebSocket commands
+static void apply_datagram(void *arg)
+{
+    cJSON *root = arg;
+    count(command_apply_state(root) ? &s_applied : &s_rejected);
+    cJSON_Delete(root);
+}
+
+static void handle_datagram(uint8_t *buf, int len)
+{
+    uint32_t seq;
+    if (!authenticate(buf, len, &seq)) {
+        count(&s_rejected);
+        return;
+    }
+
+    cJSON *root = cJSON_Parse((char *)buf + UDP_HEADER_LEN);
+    if (!root) {
+        count(&s_rejected);
+        return;
+    }
+
+    // A malformed command must not use up the seq; a stale one is counted
+    // by the claim. Claims stay on this task so datagrams are ordered as
+    // they arrive; the dispatcher runs posted work in order.
+    uint16_t unicast = command_state_target(root);
+    if (!unicast) {
+        count(&s_rejected);
+    } else if (udp_control_claim_seq(unicast, seq)) {
+        if (ws_server_queue_work(apply_datagram, root) == ESP_OK) return;
+        count(&s_rejected);
+    }
+    cJSON_Delete(root);
+}
+
+static void udp_task(void *arg)
+{
+    int sock = (int)(intptr_t)arg;
+    static uint8_t buf[UDP_MAX + 1];
+
+    while (1) {
+        int len = recvfrom(sock, buf, UDP_MAX, 0, NULL, NULL);
+        if (len < 0) {
+            ESP_LOGE(TAG, "recvfrom failed: %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        handle_datagram(buf, len);
+    }
+}
+
+esp_err_t udp_control_start(void)
+{
+    if (CONFIG_BRIDGE_UDP_PORT == 0 || s_running) return ESP_OK;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "socket failed: %d", errno);
+        return ESP_FAIL;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_BRIDGE_UDP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ESP_LOGE(TAG, "bind failed: %d", errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(udp_task, "udp_ctl", 4096, (void *)(intptr_t)sock, 6, NULL) != pdPASS) {
+        close(sock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_running = true;
+    ESP_LOGI(TAG, "Listening on UDP port %d", CONFIG_BRIDGE_UDP_PORT);
+    return ESP_OK;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+// Optional UDP side channel for absolute state commands (set_cct, set_hsi,
+// sleep, and the update_effect frames a slider streams). These can be lost
+// or repeated without harm, so a dropped datagram is simply superseded by
+// the next one. They never wait behind a TCP retransmit the way WebSocket
+// commands do.
+//
+// The channel is bound to the WebSocket session. Each new WebSocket client
+// gets a fresh session id and 16-byte token in the ready event. The session
+// ends when the client disconnects.
+//
+// Datagram:
+//   'U', version (1), session u32 LE, seq u32 LE, JSON command,
+//   tag: first 8 bytes of AES-CMAC(token, everything before the tag)
+// seq increases by one per datagram within the session. A command is
+// dropped unless its seq is newer than the last one applied to the same
+// light, so a late or reordered datagram never overwrites fresher state.
+// A malformed command is rejected without using up its seq. Accepted
+// commands are applied on the WebSocket dispatcher (ws_server_queue_work),
+// so they never run alongside a command from the phone.
+//
+// While the channel isn't ready the app sends these over the WebSocket
+// with the next seq as a "seq" field. The WebSocket server claims it the
+// same way, so a datagram still in flight can't undo a newer command that
+// took the other path.
+
+esp_err_t udp_control_start(void);
+
+// Start a session for a new WebSocket client; fills the id and token
+// to hand it. Returns false if the channel is not running.
+bool udp_control_new_session(uint32_t *session, uint8_t token[16]);
+
+void udp_control_end_session(void);
+
+// Port the channel listens on, or 0 if disabled
+uint16_t udp_control_port(void);
+
+// Take seq for a light. false if something newer was already applied in
+// this session; true whenever no session is active.
+bool udp_control_claim_seq(uint16_t unicast, uint32_t seq);
+
+// Claim the "seq" of a state command that came over the WebSocket. true
+// if it carries none, isn't a state command, or is the newest yet.
+bool udp_control_claim_command(cJSON *root);
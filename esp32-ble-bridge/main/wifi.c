@@ -133,3 +133,12 @@ bool wifi_is_connected(void)
 {
     return s_connected;
 }
+
+esp_err_t wifi_set_power_save(int mode)
+{
+    esp_err_t err = esp_wifi_set_ps((wifi_ps_type_t)mode);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Power save %d: %s", mode, esp_err_to_name(err));
+    }
+    return err;
+}
@@ -12,3 +12,7 @@ esp_err_t wifi_start_mdns(void);
 
 // Check if WiFi is connected
 bool wifi_is_connected(void);
+
+// Set the station power save mode (wifi_ps_type_t). With BLE running the
+// coexistence scheduler relies on modem sleep, so don't ask for WIFI_PS_NONE.
+esp_err_t wifi_set_power_save(int mode);
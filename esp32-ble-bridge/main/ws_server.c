@@ -1,48 +1,126 @@
 #include "ws_server.h"
 #include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
 #include "esp_log.h"
 #include "esp_http_server.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 #include "cJSON.h"
 
+#include "command.h"
 #include "mesh_crypto.h"
-#include "sidus_protocol.h"
 #include "ble_mesh.h"
+#include "mesh_adv.h"
 #include "light_registry.h"
-#include "effect_engine.h"
+#include "provisioner.h"
+#include "mesh_config.h"
+#include "show_store.h"
+#include "show_player.h"
+#include "cue_player.h"
+#include "monitor.h"
+#include "mesh_capture.h"
+#include "heap_health.h"
+#include "udp_control.h"
+#include "perf_profile.h"
+#include "topology.h"
+#include "cluster.h"
 
 static const char *TAG = "ws_server";
 
 static httpd_handle_t server = NULL;
 static int ws_fd = -1;  // File descriptor of the connected WebSocket client
+static uint32_t s_boot_id = 0;  // Lets the phone tell a bridge reboot from a WiFi blip
+
+// Outbound frame counters for the coexistence report. Frames go out from
+// httpd, effect and timer tasks alike, so the counters are locked.
+static uint32_t s_tx_frames = 0;
+static uint32_t s_tx_errors = 0;
+static int64_t s_tx_max_us = 0;    // Longest time a send call held the caller
+static portMUX_TYPE s_tx_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Commands arrive one at a time on the httpd task, so frames that fit are
+// received here instead of on the heap
+#define WS_RX_STATIC 2048
+static uint8_t s_rx_buf[WS_RX_STATIC];
 
 // Forward declarations
 static void handle_command(cJSON *root);
-static void handle_set_keys(cJSON *root);
-static void handle_add_light(cJSON *root);
-static void handle_connect(cJSON *root);
-static void handle_disconnect(cJSON *root);
-static void handle_set_cct(cJSON *root);
-static void handle_set_hsi(cJSON *root);
-static void handle_sleep(cJSON *root);
-static void handle_set_effect(cJSON *root);
-static void handle_start_effect(cJSON *root);
-static void handle_update_effect(cJSON *root);
-static void handle_stop_effect(cJSON *root);
-static void handle_stop_all(void);
-
-// Parse hex string into bytes
-static int parse_hex_string(const char *hex, uint8_t *out, int max_len)
+static void handle_set_bearer(cJSON *root);
+static void handle_provision_start(cJSON *root);
+static void handle_configure(cJSON *root);
+static void handle_profile(cJSON *root);
+static void handle_coex_stats(void);
+static void handle_show(const char *cmd_str);
+
+// Ready event carries digests of everything the phone would otherwise
+// re-push, so a reconnect only sends what actually differs:
+//   keys      - s1 digest of the loaded keys ("" if none)
+//   registry  - digest over all entries, plus per-light hashes in "lights"
+//   shadow    - digest over the desired-state shadows
+//   cues      - CRC of the loaded cue list in binary form ("" if none)
+//   show      - stored CRCs of the show's scenes and timeline ("" if none)
+// and, when the UDP channel is up, the session for it (see udp_control.h).
+static void send_ready(void)
 {
-    if (!hex) return 0;
-    int len = strlen(hex);
-    int byte_count = len / 2;
-    if (byte_count > max_len) byte_count = max_len;
-    for (int i = 0; i < byte_count; i++) {
-        unsigned int b;
-        if (sscanf(hex + i * 2, "%2x", &b) != 1) return i;
-        out[i] = (uint8_t)b;
+    char msg[1024];
+    int pos = 0;
+
+    char cues_hex[9] = "";
+    uint32_t crc;
+    if (cue_player_digest(&crc)) snprintf(cues_hex, sizeof(cues_hex), "%08lX", (unsigned long)crc);
+
+    char scenes_hex[9] = "", timeline_hex[9] = "";
+    if (show_store_info(SHOW_STORE_SCENES, NULL, NULL, &crc) == ESP_OK) {
+        snprintf(scenes_hex, sizeof(scenes_hex), "%08lX", (unsigned long)crc);
+    }
+    if (show_store_info(SHOW_STORE_TIMELINE, NULL, NULL, &crc) == ESP_OK) {
+        snprintf(timeline_hex, sizeof(timeline_hex), "%08lX", (unsigned long)crc);
+    }
+
+    char udp[96] = "";
+    uint32_t session;
+    uint8_t token[16];
+    if (udp_control_new_session(&session, token)) {
+        int n = snprintf(udp, sizeof(udp), "\"udp\":{\"port\":%d,\"session\":%lu,\"token\":\"",
+                         udp_control_port(), (unsigned long)session);
+        for (int i = 0; i < 16; i++) n += snprintf(udp + n, sizeof(udp) - n, "%02X", token[i]);
+        snprintf(udp + n, sizeof(udp) - n, "\"},");
+    }
+
+    char keys_hex[17] = "";
+    uint8_t kd[8];
+    if (mesh_crypto_keys_digest(kd)) {
+        for (int i = 0; i < 8; i++) {
+            snprintf(keys_hex + i * 2, 3, "%02X", kd[i]);
+        }
+    }
+
+    pos += snprintf(msg + pos, sizeof(msg) - pos,
+                    "{\"event\":\"ready\",\"version\":\"1.0\",\"max_lights\":%d,"
+                    "\"boot_id\":\"%08lX\",\"keys\":\"%s\",\"registry\":\"%08lX\","
+                    "\"registry_version\":%lu,\"shadow\":\"%08lX\",\"cues\":\"%s\","
+                    "\"show\":{\"scenes\":\"%s\",\"timeline\":\"%s\"},%s\"lights\":[",
+                    MAX_LIGHTS, (unsigned long)s_boot_id, keys_hex,
+                    (unsigned long)light_registry_digest(),
+                    (unsigned long)light_registry_version(),
+                    (unsigned long)light_registry_shadow_digest(), cues_hex,
+                    scenes_hex, timeline_hex, udp);
+
+    light_entry_t light;
+    bool first = true;
+    for (int i = 0; i < MAX_LIGHTS && pos < (int)sizeof(msg); i++) {
+        if (!light_registry_read_slot(i, &light)) continue;
+        pos += snprintf(msg + pos, sizeof(msg) - pos,
+                        "%s{\"unicast\":%d,\"hash\":\"%08lX\"}",
+                        first ? "" : ",", light.unicast,
+                        (unsigned long)light_registry_entry_digest(&light));
+        first = false;
+    }
+    if (pos < (int)sizeof(msg)) {
+        snprintf(msg + pos, sizeof(msg) - pos, "]}");
     }
-    return byte_count;
+    ws_server_send(msg);
 }
 
 // WebSocket handler
@@ -52,12 +130,9 @@ static esp_err_t ws_handler(httpd_req_t *req)
         // New WebSocket connection
         ws_fd = httpd_req_to_sockfd(req);
         ESP_LOGI(TAG, "WebSocket client connected (fd=%d)", ws_fd);
+        monitor_stop();  // A new client subscribes for itself
 
-        // Send ready event
-        char ready_msg[128];
-        snprintf(ready_msg, sizeof(ready_msg),
-                 "{\"event\":\"ready\",\"version\":\"1.0\",\"max_lights\":%d}", MAX_LIGHTS);
-        ws_server_send(ready_msg);
+        send_ready();
         return ESP_OK;
     }
 
@@ -75,22 +150,23 @@ static esp_err_t ws_handler(httpd_req_t *req)
 
     if (ws_pkt.len == 0) return ESP_OK;
 
-    // Allocate buffer and receive
-    uint8_t *buf = calloc(1, ws_pkt.len + 1);
-    if (!buf) {
-        ESP_LOGE(TAG, "Failed to allocate %d bytes", (int)ws_pkt.len);
-        return ESP_ERR_NO_MEM;
+    // Receive into the static buffer, or allocate for an oversized frame
+    uint8_t *buf = s_rx_buf;
+    if (ws_pkt.len + 1 > WS_RX_STATIC) {
+        buf = malloc(ws_pkt.len + 1);
+        if (!buf) {
+            ESP_LOGE(TAG, "Failed to allocate %d bytes", (int)ws_pkt.len);
+            return ESP_ERR_NO_MEM;
+        }
+        heap_health_count_alloc(HEAP_SITE_WS_RX);
     }
     ws_pkt.payload = buf;
 
     ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "httpd_ws_recv_frame failed: %s", esp_err_to_name(ret));
-        free(buf);
-        return ret;
-    }
-
-    if (ws_pkt.type == HTTPD_WS_TYPE_TEXT) {
+    } else if (ws_pkt.type == HTTPD_WS_TYPE_TEXT) {
+        buf[ws_pkt.len] = '\0';
         ESP_LOGD(TAG, "RX: %s", (char *)ws_pkt.payload);
         cJSON *root = cJSON_Parse((char *)ws_pkt.payload);
         if (root) {
@@ -102,10 +178,15 @@ static esp_err_t ws_handler(httpd_req_t *req)
     } else if (ws_pkt.type == HTTPD_WS_TYPE_CLOSE) {
         ESP_LOGI(TAG, "WebSocket client disconnected");
         ws_fd = -1;
+        monitor_stop();
+        udp_control_end_session();
     }
 
-    free(buf);
-    return ESP_OK;
+    if (buf != s_rx_buf) {
+        free(buf);
+        heap_health_count_free(HEAP_SITE_WS_RX);
+    }
+    return ret;
 }
 
 esp_err_t ws_server_start(void)
@@ -114,6 +195,9 @@ esp_err_t ws_server_start(void)
     config.server_port = 8765;
     config.max_open_sockets = 3;
     config.lru_purge_enable = true;
+    config.uri_match_fn = httpd_uri_match_wildcard;  // /store/<kind>
+
+    s_boot_id = esp_random();
 
     esp_err_t ret = httpd_start(&server, &config);
     if (ret != ESP_OK) {
@@ -131,14 +215,33 @@ esp_err_t ws_server_start(void)
     };
     httpd_register_uri_handler(server, &ws_uri);
 
+    // Show asset uploads, streamed to flash
+    show_store_register(server);
+    mesh_capture_register(server);
+
     ESP_LOGI(TAG, "WebSocket server started on port 8765, path /ws");
     return ESP_OK;
 }
 
+static esp_err_t send_frame(httpd_ws_frame_t *ws_pkt)
+{
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t ret = httpd_ws_send_frame_async(server, ws_fd, ws_pkt);
+    int64_t dt = esp_timer_get_time() - t0;
+
+    portENTER_CRITICAL(&s_tx_lock);
+    s_tx_frames++;
+    if (ret != ESP_OK) s_tx_errors++;
+    if (dt > s_tx_max_us) s_tx_max_us = dt;
+    portEXIT_CRITICAL(&s_tx_lock);
+    return ret;
+}
+
 esp_err_t ws_server_send(const char *json_str)
 {
     if (ws_fd < 0 || !server) {
-        return ESP_ERR_INVALID_STATE;
+        // The phone may be on another bridge of the cluster
+        return cluster_relay_event(json_str) ? ESP_OK : ESP_ERR_INVALID_STATE;
     }
 
     httpd_ws_frame_t ws_pkt;
@@ -147,13 +250,28 @@ esp_err_t ws_server_send(const char *json_str)
     ws_pkt.len = strlen(json_str);
     ws_pkt.type = HTTPD_WS_TYPE_TEXT;
 
-    esp_err_t ret = httpd_ws_send_frame_async(server, ws_fd, &ws_pkt);
+    esp_err_t ret = send_frame(&ws_pkt);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to send WS frame: %s", esp_err_to_name(ret));
     }
     return ret;
 }
 
+esp_err_t ws_server_send_binary(const uint8_t *data, size_t len)
+{
+    if (ws_fd < 0 || !server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    httpd_ws_frame_t ws_pkt;
+    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+    ws_pkt.payload = (uint8_t *)data;
+    ws_pkt.len = len;
+    ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+
+    return send_frame(&ws_pkt);
+}
+
 esp_err_t ws_server_send_event(const char *event_type, const char *json_body)
 {
     char buf[512];
@@ -183,9 +301,25 @@ void ws_server_notify_error(const char *message)
     ws_server_send(buf);
 }
 
+esp_err_t ws_server_queue_work(void (*fn)(void *arg), void *arg)
+{
+    if (!server) return ESP_ERR_INVALID_STATE;
+    return httpd_queue_work(server, fn, arg);
+}
+
 // MARK: - Command Dispatch
 
 static void handle_command(cJSON *root)
+{
+    // Superseded by a newer datagram on the UDP channel
+    if (!udp_control_claim_command(root)) return;
+
+    // Another bridge of the cluster may own this
+    if (cluster_route(root)) return;
+    ws_server_dispatch(root);
+}
+
+void ws_server_dispatch(cJSON *root)
 {
     cJSON *cmd = cJSON_GetObjectItem(root, "cmd");
     if (!cmd || !cJSON_IsString(cmd)) {
@@ -196,263 +330,188 @@ static void handle_command(cJSON *root)
     const char *cmd_str = cmd->valuestring;
     ESP_LOGI(TAG, "Command: %s", cmd_str);
 
-    if (strcmp(cmd_str, "set_keys") == 0) {
-        handle_set_keys(root);
-    } else if (strcmp(cmd_str, "add_light") == 0) {
-        handle_add_light(root);
-    } else if (strcmp(cmd_str, "connect") == 0) {
-        handle_connect(root);
-    } else if (strcmp(cmd_str, "disconnect") == 0) {
-        handle_disconnect(root);
-    } else if (strcmp(cmd_str, "set_cct") == 0) {
-        handle_set_cct(root);
-    } else if (strcmp(cmd_str, "set_hsi") == 0) {
-        handle_set_hsi(root);
-    } else if (strcmp(cmd_str, "sleep") == 0) {
-        handle_sleep(root);
-    } else if (strcmp(cmd_str, "set_effect") == 0) {
-        handle_set_effect(root);
-    } else if (strcmp(cmd_str, "start_effect") == 0) {
-        handle_start_effect(root);
-    } else if (strcmp(cmd_str, "update_effect") == 0) {
-        handle_update_effect(root);
-    } else if (strcmp(cmd_str, "stop_effect") == 0) {
-        handle_stop_effect(root);
-    } else if (strcmp(cmd_str, "stop_all") == 0) {
-        handle_stop_all();
+    if (command_dispatch(root)) return;
+
+    if (strcmp(cmd_str, "set_bearer") == 0) {
+        handle_set_bearer(root);
+    } else if (strcmp(cmd_str, "provision_start") == 0) {
+        handle_provision_start(root);
+    } else if (strcmp(cmd_str, "provision_stop") == 0) {
+        provisioner_stop();
+    } else if (strcmp(cmd_str, "configure") == 0) {
+        handle_configure(root);
+    } else if (strcmp(cmd_str, "configure_stop") == 0) {
+        mesh_config_cancel();
+    } else if (strcmp(cmd_str, "profile") == 0) {
+        handle_profile(root);
+    } else if (strcmp(cmd_str, "coex") == 0) {
+        handle_coex_stats();
+    } else if (strcmp(cmd_str, "topology") == 0) {
+        topology_report();
+    } else if (strcmp(cmd_str, "show_load") == 0 || strcmp(cmd_str, "show_play") == 0) {
+        handle_show(cmd_str);
+    } else if (strcmp(cmd_str, "show_stop") == 0) {
+        show_player_stop();
+    } else if (strcmp(cmd_str, "capture") == 0) {
+        cJSON *on = cJSON_GetObjectItem(root, "on");
+        if (mesh_capture_enable(cJSON_IsTrue(on)) != ESP_OK) {
+            ws_server_notify_error("capture unavailable");
+        }
     } else {
         ESP_LOGW(TAG, "Unknown command: %s", cmd_str);
     }
 }
 
-static void handle_set_keys(cJSON *root)
+static void handle_set_bearer(cJSON *root)
 {
-    cJSON *nk = cJSON_GetObjectItem(root, "network_key");
-    cJSON *ak = cJSON_GetObjectItem(root, "app_key");
-    cJSON *iv = cJSON_GetObjectItem(root, "iv_index");
-    cJSON *src = cJSON_GetObjectItem(root, "src_address");
-
-    if (!nk || !ak || !iv) {
-        ESP_LOGE(TAG, "set_keys: missing fields");
-        return;
+    cJSON *mode = cJSON_GetObjectItem(root, "mode");
+    cJSON *retransmit = cJSON_GetObjectItem(root, "retransmit");
+    cJSON *interval = cJSON_GetObjectItem(root, "interval_ms");
+
+    if (mode && cJSON_IsString(mode)) {
+        const char *m = mode->valuestring;
+        if (strcmp(m, "gatt") == 0) ble_mesh_set_bearer(MESH_BEARER_GATT);
+        else if (strcmp(m, "fallback") == 0) ble_mesh_set_bearer(MESH_BEARER_ADV_FALLBACK);
+        else if (strcmp(m, "both") == 0) ble_mesh_set_bearer(MESH_BEARER_BOTH);
+        else if (strcmp(m, "adv") == 0) ble_mesh_set_bearer(MESH_BEARER_ADV);
+        else ESP_LOGW(TAG, "set_bearer: unknown mode %s", m);
     }
 
-    uint8_t network_key[16], app_key[16];
-    parse_hex_string(nk->valuestring, network_key, 16);
-    parse_hex_string(ak->valuestring, app_key, 16);
-    uint32_t iv_index = (uint32_t)iv->valuedouble;
-    uint16_t src_addr = src ? (uint16_t)src->valueint : 0x0001;
-
-    mesh_crypto_init(network_key, app_key, iv_index, src_addr);
-    ESP_LOGI(TAG, "Mesh keys configured, iv_index=0x%08lX src=0x%04X",
-             (unsigned long)iv_index, src_addr);
+    if (retransmit || interval) {
+        mesh_adv_set_params(retransmit ? retransmit->valueint : MESH_ADV_DEFAULT_RETRANSMIT,
+                            interval ? interval->valueint : MESH_ADV_DEFAULT_INTERVAL_MS);
+    }
 }
 
-static void handle_add_light(cJSON *root)
+static void handle_provision_start(cJSON *root)
 {
-    cJSON *id = cJSON_GetObjectItem(root, "id");
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    cJSON *name = cJSON_GetObjectItem(root, "name");
+    cJSON *first = cJSON_GetObjectItem(root, "first_unicast");
+    cJSON *max = cJSON_GetObjectItem(root, "max");
 
-    if (!id || !uni) {
-        ESP_LOGE(TAG, "add_light: missing fields");
+    if (!first) {
+        ESP_LOGE(TAG, "provision_start: missing first_unicast");
         return;
     }
 
-    light_registry_add(id->valuestring, (uint16_t)uni->valueint,
-                       name ? name->valuestring : "");
-
-    // If proxy is already connected, immediately mark this light as reachable
-    if (ble_mesh_is_proxy_connected()) {
-        ws_server_notify_light_status((uint16_t)uni->valueint, true);
+    esp_err_t err = provisioner_start((uint16_t)first->valueint, max ? max->valueint : 0);
+    if (err != ESP_OK) {
+        ws_server_notify_error(err == ESP_ERR_INVALID_STATE
+                               ? "provision_start: set_keys first"
+                               : "provision_start: invalid first_unicast");
     }
 }
 
-static void handle_connect(cJSON *root)
+// {"cmd":"configure","lights":[{"unicast":2,"device_key":"..."},...],
+//  "groups":[49152,...],"full":true}
+// A light without device_key uses the one in the registry.
+static void handle_configure(cJSON *root)
 {
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    if (!uni) return;
-
-    uint16_t unicast = (uint16_t)uni->valueint;
-
-    // Register the light if not already known
-    light_entry_t *light = light_registry_find_by_unicast(unicast);
-    if (!light) {
-        // Auto-register with a placeholder id
-        char auto_id[32];
-        snprintf(auto_id, sizeof(auto_id), "auto-%04X", unicast);
-        light = light_registry_add(auto_id, unicast, "");
-        if (!light) {
-            ws_server_notify_error("Failed to register light");
-            return;
-        }
-    }
+    cJSON *lights = cJSON_GetObjectItem(root, "lights");
+    cJSON *groups = cJSON_GetObjectItem(root, "groups");
+    cJSON *full = cJSON_GetObjectItem(root, "full");
 
-    // If proxy is already connected, all lights are reachable
-    if (ble_mesh_is_proxy_connected()) {
-        light->connected = true;
-        ws_server_notify_light_status(unicast, true);
+    if (!cJSON_IsArray(lights)) {
+        ESP_LOGE(TAG, "configure: missing lights");
         return;
     }
 
-    // Connect to any mesh proxy node — once connected, all lights are reachable
-    ESP_LOGI(TAG, "Connecting to mesh proxy for light 0x%04X...", unicast);
-    ble_mesh_connect_proxy();
-}
-
-static void handle_disconnect(cJSON *root)
-{
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    if (!uni) return;
-
-    uint16_t unicast = (uint16_t)uni->valueint;
-    light_entry_t *light = light_registry_find_by_unicast(unicast);
-    if (!light || !light->connected) return;
-
-    // Stop any running effect
-    effect_engine_stop(unicast);
-
-    // Mark this light as disconnected (proxy stays up for other lights)
-    light->connected = false;
-    ws_server_notify_light_status(unicast, false);
-}
-
-static void handle_set_cct(cJSON *root)
-{
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    cJSON *intensity = cJSON_GetObjectItem(root, "intensity");
-    cJSON *cct = cJSON_GetObjectItem(root, "cct_kelvin");
-    cJSON *sleep = cJSON_GetObjectItem(root, "sleep_mode");
-
-    if (!uni || !intensity || !cct) return;
-
-    uint16_t unicast = (uint16_t)uni->valueint;
-    int sleep_mode = sleep ? sleep->valueint : 1;
-
-    ble_mesh_send_cct(unicast, intensity->valuedouble, cct->valueint, sleep_mode);
-}
-
-static void handle_set_hsi(cJSON *root)
-{
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    cJSON *intensity = cJSON_GetObjectItem(root, "intensity");
-    cJSON *hue = cJSON_GetObjectItem(root, "hue");
-    cJSON *sat = cJSON_GetObjectItem(root, "saturation");
-    cJSON *cct = cJSON_GetObjectItem(root, "cct_kelvin");
-    cJSON *sleep = cJSON_GetObjectItem(root, "sleep_mode");
-
-    if (!uni || !intensity || !hue || !sat) return;
-
-    uint16_t unicast = (uint16_t)uni->valueint;
-    int cct_kelvin = cct ? cct->valueint : 5600;
-    int sleep_mode = sleep ? sleep->valueint : 1;
-
-    ble_mesh_send_hsi(unicast, intensity->valuedouble, hue->valueint, sat->valueint,
-                      cct_kelvin, sleep_mode);
-}
-
-static void handle_sleep(cJSON *root)
-{
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    cJSON *on = cJSON_GetObjectItem(root, "on");
-
-    if (!uni || !on) return;
+    static mesh_config_target_t targets[MESH_CONFIG_MAX_TARGETS];
+    int count = 0;
+    cJSON *item;
+    cJSON_ArrayForEach(item, lights) {
+        cJSON *uni = cJSON_GetObjectItem(item, "unicast");
+        cJSON *dk = cJSON_GetObjectItem(item, "device_key");
+        if (!uni || count >= MESH_CONFIG_MAX_TARGETS) continue;
+
+        mesh_config_target_t *t = &targets[count];
+        t->unicast = (uint16_t)uni->valueint;
+        if (dk && command_parse_hex(dk->valuestring, t->device_key, 16) == 16) {
+            count++;
+            continue;
+        }
+        light_entry_t light;
+        if (light_registry_lookup(t->unicast, &light) && light.has_device_key) {
+            memcpy(t->device_key, light.device_key, 16);
+            count++;
+        } else {
+            ESP_LOGW(TAG, "configure: no device key for 0x%04X", t->unicast);
+        }
+    }
 
-    ble_mesh_send_sleep((uint16_t)uni->valueint, cJSON_IsTrue(on));
-}
+    uint16_t group_addrs[MESH_CONFIG_MAX_GROUPS];
+    int group_count = 0;
+    cJSON_ArrayForEach(item, groups) {
+        if (group_count < MESH_CONFIG_MAX_GROUPS) {
+            group_addrs[group_count++] = (uint16_t)item->valueint;
+        }
+    }
 
-static void handle_set_effect(cJSON *root)
-{
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    cJSON *type = cJSON_GetObjectItem(root, "effect_type");
-    cJSON *intensity = cJSON_GetObjectItem(root, "intensity");
-    cJSON *frq = cJSON_GetObjectItem(root, "frequency");
-    cJSON *cct = cJSON_GetObjectItem(root, "cct_kelvin");
-    cJSON *color = cJSON_GetObjectItem(root, "cop_car_color");
-    cJSON *mode = cJSON_GetObjectItem(root, "effect_mode");
-    cJSON *hue = cJSON_GetObjectItem(root, "hue");
-    cJSON *sat = cJSON_GetObjectItem(root, "saturation");
-
-    if (!uni || !type) return;
-
-    ble_mesh_send_effect(
-        (uint16_t)uni->valueint,
-        type->valueint,
-        intensity ? intensity->valuedouble : 50.0,
-        frq ? frq->valueint : 8,
-        cct ? cct->valueint : 5600,
-        color ? color->valueint : 0,
-        mode ? mode->valueint : 0,
-        hue ? hue->valueint : 0,
-        sat ? sat->valueint : 100
-    );
+    esp_err_t err = mesh_config_start(targets, count, group_addrs, group_count,
+                                      full ? cJSON_IsTrue(full) : true);
+    if (err == ESP_ERR_INVALID_STATE) {
+        ws_server_notify_error("configure: busy or no keys");
+    } else if (err != ESP_OK) {
+        ws_server_notify_error("configure: no lights with device keys");
+    }
 }
 
-static void handle_start_effect(cJSON *root)
+// {"cmd":"profile","name":"live"} switches performance profile (see
+// perf_profile.h); without a name it reports the current one
+static void handle_profile(cJSON *root)
 {
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    cJSON *engine = cJSON_GetObjectItem(root, "engine");
-    cJSON *params = cJSON_GetObjectItem(root, "params");
-
-    if (!uni || !engine) return;
-
-    uint16_t unicast = (uint16_t)uni->valueint;
-    const char *engine_name = engine->valuestring;
-
-    // Map engine name to effect type
-    effect_type_t etype = EFFECT_NONE;
-    if (strcmp(engine_name, "pulsing") == 0) etype = EFFECT_PULSING;
-    else if (strcmp(engine_name, "strobe") == 0) etype = EFFECT_STROBE;
-    else if (strcmp(engine_name, "fire") == 0) etype = EFFECT_FIRE;
-    else if (strcmp(engine_name, "candle") == 0) etype = EFFECT_CANDLE;
-    else if (strcmp(engine_name, "lightning") == 0) etype = EFFECT_LIGHTNING;
-    else if (strcmp(engine_name, "tv") == 0) etype = EFFECT_TV_FLICKER;
-    else if (strcmp(engine_name, "party") == 0) etype = EFFECT_PARTY;
-    else if (strcmp(engine_name, "explosion") == 0) etype = EFFECT_EXPLOSION;
-    else if (strcmp(engine_name, "welding") == 0) etype = EFFECT_WELDING;
-    else if (strcmp(engine_name, "faulty_bulb") == 0) etype = EFFECT_FAULTY_BULB;
-    else if (strcmp(engine_name, "paparazzi") == 0) etype = EFFECT_PAPARAZZI;
-    else {
-        ESP_LOGW(TAG, "Unknown engine: %s", engine_name);
-        return;
+    cJSON *name = cJSON_GetObjectItem(root, "name");
+    if (name && cJSON_IsString(name)) {
+        esp_err_t err = perf_profile_select(name->valuestring);
+        if (err == ESP_ERR_NOT_FOUND) {
+            ws_server_notify_error("profile: unknown name");
+        } else if (err != ESP_OK) {
+            ws_server_notify_error("profile: applied but not saved");
+        }
     }
-
-    // Parse parameters
-    effect_params_t ep = {0};
-    effect_params_from_json(&ep, engine_name, params);
-
-    // Stop any existing effect on this light
-    effect_engine_stop(unicast);
-
-    // Start new effect
-    effect_engine_start(unicast, etype, &ep);
-    ESP_LOGI(TAG, "Started %s effect on unicast 0x%04X", engine_name, unicast);
+    perf_profile_report();
 }
 
-static void handle_update_effect(cJSON *root)
+// {"cmd":"coex"} reports how the two radios are getting along: proxy write
+// bursts, congestion and refused writes on the BLE side; frame errors,
+// send stalls and telemetry held back for BLE bursts on the WiFi side
+static void handle_coex_stats(void)
 {
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    cJSON *params = cJSON_GetObjectItem(root, "params");
-
-    if (!uni || !params) return;
-
-    uint16_t unicast = (uint16_t)uni->valueint;
-
-    // Parse partial params and merge
-    effect_params_t ep = {0};
-    effect_params_from_json(&ep, NULL, params);
-    effect_engine_update(unicast, &ep);
+    ble_tx_stats_t tx;
+    ble_mesh_get_tx_stats(&tx);
+
+    portENTER_CRITICAL(&s_tx_lock);
+    uint32_t frames = s_tx_frames;
+    uint32_t errors = s_tx_errors;
+    int64_t max_us = s_tx_max_us;
+    portEXIT_CRITICAL(&s_tx_lock);
+
+    char body[384];
+    snprintf(body, sizeof(body),
+             "\"ble_writes\":%lu,\"ble_bursts\":%lu,\"ble_write_errors\":%lu,"
+             "\"congestions\":%lu,\"congested_ms\":%lu,\"conn_int_us\":%lu,"
+             "\"ws_frames\":%lu,\"ws_errors\":%lu,\"ws_send_max_us\":%lld,"
+             "\"telemetry_deferred\":%lu",
+             (unsigned long)tx.writes, (unsigned long)tx.bursts, (unsigned long)tx.write_errors,
+             (unsigned long)tx.congestions, (unsigned long)tx.congested_ms,
+             (unsigned long)tx.conn_int_us,
+             (unsigned long)frames, (unsigned long)errors, (long long)max_us,
+             (unsigned long)monitor_deferred());
+    ws_server_send_event("coex", body);
 }
 
-static void handle_stop_effect(cJSON *root)
+// {"cmd":"show_load"} and {"cmd":"show_play"}: the stored show (show_player.h)
+static void handle_show(const char *cmd_str)
 {
-    cJSON *uni = cJSON_GetObjectItem(root, "unicast");
-    if (!uni) return;
-
-    effect_engine_stop((uint16_t)uni->valueint);
+    bool play = strcmp(cmd_str, "show_play") == 0;
+    esp_err_t err = play ? show_player_play() : show_player_load();
+    if (err == ESP_ERR_NOT_FOUND) {
+        ws_server_notify_error("show: nothing uploaded");
+    } else if (err == ESP_ERR_NO_MEM) {
+        ws_server_notify_error("show: out of memory");
+    } else if (err != ESP_OK) {
+        ws_server_notify_error("show: invalid show");
+    } else if (!play) {
+        cue_player_report();
+    }
 }
 
-static void handle_stop_all(void)
-{
-    effect_engine_stop_all();
-}
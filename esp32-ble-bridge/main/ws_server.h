@@ -2,7 +2,9 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "esp_err.h"
+#include "cJSON.h"
 
 // Start the WebSocket server on port 8765
 esp_err_t ws_server_start(void);
@@ -10,6 +12,9 @@ esp_err_t ws_server_start(void);
 // Send a JSON string to the connected client
 esp_err_t ws_server_send(const char *json_str);
 
+// Send a binary frame to the connected client
+esp_err_t ws_server_send_binary(const uint8_t *data, size_t len);
+
 // Send a formatted JSON event
 esp_err_t ws_server_send_event(const char *event_type, const char *json_body);
 
@@ -19,5 +24,14 @@ bool ws_server_has_client(void);
 // Notify phone about light connection status
 void ws_server_notify_light_status(uint16_t unicast, bool connected);
 
+// Run a command here, without cluster routing (cluster.h): the shared
+// commands (command.h) plus the radio-specific ones
+void ws_server_dispatch(cJSON *root);
+
+// Run fn(arg) where WebSocket commands run: the httpd task here, the event
+// loop on the host daemon. Other tasks hand commands over this way instead
+// of racing them. ESP_ERR_INVALID_STATE if the server isn't running.
+esp_err_t ws_server_queue_work(void (*fn)(void *arg), void *arg);
+
 // Notify phone about an error
 void ws_server_notify_error(const char *message);